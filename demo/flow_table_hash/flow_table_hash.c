@@ -0,0 +1,116 @@
+/*
+ * flow_table_hash.c
+ *
+ * Given a .pcap file, it measures the throughput of the flow table
+ * (L2-L4 processing, no L7 inspection) for each available hash function.
+ *
+ * =========================================================================
+ * Copyright (c) 2016-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#include <peafowl/peafowl.h>
+#include <pcap.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define ITERATIONS 100
+
+typedef struct{
+  unsigned char* data;
+  uint32_t length;
+  uint32_t timestamp;
+}packet_t;
+
+static const char* hash_names[] = {"SIMPLE", "FNV", "MURMUR3", "BKDR", "CRC32C", "XXHASH"};
+
+int main(int argc, char** argv){
+  if(argc < 2){
+    fprintf(stderr, "Usage: %s pcap_file [iterations]\n", argv[0]);
+    return -1;
+  }
+  char* pcap_filename = argv[1];
+  size_t iterations = argc > 2 ? strtoul(argv[2], NULL, 10) : ITERATIONS;
+  char errbuf[PCAP_ERRBUF_SIZE];
+  const u_char* packet;
+  struct pcap_pkthdr header;
+
+  pcap_t *handle = pcap_open_offline(pcap_filename, errbuf);
+  if(handle == NULL){
+    fprintf(stderr, "Couldn't open device %s: %s\n", pcap_filename, errbuf);
+    return (2);
+  }
+  pfwl_protocol_l2_t dlt = pfwl_convert_pcap_dlt(pcap_datalink(handle));
+
+  // Load the trace in memory, so that we do not measure the I/O.
+  size_t num_packets = 0, capacity = 1024;
+  packet_t* packets = malloc(sizeof(packet_t) * capacity);
+  while((packet = pcap_next(handle, &header)) != NULL){
+    if(num_packets == capacity){
+      capacity *= 2;
+      packets = realloc(packets, sizeof(packet_t) * capacity);
+    }
+    packets[num_packets].data = malloc(header.caplen);
+    memcpy(packets[num_packets].data, packet, header.caplen);
+    packets[num_packets].length = header.caplen;
+    packets[num_packets].timestamp = header.ts.tv_sec;
+    ++num_packets;
+  }
+  pcap_close(handle);
+
+  pfwl_dissection_info_t r;
+  memset(&r, 0, sizeof(r));
+  for(pfwl_flow_table_hash_t hash = PFWL_FLOW_TABLE_HASH_SIMPLE;
+      hash <= PFWL_FLOW_TABLE_HASH_XXHASH; hash++){
+    pfwl_state_t* state = pfwl_init();
+    if(pfwl_set_flow_table_hash(state, hash)){
+      printf("%-8s not available\n", hash_names[hash]);
+      pfwl_terminate(state);
+      continue;
+    }
+    pfwl_protocol_l7_disable_all(state);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t i = 0; i < iterations; i++){
+      for(size_t j = 0; j < num_packets; j++){
+        pfwl_dissect_from_L2(state, packets[j].data, packets[j].length,
+                             packets[j].timestamp, dlt, &r);
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pfwl_terminate(state);
+
+    double seconds = (end.tv_sec - start.tv_sec) +
+                     (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+    double pkts = (double) num_packets * iterations;
+    printf("%-8s %10.3f Mpps (%.3f ns/pkt)\n", hash_names[hash],
+           pkts / seconds / 1000000.0, seconds * 1000000000.0 / pkts);
+  }
+
+  for(size_t j = 0; j < num_packets; j++){
+    free(packets[j].data);
+  }
+  free(packets);
+  return 0;
+}
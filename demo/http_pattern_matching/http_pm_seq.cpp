@@ -197,6 +197,7 @@ int main(int argc, char **argv){
     for(j=0; j<num_iterations; j++){
       for(i=0; i<num_packets; i++){
         pfwl_dissection_info_t r;
+        memset(&r, 0, sizeof(r));
         if(pfwl_dissect_from_L2(state, packets[i], sizes[i], 0, dlt, &r) >= PFWL_STATUS_OK){
           if(r.l7.protocol == PFWL_PROTO_L7_HTTP){
             pfwl_string_t field;
@@ -62,6 +62,7 @@ int main(int argc, char** argv){
 
   pfwl_state_t* state = pfwl_init();
   pfwl_dissection_info_t r;
+  memset(&r, 0, sizeof(r));
   pfwl_protocol_l2_t dlt = pfwl_convert_pcap_dlt(pcap_datalink(handle));
   while((packet = pcap_next(handle, &header)) != NULL){
     if(pfwl_dissect_from_L2(state, packet, header.caplen, time(NULL), dlt, &r) >= PFWL_STATUS_OK){
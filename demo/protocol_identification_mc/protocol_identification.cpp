@@ -41,11 +41,6 @@
 #include <inttypes.h>
 #include <assert.h>
 
-#define SIZE_IPv4_FLOW_TABLE 32767
-#define SIZE_IPv6_FLOW_TABLE 32767
-#define MAX_IPv4_ACTIVE_FLOWS 500000
-#define MAX_IPv6_ACTIVE_FLOWS 500000
-
 #define AVAILABLE_PROCESSORS 8
 
 int datalink_type=0;
@@ -121,11 +116,12 @@ mc_pfwl_packet_reading_result_t reading_cb(void* callback_data){
  *                            network socket).
  */
 void processing_cb(mc_pfwl_processing_result_t* processing_result, void* callback_data){
-	pfwl_dissection_info_t r = processing_result->result;
-    if(r.protocol.l4prot == IPPROTO_TCP ||
-       r.protocol.l4prot == IPPROTO_UDP){
-        if(r.protocol.l7prot < PFWL_PROTO_L7_NUM){
-            ++protocols[r.protocol.l7prot];
+	pfwl_dissection_info_t* r = &(processing_result->result);
+    if(processing_result->status >= PFWL_STATUS_OK &&
+       (r->l4.protocol == IPPROTO_TCP ||
+        r->l4.protocol == IPPROTO_UDP)){
+        if(r->l7.protocol < PFWL_PROTO_L7_NUM){
+            ++protocols[r->l7.protocol];
         }else{
             ++unknown;
         }
@@ -147,7 +143,7 @@ int main(int argc, char** argv){
 	mc_pfwl_parallelism_details_t par;
 	memset(&par, 0, sizeof(par));
 	par.available_processors = AVAILABLE_PROCESSORS;
-	mc_pfwl_state_t* state = mc_pfwl_init_stateful(SIZE_IPv4_FLOW_TABLE, SIZE_IPv6_FLOW_TABLE, MAX_IPv4_ACTIVE_FLOWS, MAX_IPv6_ACTIVE_FLOWS, par);
+	mc_pfwl_state_t* state = mc_pfwl_init(par);
 	pcap_t *handle=pcap_open_offline(pcap_filename, errbuf);
 
 	if(handle==NULL){
@@ -185,7 +181,7 @@ int main(int argc, char** argv){
 
 	if (unknown > 0) printf("Unknown packets: %" PRIu32 "\n", unknown);
     for(size_t i = 0; i < PFWL_PROTO_L7_NUM; i++){
-        if (protocols[i] > 0) printf("%s packets: %" PRIu32 "\n", pfwl_get_L7_protocol_name(i), protocols[i]);
+        if (protocols[i] > 0) printf("%s packets: %" PRIu32 "\n", pfwl_get_L7_protocol_name((pfwl_protocol_l7_t) i), protocols[i]);
     }
 	return 0;
 }
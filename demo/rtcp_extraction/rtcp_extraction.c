@@ -80,6 +80,7 @@ int main(int argc, char** argv){
 
   while((packet = pcap_next(handle, &header)) != NULL){
     pfwl_dissection_info_t r;
+    memset(&r, 0, sizeof(r));
     if(pfwl_dissect_from_L2(state, packet, header.caplen, time(NULL), dlt, &r) >= PFWL_STATUS_OK){
         pfwl_string_t field;
         int64_t extracted_value;
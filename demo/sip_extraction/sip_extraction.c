@@ -62,6 +62,7 @@ int main(int argc, char** argv){
   pfwl_protocol_l2_t dlt = pfwl_convert_pcap_dlt(pcap_datalink(handle));
   while((packet = pcap_next(handle, &header)) != NULL){
     pfwl_dissection_info_t r;
+    memset(&r, 0, sizeof(r));
     if(pfwl_dissect_from_L2(state, packet, header.caplen, time(NULL), dlt, &r) >= PFWL_STATUS_OK){
       pfwl_string_t field;
       if(r.l7.protocol == PFWL_PROTO_L7_SIP &&
@@ -0,0 +1,175 @@
+/*
+ * allocator.h
+ *
+ * =========================================================================
+ * Copyright (c) 2012-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#ifndef PFWL_ALLOCATOR_H_
+#define PFWL_ALLOCATOR_H_
+
+#include <peafowl/peafowl.h>
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Objects are rounded up to a power of two between 2^PFWL_ALLOCATOR_MIN_CLASS
+ * and 2^PFWL_ALLOCATOR_MAX_CLASS bytes. Bigger objects are always taken
+ * from the system allocator.
+ **/
+#define PFWL_ALLOCATOR_MIN_CLASS 5
+#define PFWL_ALLOCATOR_MAX_CLASS 12
+#define PFWL_ALLOCATOR_NUM_CLASSES                                             \
+  (PFWL_ALLOCATOR_MAX_CLASS - PFWL_ALLOCATOR_MIN_CLASS + 1)
+
+/**
+ * Not thread safe. Each flow table partition has its own allocator,
+ * only used by the thread managing that partition.
+ **/
+typedef struct pfwl_allocator {
+  pfwl_memory_allocator_t type;
+  /** Free objects, one list per size class. **/
+  void *free_objects[PFWL_ALLOCATOR_NUM_CLASSES];
+  /** Slabs obtained from the system. **/
+  void *slabs;
+  size_t used[PFWL_MEMORY_NUM];
+  size_t high_water[PFWL_MEMORY_NUM];
+  size_t reserved;
+  /** NUMA node of the slabs, -1 to leave the placement to the system. **/
+  int16_t node;
+} pfwl_allocator_t;
+
+/**
+ * Initializes an allocator.
+ * @param allocator The allocator.
+ * @param type The type of the allocator.
+ */
+void pfwl_allocator_init(pfwl_allocator_t *allocator,
+                         pfwl_memory_allocator_t type);
+
+/**
+ * Releases all the memory obtained from the system by an allocator.
+ * Objects allocated from it must not be used anymore. The NUMA node of the
+ * allocator is kept.
+ * @param allocator The allocator.
+ */
+void pfwl_allocator_destroy(pfwl_allocator_t *allocator);
+
+/**
+ * Sets the NUMA node where the slabs of an allocator are placed. Slabs
+ * already obtained from the system are moved there.
+ * @param allocator The allocator.
+ * @param node The node, -1 to leave the placement of new slabs to the
+ * system.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_allocator_set_node(pfwl_allocator_t *allocator, int16_t node);
+
+/**
+ * Allocates an object.
+ * @param allocator The allocator. If NULL, the system allocator is used.
+ * @param type What the object will be used for.
+ * @param size The size of the object.
+ * @return The object, or NULL if no memory is available.
+ */
+void *pfwl_allocator_alloc(pfwl_allocator_t *allocator, pfwl_memory_type_t type,
+                           size_t size);
+
+/**
+ * Releases an object.
+ * @param allocator The allocator used to allocate the object.
+ * @param type What the object was used for.
+ * @param ptr The object.
+ * @param size The size specified when the object was allocated.
+ */
+void pfwl_allocator_free(pfwl_allocator_t *allocator, pfwl_memory_type_t type,
+                         void *ptr, size_t size);
+
+/**
+ * Changes the size of an object.
+ * @param allocator The allocator used to allocate the object.
+ * @param type What the object is used for.
+ * @param ptr The object.
+ * @param old_size The current size of the object.
+ * @param new_size The new size of the object.
+ * @return The resized object, or NULL if no memory is available (in this
+ * case the old object is left untouched).
+ */
+void *pfwl_allocator_realloc(pfwl_allocator_t *allocator,
+                             pfwl_memory_type_t type, void *ptr,
+                             size_t old_size, size_t new_size);
+
+/**
+ * Records an object allocated outside of the allocator, to have it
+ * reported in the memory usage.
+ * @param allocator The allocator.
+ * @param type What the object is used for.
+ * @param size The size of the object.
+ */
+void pfwl_allocator_account_alloc(pfwl_allocator_t *allocator,
+                                  pfwl_memory_type_t type, size_t size);
+
+/**
+ * Records the release of an object recorded with
+ * pfwl_allocator_account_alloc.
+ * @param allocator The allocator.
+ * @param type What the object was used for.
+ * @param size The size of the object.
+ */
+void pfwl_allocator_account_free(pfwl_allocator_t *allocator,
+                                 pfwl_memory_type_t type, size_t size);
+
+/**
+ * Adds the memory usage of an allocator to stats.
+ * @param allocator The allocator.
+ * @param stats The memory usage.
+ */
+void pfwl_allocator_get_stats(pfwl_allocator_t *allocator,
+                              pfwl_memory_stats_t *stats);
+
+/**
+ * Moves the pages fully contained in a memory area to a NUMA node. Pages
+ * of the area allocated later will also be taken from that node, when
+ * possible.
+ * @param ptr The memory area.
+ * @param size The size of the memory area.
+ * @param node The node.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_numa_bind(void *ptr, size_t size, int16_t node);
+
+/**
+ * Returns the NUMA node of a processor.
+ * @param cpu The processor.
+ * @return The node, -1 if it can't be found.
+ */
+int16_t pfwl_numa_node_of_cpu(uint16_t cpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PFWL_ALLOCATOR_H_ */
@@ -32,9 +32,13 @@
 /*******************************************************************/
 /*                  Performance related macros.                    */
 /*******************************************************************/
+/**
+ * If 1, the multicore tasks and packets are allocated with libnuma on the
+ * nodes specified below. The flow table partitions are instead always
+ * placed at runtime on the node of the worker owning them.
+ **/
 #ifndef PFWL_NUMA_AWARE
 #define PFWL_NUMA_AWARE 0
-#define PFWL_NUMA_AWARE_FLOW_TABLE_NODE 1
 #endif
 
 #ifndef PFWL_USE_MTF
@@ -53,6 +57,14 @@
 #define PFWL_DEFAULT_FLOW_TABLE_AVG_BUCKET_SIZE 8
 #endif
 
+#ifndef PFWL_DEFAULT_FLOW_TABLE_FLOWS_PER_BUCKET
+#define PFWL_DEFAULT_FLOW_TABLE_FLOWS_PER_BUCKET 4 /** Bucketed engine only. **/
+#endif
+
+#ifndef PFWL_DEFAULT_FLOW_TABLE_ENGINE
+#define PFWL_DEFAULT_FLOW_TABLE_ENGINE PFWL_FLOW_TABLE_ENGINE_CHAINED
+#endif
+
 #ifndef PFWL_DEFAULT_EXPECTED_IPv4_FLOWS
 #define PFWL_DEFAULT_EXPECTED_FLOWS 262143
 #endif
@@ -94,6 +106,11 @@
 
 #define PFWL_MAX_CPU_SOCKETS 8
 
+/** Packets of a burst whose flows are prefetched together. **/
+#ifndef PFWL_DISSECT_BATCH_CHUNK
+#define PFWL_DISSECT_BATCH_CHUNK 32
+#endif
+
 #define PFWL_ENABLE_L3_TRUNCATION_PROTECTION
 #define PFWL_ENABLE_L4_TRUNCATION_PROTECTION
 
@@ -101,9 +118,92 @@
 #define PFWL_FLOW_TABLE_USE_MEMORY_POOL 0
 #endif
 
+#ifndef PFWL_DEFAULT_MEMORY_ALLOCATOR
 #if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-#define PFWL_FLOW_TABLE_MEMORY_POOL_DEFAULT_SIZE_v4 500000
-#define PFWL_FLOW_TABLE_MEMORY_POOL_DEFAULT_SIZE_v6 100
+#define PFWL_DEFAULT_MEMORY_ALLOCATOR PFWL_MEMORY_ALLOCATOR_SLAB
+#else
+#define PFWL_DEFAULT_MEMORY_ALLOCATOR PFWL_MEMORY_ALLOCATOR_MALLOC
+#endif
+#endif
+
+/** Buckets the ports are hashed to when learning the protocols ordering. **/
+#ifndef PFWL_GUESS_PORT_BUCKETS
+#define PFWL_GUESS_PORT_BUCKETS 64
+#endif
+
+/** Maximum number of payload signatures used to skip the dissectors. **/
+#ifndef PFWL_PREFILTER_MAX_SIGNATURES
+#define PFWL_PREFILTER_MAX_SIGNATURES 64
+#endif
+
+#ifndef PFWL_ALLOCATOR_SLAB_SIZE
+#define PFWL_ALLOCATOR_SLAB_SIZE 65536
+#endif
+
+/** Flows idle timeouts, in seconds. **/
+#ifndef PFWL_DEFAULT_FLOW_TIMEOUT_TCP
+#define PFWL_DEFAULT_FLOW_TIMEOUT_TCP 30
+#endif
+
+#ifndef PFWL_DEFAULT_FLOW_TIMEOUT_TCP_CLOSED
+#define PFWL_DEFAULT_FLOW_TIMEOUT_TCP_CLOSED 10
+#endif
+
+#ifndef PFWL_DEFAULT_FLOW_TIMEOUT_UDP
+#define PFWL_DEFAULT_FLOW_TIMEOUT_UDP 30
+#endif
+
+#ifndef PFWL_DEFAULT_FLOW_TIMEOUT_OTHER
+#define PFWL_DEFAULT_FLOW_TIMEOUT_OTHER 30
+#endif
+
+/**
+ * TCP reordering. Out of order segments are stored in chunks of
+ * PFWL_TCP_REORDERING_CHUNK_SIZE bytes. All the out of order data of a
+ * connection direction must lie in a window of PFWL_TCP_REORDERING_WINDOW
+ * bytes (a power of two), and can have at most PFWL_TCP_REORDERING_MAX_HOLES
+ * holes.
+ **/
+#ifndef PFWL_TCP_REORDERING_CHUNK_SIZE
+#define PFWL_TCP_REORDERING_CHUNK_SIZE 2048
+#endif
+
+#ifndef PFWL_TCP_REORDERING_WINDOW
+#define PFWL_TCP_REORDERING_WINDOW 65536
+#endif
+
+#ifndef PFWL_TCP_REORDERING_MAX_HOLES
+#define PFWL_TCP_REORDERING_MAX_HOLES 16
+#endif
+
+#define PFWL_TCP_REORDERING_DEFAULT_PER_FLOW_MEMORY_LIMIT 102400 /* 100K */
+#define PFWL_TCP_REORDERING_DEFAULT_PER_PARTITION_MEMORY_LIMIT                 \
+  33554432 /* 32M */
+#define PFWL_TCP_REORDERING_DEFAULT_TOTAL_MEMORY_LIMIT 67108864 /* 64M */
+
+/**
+ * Maximum number of separate ranges of data stored for an IP datagram
+ * being reassembled. Fragments creating more holes are dropped.
+ **/
+#ifndef PFWL_IP_FRAGMENTATION_MAX_HOLES
+#define PFWL_IP_FRAGMENTATION_MAX_HOLES 16
+#endif
+
+/**
+ * Bytes of the total defragmentation memory limit that a shard takes
+ * (or gives back) at once. Only relevant when more than one thread
+ * manages the fragments.
+ **/
+#ifndef PFWL_IP_FRAGMENTATION_CREDITS_GRAIN
+#define PFWL_IP_FRAGMENTATION_CREDITS_GRAIN 65536
+#endif
+
+/**
+ * Maximum number of threads which can match fields against the tags rules
+ * at the same time without delaying the release of replaced rules.
+ **/
+#ifndef PFWL_TAGS_MAX_READERS
+#define PFWL_TAGS_MAX_READERS 256
 #endif
 
 #define PFWL_IPv4_FRAGMENTATION_DEFAULT_TABLE_SIZE 512
@@ -124,15 +224,21 @@
               1000 hosts. */
 #define PFWL_IPv6_FRAGMENTATION_DEFAULT_REASSEMBLY_TIMEOUT 60
 
-/** Hash functions choice. **/
-enum hashes {
-  PFWL_SIMPLE_HASH = 0,
-  PFWL_FNV_HASH,
-  PFWL_MURMUR3_HASH,
-  PFWL_BKDR_HASH,
-};
-
-#define PFWL_FLOW_TABLE_HASH_VERSION PFWL_SIMPLE_HASH
+/**
+ * Hash functions choice. Values must be the same of the
+ * pfwl_flow_table_hash_t enumeration.
+ **/
+#define PFWL_SIMPLE_HASH 0
+#define PFWL_FNV_HASH 1
+#define PFWL_MURMUR3_HASH 2
+#define PFWL_BKDR_HASH 3
+#define PFWL_CRC32C_HASH 4
+#define PFWL_XXHASH_HASH 5
+
+/** Default hash function, can be changed with pfwl_set_flow_table_hash. **/
+#ifndef PFWL_FLOW_TABLE_HASH_VERSION
+#define PFWL_FLOW_TABLE_HASH_VERSION PFWL_FNV_HASH
+#endif
 
 #define PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE 1
 
@@ -152,12 +258,25 @@ enum hashes {
 #define PFWL_NUMA_AWARE_PACKETS_NODE 0
 #endif
 
-#define PFWL_MULTICORE_DEFAULT_GRAIN_SIZE 1 // 256
+/**
+ * Maximum number of packets in a task. The grain of each batch is adapted
+ * at runtime between 1 and mc_pfwl_set_batching's max_grain, which can't
+ * be larger than this.
+ **/
+#ifndef PFWL_MULTICORE_MAX_GRAIN_SIZE
+#define PFWL_MULTICORE_MAX_GRAIN_SIZE 16
+#endif
+
+/** Maximum time (microseconds) waited by a packet in a partial batch. **/
+#ifndef PFWL_MULTICORE_DEFAULT_MAX_BATCH_LATENCY_US
+#define PFWL_MULTICORE_DEFAULT_MAX_BATCH_LATENCY_US 100
+#endif
 
 #ifndef PFWL_MULTICORE_USE_TASKS_POOL
 #define PFWL_MULTICORE_USE_TASKS_POOL 1
 #endif
-#define PFWL_MULTICORE_TASKS_POOL_SIZE 16384
+/** Tasks in the pool, enough for 16384 packets. **/
+#define PFWL_MULTICORE_TASKS_POOL_SIZE (16384 / PFWL_MULTICORE_MAX_GRAIN_SIZE)
 
 #ifndef PFWL_MULTICORE_PREFETCH
 #define PFWL_MULTICORE_PREFETCH 0
@@ -170,9 +289,76 @@ enum hashes {
 #define PFWL_MULTICORE_L3_L4_ORDERED_FARM 0
 #define PFWL_MULTICORE_L3_L4_NOT_ORDERED_FARM 1
 #define PFWL_MULTICORE_L3_L4_ON_DEMAND 2
+/**
+ * The emitter sends all the fragments of a datagram to the same L3_L4
+ * worker, and the packets of a flow to the same L3_L4 worker (keeping
+ * them in order). Each worker has its own defragmentation shard. With the
+ * other farm types IP defragmentation needs a single L3_L4 worker.
+ **/
+#define PFWL_MULTICORE_L3_L4_STEERED_FARM 3
 
 #ifndef PFWL_MULTICORE_L3_L4_FARM_TYPE
-#define PFWL_MULTICORE_L3_L4_FARM_TYPE PFWL_MULTICORE_L3_L4_ORDERED_FARM
+#define PFWL_MULTICORE_L3_L4_FARM_TYPE PFWL_MULTICORE_L3_L4_STEERED_FARM
+#endif
+
+/**
+ * The flow table is split in this number of partitions (bucket ranges) for
+ * each L7 worker. A worker owns a set of partitions, and partitions are
+ * moved from the most loaded workers to the least loaded ones.
+ **/
+#ifndef PFWL_MULTICORE_PARTITIONS_PER_WORKER
+#define PFWL_MULTICORE_PARTITIONS_PER_WORKER 16
+#endif
+
+/**
+ * Number of tasks sent to the L7 workers between two checks of their
+ * load. 0 disables partitions migration.
+ **/
+#ifndef PFWL_MULTICORE_REBALANCE_INTERVAL
+#define PFWL_MULTICORE_REBALANCE_INTERVAL 1024
+#endif
+
+/**
+ * A partition is moved when the tasks waiting in the queue of the most
+ * loaded L7 worker exceed the ones of the least loaded by at least this
+ * amount. Default of mc_pfwl_set_rebalance_threshold.
+ **/
+#ifndef PFWL_MULTICORE_REBALANCE_THRESHOLD
+#define PFWL_MULTICORE_REBALANCE_THRESHOLD 16
+#endif
+
+/** Defaults of mc_pfwl_scaling_parameters_t. **/
+#ifndef PFWL_MULTICORE_SCALING_DEFAULT_PERIOD_MS
+#define PFWL_MULTICORE_SCALING_DEFAULT_PERIOD_MS 1000
+#endif
+
+#ifndef PFWL_MULTICORE_SCALING_DEFAULT_LOW_UTILIZATION
+#define PFWL_MULTICORE_SCALING_DEFAULT_LOW_UTILIZATION 0.3
+#endif
+
+#ifndef PFWL_MULTICORE_SCALING_DEFAULT_HIGH_UTILIZATION
+#define PFWL_MULTICORE_SCALING_DEFAULT_HIGH_UTILIZATION 0.8
+#endif
+
+#ifndef PFWL_MULTICORE_SCALING_DEFAULT_HIGH_BACKLOG
+#define PFWL_MULTICORE_SCALING_DEFAULT_HIGH_BACKLOG 64
+#endif
+
+/**
+ * Packets of a partition being moved are held by the L7 emitter until the
+ * old owner processed the ones it already received. If more packets than
+ * this arrive in the meanwhile, the emitter waits for the old owner.
+ **/
+#ifndef PFWL_MULTICORE_MIGRATION_BUFFER_SIZE
+#define PFWL_MULTICORE_MIGRATION_BUFFER_SIZE 1024
+#endif
+
+/**
+ * Packets which can be waiting in the queue between a producer and a
+ * shard of pfwl_sharded_state_t. Must be a power of 2.
+ **/
+#ifndef PFWL_SHARDED_QUEUE_SIZE
+#define PFWL_SHARDED_QUEUE_SIZE 4096
 #endif
 
 #ifndef PFWL_MULTICORE_DEFAULT_BUFFER_SIZE
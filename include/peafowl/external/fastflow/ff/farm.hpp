@@ -54,6 +54,8 @@
 #include <vector>
 #include <algorithm>
 #include <memory>
+#include <type_traits>
+#include <utility>
 #include <ff/platforms/platform.h>
 #include <ff/lb.hpp>
 #include <ff/gt.hpp>
@@ -774,8 +774,9 @@ public:
                     else skipfirstpop=false;
                     
                     if (task == EOS) {
-                        push_eos(); 
+                        // the filter may still send out tasks when notified
                         if (filter) filter->eosnotify();
+                        push_eos(); 
                         break;
                     } else if (task == EOS_NOFREEZE) {
                         if (filter) {
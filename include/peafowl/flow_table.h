@@ -27,11 +27,13 @@
 #ifndef FLOW_TABLE_H_
 #define FLOW_TABLE_H_
 
+#include <peafowl/allocator.h>
 #include <peafowl/config.h>
 #include <peafowl/external/utils/uthash.h>
 #include <peafowl/inspectors/http_parser_joyent.h>
 #include <peafowl/peafowl.h>
 #include <peafowl/reassembly.h>
+#include <peafowl/tcp_reassembly.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -127,15 +129,33 @@ typedef struct pfwl_dns_internal_information {
 /******************** DNS (end) ******************/
 
 /********************** HTTP ************************/
+/**
+ * Buffer containing an HTTP field split across segments (or across the
+ * pieces of a resegmented payload). Kept until the next packet of the flow,
+ * since the extracted fields point to it.
+ **/
+typedef struct pfwl_http_used_buffer {
+  struct pfwl_http_used_buffer *next;
+  unsigned char *data;
+  size_t size;
+} pfwl_http_used_buffer_t;
+
 typedef struct pfwl_http_internal_informations {
   unsigned char *temp_buffer;
   size_t temp_buffer_size;
-  uint8_t temp_buffer_dirty;
+  pfwl_http_used_buffer_t *used_buffers;
+  pfwl_allocator_t *allocator; // Used for temp_buffer and used_buffers.
   pfwl_pair_t headers[PFWL_HTTP_MAX_HEADERS];
   size_t headers_length;
 } pfwl_http_internal_informations_t;
 /********************** HTTP (END) ************************/
 
+/********************** STUN ************************/
+typedef struct pfwl_stun_internal_information {
+  char mapped_address[INET6_ADDRSTRLEN];
+} pfwl_stun_internal_information_t;
+/********************** STUN (END) ************************/
+
 /********************** SSL ************************/
 typedef enum{
   PFWL_SSLV2 = 0,
@@ -152,6 +172,24 @@ typedef struct pfwl_ssl_internal_information_new {
 
 typedef struct pfwl_flow pfwl_flow_t;
 
+/**
+ * Protocol inspectors state which is too large to be stored in each flow.
+ * It is allocated (zeroed) only when the inspector needs it for the first
+ * time, taking it from the pool of the partition the flow belongs to.
+ **/
+typedef enum {
+  PFWL_INSPECTOR_STATE_HTTP = 0,
+  PFWL_INSPECTOR_STATE_SIP,
+  PFWL_INSPECTOR_STATE_STUN,
+  PFWL_INSPECTOR_STATE_NUM
+} pfwl_inspector_state_type_t;
+
+typedef struct pfwl_http_inspector_state {
+  /** One HTTP parser per direction. **/
+  http_parser http[2];
+  pfwl_http_internal_informations_t http_informations[2];
+} pfwl_http_inspector_state_t;
+
 typedef void (*pfwl_flow_cleaner_dissectors)(pfwl_flow_info_private_t *flow_info_private);
 
 /** This must be initialized to zero before use. **/
@@ -169,6 +207,12 @@ typedef struct pfwl_flow_info_private {
   uint16_t trials;
   /** The possible number of l7 protocols that match with this flow. **/
   uint8_t possible_protocols;
+  /**
+   * Class of the first byte of the first L7 payload of the flow (0 if not
+   * yet computed). Only used when the guess ordering is not
+   * PFWL_GUESS_ORDERING_PORTS.
+   **/
+  uint8_t guess_byte_class;
 
   /**
    * Contains the possible matching protocols for the flow (At the first
@@ -183,7 +227,12 @@ typedef struct pfwl_flow_info_private {
   /********************************/
   /** TCP Tracking information.  **/
   /********************************/
-  const unsigned char *last_rebuilt_tcp_data;
+  /**
+   * Where the segments filling a hole are rebuilt. Reused for all the
+   * holes of the flow.
+   **/
+  unsigned char *tcp_rebuilt_buffer;
+  uint32_t tcp_rebuilt_buffer_size;
   /**
    * The expected sequence numbers in the two directions.
    * (Stored in host byte order).
@@ -196,8 +245,8 @@ typedef struct pfwl_flow_info_private {
   /** Last ack number saw in each direction. **/
   uint32_t last_ack[2];
 
-  /** A pointer to out of order segments. **/
-  pfwl_reassembly_fragment_t *segments[2];
+  /** Out of order data, NULL if there is none. **/
+  pfwl_tcp_reassembly_stream_t *tcp_streams[2];
 
   /**
    * In this way if a flow was created when TCP reordering was enabled,
@@ -217,6 +266,20 @@ typedef struct pfwl_flow_info_private {
   uint8_t seen_fin_ack : 1;
 
   uint8_t first_packet_arrived : 2;
+  /**
+   * One bit per direction, set when out of order data has been dropped
+   * because of the memory limits. The next segment will be considered
+   * in order.
+   **/
+  uint8_t tcp_gap : 2;
+  /**
+   * One bit per direction, set while the connection has been picked up
+   * without seeing the handshake and the peer did not yet acknowledge
+   * the data preceding tcp_pickup_seq. Until then, segments before
+   * tcp_pickup_seq carry data never inspected.
+   **/
+  uint8_t tcp_speculative : 2;
+  uint32_t tcp_pickup_seq[2];
   uint32_t highest_ack[2];
 
   uint32_t synack_acknum;
@@ -226,6 +289,13 @@ typedef struct pfwl_flow_info_private {
   /************************************/
   pfwl_flow_cleaner_dissectors flow_cleaners_dissectors[PFWL_PROTO_L7_NUM];
 
+  /**
+   * Lazily allocated inspectors state. Must only be accessed through
+   * pfwl_inspector_state_get.
+   **/
+  void *inspectors_state[PFWL_INSPECTOR_STATE_NUM];
+  void *partition_info; // NULL if not taken from a flow table.
+
   /*********************************/
   /** DNS Tracking information   **/
   /*********************************/
@@ -237,23 +307,11 @@ typedef struct pfwl_flow_info_private {
   uint8_t ssh_stage : 2;
   char *ssh_client_signature, *ssh_server_signature;
 
-  /*********************************/
-  /** HTTP Tracking information   **/
-  /*********************************/
-  /** One HTTP parser per direction. **/
-  http_parser http[2];
-  pfwl_http_internal_informations_t http_informations[2];
-
   /*********************************/
   /** SMTP Tracking information   **/
   /*********************************/
   uint8_t num_smtp_matched_messages : 2;
 
-  /*********************************/
-  /** SIP Tracking information    **/
-  /*********************************/
-  pfwl_sip_internal_information_t sip_informations;
-
   /*********************************/
   /** POP3 Tracking information   **/
   /*********************************/
@@ -280,33 +338,130 @@ typedef struct pfwl_flow_info_private {
   /*****************************************/
   void* json_parser;
   void* json_stringbuffers[PFWL_FIELDS_L7_JSON_RPC_LAST - PFWL_FIELDS_L7_JSON_RPC_FIRST - 1];
-
-  /***************************************/
-  /** STUN tracking information         **/
-  /***************************************/
-  char stun_mapped_address[INET6_ADDRSTRLEN];
 } pfwl_flow_info_private_t;
 
+/**
+ * Node of the expiration lists. Each partition keeps one list per
+ * pfwl_flow_timeout_t, sorted from the least to the most recently
+ * updated flow.
+ **/
+typedef struct pfwl_flow_expiration_node {
+  struct pfwl_flow_expiration_node *prev;
+  struct pfwl_flow_expiration_node *next;
+} pfwl_flow_expiration_node_t;
+
 struct pfwl_flow {
   pfwl_flow_t *prev;
   pfwl_flow_t *next;
+  uint32_t bucket; // Home bucket (only used by the bucketed engine).
+  pfwl_flow_expiration_node_t expiration;
+  uint8_t timeout; // The pfwl_flow_timeout_t of the list the flow is in.
   pfwl_flow_info_t info;
   pfwl_flow_info_private_t info_private;
 };
 
 typedef struct pfwl_flow_table pfwl_flow_table_t;
 
-#if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-pfwl_flow_table_t *pfwl_flow_table_create(uint32_t size,
-                                          uint32_t max_active_v4_flows,
-                                          uint16_t num_partitions,
-                                          uint32_t start_pool_size);
-
-#else
 pfwl_flow_table_t *pfwl_flow_table_create(uint32_t expected_flows,
                                           uint8_t strict,
-                                          uint16_t num_partitions);
-#endif
+                                          uint16_t num_partitions,
+                                          pfwl_flow_table_engine_t engine);
+
+/**
+ * Changes the hash function used to find the flows.
+ * @param db The flow table.
+ * @param hash The hash function.
+ * @return 0 if succeeded, 1 if some flow is stored or if the hash
+ * function was not compiled in.
+ **/
+uint8_t pfwl_flow_table_set_hash(pfwl_flow_table_t *db,
+                                 pfwl_flow_table_hash_t hash);
+
+/**
+ * Checks whether the table contains flows.
+ * @param db The flow table.
+ * @return 1 if some partition contains flows, 0 otherwise.
+ **/
+uint8_t pfwl_flow_table_memory_in_use(pfwl_flow_table_t *db);
+
+/**
+ * Changes the allocator used by all the partitions of the table.
+ * @param db The flow table.
+ * @param type The allocator.
+ * @return 0 if succeeded, 1 otherwise (i.e. if the table contains flows).
+ **/
+uint8_t pfwl_flow_table_set_memory_allocator(pfwl_flow_table_t *db,
+                                             pfwl_memory_allocator_t type);
+
+/**
+ * Sets the limits on the memory used to store out of order TCP segments.
+ * @param db The flow table.
+ * @param per_flow Maximum bytes used by a single flow.
+ * @param per_partition Maximum bytes used by a single partition.
+ * @param total Maximum bytes used by the whole table.
+ **/
+void pfwl_flow_table_set_tcp_reordering_limits(pfwl_flow_table_t *db,
+                                               uint32_t per_flow,
+                                               uint32_t per_partition,
+                                               uint32_t total);
+
+/**
+ * Adds the TCP reordering statistics of the table to stats.
+ * @param db The flow table.
+ * @param stats The statistics.
+ **/
+void pfwl_flow_table_get_tcp_reordering_stats(
+    pfwl_flow_table_t *db, pfwl_tcp_reordering_stats_t *stats);
+
+/**
+ * Adds the memory used by the table to stats.
+ * @param db The flow table.
+ * @param stats The memory usage.
+ **/
+void pfwl_flow_table_get_memory_stats(pfwl_flow_table_t *db,
+                                      pfwl_memory_stats_t *stats);
+
+/**
+ * Places a partition on a NUMA node. Its part of the table is moved to the
+ * node, as well as the slabs of its allocator, which will also take the
+ * new slabs from there. Flows, TCP segments and buffers allocated with
+ * PFWL_MEMORY_ALLOCATOR_MALLOC are not moved. The partition must not be
+ * used by other threads in the meanwhile.
+ * @param db The flow table.
+ * @param partition The partition.
+ * @param node The node, -1 to leave the placement of new memory to the
+ * system.
+ * @return 0 if succeeded, 1 if some memory could not be moved.
+ **/
+uint8_t pfwl_flow_table_set_partition_node(pfwl_flow_table_t *db,
+                                           uint16_t partition, int16_t node);
+
+/**
+ * Adds the memory used by the partitions placed on a NUMA node to stats.
+ * Partitions not placed on any node are considered to be on node 0.
+ * @param db The flow table.
+ * @param node The node.
+ * @param stats The memory usage.
+ **/
+void pfwl_flow_table_get_node_memory_stats(pfwl_flow_table_t *db, int16_t node,
+                                           pfwl_memory_stats_t *stats);
+
+/**
+ * Sets the idle timeout of a class of flows.
+ * @param db The flow table.
+ * @param type The class of flows.
+ * @param seconds The timeout, in seconds.
+ **/
+void pfwl_flow_table_set_timeout(pfwl_flow_table_t *db,
+                                 pfwl_flow_timeout_t type, uint32_t seconds);
+
+/**
+ * Moves a flow to the expiration list matching its current state.
+ * Must be called when the TCP connection tracking sees a FIN or a RST,
+ * since the flow may need a shorter timeout.
+ * @param flow The flow.
+ **/
+void pfwl_flow_table_update_expiration(pfwl_flow_t *flow);
 
 void pflw_flow_table_set_flow_cleaner_callback(
     pfwl_flow_table_t *db, pfwl_flow_cleaner_callback_t *flow_cleaner_callback);
@@ -324,6 +479,24 @@ pfwl_flow_t *pfwl_flow_table_find_or_create_flow(pfwl_flow_table_t *db, pfwl_dis
     uint32_t timestamp, uint8_t syn, pfwl_timestamp_unit_t unit);
 
 void pfwl_flow_table_delete_flow(pfwl_flow_table_t *db, pfwl_flow_t *to_delete);
+
+/**
+ * Prefetches the table entry where the flow of a packet is searched.
+ * @param db The flow table.
+ * @param pkt_info The packet, with L3 addresses and L4 ports and protocol.
+ **/
+void pfwl_flow_table_prefetch_entry(pfwl_flow_table_t *db,
+                                    const pfwl_dissection_info_t *pkt_info);
+
+/**
+ * Prefetches the flow which will probably match a packet. It should be
+ * called some time after pfwl_flow_table_prefetch_entry, since it reads
+ * the table entry.
+ * @param db The flow table.
+ * @param pkt_info The packet, with L3 addresses and L4 ports and protocol.
+ **/
+void pfwl_flow_table_prefetch_flow(pfwl_flow_table_t *db,
+                                   const pfwl_dissection_info_t *pkt_info);
 void pfwl_flow_table_delete_flow_later(pfwl_flow_table_t *db,
                                        pfwl_flow_t *to_delete);
 
@@ -339,10 +512,64 @@ uint32_t
 pfwl_compute_v6_hash_function(pfwl_flow_table_t *db,
                               const pfwl_dissection_info_t *const pkt_info);
 
+/**
+ * Computes the index of the flow of the packet (IPv4 or IPv6).
+ * @param db The flow table.
+ * @param pkt_info The L3 and L4 information of the packet.
+ * @return The index of the flow in the table.
+ */
+uint32_t
+pfwl_compute_hash_function(pfwl_flow_table_t *db,
+                           const pfwl_dissection_info_t *const pkt_info);
+
 void pfwl_init_flow_info_internal(pfwl_flow_info_private_t *flow_info_private,
                                   char *protocols_to_inspect,
                                   uint8_t tcp_reordering_enabled);
 
+/**
+ * Returns the state of an inspector for a flow, allocating it (zeroed)
+ * if this is the first time it is requested.
+ * @param flow_info_private The flow.
+ * @param type The type of the state.
+ * @return The state of the inspector.
+ **/
+void *pfwl_inspector_state_get(pfwl_flow_info_private_t *flow_info_private,
+                               pfwl_inspector_state_type_t type);
+
+/**
+ * Releases the state of an inspector for a flow, if allocated. It will be
+ * reused by other flows of the same partition.
+ * @param flow_info_private The flow.
+ * @param type The type of the state.
+ **/
+void pfwl_inspector_state_release(pfwl_flow_info_private_t *flow_info_private,
+                                  pfwl_inspector_state_type_t type);
+
+/**
+ * Returns the allocator of the partition a flow belongs to.
+ * @param flow_info_private The flow.
+ * @return The allocator, or NULL if the flow is not stored in a flow table
+ * (in this case the system allocator must be used).
+ **/
+pfwl_allocator_t *
+pfwl_flow_allocator(pfwl_flow_info_private_t *flow_info_private);
+
+/**
+ * Returns the out of order data of the partition a flow belongs to.
+ * @param flow_info_private The flow.
+ * @return The out of order data of the partition, or NULL if the flow is
+ * not stored in a flow table.
+ **/
+pfwl_tcp_reassembly_partition_t *
+pfwl_flow_tcp_reassembly(pfwl_flow_info_private_t *flow_info_private);
+
+/**
+ * Releases all the inspectors state of a flow.
+ * @param flow_info_private The flow.
+ **/
+void pfwl_inspector_state_release_all(
+    pfwl_flow_info_private_t *flow_info_private);
+
 pfwl_flow_t *mc_pfwl_flow_table_find_or_create_flow(pfwl_flow_table_t *db, uint16_t partition_id, uint32_t index,
     pfwl_dissection_info_t *pkt_info, char *protocols_to_inspect,
     uint8_t tcp_reordering_enabled, uint32_t timestamp, uint8_t syn, pfwl_timestamp_unit_t unit);
@@ -350,6 +577,15 @@ pfwl_flow_t *mc_pfwl_flow_table_find_or_create_flow(pfwl_flow_table_t *db, uint1
 void pfwl_flow_table_setup_partitions(pfwl_flow_table_t *table,
                                       uint16_t num_partitions);
 
+/**
+ * Returns the partition containing a given index of the table. All the
+ * packets of a flow map to the same index and thus to the same partition.
+ * @param db The flow table.
+ * @param index The index, as returned by pfwl_compute_hash_function.
+ * @return The partition id.
+ */
+uint16_t mc_pfwl_flow_table_partition(pfwl_flow_table_t *db, uint32_t index);
+
 void mc_pfwl_flow_table_delete_flow(pfwl_flow_table_t *db,
                                     uint16_t partition_id,
                                     pfwl_flow_t *to_delete);
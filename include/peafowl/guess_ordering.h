@@ -0,0 +1,119 @@
+/*
+ * guess_ordering.h
+ *
+ * =========================================================================
+ * Copyright (c) 2012-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#ifndef PFWL_GUESS_ORDERING_H_
+#define PFWL_GUESS_ORDERING_H_
+
+#include <peafowl/config.h>
+#include <peafowl/peafowl.h>
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Classes of the first byte of the L7 payload. 0 is used to mark a flow
+ * whose class has not yet been computed.
+ **/
+#define PFWL_GUESS_BYTE_CLASSES 7
+
+/**
+ * Number of matches of each protocol, for each context. A context is
+ * identified by the L4 protocol, the bucket of the lowest of the two ports
+ * and the class of the first byte of the L7 payload of the flow. A profile
+ * is not thread safe: it must not be updated by a thread while other
+ * threads update or read it.
+ **/
+typedef struct pfwl_guess_profile pfwl_guess_profile_t;
+
+/**
+ * Creates an empty profile.
+ * @return The profile, or NULL if no memory is available.
+ */
+pfwl_guess_profile_t *pfwl_guess_profile_create(void);
+
+/**
+ * Deletes a profile.
+ * @param profile The profile.
+ */
+void pfwl_guess_profile_delete(pfwl_guess_profile_t *profile);
+
+/**
+ * Returns the class of the first byte of a L7 payload.
+ * @param pkt The L7 payload.
+ * @param length The length of the L7 payload.
+ * @return The class, between 1 and PFWL_GUESS_BYTE_CLASSES.
+ */
+uint8_t pfwl_guess_byte_class(const unsigned char *pkt, size_t length);
+
+/**
+ * Returns the protocols which matched in a context, the most frequent first.
+ * @param profile The profile.
+ * @param diss_info The dissection info of the packet (L4 protocol and ports).
+ * @param byte_class The class of the first byte of the L7 payload of the flow.
+ * @param num Will be set to the number of protocols returned.
+ * @return The protocols.
+ */
+const uint8_t *pfwl_guess_profile_get(const pfwl_guess_profile_t *profile,
+                                      const pfwl_dissection_info_t *diss_info,
+                                      uint8_t byte_class, size_t *num);
+
+/**
+ * Records that a protocol matched in a context.
+ * @param profile The profile.
+ * @param diss_info The dissection info of the packet (L4 protocol and ports).
+ * @param byte_class The class of the first byte of the L7 payload of the flow.
+ * @param protocol The protocol which matched.
+ */
+void pfwl_guess_profile_update(pfwl_guess_profile_t *profile,
+                               const pfwl_dissection_info_t *diss_info,
+                               uint8_t byte_class, pfwl_protocol_l7_t protocol);
+
+/**
+ * Writes a profile in textual form. Protocols are stored by name,
+ * so that the profile can be used by other versions of the library.
+ * @param profile The profile.
+ * @param f The file.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_guess_profile_write(const pfwl_guess_profile_t *profile, FILE *f);
+
+/**
+ * Reads a profile written by pfwl_guess_profile_write, replacing the
+ * content of 'profile'. Unknown protocols are skipped.
+ * @param profile The profile.
+ * @param f The file.
+ * @return 0 if succeeded, 1 otherwise (in this case the profile is empty).
+ */
+uint8_t pfwl_guess_profile_read(pfwl_guess_profile_t *profile, FILE *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PFWL_GUESS_ORDERING_H_ */
@@ -27,40 +27,86 @@
 #ifndef HASH_FUNCTIONS_H_
 #define HASH_FUNCTIONS_H_
 
+#include <peafowl/config.h>
 #include <peafowl/peafowl.h>
 
+#include <netinet/in.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * Direction independent keys of the flows: the endpoint with the lower
+ * address (or port, if the addresses are equal) comes first. Padding is
+ * always zero, so that keys can be hashed as a whole.
+ **/
+typedef struct {
+  uint32_t addr_low;
+  uint32_t addr_high;
+  uint16_t port_low;
+  uint16_t port_high;
+  uint8_t protocol;
+  uint8_t padding[3];
+} pfwl_flow_key_v4_t;
+
+typedef struct {
+  struct in6_addr addr_low;
+  struct in6_addr addr_high;
+  uint16_t port_low;
+  uint16_t port_high;
+  uint8_t protocol;
+  uint8_t padding[3];
+} pfwl_flow_key_v6_t;
+
+void pfwl_flow_key_v4_make(const pfwl_dissection_info_t *const in,
+                           pfwl_flow_key_v4_t *key);
+
+void pfwl_flow_key_v6_make(const pfwl_dissection_info_t *const in,
+                           pfwl_flow_key_v6_t *key);
+
 #if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_FNV_HASH ||                           \
     PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE == 1
 uint32_t v4_fnv_hash_function(const pfwl_dissection_info_t *const in);
 
-uint32_t v6_fnv_hash_function(const pfwl_dissection_info_t *const in);
+uint32_t v6_fnv_hash_function(const pfwl_flow_key_v6_t *const key);
 #endif
 
 #if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_MURMUR3_HASH ||                       \
     PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE == 1
 uint32_t v4_hash_murmur3(const pfwl_dissection_info_t *const in, uint32_t seed);
 
-uint32_t v6_hash_murmur3(const pfwl_dissection_info_t *const in, uint32_t seed);
+uint32_t v6_hash_murmur3(const pfwl_flow_key_v6_t *const key, uint32_t seed);
 #endif
 
 #if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_SIMPLE_HASH ||                        \
     PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE == 1
 uint32_t v4_hash_function_simple(const pfwl_dissection_info_t *const in);
 
-uint32_t v6_hash_function_simple(const pfwl_dissection_info_t *const in);
+uint32_t v6_hash_function_simple(const pfwl_flow_key_v6_t *const key);
 #endif
 
 #if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_BKDR_HASH ||                          \
     PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE == 1
 uint32_t v4_hash_function_bkdr(const pfwl_dissection_info_t *const in);
 
-uint32_t v6_hash_function_bkdr(const pfwl_dissection_info_t *const in);
+uint32_t v6_hash_function_bkdr(const pfwl_flow_key_v6_t *const key);
+#endif
+
+#if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_CRC32C_HASH ||                        \
+    PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE == 1
+uint32_t v4_hash_crc32c(const pfwl_dissection_info_t *const in, uint32_t seed);
+
+uint32_t v6_hash_crc32c(const pfwl_flow_key_v6_t *const key, uint32_t seed);
+#endif
+
+#if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_XXHASH_HASH ||                        \
+    PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE == 1
+uint32_t v4_hash_xxhash(const pfwl_dissection_info_t *const in, uint32_t seed);
+
+uint32_t v6_hash_xxhash(const pfwl_flow_key_v6_t *const key, uint32_t seed);
 #endif
 
 #ifdef __cplusplus
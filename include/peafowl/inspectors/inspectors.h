@@ -58,6 +58,16 @@ void pfwl_field_array_push_back_string(pfwl_field_t *fields, pfwl_field_id_t id,
                                        const unsigned char *s, size_t len);
 void pfwl_field_array_get_length(pfwl_field_t *fields, pfwl_field_id_t id);
 
+/**
+ * Prepares a dissection info for a new packet. If it was last filled by
+ * this state, only the fields this state may have set are cleared,
+ * otherwise the whole structure is cleared.
+ * @param state The state of the library.
+ * @param dissection_info The dissection info to reset.
+ */
+void pfwl_dissection_info_reset(pfwl_state_t *state,
+                                pfwl_dissection_info_t *dissection_info);
+
 uint8_t check_dhcp(pfwl_state_t *state, const unsigned char *app_data,
                    size_t data_length, pfwl_dissection_info_t *pkt_info,
                    pfwl_flow_info_private_t *flow_info_private);
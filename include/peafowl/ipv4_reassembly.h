@@ -27,6 +27,8 @@
 #ifndef PFWL_IPV4_REASSEMBLY_H_
 #define PFWL_IPV4_REASSEMBLY_H_
 
+#include <peafowl/peafowl.h>
+
 #include <stdint.h>
 
 /* To get the 'fragment offset' part. **/
@@ -80,6 +82,45 @@ void pfwl_reordering_ipv4_fragmentation_set_total_memory_limit(
 void pfwl_reordering_ipv4_fragmentation_set_reassembly_timeout(
     pfwl_ipv4_fragmentation_state_t *frag_state, uint8_t timeout_seconds);
 
+/**
+ * Splits the state in a number of shards, one for each thread which
+ * manages the fragments. Each shard has its own tables and is only
+ * accessed by one thread, while the total memory limit is shared by all
+ * the shards. The per host memory limit is enforced separately by each
+ * shard. It can only be changed when no fragments are stored.
+ * @param frag_state  A pointer to the IPv4 defragmentation handle.
+ * @param shards_num  The number of shards.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_reordering_ipv4_fragmentation_set_shards(
+    pfwl_ipv4_fragmentation_state_t *frag_state, uint16_t shards_num);
+
+/**
+ * Checks whether fragments are stored.
+ * @param frag_state  A pointer to the IPv4 defragmentation handle.
+ * @return 1 if some shard stores fragments, 0 otherwise.
+ */
+uint8_t pfwl_reordering_ipv4_fragmentation_memory_in_use(
+    pfwl_ipv4_fragmentation_state_t *frag_state);
+
+/**
+ * Sets the allocator used to store the fragments. It can only be changed
+ * when no fragments are stored.
+ * @param frag_state  A pointer to the IPv4 defragmentation handle.
+ * @param type        The allocator.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_reordering_ipv4_fragmentation_set_memory_allocator(
+    pfwl_ipv4_fragmentation_state_t *frag_state, pfwl_memory_allocator_t type);
+
+/**
+ * Adds the memory used to store the fragments to stats.
+ * @param frag_state  A pointer to the IPv4 defragmentation handle.
+ * @param stats       The memory usage.
+ */
+void pfwl_reordering_ipv4_fragmentation_get_memory_stats(
+    pfwl_ipv4_fragmentation_state_t *frag_state, pfwl_memory_stats_t *stats);
+
 /**
  * Disables the IPv4 fragmentation and deallocates the handle.
  * @param frag_state  A pointer to the IPv4 defragmentation handle.
@@ -88,14 +129,16 @@ void pfwl_reordering_disable_ipv4_fragmentation(
     pfwl_ipv4_fragmentation_state_t *frag_state);
 
 /**
- * Reassemble the IP datagram if it is fragmented. It is thread safe
- * if and only if PFWL_THREAD_SAFETY_ENABLED == 1.
+ * Reassemble the IP datagram if it is fragmented. Different threads can
+ * call it concurrently, as long as they use different tids and all the
+ * fragments of a datagram are managed by the same thread (see
+ * pfwl_reassembly_ip_shard).
  * @param state The state for fragmentation support.
  * @param data A pointer to the beginning of IP header.
  * @param current_time The current time, in seconds.
  * @param offset The data offset specified in the ip header.
  * @param more_fragments 1 if the MF flag is set, 0 otherwise.
- * @param tid The thread id.
+ * @param tid The thread id, which selects the shard to be used.
  * @return Returns NULL if the datagram is a fragment but doesn't fill an
  *         hole. In this case, the content of the datagram has been
  *         copied, so if the user wants, he can release the resources
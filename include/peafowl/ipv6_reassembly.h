@@ -27,6 +27,8 @@
 #ifndef PFWL_IPV6_REASSEMBLY_H_
 #define PFWL_IPV6_REASSEMBLY_H_
 
+#include <peafowl/peafowl.h>
+
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -73,6 +75,45 @@ void pfwl_reordering_ipv6_fragmentation_set_total_memory_limit(
 void pfwl_reordering_ipv6_fragmentation_set_reassembly_timeout(
     pfwl_ipv6_fragmentation_state_t *frag_state, uint8_t timeout_seconds);
 
+/**
+ * Splits the state in a number of shards, one for each thread which
+ * manages the fragments. Each shard has its own tables and is only
+ * accessed by one thread, while the total memory limit is shared by all
+ * the shards. The per host memory limit is enforced separately by each
+ * shard. It can only be changed when no fragments are stored.
+ * @param frag_state  A pointer to the IPv6 defragmentation handle.
+ * @param shards_num  The number of shards.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_reordering_ipv6_fragmentation_set_shards(
+    pfwl_ipv6_fragmentation_state_t *frag_state, uint16_t shards_num);
+
+/**
+ * Checks whether fragments are stored.
+ * @param frag_state  A pointer to the IPv6 defragmentation handle.
+ * @return 1 if some shard stores fragments, 0 otherwise.
+ */
+uint8_t pfwl_reordering_ipv6_fragmentation_memory_in_use(
+    pfwl_ipv6_fragmentation_state_t *frag_state);
+
+/**
+ * Sets the allocator used to store the fragments. It can only be changed
+ * when no fragments are stored.
+ * @param frag_state  A pointer to the IPv6 defragmentation handle.
+ * @param type        The allocator.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_reordering_ipv6_fragmentation_set_memory_allocator(
+    pfwl_ipv6_fragmentation_state_t *frag_state, pfwl_memory_allocator_t type);
+
+/**
+ * Adds the memory used to store the fragments to stats.
+ * @param frag_state  A pointer to the IPv6 defragmentation handle.
+ * @param stats       The memory usage.
+ */
+void pfwl_reordering_ipv6_fragmentation_get_memory_stats(
+    pfwl_ipv6_fragmentation_state_t *frag_state, pfwl_memory_stats_t *stats);
+
 /**
  * Disables the IPv6 fragmentation and deallocates the handle.
  * @param frag_state  A pointer to the IPv6 defragmentation handle.
@@ -81,7 +122,10 @@ void pfwl_reordering_disable_ipv6_fragmentation(
     pfwl_ipv6_fragmentation_state_t *frag_state);
 
 /**
- * Reassemble the IP datagram if it is fragmented.
+ * Reassemble the IP datagram if it is fragmented. Different threads can
+ * call it concurrently, as long as they use different tids and all the
+ * fragments of a datagram are managed by the same thread (see
+ * pfwl_reassembly_ip_shard).
  * @param state The state for fragmentation support.
  * @param unfragmentable_start A pointer to the beginning of
  * unfragmentable part. We suppose that unfragmentable and
@@ -101,7 +145,7 @@ void pfwl_reordering_disable_ipv6_fragmentation(
  * @param next_header The header which follows the fragmentation
  * header.
  * @param current_time The current time, in seconds.
- * @param tid The thread identifier.
+ * @param tid The thread identifier, which selects the shard to be used.
  * @return Returns NULL if the datagram is a fragment but doesn't fill
  * an hole. In this case, the content of the datagram has been copied,
  * so if the user wants, he can release the resources used to store the
@@ -524,6 +524,14 @@ typedef struct pfwl_dissection_info_l3 {
                                ///< PFWL_IP_VERSION_6 in IPv6.
 }pfwl_dissection_info_l3_t;
 
+/**
+ * A contiguous piece of data.
+ **/
+typedef struct pfwl_span {
+  const unsigned char *data; ///< Start of the piece.
+  size_t length;             ///< Length of the piece.
+} pfwl_span_t;
+
 /**
  * The result of the L4 identification process.
  **/
@@ -536,8 +544,17 @@ typedef struct pfwl_dissection_info_l4 {
                          ///< 0: From source to dest. 1: From dest to source
                          ///< (with respect to src and dst stored in the flow).
                          ///< This is only valid for TCP and UDP packets.
-  const unsigned char *resegmented_pkt; ///< Resegmented TCP payload.
+  const unsigned char *resegmented_pkt; ///< Resegmented TCP payload. To avoid
+                         ///< copies, it is only built if some dissector
+                         ///< needs it, otherwise it is NULL and the payload
+                         ///< is available through payload_spans.
   size_t resegmented_pkt_len;  ///< The length of the resegmented TCP payload.
+  const pfwl_span_t *payload_spans; ///< Resegmented TCP payload, as a list of
+                         ///< pieces pointing to the packet and to the out of
+                         ///< order data stored by the library. Valid until
+                         ///< the next packet of the same flow is processed.
+                         ///< Only set when resegmented_pkt_len is not 0.
+  size_t payload_spans_num; ///< Number of pieces in payload_spans.
   pfwl_protocol_l4_t protocol; ///< The Level 4 protocol.
 }pfwl_dissection_info_l4_t;
 
@@ -581,6 +598,10 @@ typedef struct pfwl_dissection_info_l7 {
                                                     ///< needed field needs to be done.
   const char* tags[PFWL_TAGS_MAX];                  ///< Tags associated to the packet.
   uint16_t tags_num;                                ///< Number of values in 'tags' array.
+  uint64_t reset_id;                                ///< For internal use only. Identifier of the state which last filled
+                                                    ///< this structure. If the structure is reused for
+                                                    ///< another packet dissected with the same state,
+                                                    ///< only the fields that state may have set are reset.
 }pfwl_dissection_info_l7_t;
 
 /**
@@ -591,7 +612,13 @@ typedef struct pfwl_dissection_info {
   pfwl_dissection_info_l3_t l3; ///< Information known after L3 parsing
   pfwl_dissection_info_l4_t l4; ///< Information known after L4 parsing
   pfwl_dissection_info_l7_t l7; ///< Information known after L7 parsing
-  pfwl_flow_info_t flow_info; ///< Information about the flow.
+  pfwl_flow_info_t flow_info; ///< Information about the flow. Not filled if
+                              ///< PFWL_FLOW_INFO_MODE_REFERENCE is used.
+  const pfwl_flow_info_t* flow_info_ref; ///< Information about the flow, as stored in the flow table.
+                                         ///< Always set when the packet belongs to a flow, regardless
+                                         ///< of the flow info mode. It is only valid until the next
+                                         ///< pfwl_dissect_* call on the same state, since the flow may
+                                         ///< then be deleted.
 } pfwl_dissection_info_t;
 
 // clang-format on
@@ -631,6 +658,121 @@ typedef enum {
   PFWL_DISSECTOR_ACCURACY_HIGH,    ///< High accuracy
 } pfwl_dissector_accuracy_t;
 
+/**
+ * The data structure used to store the flows.
+ **/
+typedef enum {
+  PFWL_FLOW_TABLE_ENGINE_CHAINED = 0, ///< Hash table with collision lists
+  PFWL_FLOW_TABLE_ENGINE_BUCKETED,    ///< Open addressing hash table with
+                                      ///< cache line sized buckets, storing
+                                      ///< flows fingerprints.
+} pfwl_flow_table_engine_t;
+
+/**
+ * The hash function used to find the flows in the flow table.
+ **/
+typedef enum {
+  PFWL_FLOW_TABLE_HASH_SIMPLE = 0, ///< Sum of addresses, ports and protocol
+  PFWL_FLOW_TABLE_HASH_FNV,        ///< FNV-1a
+  PFWL_FLOW_TABLE_HASH_MURMUR3,    ///< MurmurHash3
+  PFWL_FLOW_TABLE_HASH_BKDR,       ///< BKDR
+  PFWL_FLOW_TABLE_HASH_CRC32C,     ///< CRC32C, computed with the SSE4.2
+                                   ///< instruction when available
+  PFWL_FLOW_TABLE_HASH_XXHASH,     ///< xxHash32
+} pfwl_flow_table_hash_t;
+
+/**
+ * The allocator used for flows, TCP segments, IP fragments and
+ * inspectors buffers.
+ **/
+typedef enum {
+  PFWL_MEMORY_ALLOCATOR_MALLOC = 0, ///< System allocator
+  PFWL_MEMORY_ALLOCATOR_SLAB,       ///< Per-partition slab allocator. Memory
+                                    ///< is never returned to the system
+                                    ///< before pfwl_terminate.
+} pfwl_memory_allocator_t;
+
+/**
+ * The objects for which memory usage is reported.
+ **/
+typedef enum {
+  PFWL_MEMORY_FLOWS = 0, ///< Flows
+  PFWL_MEMORY_FRAGMENTS, ///< Buffered TCP segments and IP fragments
+  PFWL_MEMORY_BUFFERS,   ///< Inspectors temporary buffers
+  PFWL_MEMORY_NUM
+} pfwl_memory_type_t;
+
+/**
+ * Memory usage.
+ **/
+typedef struct {
+  size_t used[PFWL_MEMORY_NUM];       ///< Bytes currently used
+  size_t high_water[PFWL_MEMORY_NUM]; ///< Highest number of bytes used. When
+                                      ///< there are multiple partitions, it is
+                                      ///< the sum of the per-partition values.
+  size_t reserved; ///< Bytes obtained from the system by the slab allocator
+} pfwl_memory_stats_t;
+
+/**
+ * Statistics about the out of order TCP segments.
+ **/
+typedef struct {
+  size_t used;       ///< Bytes currently used to store out of order segments
+  size_t high_water; ///< Highest number of bytes used. When there are
+                     ///< multiple partitions, it is the sum of the
+                     ///< per-partition values.
+  uint64_t dropped_segments; ///< Out of order segments which have not been
+                             ///< stored (memory limits reached or segment too
+                             ///< far from the expected one)
+  uint64_t dropped_bytes;    ///< Bytes of the dropped segments plus bytes
+                             ///< dropped to make room for other segments
+  uint64_t evicted_streams;  ///< Number of times the out of order data of a
+                             ///< connection has been dropped to make room for
+                             ///< other segments
+} pfwl_tcp_reordering_stats_t;
+
+/**
+ * The classes of flows for which a different idle timeout can be set.
+ **/
+typedef enum {
+  PFWL_FLOW_TIMEOUT_TCP = 0,    ///< TCP flows
+  PFWL_FLOW_TIMEOUT_TCP_CLOSED, ///< TCP flows where a RST or a FIN in both
+                                ///< directions has been seen
+  PFWL_FLOW_TIMEOUT_UDP,        ///< UDP flows
+  PFWL_FLOW_TIMEOUT_OTHER,      ///< Flows of other L4 protocols
+  PFWL_FLOW_TIMEOUT_NUM
+} pfwl_flow_timeout_t;
+
+/**
+ * How the information about the flow is provided in the dissection info.
+ **/
+typedef enum {
+  PFWL_FLOW_INFO_MODE_COPY = 0, ///< The information about the flow is copied
+                                ///< into 'flow_info' for each packet.
+  PFWL_FLOW_INFO_MODE_REFERENCE, ///< 'flow_info' is not filled, the
+                                 ///< information must be read through
+                                 ///< 'flow_info_ref'.
+} pfwl_flow_info_mode_t;
+
+/**
+ * The order in which the dissectors are tried when the protocol of a
+ * flow is not yet known.
+ **/
+typedef enum {
+  PFWL_GUESS_ORDERING_PORTS = 0, ///< Start from the protocol associated to
+                                 ///< the well-known port, then try the others
+                                 ///< by protocol identifier.
+  PFWL_GUESS_ORDERING_ADAPTIVE,  ///< Count which protocols matched for each
+                                 ///< L4 protocol, port bucket and class of the
+                                 ///< first payload byte, and try them first,
+                                 ///< the most frequent first. The counters are
+                                 ///< not updated atomically, so the state must
+                                 ///< not be used by several threads at once.
+  PFWL_GUESS_ORDERING_STATIC,    ///< Like PFWL_GUESS_ORDERING_ADAPTIVE, but
+                                 ///< the counters are not updated. Meant to be
+                                 ///< used with an imported profile.
+} pfwl_guess_ordering_t;
+
 /**
  * @brief Initializes Peafowl.
  * Initializes the library.
@@ -658,6 +800,114 @@ void pfwl_terminate(pfwl_state_t *state);
 uint8_t pfwl_set_expected_flows(pfwl_state_t *state, uint32_t flows,
                                 uint8_t strict);
 
+/**
+ * @brief Sets the data structure used to store the flows.
+ * With PFWL_FLOW_TABLE_ENGINE_BUCKETED, each lookup usually touches a
+ * single cache line of the table before reading the flow it is looking
+ * for, instead of walking a collision list. Since the table is
+ * recreated, this should be called before starting the dissection.
+ * @param state A pointer to the state of the library.
+ * @param engine The flow table engine.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_set_flow_table_engine(pfwl_state_t *state,
+                                   pfwl_flow_table_engine_t engine);
+
+/**
+ * @brief Sets the hash function used to find the flows in the flow
+ * table. The hash function can only be changed when no flows are
+ * stored, thus this should be called before starting the dissection.
+ * @param state A pointer to the state of the library.
+ * @param hash The hash function.
+ * @return 0 if succeeded, 1 otherwise (e.g. if the library was compiled
+ * without the code of that hash function).
+ */
+uint8_t pfwl_set_flow_table_hash(pfwl_state_t *state,
+                                 pfwl_flow_table_hash_t hash);
+
+/**
+ * @brief Sets the allocator used for flows, TCP segments, IP fragments
+ * and inspectors buffers. The allocator can only be changed when
+ * no flows and no fragments are stored, thus this should be called
+ * before starting the dissection.
+ * @param state A pointer to the state of the library.
+ * @param allocator The allocator.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_set_memory_allocator(pfwl_state_t *state,
+                                  pfwl_memory_allocator_t allocator);
+
+/**
+ * @brief Returns the memory used by flows, TCP segments, IP fragments
+ * and inspectors buffers.
+ * @param state A pointer to the state of the library.
+ * @param stats The memory usage will be stored here.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_get_memory_stats(pfwl_state_t *state, pfwl_memory_stats_t *stats);
+
+/**
+ * @brief Sets after how much time without packets a flow is removed
+ * from the flow table. The new timeout also applies to the flows which
+ * are already stored.
+ * @param state A pointer to the state of the library.
+ * @param type The class of flows the timeout refers to.
+ * @param seconds The timeout, in seconds.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_set_flow_timeout(pfwl_state_t *state, pfwl_flow_timeout_t type,
+                              uint32_t seconds);
+
+/**
+ * @brief Sets how the information about the flow is provided in the
+ * dissection info. By default (PFWL_FLOW_INFO_MODE_COPY) it is copied
+ * into 'flow_info' for each packet, statistics included. With
+ * PFWL_FLOW_INFO_MODE_REFERENCE the copy is not done and the information
+ * can only be read through 'flow_info_ref', which is cheaper when only a
+ * few values (e.g. the flow id) are needed.
+ * @param state A pointer to the state of the library.
+ * @param mode The flow info mode.
+ * @return 0 if succeeded, 1 otherwise (e.g. unknown mode).
+ */
+uint8_t pfwl_set_flow_info_mode(pfwl_state_t *state,
+                                pfwl_flow_info_mode_t mode);
+
+/**
+ * @brief Sets the order in which the dissectors are tried when the
+ * protocol of a flow is not yet known. When some payload matches more
+ * than one protocol, the order also decides which one is reported.
+ * The learned counters (the profile) are kept when switching between
+ * orderings. With PFWL_GUESS_ORDERING_ADAPTIVE the counters are updated
+ * while dissecting, without synchronization: the state must then not be
+ * used to dissect packets from several threads at once.
+ * @param state A pointer to the state of the library.
+ * @param ordering The ordering.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_set_guess_ordering(pfwl_state_t *state,
+                                pfwl_guess_ordering_t ordering);
+
+/**
+ * @brief Writes the profile learned with PFWL_GUESS_ORDERING_ADAPTIVE
+ * to a file, in textual form.
+ * @param state A pointer to the state of the library.
+ * @param filename The name of the file.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_guess_profile_export(pfwl_state_t *state, const char *filename);
+
+/**
+ * @brief Replaces the profile used by PFWL_GUESS_ORDERING_ADAPTIVE and
+ * PFWL_GUESS_ORDERING_STATIC with the one stored in a file by
+ * pfwl_guess_profile_export. Protocols not known to this version of the
+ * library are skipped.
+ * @param state A pointer to the state of the library.
+ * @param filename The name of the file.
+ * @return 0 if succeeded, 1 otherwise (e.g. non existing file, or
+ * profile written with a different number of port buckets).
+ */
+uint8_t pfwl_guess_profile_import(pfwl_state_t *state, const char *filename);
+
 /**
  * Sets the maximum number of packets to use to identify the protocol.
  * During the flow protocol identification, after this number
@@ -824,6 +1074,87 @@ uint8_t pfwl_tcp_reordering_enable(pfwl_state_t *state);
  */
 uint8_t pfwl_tcp_reordering_disable(pfwl_state_t *state);
 
+/**
+ * If enabled, TCP connections whose handshake has not been seen are
+ * picked up speculatively: the first segment of each direction is
+ * considered in order and immediately inspected, instead of waiting
+ * for the sequence and acknowledgment numbers of the two directions
+ * to match. If a later segment shows that the guess was wrong (e.g.
+ * data sent before the first segment arrives late, or the peer
+ * acknowledges data never seen) the state is repaired. Disabled by
+ * default.
+ * @param state A pointer to the state of the library.
+ *
+ * @return 0 if succeeded,
+ *         1 otherwise.
+ */
+uint8_t pfwl_tcp_reordering_enable_pickup(pfwl_state_t *state);
+
+/**
+ * Disables the speculative pick up of TCP connections whose handshake
+ * has not been seen. The data of these connections will be inspected only
+ * after the sequence and acknowledgment numbers of the two directions
+ * match.
+ * @param state A pointer to the state of the library.
+ *
+ * @return 0 if succeeded,
+ *         1 otherwise.
+ */
+uint8_t pfwl_tcp_reordering_disable_pickup(pfwl_state_t *state);
+
+/**
+ * Sets the maximum amount of memory that can be used to store the
+ * out of order segments of a single flow. When it is reached, the out of
+ * order data of the other direction of the flow is dropped. If this is
+ * not enough, the segment is not stored.
+ * @param state A pointer to the state of the library.
+ * @param per_flow_memory_limit The maximum amount of memory, in bytes.
+ *
+ * @return 0 if succeeded,
+ *         1 otherwise.
+ */
+uint8_t pfwl_tcp_reordering_set_per_flow_memory_limit(
+    pfwl_state_t *state, uint32_t per_flow_memory_limit);
+
+/**
+ * Sets the maximum amount of memory that can be used to store out of
+ * order segments by each partition of the flow table (i.e. by each
+ * thread when using the multicore version). When it is reached, the out
+ * of order data of the least recently updated connections is dropped.
+ * Those connections will resynchronize on their next segment, losing
+ * the dropped data.
+ * @param state A pointer to the state of the library.
+ * @param per_partition_memory_limit The maximum amount of memory, in bytes.
+ *
+ * @return 0 if succeeded,
+ *         1 otherwise.
+ */
+uint8_t pfwl_tcp_reordering_set_per_partition_memory_limit(
+    pfwl_state_t *state, uint32_t per_partition_memory_limit);
+
+/**
+ * Sets the maximum amount of memory that can be used to store out of
+ * order segments (globally). When it is reached, the out of order data
+ * of the least recently updated connections is dropped, as for the
+ * per-partition limit.
+ * @param state A pointer to the state of the library.
+ * @param total_memory_limit The maximum amount of memory, in bytes.
+ *
+ * @return 0 if succeeded,
+ *         1 otherwise.
+ */
+uint8_t pfwl_tcp_reordering_set_total_memory_limit(pfwl_state_t *state,
+                                                   uint32_t total_memory_limit);
+
+/**
+ * @brief Returns the statistics about out of order TCP segments.
+ * @param state A pointer to the state of the library.
+ * @param stats The statistics will be stored here.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_tcp_reordering_get_stats(pfwl_state_t *state,
+                                      pfwl_tcp_reordering_stats_t *stats);
+
 /**
  * Enables an L7 protocol dissector.
  * @param state         A pointer to the state of the library.
@@ -886,7 +1217,9 @@ uint8_t pfwl_set_timestamp_unit(pfwl_state_t *state, pfwl_timestamp_unit_t unit)
  * types. You can convert a PCAP datalink type to a Peafowl datalink type by
  * calling the function 'pfwl_convert_pcap_dlt'.
  * @param dissection_info The result of the dissection. All its bytes must be
- *        set to 0 before calling this call.
+ *        set to 0 before its first use. It can then be reused for the
+ *        following packets without clearing it, since only the fields
+ *        which may have been set by the previous dissection are reset.
  *        Dissection information from L2 to L7 will be filled in by this call.
  * @return The status of the identification process.
  */
@@ -896,6 +1229,44 @@ pfwl_status_t pfwl_dissect_from_L2(pfwl_state_t *state,
                                    pfwl_protocol_l2_t datalink_type,
                                    pfwl_dissection_info_t *dissection_info);
 
+/**
+ * Dissects a burst of packets starting from the beginning of the L2
+ * (datalink) header. The result is the same as calling pfwl_dissect_from_L2
+ * on each packet, in order. However, the headers of a group of packets are
+ * parsed and the flow table locations they need are prefetched before
+ * looking up their flows, so that memory accesses of different packets
+ * overlap.
+ * ATTENTION: The L7 fields of a packet may point to data owned by its flow
+ * (e.g. TCP reassembled data), which is released when a following packet of
+ * the same flow is dissected. If such fields are needed, they should be read
+ * with single packet dissection. For the same reason, once this call returns
+ * 'flow_info_ref' is only valid for the last packet of the batch, since the
+ * flows of the previous ones may have been deleted meanwhile. With
+ * PFWL_FLOW_INFO_MODE_REFERENCE the flow information of the other packets
+ * is therefore not available.
+ * @param state The state of the library.
+ * @param pkts The pointers to the beginning of the datalink header of
+ * each packet.
+ * @param lengths The length of each packet.
+ * @param timestamps The timestamp of each packet. The time unit depends on
+ * the timers used by the caller and can be set through the
+ * pfwl_set_timestamp_unit call. By default it is assumed that the timestamps
+ * unit is 'seconds'.
+ * @param num_pkts The number of packets.
+ * @param datalink_type The datalink type. They match 1:1 the pcap datalink
+ * types. You can convert a PCAP datalink type to a Peafowl datalink type by
+ * calling the function 'pfwl_convert_pcap_dlt'.
+ * @param dissection_infos The result of the dissection of each packet. As
+ * for pfwl_dissect_from_L2, all their bytes must be set to 0 before their
+ * first use, and they can then be reused for the following batches.
+ * @param statuses The status of the identification process of each packet.
+ */
+void pfwl_dissect_batch(pfwl_state_t *state, const unsigned char *const *pkts,
+                        const size_t *lengths, const uint32_t *timestamps,
+                        size_t num_pkts, pfwl_protocol_l2_t datalink_type,
+                        pfwl_dissection_info_t *dissection_infos,
+                        pfwl_status_t *statuses);
+
 /**
  * Dissects the packet starting from the beginning of the L3 (IP) header.
  * @param   state The state of the library.
@@ -905,7 +1276,8 @@ pfwl_status_t pfwl_dissect_from_L2(pfwl_state_t *state,
  * caller and can be set through the pfwl_set_timestamp_unit call. By default
  * it is assumed that the timestamps unit is 'seconds'.
  * @param   dissection_info The result of the dissection. All its bytes must be
- *          set to 0 before calling this call.
+ *          set to 0 before its first use. As for pfwl_dissect_from_L2, it
+ *          can then be reused without clearing it.
  *          Dissection information from L3 to L7 will be filled in by this call.
  * @return  The status of the identification process.
  */
@@ -951,6 +1323,31 @@ pfwl_status_t pfwl_dissect_L2(const unsigned char *packet,
                               pfwl_protocol_l2_t datalink_type,
                               pfwl_dissection_info_t *dissection_info);
 
+/**
+ * Returns the shard which must dissect a packet, when the packets are
+ * spread among independent states (e.g. one for each core). The hash is
+ * computed on the innermost IP header (tunnels are followed) and is the
+ * same for both the directions of a flow. TCP segments are assigned by
+ * their addresses and ports. Since only the first fragment carries the
+ * ports, all the other packets (UDP included) and the IP fragments are
+ * assigned by their addresses only, so that a rebuilt datagram is
+ * dissected by the same shard as the rest of its flow.
+ * ATTENTION: TCP segments fragmented at the IP layer may therefore be
+ * dissected by a different shard than the other segments of their
+ * connection. TCP normally avoids IP fragmentation by sizing its segments
+ * on the path MTU.
+ * No state is read or modified, so it can be called concurrently
+ * by any number of threads.
+ * @param pkt A pointer to the packet, starting from the L2 header.
+ * @param length The length of the packet.
+ * @param datalink_type The datalink type (see pfwl_dissect_L2).
+ * @param shards The number of shards.
+ * @return The shard, in the range [0, shards). Packets which are not
+ * IP packets are assigned to shard 0.
+ */
+uint16_t pfwl_shard_of(const unsigned char *pkt, size_t length,
+                       pfwl_protocol_l2_t datalink_type, uint16_t shards);
+
 /**
  * Extracts from the packet the L3 information.
  * @param   state The state of the library.
@@ -960,7 +1357,8 @@ pfwl_status_t pfwl_dissect_L2(const unsigned char *packet,
  * caller and can be set through the pfwl_set_timestamp_unit call. By default
  * it is assumed that the timestamps unit is 'seconds'.
  * @param   dissection_info The result of the dissection. All its bytes must be
- *          set to 0 before calling this call.
+ *          set to 0 before its first use. As for pfwl_dissect_from_L2, it
+ *          can then be reused without clearing it.
  *          Dissection information about L3 headers will be filled in by this
  * call.
  * @return The status of the identification process.
@@ -1361,6 +1759,10 @@ typedef enum{
   PFWL_FIELD_MATCHING_PREFIX = 0, ///< Prefix matching.
   PFWL_FIELD_MATCHING_EXACT,      ///< Exact matching.
   PFWL_FIELD_MATCHING_SUFFIX,     ///< Suffix matching.
+  PFWL_FIELD_MATCHING_DOMAIN,     ///< Domain matching. Matches the domain and its subdomains,
+                                  ///< i.e. 'example.com' matches 'example.com' and 'www.example.com'
+                                  ///< but not 'badexample.com'. The port and the trailing dot
+                                  ///< of the value (e.g. 'www.example.com:8080') are ignored.
   PFWL_FIELD_MATCHING_ERROR       ///< Invalid tag matching.
 }pfwl_field_matching_t;
 
@@ -1386,7 +1788,7 @@ typedef enum{
  * value:         Is the string to be matched against the field. The comparison will
  *                always be case insensitive. I.e. if searching for 'BarFoo', 'barfoo' and 'BaRfOo'
  *                will match as well.
- * matchingType:  Can be 'PREFIX', 'EXACT' or 'SUFFIX'.
+ * matchingType:  Can be 'PREFIX', 'EXACT', 'SUFFIX' or 'DOMAIN'.
  * tag:           The tag to assign to the packet when the field matches with stringToMatch.
  *
  * ------------------------
@@ -1405,6 +1807,14 @@ typedef enum{
  * 'value', 'matchingType' and 'tag' are the same as in the string case.
  *
  * The 'tags_file' argument can be NULL and the matching rules can be added later with the pfwl_*_tags_add calls.
+ * The rules are compiled into a matcher which scans each field once, without
+ * copying it. Rules added with the pfwl_*_tags_add calls are compiled and
+ * published when the next packet is dissected.
+ * The rules can be replaced while packets are being dissected. To avoid compiling
+ * them while holding the state, use pfwl_field_tags_compile_L7 and
+ * pfwl_field_tags_publish_L7. However, the first rules of a field enable its
+ * extraction (as pfwl_field_add_L7), which can't be done while other threads
+ * are dissecting packets with the state.
  *
  * @return 0 if the loading was successful, 1 otherwise (e.g. error while parsing the json file, non existing file, etc...)
  */
@@ -1418,8 +1828,9 @@ int pfwl_field_tags_load_L7(pfwl_state_t* state, pfwl_field_id_t field, const ch
  * @param value Is the string to be matched against the field. The comparison will
  *                always be case insensitive. I.e. if searching for 'BarFoo', 'barfoo' and 'BaRfOo'
  *                will match as well.
- * @param matchingType Can be 'PREFIX', 'EXACT' or 'SUFFIX'.
+ * @param matchingType Can be 'PREFIX', 'EXACT', 'SUFFIX' or 'DOMAIN'.
  * @param tag The tag to assign to the packet when the field matches with 'value'.
+ * Like pfwl_field_tags_load_L7, it enables the extraction of the field if needed.
  */
 void pfwl_field_string_tags_add_L7(pfwl_state_t* state, pfwl_field_id_t field, const char* value, pfwl_field_matching_t matchingType, const char* tag);
 
@@ -1434,8 +1845,9 @@ void pfwl_field_string_tags_add_L7(pfwl_state_t* state, pfwl_field_id_t field, c
  * @param value The value of the multimap value. The comparison will
  *                always be case insensitive. I.e. if searching for 'BarFoo', 'barfoo' and 'BaRfOo'
  *                will match as well.
- * @param matchingType Can be 'PREFIX', 'EXACT' or 'SUFFIX'.
+ * @param matchingType Can be 'PREFIX', 'EXACT', 'SUFFIX' or 'DOMAIN'.
  * @param tag The tag to assign to the packet when the field matches with 'value'.
+ * Like pfwl_field_tags_load_L7, it enables the extraction of the field if needed.
  */
 void pfwl_field_mmap_tags_add_L7(pfwl_state_t* state, pfwl_field_id_t field, const char* key, const char* value, pfwl_field_matching_t matchingType, const char* tag);
 
@@ -1447,6 +1859,89 @@ void pfwl_field_mmap_tags_add_L7(pfwl_state_t* state, pfwl_field_id_t field, con
  */
 void pfwl_field_tags_unload_L7(pfwl_state_t* state, pfwl_field_id_t field);
 
+/**
+ * Rules associating the values of a field to user-defined tags, compiled
+ * and ready to be published into one or more states.
+ **/
+typedef struct pfwl_field_tags pfwl_field_tags_t;
+
+/**
+ * Compiles the associations between fields values and user-defined tags,
+ * without modifying any state. It can thus be called by any thread, while
+ * packets are being dissected.
+ * @brief pfwl_field_tags_compile_L7 Compiles the associations between fields values and user-defined tags.
+ * @param field   The field identifier.
+ * @param tags_file The name of the JSON file containing associations between fields values and tags
+ * (see pfwl_field_tags_load_L7 for its format). If NULL, no rules are loaded.
+ * @return The compiled rules, which must be released with pfwl_field_tags_release_L7, or NULL if the
+ * file cannot be parsed or if the field is neither a string nor a multi map.
+ */
+pfwl_field_tags_t* pfwl_field_tags_compile_L7(pfwl_field_id_t field, const char* tags_file);
+
+/**
+ * Atomically replaces the rules used by a state for a field. It can be called
+ * while other threads are dissecting packets with the state (e.g. the workers
+ * of the multicore version), which are never blocked: each field is matched
+ * either against the old or against the new rules, and the old rules are freed
+ * once no thread is matching against them. The same rules can be published into
+ * more states. Tags returned in the dissection info stay valid after the rules are
+ * replaced. If the field is not extracted yet, it is enabled as with
+ * pfwl_field_add_L7, which must be done before other threads start dissecting
+ * packets with the state.
+ * Rules added with the pfwl_*_tags_add calls and not used yet are discarded.
+ * @brief pfwl_field_tags_publish_L7 Replaces the rules used by a state for a field.
+ * @param state   A pointer to the state of the library.
+ * @param field   The field identifier.
+ * @param tags    The rules, compiled with pfwl_field_tags_compile_L7 for the same field.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_field_tags_publish_L7(pfwl_state_t* state, pfwl_field_id_t field, pfwl_field_tags_t* tags);
+
+/**
+ * Releases compiled rules. Rules published into some state are freed only once
+ * they are replaced (or unloaded) in all the states, or the states are terminated.
+ * @brief pfwl_field_tags_release_L7 Releases compiled rules.
+ * @param tags The rules.
+ */
+void pfwl_field_tags_release_L7(pfwl_field_tags_t* tags);
+
+/**
+ * Saves compiled rules into a file, which can later be mapped by any
+ * process on the same architecture with pfwl_field_tags_map_L7. The
+ * 'tags_compiler' tool builds such a file from a JSON rules file.
+ * @brief pfwl_field_tags_save_L7 Saves compiled rules into a file.
+ * @param tags    The rules.
+ * @param db_file The name of the file to write.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_field_tags_save_L7(pfwl_field_tags_t* tags, const char* db_file);
+
+/**
+ * Maps read-only rules saved with pfwl_field_tags_save_L7. The matcher runs
+ * directly on the mapped file, so that nothing needs to be parsed or compiled,
+ * and processes mapping the same file share the same physical memory.
+ * The file is validated before being used, and must not be modified while
+ * mapped (replace it with a rename instead).
+ * Rules added later with the pfwl_*_tags_add calls are applied to a copy.
+ * @brief pfwl_field_tags_map_L7 Maps compiled rules from a file.
+ * @param field   The field identifier.
+ * @param db_file The name of the file.
+ * @return The rules, which must be released with pfwl_field_tags_release_L7, or NULL if the
+ * file cannot be mapped, is not valid, or was saved for a field of a different type.
+ */
+pfwl_field_tags_t* pfwl_field_tags_map_L7(pfwl_field_id_t field, const char* db_file);
+
+/**
+ * Same as pfwl_field_tags_load_L7, but maps rules saved with pfwl_field_tags_save_L7
+ * instead of parsing a JSON file.
+ * @brief pfwl_field_tags_load_L7_mmap Maps compiled rules and uses them for a field.
+ * @param state   A pointer to the state of the library.
+ * @param field   The field identifier.
+ * @param db_file The name of the file.
+ * @return 0 if the loading was successful, 1 otherwise.
+ */
+int pfwl_field_tags_load_L7_mmap(pfwl_state_t* state, pfwl_field_id_t field, const char* db_file);
+
 /// @cond MC
 pfwl_state_t *pfwl_init_stateful_num_partitions(uint32_t expected_flows,
                                                 uint8_t strict,
@@ -1458,11 +1953,22 @@ pfwl_status_t mc_pfwl_parse_L3_header(pfwl_state_t *state,
                                       int tid,
                                       pfwl_dissection_info_t *dissection_info);
 
+pfwl_status_t mc_pfwl_parse_L4_ports(const unsigned char *p_pkt,
+                                     size_t p_length,
+                                     pfwl_dissection_info_t *dissection_info);
+
 pfwl_status_t
 mc_pfwl_parse_L4_header(pfwl_state_t *state, const unsigned char *p_pkt,
-                        size_t p_length, uint32_t timestamp, int tid,
+                        size_t p_length, uint32_t timestamp,
+                        uint16_t partition_id, uint32_t index,
                         pfwl_dissection_info_t *dissection_info,
                         pfwl_flow_info_private_t **flow_info_private);
+
+pfwl_status_t mc_pfwl_dissect_from_L4(pfwl_state_t *state,
+                                      const unsigned char *pkt, size_t length,
+                                      uint32_t timestamp,
+                                      uint16_t partition_id, uint32_t index,
+                                      pfwl_dissection_info_t *dissection_info);
 /// @endcond
 
 /// @cond Private structures
@@ -1494,6 +2000,23 @@ typedef struct pfwl_state {
 
   pfwl_timestamp_unit_t ts_unit;
 
+  /** Flow table creation parameters. **/
+  uint32_t expected_flows;
+  uint8_t expected_flows_strict;
+  uint16_t flow_table_partitions;
+  pfwl_flow_table_engine_t flow_table_engine;
+  pfwl_flow_table_hash_t flow_table_hash;
+  pfwl_memory_allocator_t memory_allocator;
+  uint32_t flow_timeouts[PFWL_FLOW_TIMEOUT_NUM];
+  uint32_t tcp_reordering_per_flow_memory_limit;
+  uint32_t tcp_reordering_per_partition_memory_limit;
+  uint32_t tcp_reordering_total_memory_limit;
+  pfwl_flow_info_mode_t flow_info_mode;
+  pfwl_guess_ordering_t guess_ordering;
+  struct pfwl_guess_profile *guess_profile;
+  /** Signatures of the enabled protocols, to skip their dissectors. **/
+  struct pfwl_prefilter *prefilter;
+
   /** Field extraction. **/
   /**
    * One flag per field.
@@ -1526,6 +2049,24 @@ typedef struct pfwl_state {
    **/
   uint8_t fields_support_num[PFWL_PROTO_L7_NUM];
 
+  /**
+   * Fields which may be set by the inspectors, i.e. all the fields of the
+   * protocols for which at least one field has ever been added (either to
+   * fields_to_extract or to fields_support). Only these fields need to be
+   * reset before dissecting a packet. Never shrinks, since a reused
+   * dissection info may still hold a field which has since been removed.
+   **/
+  pfwl_field_id_t fields_to_reset[PFWL_FIELDS_L7_NUM];
+  size_t fields_to_reset_num;
+  uint8_t fields_to_reset_protocols[PFWL_PROTO_L7_NUM];
+  /**
+   * Unique (non-zero) identifier of this state, stored in the dissection
+   * infos it fills. States may be reallocated at the same address, so the
+   * state pointer cannot be used for this purpose. It is scrambled, since
+   * a dissection info which was not zeroed could otherwise hold it.
+   **/
+  uint64_t reset_id;
+
   /**
    * Dependencies among L7 protocols.
    * E.g. protocol_dependencies[PFWL_PROTO_L7_JSON_RPC] contains
@@ -1535,15 +2076,20 @@ typedef struct pfwl_state {
   pfwl_protocol_l7_t protocol_dependencies[PFWL_PROTO_L7_NUM][PFWL_PROTO_L7_NUM + 1];
 
   uint8_t tcp_reordering_enabled : 1;
+  uint8_t tcp_reordering_pickup : 1;
 
   /** L7 skipping information. **/
   pfwl_l7_skipping_info_t *l7_skip;
 
   pfwl_dissector_accuracy_t inspectors_accuracy[PFWL_PROTO_L7_NUM];
 
-  /** Tags **/
+  /**
+   * Tags. The databases are atomically replaced while other threads may
+   * be using them, see pfwl_field_tags_publish_L7.
+   **/
   void* tags_matchers[PFWL_FIELDS_L7_NUM];
   size_t tags_matchers_num;
+  void* tags_updates;
 
   /********************************************************************/
   /** The content of these structures can be modified during the     **/
@@ -201,6 +201,8 @@ public:
   pfwl_dissection_info_l3_t getNative() const;
 };
 
+typedef pfwl_span_t Span;
+
 class DissectionInfoL4{
 private:
   pfwl_dissection_info_l4_t _dissectionInfo;
@@ -214,6 +216,7 @@ public:
   Direction getDirection() const;
   const unsigned char* getResegmentedPacket() const;
   size_t getResegmentedPacketLength() const;
+  std::vector<Span> getPayloadSpans() const;
   ProtocolL4 getProtocol() const;
   pfwl_dissection_info_l4_t getNative() const;
 };
@@ -353,6 +356,15 @@ public:
 
 typedef pfwl_dissector_accuracy_t DissectorAccuracy;
 typedef pfwl_field_matching_t FieldMatching;
+typedef pfwl_field_tags_t FieldTags;
+typedef pfwl_flow_table_engine_t FlowTableEngine;
+typedef pfwl_flow_table_hash_t FlowTableHash;
+typedef pfwl_memory_allocator_t MemoryAllocator;
+typedef pfwl_memory_stats_t MemoryStats;
+typedef pfwl_tcp_reordering_stats_t TcpReorderingStats;
+typedef pfwl_flow_timeout_t FlowTimeout;
+typedef pfwl_flow_info_mode_t FlowInfoMode;
+typedef pfwl_guess_ordering_t GuessOrdering;
 
 /**
  * @brief The FlowManager class is a functor class, which
@@ -476,6 +488,7 @@ class Peafowl{
   friend class FlowInfoPrivate;
 private:
   pfwl_state_t* _state;
+  pfwl_dissection_info_t _dissectionInfo; ///< Reused across packets, so that the library only resets what it set.
 public:
   /**
    * @brief Initializes Peafowl.
@@ -506,6 +519,74 @@ public:
    */
   void setExpectedFlows(uint32_t flows, uint8_t strict);
 
+  /**
+   * @brief Sets the data structure used to store the flows.
+   * Since the table is recreated, this should be called before
+   * starting the dissection.
+   * @param engine The flow table engine.
+   */
+  void setFlowTableEngine(FlowTableEngine engine);
+
+  /**
+   * @brief Sets the hash function used to index the flow table.
+   * Must be called before any flow is stored.
+   * @param hash The hash function.
+   */
+  void setFlowTableHash(FlowTableHash hash);
+
+  /**
+   * @brief Sets the allocator used for flows, TCP segments, IP fragments
+   * and inspectors buffers. This should be called before starting the
+   * dissection.
+   * @param allocator The allocator.
+   */
+  void setMemoryAllocator(MemoryAllocator allocator);
+
+  /**
+   * @brief Returns the memory used by flows, TCP segments, IP fragments
+   * and inspectors buffers.
+   * @return The memory usage.
+   */
+  MemoryStats getMemoryStats();
+
+  /**
+   * @brief Sets after how much time without packets a flow is removed
+   * from the flow table. The new timeout also applies to the flows which
+   * are already stored.
+   * @param type The class of flows the timeout refers to.
+   * @param seconds The timeout, in seconds.
+   */
+  void setFlowTimeout(FlowTimeout type, uint32_t seconds);
+
+  /**
+   * @brief Sets how the information about the flow is provided by the
+   * library. DissectionInfo always holds a copy of the flow information,
+   * taken from the flow table when PFWL_FLOW_INFO_MODE_REFERENCE is used.
+   * @param mode The flow info mode.
+   */
+  void setFlowInfoMode(FlowInfoMode mode);
+
+  /**
+   * @brief Sets the order in which the dissectors are tried when the
+   * protocol of a flow is not yet known.
+   * @param ordering The ordering.
+   */
+  void setGuessOrdering(GuessOrdering ordering);
+
+  /**
+   * @brief Writes the profile learned with PFWL_GUESS_ORDERING_ADAPTIVE
+   * to a file.
+   * @param filename The name of the file.
+   */
+  void guessProfileExport(const std::string& filename);
+
+  /**
+   * @brief Replaces the guess profile with the one stored in a file by
+   * guessProfileExport.
+   * @param filename The name of the file.
+   */
+  void guessProfileImport(const std::string& filename);
+
 
   /**
    * Sets the maximum number of packets to use to identify the protocol.
@@ -540,6 +621,46 @@ public:
    */
   void tcpReorderingDisable();
 
+  /**
+   * If enabled, TCP connections whose handshake has not been seen are
+   * picked up speculatively: the first segment of each direction is
+   * considered in order and immediately inspected. Disabled by default.
+   */
+  void tcpReorderingEnablePickup();
+
+  /**
+   * Disables the speculative pick up of TCP connections whose handshake
+   * has not been seen.
+   */
+  void tcpReorderingDisablePickup();
+
+  /**
+   * Sets the maximum amount of memory that can be used to store the
+   * out of order segments of a single flow.
+   * @param limit The maximum amount of memory, in bytes.
+   */
+  void setTcpReorderingPerFlowMemoryLimit(uint32_t limit);
+
+  /**
+   * Sets the maximum amount of memory that can be used to store out of
+   * order segments by each partition of the flow table.
+   * @param limit The maximum amount of memory, in bytes.
+   */
+  void setTcpReorderingPerPartitionMemoryLimit(uint32_t limit);
+
+  /**
+   * Sets the maximum amount of memory that can be used to store out of
+   * order segments (globally).
+   * @param limit The maximum amount of memory, in bytes.
+   */
+  void setTcpReorderingTotalMemoryLimit(uint32_t limit);
+
+  /**
+   * @brief Returns the statistics about out of order TCP segments.
+   * @return The statistics.
+   */
+  TcpReorderingStats getTcpReorderingStats();
+
   /**
    * Enables an L7 protocol dissector.
    * @param protocol      The protocol to enable.
@@ -586,6 +707,26 @@ public:
                                uint32_t timestamp,
                                ProtocolL2 datalinkType);
 
+  /**
+   * Dissects a burst of packets starting from the beginning of the L2
+   * (datalink) header. The result is the same as calling dissectFromL2
+   * on each packet, in order, but flow table accesses of different
+   * packets are overlapped. The flow information of each packet is
+   * always copied, regardless of the flow info mode.
+   * @param pkts The packets.
+   * @param timestamps The timestamp of each packet. The time unit depends
+   * on the timers used by the caller and can be set through the
+   * setTimestampUnit call. By default it is assumed that the timestamps
+   * unit is 'seconds'.
+   * @param datalinkType The datalink type. They match 1:1 the pcap datalink
+   * types. You can convert a PCAP datalink type to a Peafowl datalink type by
+   * calling the function 'pfwl_convert_pcap_dlt'.
+   * @return The result of the dissection of each packet.
+   */
+  std::vector<DissectionInfo> dissectBatch(const std::vector<std::string>& pkts,
+                                           const std::vector<uint32_t>& timestamps,
+                                           ProtocolL2 datalinkType);
+
   /**
    * Dissects the packet starting from the beginning of the L3 (IP) header.
    * @param   pkt A string containing the packet (starting from the IP header).
@@ -744,7 +885,7 @@ public:
    * value:         Is the string to be matched against the field. The comparison will
    *                always be case insensitive. I.e. if searching for 'BarFoo', 'barfoo' and 'BaRfOo'
    *                will match as well.
-   * matchingType:  Can be 'PREFIX', 'EXACT' or 'SUFFIX'.
+   * matchingType:  Can be 'PREFIX', 'EXACT', 'SUFFIX' or 'DOMAIN'.
    * tag:           The tag to assign to the packet when the field matches with stringToMatch.
    *
    * ------------------------
@@ -767,6 +908,15 @@ public:
    */
   void fieldTagsLoadL7(FieldId field, const char* tagsFile);
 
+  /**
+   * Same as fieldTagsLoadL7, but maps rules compiled with the 'tags_compiler'
+   * tool (or saved with pfwl_field_tags_save_L7) instead of parsing a JSON file.
+   * @brief fieldTagsLoadL7Mmap Maps compiled rules and uses them for a field.
+   * @param field   The field identifier.
+   * @param dbFile  The name of the compiled rules file.
+   */
+  void fieldTagsLoadL7Mmap(FieldId field, const char* dbFile);
+
   /**
    * Adds a tag matching rule for a specific string field.
    * @brief pfwl_field_string_tags_add Adds a tag matching rule for a specific field.
@@ -774,7 +924,7 @@ public:
    * @param value Is the string to be matched against the field. The comparison will
    *                always be case insensitive. I.e. if searching for 'BarFoo', 'barfoo' and 'BaRfOo'
    *                will match as well.
-   * @param matchingType Can be 'PREFIX', 'EXACT' or 'SUFFIX'.
+   * @param matchingType Can be 'PREFIX', 'EXACT', 'SUFFIX' or 'DOMAIN'.
    * @param tag The tag to assign to the packet when the field matches with 'value'.
    */
   void fieldStringTagsAddL7(FieldId field, const std::string& value, FieldMatching matchingType, const std::string& tag);
@@ -789,7 +939,7 @@ public:
    * @param value The value of the multimap value. The comparison will
    *                always be case insensitive. I.e. if searching for 'BarFoo', 'barfoo' and 'BaRfOo'
    *                will match as well.
-   * @param matchingType Can be 'PREFIX', 'EXACT' or 'SUFFIX'.
+   * @param matchingType Can be 'PREFIX', 'EXACT', 'SUFFIX' or 'DOMAIN'.
    * @param tag The tag to assign to the packet when the field matches with 'value'.
    */
   void fieldMmapTagsAddL7(FieldId field, const std::string& key, const std::string& value, FieldMatching matchingType, const std::string& tag);
@@ -801,6 +951,16 @@ public:
    */
   void fieldTagsUnloadL7(FieldId field);
 
+  /**
+   * Atomically replaces the rules used for a field. It can be called while
+   * other threads are dissecting packets, once the field is extracted.
+   * @brief fieldTagsPublishL7 Replaces the rules used for a field.
+   * @param field   The field identifier.
+   * @param tags    The rules, compiled with pfwl_field_tags_compile_L7 for
+   * the same field. They can be released after this call.
+   */
+  void fieldTagsPublishL7(FieldId field, FieldTags* tags);
+
 
   /**
    * Enables the computation of a specific flow statistic.
@@ -895,6 +1055,18 @@ Field fieldGet(std::vector<Field> fields, FieldId id);
  */
 ProtocolL2 convertPcapDlt(int dlt);
 
+/**
+ * @brief shardOf Returns the shard which must dissect a packet, when the
+ * packets are spread among independent Peafowl instances (see
+ * pfwl_shard_of).
+ * @param pkt A string containing the packet (from the start of the L2 header).
+ * @param datalinkType The datalink type.
+ * @param shards The number of shards.
+ * @return The shard, in the range [0, shards).
+ */
+uint16_t shardOf(const std::string& pkt, ProtocolL2 datalinkType,
+                 uint16_t shards);
+
 } // namespace peafowl
 
 #endif // PFWL_API_HPP
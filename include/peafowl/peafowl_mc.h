@@ -35,8 +35,22 @@
 
 typedef struct mc_pfwl_state mc_pfwl_state_t;
 
+/**
+ * The result of the dissection of a packet.
+ * user_pointer: The pointer returned with the packet by the reading
+ *               callback.
+ * status: The status of the dissection, as returned by
+ *         pfwl_dissect_from_L3.
+ * result: The dissection info. Since the packets of a flow may be
+ *         dissected while the processing callback runs, flow_info_ref,
+ *         the TCP payload spans, the rebuilt IP datagram and the fields
+ *         pointing to data stored in the flow may be already invalid.
+ *         PFWL_FLOW_INFO_MODE_COPY provides a copy of the flow info
+ *         taken when the packet was dissected.
+ */
 typedef struct mc_pfwl_processing_result {
   void *user_pointer;
+  pfwl_status_t status;
   pfwl_dissection_info_t result;
 } mc_pfwl_processing_result_t;
 
@@ -47,6 +61,12 @@ typedef struct mc_pfwl_packet_reading_result {
   void *user_pointer;
 } mc_pfwl_packet_reading_result_t;
 
+/**
+ * Returned as pkt by the reading callback when no packet is available yet.
+ * Unlike NULL, the stream does not end and the callback is called again.
+ **/
+#define MC_PFWL_NO_PACKET ((const unsigned char *) 1)
+
 typedef enum analysis_results {
   MC_PFWL_PARALLELISM_FORM_ONE_FARM = 0,
   MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM,
@@ -87,6 +107,111 @@ typedef struct mc_pfwl_parallelism_details {
   uint16_t double_farm_num_L7_workers;
 } mc_pfwl_parallelism_details_t;
 
+/**
+ * Load of an L7 worker.
+ * packets: Packets processed by the worker.
+ * backlog: Tasks waiting in the queue of the worker.
+ * partitions: Flow table partitions currently owned by the worker.
+ * migrations: Partitions moved to the worker from more loaded ones.
+ * node: NUMA node of the worker (and of its partitions), -1 if unknown.
+ */
+typedef struct mc_pfwl_worker_load {
+  uint64_t packets;
+  uint32_t backlog;
+  uint16_t partitions;
+  uint32_t migrations;
+  int16_t node;
+  uint8_t active; ///< 0 if put to sleep by the scaling controller.
+} mc_pfwl_worker_load_t;
+
+/**
+ * Points of the pipeline where packets are batched into tasks.
+ */
+typedef enum {
+  MC_PFWL_BATCHING_STAGE_L3_L4 = 0, ///< Read packets, sent to the L3 and L4
+                                    ///< parsing
+  MC_PFWL_BATCHING_STAGE_L7,        ///< Parsed packets, sent to the L7
+                                    ///< workers
+  MC_PFWL_BATCHING_STAGES_NUM
+} mc_pfwl_batching_stage_t;
+
+#define MC_PFWL_BATCHING_HISTOGRAM_BUCKETS 16
+
+/**
+ * Batches sent by a stage.
+ * batches: Number of sent batches.
+ * timeouts: Batches sent before being full, since their first packet
+ *           waited for the maximum latency.
+ * sizes: sizes[i] is the number of batches with [2^i, 2^(i+1)) packets.
+ * latencies: latencies[i] is the number of batches whose first packet
+ *            waited [2^i, 2^(i+1)) microseconds to be sent ([0, 2) for
+ *            i = 0). The last bucket also counts the longer waits.
+ */
+typedef struct mc_pfwl_batching_stats {
+  uint64_t batches;
+  uint64_t timeouts;
+  uint64_t sizes[MC_PFWL_BATCHING_HISTOGRAM_BUCKETS];
+  uint64_t latencies[MC_PFWL_BATCHING_HISTOGRAM_BUCKETS];
+} mc_pfwl_batching_stats_t;
+
+/**
+ * Decisions of the scaling controller.
+ */
+typedef enum {
+  MC_PFWL_SCALING_NONE = 0, ///< The active workers did not change
+  MC_PFWL_SCALING_UP,       ///< A worker has been activated
+  MC_PFWL_SCALING_DOWN,     ///< A worker is being deactivated. Its
+                            ///< partitions are moved to the other workers,
+                            ///< and then it is put to sleep.
+} mc_pfwl_scaling_decision_t;
+
+/**
+ * State of the L7 workers observed by the scaling controller over a
+ * period, and the decision taken.
+ * utilization: Average fraction of the period spent by the active workers
+ *              dissecting packets.
+ * backlog: Average number of tasks waiting in the queues of the active
+ *          workers.
+ * active_workers: Active workers, after the decision.
+ */
+typedef struct mc_pfwl_scaling_stats {
+  mc_pfwl_scaling_decision_t decision;
+  double utilization;
+  double backlog;
+  uint16_t active_workers;
+} mc_pfwl_scaling_stats_t;
+
+/**
+ * Called by the library after each decision of the scaling controller.
+ * It runs in the thread distributing the packets to the L7 workers, so it
+ * should return quickly.
+ * @param stats The state of the workers and the decision.
+ * @param callback_data The data specified in mc_pfwl_scaling_parameters_t.
+ */
+typedef void(mc_pfwl_scaling_callback)(mc_pfwl_scaling_stats_t *stats,
+                                       void *callback_data);
+
+/**
+ * Parameters of the scaling controller. Must be zeroed and then filled by
+ * the user. Fields left to 0 take their default value.
+ */
+typedef struct mc_pfwl_scaling_parameters {
+  uint16_t min_workers; ///< Workers which are never deactivated [1]
+  uint32_t period_ms;   ///< Time between two decisions
+                        ///< [PFWL_MULTICORE_SCALING_DEFAULT_PERIOD_MS]
+  double low_utilization;  ///< A worker is deactivated when the
+                           ///< utilization is lower than this
+                           ///< [PFWL_MULTICORE_SCALING_DEFAULT_LOW_UTILIZATION]
+  double high_utilization; ///< A worker is activated when the utilization
+                           ///< is higher than this
+                           ///< [PFWL_MULTICORE_SCALING_DEFAULT_HIGH_UTILIZATION]
+  double high_backlog;     ///< A worker is activated when the backlog is
+                           ///< higher than this
+                           ///< [PFWL_MULTICORE_SCALING_DEFAULT_HIGH_BACKLOG]
+  mc_pfwl_scaling_callback *callback; ///< Called after each decision
+  void *callback_data;                ///< Passed to the callback
+} mc_pfwl_scaling_parameters_t;
+
 /**
  * This function will be called by the library (active mode only) to read
  * a packet from the network.
@@ -97,7 +222,9 @@ typedef struct mc_pfwl_parallelism_details {
  *                        will terminate. The user must never try to
  *                        modify the state after that he returned
  *                        pkt=NULL, otherwise the behaviour is not
- *                        defined.
+ *                        defined. If the pkt field is
+ *                        MC_PFWL_NO_PACKET, no packet is available
+ *                        yet and the callback will be called again.
  */
 typedef mc_pfwl_packet_reading_result_t(mc_pfwl_packet_reading_callback)(
     void *callback_data);
@@ -148,10 +275,64 @@ void mc_pfwl_set_core_callbacks(
  * @param state A pointer to the state of the library.
  * @param p The reconfiguration parameters.
  */
-void mc_pfwl_set_reconf_parameters(mc_pfwl_library_state_t *state,
+void mc_pfwl_set_reconf_parameters(mc_pfwl_state_t *state,
                                    nornir::Parameters *p);
 #endif
 
+/**
+ * Enables the scaling controller, which changes the number of active L7
+ * workers according to their load. A worker is activated when the workers
+ * are busy or their queues grow, and gets flow table partitions from the
+ * other workers. A worker is deactivated when the workers are mostly idle:
+ * its partitions are moved to the other workers (each one once its
+ * packets have been processed), and then the worker sleeps until it is
+ * activated again, leaving its processor to other applications. Requires
+ * PFWL_MULTICORE_REBALANCE_INTERVAL to be different from 0. It can be
+ * called only before mc_pfwl_run.
+ * @param state A pointer to the state of the library.
+ * @param parameters The parameters of the controller.
+ * @return 1 if succeeded, 0 otherwise.
+ */
+uint8_t mc_pfwl_set_scaling(mc_pfwl_state_t *state,
+                            mc_pfwl_scaling_parameters_t parameters);
+
+/**
+ * Sets how unbalanced the L7 workers must be for a flow table partition to
+ * be moved: every PFWL_MULTICORE_REBALANCE_INTERVAL tasks, a partition is
+ * moved from the worker with the most tasks waiting in its queue to the
+ * one with the fewest, if they differ by at least 'threshold' tasks (by
+ * default PFWL_MULTICORE_REBALANCE_THRESHOLD). With 0, a partition is
+ * moved at every check. Requires PFWL_MULTICORE_REBALANCE_INTERVAL to be
+ * different from 0. It can be called only before mc_pfwl_run.
+ * @param state A pointer to the state of the library.
+ * @param threshold The minimum difference between the backlogs.
+ * @return 1 if succeeded, 0 otherwise.
+ */
+uint8_t mc_pfwl_set_rebalance_threshold(mc_pfwl_state_t *state,
+                                        uint32_t threshold);
+
+/**
+ * Sets how packets are batched into tasks. Each stage keeps a batch for
+ * each destination, with its own grain (starting from 1): the grain is
+ * doubled (up to 'max_grain') when a batch is filled, and halved when a
+ * batch is sent partially filled since its first packet waited for
+ * 'max_latency_us'. The latency is checked when the stage reads or
+ * receives a packet, so the reading callback should not block for longer
+ * than it: when no packet is available it should return
+ * MC_PFWL_NO_PACKET, and the expired batches are then sent (an empty
+ * task is sent down the pipeline every half of the latency, so that the
+ * later stages do the same). At the end of the stream the partially filled batches are
+ * sent. It can be called only before mc_pfwl_run.
+ * @param state A pointer to the state of the library.
+ * @param max_grain The maximum number of packets in a batch, at most
+ * PFWL_MULTICORE_MAX_GRAIN_SIZE. With 1, packets are not batched.
+ * @param max_latency_us The maximum time (microseconds) waited by a packet
+ * in a partially filled batch. Must be greater than 0.
+ * @return 1 if succeeded, 0 otherwise.
+ */
+uint8_t mc_pfwl_set_batching(mc_pfwl_state_t *state, uint32_t max_grain,
+                             uint32_t max_latency_us);
+
 /**
  * Starts the library.
  * @param state A pointer to the state of the library.
@@ -170,6 +351,47 @@ void mc_pfwl_wait_end(mc_pfwl_state_t *state);
  */
 void mc_pfwl_print_stats(mc_pfwl_state_t *state);
 
+/**
+ * Returns the load of the L7 workers. It can be called while the
+ * framework is running.
+ * @param state A pointer to the state of the library.
+ * @param loads An array where the loads will be stored.
+ * @param loads_size The size of 'loads'.
+ * @return The number of loads stored in 'loads'.
+ */
+uint16_t mc_pfwl_get_workers_load(mc_pfwl_state_t *state,
+                                  mc_pfwl_worker_load_t *loads,
+                                  uint16_t loads_size);
+
+/**
+ * Returns the batches sent by a stage. It can be called while the
+ * framework is running.
+ * @param state A pointer to the state of the library.
+ * @param stage The stage.
+ * @param stats Where the statistics will be stored.
+ * @return 1 if succeeded, 0 if the stage is not valid.
+ */
+uint8_t mc_pfwl_get_batching_stats(mc_pfwl_state_t *state,
+                                   mc_pfwl_batching_stage_t stage,
+                                   mc_pfwl_batching_stats_t *stats);
+
+/**
+ * Returns the memory used by the flow table partitions placed on each NUMA
+ * node. Each partition is placed on the node of the L7 worker owning it,
+ * and is moved with the partition when the worker changes. Memory whose
+ * node is unknown is reported on node 0. It can't be called while the
+ * framework is running.
+ * @param state A pointer to the state of the library.
+ * @param stats An array where the memory used on node 'i' will be stored
+ * in stats[i].
+ * @param stats_size The size of 'stats'.
+ * @return The number of nodes stored in 'stats', 0 if the framework is
+ * running.
+ */
+uint16_t mc_pfwl_get_nodes_memory_stats(mc_pfwl_state_t *state,
+                                        pfwl_memory_stats_t *stats,
+                                        uint16_t stats_size);
+
 /**
  * Terminates the library.
  * @param state A pointer to the state of the library.
@@ -181,17 +403,20 @@ void mc_pfwl_terminate(mc_pfwl_state_t *state);
 /*************************************************/
 /**
  * @brief Sets the number of simultaneously active flows to be expected.
+ * The flow table is split in partitions, one for each group of flows
+ * processed by the same L7 worker.
  * @param state A pointer to the state of the library.
- * @param flows_v4 The number of simultaneously active IPv4 flows.
- * @param flows_v6 The number of simultaneously active IPv6 flows.
+ * @param flows The number of simultaneously active flows.
  * @param strict If 1, when that number of active flows is reached,
  * an error will be returned (PFWL_ERROR_MAX_FLOWS) and new flows
  * will not be created. If 0, there will not be any limit to the number
  * of simultaneously active flows.
- * @return 0 if succeeded, 1 otherwise.
+ * @return 1 If the state has been successfully
+ *         updated. 0 if the state has not
+ *         been changed because a problem happened.
  */
-uint8_t mc_pfwl_set_expected_flows(mc_pfwl_state_t *state, uint32_t flows_v4,
-                                   uint32_t flows_v6, uint8_t strict);
+uint8_t mc_pfwl_set_expected_flows(mc_pfwl_state_t *state, uint32_t flows,
+                                   uint8_t strict);
 
 /**
  * Sets the maximum number of times that the library tries to guess the
@@ -458,46 +683,123 @@ mc_pfwl_set_flow_cleaner_callback(mc_pfwl_state_t *state,
                                   pfwl_flow_cleaner_callback_t *cleaner);
 
 /**
- * Sets callbacks informations. When a protocol is identified the
- * default behavior is to not inspect the packets belonging to that
- * flow anymore and keep simply returning the same protocol identifier.
- *
- * If a callback is enabled for a certain protocol, then we keep
- * inspecting all the new flows with that protocol in order to
- * invoke the callbacks specified by the user on the various parts
- * of the message. Moreover, if the application protocol uses TCP,
- * then we have the additional cost of TCP reordering for all the
- * segments. Is highly recommended to enable TCP reordering if it is
- * not already enabled (remember that is enabled by default).
- * Otherwise the informations extracted could be erroneous/incomplete.
- *
- * The pointers to the data passed to the callbacks are valid only for
- * the duration of the callback.
- *
+ * Atomically replaces the tags rules used by all the workers for a field.
+ * Differently from the other state updates, it can be called while the
+ * framework is running. The workers are never blocked, and the old rules
+ * are freed once no worker is using them. The first rules of a field
+ * enable its extraction, so they must be published before mc_pfwl_run.
  * @param state       A pointer to the state of the library.
- * @param callbacks   A pointer to HTTP callbacks.
- * @param user_data   A pointer to global user HTTP data. This pointer
- *                    will be passed to any HTTP callback when it is
- *                    invoked.
+ * @param field       The field identifier.
+ * @param tags        The rules, compiled with pfwl_field_tags_compile_L7.
  *
  * @return 1 If the state has been successfully
  *         updated. 0 if the state has not
- *         been changed because a problem happened.
- *
- **/
-uint8_t mc_pfwl_http_activate_callbacks(mc_pfwl_state_t *state,
-                                        pfwl_http_callbacks_t *callbacks,
-                                        void *user_data);
+ *         been changed because a problem happened (e.g. the field is
+ *         not extracted and the framework is running).
+ */
+uint8_t mc_pfwl_field_tags_publish_L7(mc_pfwl_state_t *state,
+                                      pfwl_field_id_t field,
+                                      pfwl_field_tags_t *tags);
 
+/*************************************************/
+/*                 Sharded mode                  */
+/*************************************************/
 /**
- * Remove the internal structure used to store callbacks informations.
- * user_data is not freed/modified.
- * @param state       A pointer to the state of the library.
- *
- * @return 1 If the state has been successfully
- *         updated. 0 if the state has not
- *         been changed because a problem happened.
- */
-uint8_t mc_pfwl_http_disable_callbacks(mc_pfwl_state_t *state);
+ * Alternative to the farms: a number of independent pfwl_state_t (the
+ * shards), each one used by a thread pinned on its own core. The packets
+ * are assigned to the shards with pfwl_shard_of, and each producer (e.g.
+ * a capture thread) has its own single-producer single-consumer queue
+ * towards each shard, so that the threads never write the same memory.
+ */
+typedef struct pfwl_sharded_state pfwl_sharded_state_t;
+
+/**
+ * Called by the thread of a shard after it dissected a packet.
+ * @param shard           The shard which dissected the packet.
+ * @param status          The status returned by pfwl_dissect_from_L2.
+ * @param dissection_info The dissection info. It is valid until the
+ *                        callback returns.
+ * @param user_pointer    The pointer passed with the packet to
+ *                        pfwl_sharded_dissect. Once the callback
+ *                        returns, the library does not access the
+ *                        packet anymore.
+ * @param callback_data   The pointer passed to pfwl_sharded_set_callback.
+ */
+typedef void(pfwl_sharded_callback)(uint16_t shard, pfwl_status_t status,
+                                    pfwl_dissection_info_t *dissection_info,
+                                    void *user_pointer, void *callback_data);
+
+/**
+ * Creates the shards. Each shard is a state created with pfwl_init, which
+ * can be configured with pfwl_sharded_get_state before calling
+ * pfwl_sharded_run.
+ * @param num_shards    The number of shards.
+ * @param num_producers The number of threads which will call
+ *                      pfwl_sharded_dissect.
+ * @param datalink_type The datalink type of the packets.
+ * @param mapping       The cores on which the shards are pinned
+ *                      (num_shards elements). If NULL, shard 'i' is
+ *                      pinned on core 'i'.
+ * @return A pointer to the sharded state, NULL if it can't be created.
+ */
+pfwl_sharded_state_t *pfwl_sharded_init(uint16_t num_shards,
+                                        uint16_t num_producers,
+                                        pfwl_protocol_l2_t datalink_type,
+                                        const uint16_t *mapping);
+
+/**
+ * Returns the state of a shard. It must only be modified before calling
+ * pfwl_sharded_run.
+ * @param state A pointer to the sharded state.
+ * @param shard The shard.
+ * @return The state of the shard, NULL if the shard does not exist.
+ */
+pfwl_state_t *pfwl_sharded_get_state(pfwl_sharded_state_t *state,
+                                     uint16_t shard);
+
+/**
+ * Sets the callback called after the dissection of each packet. It must
+ * be set before calling pfwl_sharded_run.
+ * @param state         A pointer to the sharded state.
+ * @param callback      The callback.
+ * @param callback_data A pointer passed to the callback.
+ */
+void pfwl_sharded_set_callback(pfwl_sharded_state_t *state,
+                               pfwl_sharded_callback *callback,
+                               void *callback_data);
+
+/**
+ * Starts the threads of the shards.
+ * @param state A pointer to the sharded state.
+ * @return 1 if the threads have been started, 0 otherwise.
+ */
+uint8_t pfwl_sharded_run(pfwl_sharded_state_t *state);
+
+/**
+ * Sends a packet to the shard which must dissect it. The packet must stay
+ * valid until the callback is called for it.
+ * @param state        A pointer to the sharded state.
+ * @param producer     The identifier of the calling thread, in the range
+ *                     [0, num_producers). Different threads must use
+ *                     different identifiers.
+ * @param pkt          A pointer to the packet, starting from the L2
+ *                     header.
+ * @param length       The length of the packet.
+ * @param timestamp    The time of the packet (see pfwl_dissect_from_L2).
+ * @param user_pointer A pointer passed to the callback.
+ * @return 1 if the packet has been queued, 0 if the queue of the shard is
+ *         full (i.e. the shard is not keeping up with the traffic).
+ */
+uint8_t pfwl_sharded_dissect(pfwl_sharded_state_t *state, uint16_t producer,
+                             const unsigned char *pkt, size_t length,
+                             uint32_t timestamp, void *user_pointer);
+
+/**
+ * Waits for the dissection of the queued packets, stops the threads and
+ * frees the shards. It must be called after all the producers stopped
+ * calling pfwl_sharded_dissect.
+ * @param state A pointer to the sharded state.
+ */
+void pfwl_sharded_terminate(pfwl_sharded_state_t *state);
 
 #endif /* MP_PFWL_API_H_ */
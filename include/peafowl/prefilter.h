@@ -0,0 +1,121 @@
+/*
+ * prefilter.h
+ *
+ * =========================================================================
+ * Copyright (c) 2012-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#ifndef PFWL_PREFILTER_H_
+#define PFWL_PREFILTER_H_
+
+#include <peafowl/config.h>
+#include <peafowl/peafowl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of payload bytes a signature can check. **/
+#define PFWL_PREFILTER_BYTES 8
+
+typedef enum {
+  PFWL_PREFILTER_TRANSPORT_END = 0, ///< Marks the end of a signatures array.
+  PFWL_PREFILTER_TRANSPORT_TCP,
+  PFWL_PREFILTER_TRANSPORT_UDP,
+  PFWL_PREFILTER_TRANSPORT_TCP_OR_UDP,
+} pfwl_prefilter_transport_t;
+
+/**
+ * A condition which the L7 payload must satisfy for a dissector to
+ * possibly match it. A dissector may have more signatures; if it has
+ * some, a payload satisfying none of them is considered not matching
+ * without calling the dissector. Signatures must thus only reject
+ * payloads for which the dissector would return
+ * PFWL_PROTOCOL_NO_MATCHES, whatever the state of the flow.
+ **/
+typedef struct {
+  pfwl_prefilter_transport_t transport;
+  size_t min_length; ///< Minimum length of the payload.
+  size_t max_length; ///< Maximum length of the payload, 0 if unbounded.
+  size_t bytes_length; ///< Number of bytes in 'bytes' (at most
+                       ///< PFWL_PREFILTER_BYTES).
+  unsigned char bytes[PFWL_PREFILTER_BYTES]; ///< First bytes of the payload.
+  unsigned char mask[PFWL_PREFILTER_BYTES];  ///< Bits of 'bytes' to check.
+                                             ///< If all zero, 'bytes' are
+                                             ///< compared as they are.
+} pfwl_prefilter_signature_t;
+
+/**
+ * The signatures of the enabled protocols, compiled into one table per
+ * transport protocol.
+ **/
+typedef struct pfwl_prefilter pfwl_prefilter_t;
+
+/**
+ * Creates an empty prefilter, which does not reject any protocol.
+ * @return The prefilter, or NULL if no memory is available.
+ */
+pfwl_prefilter_t *pfwl_prefilter_create(void);
+
+/**
+ * Deletes a prefilter.
+ * @param prefilter The prefilter.
+ */
+void pfwl_prefilter_delete(pfwl_prefilter_t *prefilter);
+
+/**
+ * Removes all the signatures from a prefilter.
+ * @param prefilter The prefilter.
+ */
+void pfwl_prefilter_clear(pfwl_prefilter_t *prefilter);
+
+/**
+ * Adds the signatures of a protocol to a prefilter. If they do not fit
+ * in the prefilter, the protocol is never rejected.
+ * @param prefilter The prefilter.
+ * @param protocol The protocol.
+ * @param signatures The signatures, terminated by one with
+ * PFWL_PREFILTER_TRANSPORT_END transport.
+ */
+void pfwl_prefilter_add(pfwl_prefilter_t *prefilter,
+                        pfwl_protocol_l7_t protocol,
+                        const pfwl_prefilter_signature_t *signatures);
+
+/**
+ * Checks a L7 payload against all the signatures.
+ * @param prefilter The prefilter.
+ * @param protocol_l4 The L4 protocol of the packet.
+ * @param pkt The L7 payload.
+ * @param length The length of the L7 payload.
+ * @param plausible For each protocol, will be set to 0 if the protocol
+ * cannot match the payload, to 1 otherwise.
+ */
+void pfwl_prefilter_match(const pfwl_prefilter_t *prefilter,
+                          pfwl_protocol_l4_t protocol_l4,
+                          const unsigned char *pkt, size_t length,
+                          uint8_t *plausible);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PFWL_PREFILTER_H_ */
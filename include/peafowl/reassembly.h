@@ -34,6 +34,8 @@
 #ifndef PFWL_REASSEMBLY_H_
 #define PFWL_REASSEMBLY_H_
 
+#include <peafowl/allocator.h>
+#include <peafowl/config.h>
 #include <peafowl/utils.h>
 
 #include <sys/types.h>
@@ -43,7 +45,6 @@ extern "C" {
 #endif
 
 typedef struct pfwl_reassembly_timer pfwl_reassembly_timer_t;
-typedef struct pfwl_reassembly_fragment pfwl_reassembly_fragment_t;
 
 /**If tail insertion, then the head will be the first to expire. **/
 struct pfwl_reassembly_timer {
@@ -53,24 +54,52 @@ struct pfwl_reassembly_timer {
   uint32_t expiration_time;
 };
 
-/* Describe an IP fragment (or TCP segment). */
-struct pfwl_reassembly_fragment {
-  /* Offset of fragment. */
-  uint32_t offset;
-  /* Last byte of data in fragment. */
-  uint32_t end;
+#define PFWL_IP_FRAGMENTATION_MAX_DATAGRAM_SIZE 65535
+
+/** Range [start, end) of the data of an IP datagram which has been received. **/
+typedef struct pfwl_reassembly_ip_interval {
+  uint16_t start;
+  uint16_t end;
+} pfwl_reassembly_ip_interval_t;
+
+/**
+ * An IP datagram being reassembled. The data of the fragments is directly
+ * copied in a single buffer, preceded by the header. The buffer is sized
+ * when the first fragment is received (exactly, if it is the last one) and
+ * grown only if needed. When the datagram is complete the buffer is given
+ * to the caller, which must free() it.
+ **/
+typedef struct pfwl_reassembly_ip_datagram {
+  unsigned char *buffer;
+  /** Bytes reserved for the header at the beginning of the buffer. **/
+  uint16_t header_length;
+  /** Bytes available for the data, after the header. **/
+  uint16_t capacity;
+  /** Length of the data, 0 until the last fragment is received. **/
+  uint16_t length;
+  uint8_t intervals_num;
+  /** Sorted, not overlapping and not adjacent intervals. **/
+  pfwl_reassembly_ip_interval_t intervals[PFWL_IP_FRAGMENTATION_MAX_HOLES];
+} pfwl_reassembly_ip_datagram_t;
+
+/**
+ * Memory shared by the shards of an IP defragmentation state. Each shard
+ * takes credits (bytes) from the total limit, in chunks of
+ * PFWL_IP_FRAGMENTATION_CREDITS_GRAIN bytes, and only uses the memory it
+ * holds credits for. In this way the total limit is enforced without
+ * locking the shards.
+ **/
+typedef struct pfwl_reassembly_credits {
+  uint32_t limit;
+  /** Credits held by all the shards. Atomically updated. **/
+  uint32_t taken;
+  uint16_t shards;
   /**
-   * This is needed because when a segment contains a FIN,
-   * then the expected sequence number in the other direction
-   * will be incremented by one.
-   */
-  uint8_t tcp_fin : 1;
-  /* Pointer into real fragment data. */
-  unsigned char *ptr;
-  /* Linked list pointers to the other fragments. */
-  pfwl_reassembly_fragment_t *next;
-  pfwl_reassembly_fragment_t *prev;
-};
+   * Set by a shard which found no credits. Until it gets some, the shards
+   * holding more than limit/shards credits give back the excess.
+   **/
+  uint8_t starving;
+} pfwl_reassembly_credits_t;
 
 /**
  * Returns 1 if the sequence number x is before y, 0 otherwise.
@@ -133,44 +162,109 @@ void pfwl_reassembly_delete_timer(pfwl_reassembly_timer_t **head,
                                   pfwl_reassembly_timer_t *timer);
 
 /**
- * Insert a fragment in the correct position in the list of fragments,
- * considering overlaps, etc..
- * @param head The head of the list of fragments.
- * @param data The data contained in the fragment (without IP header).
+ * Returns the memory reserved for a datagram buffer.
+ * @param datagram The datagram.
+ * @return The number of bytes of the buffer.
+ */
+uint32_t
+pfwl_reassembly_ip_datagram_memory(const pfwl_reassembly_ip_datagram_t *datagram);
+
+/**
+ * Stores the header of a datagram. If the buffer has not yet been
+ * allocated, it will reserve 'length' bytes for the header.
+ * @param datagram The datagram.
+ * @param header The header.
+ * @param length The length of the header.
+ * @return 0 if succeeded, 1 if no memory is available.
+ */
+uint8_t pfwl_reassembly_ip_datagram_set_header(
+    pfwl_reassembly_ip_datagram_t *datagram, const unsigned char *header,
+    uint16_t length);
+
+/**
+ * Copies the data of a fragment in the datagram. Data already received
+ * is not overwritten.
+ * @param datagram The datagram.
+ * @param data The data of the fragment (without header).
  * @param offset The offset of this fragment.
  * @param end The end of this fragment.
- * @param bytes_removed The total number of bytes removed
- *                      (in the fragments) by this call.
- * @param bytes_inserted The total number of byte inserted
- *                       (in the fragments) by this call.
- *
- * @return The created fragment.
+ * @param header_length The length of the header of the fragment, used to
+ * reserve space for the header if the buffer has not yet been allocated.
+ * @return 0 if succeeded, 1 if no memory is available or if the datagram
+ * has too many holes.
  */
-pfwl_reassembly_fragment_t *
-pfwl_reassembly_insert_fragment(pfwl_reassembly_fragment_t **head,
-                                const unsigned char *data, uint32_t offset,
-                                uint32_t end, uint32_t *bytes_removed,
-                                uint32_t *bytes_inserted);
+uint8_t pfwl_reassembly_ip_datagram_insert(
+    pfwl_reassembly_ip_datagram_t *datagram, const unsigned char *data,
+    uint16_t offset, uint16_t end, uint16_t header_length);
 
 /**
- * See there is a train of contiguous fragments.
- * @param head The pointer to the head of the list of fragments.
- * @return 0 if there are missing fragments, 1 otherwise.
+ * Checks if all the data of a datagram has been received.
+ * @param datagram The datagram.
+ * @return 1 if the datagram is complete, 0 otherwise.
  */
-uint8_t pfwl_reassembly_ip_check_train_of_contiguous_fragments(
-    pfwl_reassembly_fragment_t *head);
+uint8_t pfwl_reassembly_ip_datagram_complete(
+    const pfwl_reassembly_ip_datagram_t *datagram);
+
+/**
+ * Releases the buffer of a datagram.
+ * @param datagram The datagram.
+ */
+void pfwl_reassembly_ip_datagram_release(
+    pfwl_reassembly_ip_datagram_t *datagram);
+
+/**
+ * Checks if a shard must release some memory before storing a new
+ * fragment, taking more credits if it has used all of them. If the limit
+ * has been lowered, or if another shard is starving, the credits exceeding
+ * the limit (or the fair share of the shard) are given back.
+ * @param credits The credits of the defragmentation state.
+ * @param held The credits held by the shard.
+ * @param used The memory used by the shard.
+ * @return 1 if the shard used all its credits and no more credits are
+ * available, 0 otherwise.
+ */
+uint8_t pfwl_reassembly_credits_exhausted(pfwl_reassembly_credits_t *credits,
+                                          uint32_t *held, uint32_t used);
+
+/**
+ * Gives back the credits of a shard which are not needed anymore, keeping
+ * PFWL_IP_FRAGMENTATION_CREDITS_GRAIN bytes for the next fragments.
+ * @param credits The credits of the defragmentation state.
+ * @param held The credits held by the shard.
+ * @param used The memory used by the shard.
+ */
+void pfwl_reassembly_credits_release(pfwl_reassembly_credits_t *credits,
+                                     uint32_t *held, uint32_t used);
+
+/**
+ * Robert Jenkins' 32 bit integer hash function, used to spread the IP
+ * fragments among the shards and the buckets of the fragmentation tables.
+ * @param x The value to hash.
+ * @return The hash.
+ */
+static inline uint32_t pfwl_reassembly_mix(uint32_t x) {
+  x = (x + 0x7ed55d16) + (x << 12);
+  x = (x ^ 0xc761c23c) ^ (x >> 19);
+  x = (x + 0x165667b1) + (x << 5);
+  x = (x + 0xd3a2646c) ^ (x << 9);
+  x = (x + 0xfd7046c5) + (x << 3);
+  x = (x ^ 0xb55a4f09) ^ (x >> 16);
+  return x;
+}
 
 /**
- * Compacts a train of contiguous fragments and returns it.
- * @param head A pointer to the head of the train.
- * @param where A pointer to a buffer where to put the data.
- * @param len The data_length of the buffer where to put the data.
- * @return The data_length of the recompacted data. If an error
- * occurred (e.g. misbehaving packet), -1 is returned.
+ * Returns the shard (i.e. the thread) which must manage an IP packet.
+ * Packets are assigned by hashing their addresses (in the same way for
+ * both the directions). Hence all the fragments of a datagram are
+ * assigned to the same shard, and a reassembled datagram is kept in
+ * order with the other packets of its flow.
+ * @param pkt A pointer to the beginning of the IP header.
+ * @param length The length of the packet.
+ * @param shards The number of shards.
+ * @return The shard, in the range [0, shards).
  */
-int32_t pfwl_reassembly_ip_compact_fragments(pfwl_reassembly_fragment_t *head,
-                                             unsigned char **where,
-                                             uint32_t len);
+uint16_t pfwl_reassembly_ip_shard(const unsigned char *pkt, size_t length,
+                                  uint16_t shards);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,77 @@
+/*
+ * tags.h
+ *
+ * =========================================================================
+ * Copyright (c) 2016-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#ifndef PFWL_TAGS_H_
+#define PFWL_TAGS_H_
+
+#include <peafowl/config.h>
+#include <peafowl/peafowl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Creates the structures needed to update the tags rules of a state.
+ * @param state The state.
+ * @return 0 if succeeded, 1 otherwise.
+ */
+uint8_t pfwl_field_tags_init(pfwl_state_t *state);
+
+/**
+ * Releases all the tags rules of a state. No thread must be dissecting
+ * packets with the state.
+ * @param state The state.
+ */
+void pfwl_field_tags_terminate(pfwl_state_t *state);
+
+/**
+ * Publishes the rules added with the pfwl_*_tags_add calls since the last
+ * publication, if any.
+ * @param state The state.
+ * @param wait If 0, nothing is done if another thread is updating the
+ * rules of the state.
+ */
+void pfwl_field_tags_flush(pfwl_state_t *state, uint8_t wait);
+
+/**
+ * Matches the fields extracted from a packet against the published rules,
+ * adding the tags to the dissection info.
+ * @param state The state.
+ * @param diss_info The dissection info.
+ */
+void pfwl_field_tags_match(pfwl_state_t *state,
+                           pfwl_dissection_info_t *diss_info);
+
+const char *pfwl_field_string_tag_get(void *db, pfwl_string_t *value);
+const char *pfwl_field_mmap_tag_get(void *db, pfwl_string_t *key,
+                                    pfwl_string_t *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PFWL_TAGS_H_ */
@@ -0,0 +1,190 @@
+/*
+ * tcp_reassembly.h
+ *
+ * =========================================================================
+ * Copyright (c) 2012-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#ifndef PFWL_TCP_REASSEMBLY_H_
+#define PFWL_TCP_REASSEMBLY_H_
+
+#include <peafowl/allocator.h>
+#include <peafowl/config.h>
+#include <peafowl/peafowl.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PFWL_TCP_REORDERING_CHUNKS                                             \
+  (PFWL_TCP_REORDERING_WINDOW / PFWL_TCP_REORDERING_CHUNK_SIZE)
+
+#if (PFWL_TCP_REORDERING_WINDOW & (PFWL_TCP_REORDERING_WINDOW - 1)) ||         \
+    PFWL_TCP_REORDERING_WINDOW % PFWL_TCP_REORDERING_CHUNK_SIZE ||             \
+    PFWL_TCP_REORDERING_CHUNKS > 64
+#error "PFWL_TCP_REORDERING_WINDOW must be a power of two, multiple of "\
+       "PFWL_TCP_REORDERING_CHUNK_SIZE and at most 64 chunks long"
+#endif
+
+typedef struct pfwl_tcp_reassembly_stream pfwl_tcp_reassembly_stream_t;
+
+/**
+ * Memory limits, shared by all the partitions of a flow table.
+ **/
+typedef struct pfwl_tcp_reassembly_budget {
+  uint32_t per_flow;
+  uint32_t per_partition;
+  uint32_t total;
+  /** Bytes used by all the partitions. Atomically updated. **/
+  size_t used;
+} pfwl_tcp_reassembly_budget_t;
+
+/**
+ * Out of order data of a flow table partition. Only accessed by the
+ * thread managing the partition.
+ **/
+typedef struct pfwl_tcp_reassembly_partition {
+  /**
+   * Sentinel of the list of the streams with buffered data, sorted from
+   * the least to the most recently updated one. This is the order in
+   * which streams are dropped when a limit is reached. Must be the first
+   * fields, as in pfwl_tcp_reassembly_stream_t.
+   **/
+  pfwl_tcp_reassembly_stream_t *lru_prev;
+  pfwl_tcp_reassembly_stream_t *lru_next;
+  pfwl_tcp_reassembly_budget_t *budget;
+  size_t used;
+  size_t high_water;
+  uint64_t dropped_segments;
+  uint64_t dropped_bytes;
+  uint64_t evicted_streams;
+} pfwl_tcp_reassembly_partition_t;
+
+/** Range [start, end) of sequence numbers for which we have the data. **/
+typedef struct pfwl_tcp_reassembly_interval {
+  uint32_t start;
+  uint32_t end;
+} pfwl_tcp_reassembly_interval_t;
+
+/**
+ * Out of order data of one direction of a TCP connection. Data is stored in
+ * a ring of PFWL_TCP_REORDERING_CHUNKS chunks, allocated only when some data
+ * falls in them. The byte with sequence number 'x' is always at position
+ * x % PFWL_TCP_REORDERING_WINDOW of the ring, thus all the buffered data must
+ * lie in a window of PFWL_TCP_REORDERING_WINDOW bytes (starting from the
+ * chunk containing the expected sequence number).
+ **/
+struct pfwl_tcp_reassembly_stream {
+  /** The partition is the sentinel of this list. **/
+  pfwl_tcp_reassembly_stream_t *lru_prev;
+  pfwl_tcp_reassembly_stream_t *lru_next;
+  pfwl_tcp_reassembly_partition_t *partition;
+  pfwl_flow_info_private_t *flow;
+  uint8_t direction;
+  uint8_t fin;
+  uint8_t intervals_num;
+  /** Sequence number of the FIN, if fin is 1. **/
+  uint32_t fin_seq;
+  /** Bytes of memory used by the stream, descriptor included. **/
+  uint32_t memory;
+  /**
+   * 1 if the first interval has been described by pfwl_tcp_reassembly_spans
+   * and must be removed by pfwl_tcp_reassembly_commit.
+   **/
+  uint8_t pending;
+  uint8_t spans_num;
+  /** Sorted, not overlapping and not adjacent intervals. **/
+  pfwl_tcp_reassembly_interval_t intervals[PFWL_TCP_REORDERING_MAX_HOLES];
+  unsigned char *chunks[PFWL_TCP_REORDERING_CHUNKS];
+  /**
+   * Spans filled by pfwl_tcp_reassembly_spans: the in order data of the
+   * segment followed by (at most PFWL_TCP_REORDERING_CHUNKS) pieces of
+   * the chunks.
+   **/
+  pfwl_span_t spans[PFWL_TCP_REORDERING_CHUNKS + 1];
+};
+
+/**
+ * Initializes the out of order data of a partition.
+ * @param partition The partition.
+ * @param budget The limits shared among all the partitions.
+ */
+void pfwl_tcp_reassembly_partition_init(
+    pfwl_tcp_reassembly_partition_t *partition,
+    pfwl_tcp_reassembly_budget_t *budget);
+
+/**
+ * Stores an out of order segment.
+ * @param partition The partition the flow belongs to.
+ * @param flow The flow.
+ * @param direction The direction of the segment.
+ * @param expected_seq The next in order sequence number for this direction.
+ * @param seq The sequence number of the segment.
+ * @param data The payload of the segment.
+ * @param length The length of the payload.
+ * @param fin 1 if the segment carries a FIN.
+ * @return 0 if the segment has been stored (or if its data was already
+ * stored), 1 if it has been dropped.
+ */
+uint8_t pfwl_tcp_reassembly_insert(pfwl_tcp_reassembly_partition_t *partition,
+                                   pfwl_flow_info_private_t *flow,
+                                   uint8_t direction, uint32_t expected_seq,
+                                   uint32_t seq, const unsigned char *data,
+                                   uint32_t length, uint8_t fin);
+
+/**
+ * Describes, without copying it, the in order data of a segment followed by
+ * the first train of contiguous data of a stream. The stored data stays
+ * valid until pfwl_tcp_reassembly_commit is called.
+ * @param stream The stream. Must contain some data.
+ * @param data The in order data of the segment.
+ * @param length The length of 'data'. It must end where the stored data
+ * starts.
+ * @param fin Will be set to 1 if the FIN follows the data, to 0 otherwise.
+ * @return The total length of the data, described by stream->spans.
+ */
+uint32_t pfwl_tcp_reassembly_spans(pfwl_tcp_reassembly_stream_t *stream,
+                                   const unsigned char *data, uint32_t length,
+                                   uint8_t *fin);
+
+/**
+ * Removes the data described by the last call of pfwl_tcp_reassembly_spans,
+ * if any. The stream is released (and the pointer to it in the flow is set
+ * to NULL) if no data remains.
+ * @param stream The stream.
+ */
+void pfwl_tcp_reassembly_commit(pfwl_tcp_reassembly_stream_t *stream);
+
+/**
+ * Releases a stream and all its data.
+ * @param stream The stream.
+ */
+void pfwl_tcp_reassembly_release(pfwl_tcp_reassembly_stream_t *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PFWL_TCP_REASSEMBLY_H_ */
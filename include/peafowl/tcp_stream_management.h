@@ -51,8 +51,9 @@ enum pfwl_tcp_reordering_statuses {
 };
 
 typedef struct pfwl_tcp_reordering_reordered_segment {
-  unsigned char *data;
+  const pfwl_span_t *spans;
   uint32_t data_length;
+  uint8_t spans_num;
   uint8_t status : 2;
   uint8_t connection_terminated : 1;
 } pfwl_tcp_reordering_reordered_segment_t;
@@ -69,6 +70,8 @@ void pfwl_reordering_tcp_delete_all_fragments(pfwl_flow_info_private_t *victim);
  * @param tracking A pointer to the structure containing the information
  *                 about the TCP connection.
  * @param pkt A pointer to the L4 packet
+ * @param pickup 1 if a connection whose handshake has not been seen
+ *               must be picked up speculatively, 0 otherwise.
  * @return If the packet is out of order, if it has already been received
  *         or if an error occurred, the returned structure contains
  *         PFWL_TCP_REORDERING_STATUS_OUT_OF_ORDER in the 'status' field.
@@ -84,15 +87,29 @@ void pfwl_reordering_tcp_delete_all_fragments(pfwl_flow_info_private_t *victim);
  *         If the received data is in order and fills an 'hole' in
  *         the segment space, the returned structure contains
  *         PFWL_TCP_REORDERING_STATUS_REBUILT in the 'status' field.
- *         The 'data' field will contain a pointer to the new (longer)
- *         segment. This pointer must be freed after the use. The
- *         'data_length' field contains the length of the new (longer)
- *         segment.
+ *         The 'spans' field will describe the new (longer) segment,
+ *         made of the data of the packet followed by the stored data.
+ *         They are valid until the next segment of the flow is tracked.
+ *         The 'data_length' field contains the length of the new
+ *         (longer) segment.
  */
 pfwl_tcp_reordering_reordered_segment_t
 pfwl_reordering_tcp_track_connection(pfwl_dissection_info_t *dissection_info,
                                      pfwl_flow_info_private_t *tracking,
-                                     const unsigned char *pkt);
+                                     const unsigned char *pkt, uint8_t pickup);
+
+/**
+ * Copies a resegmented payload in a buffer owned by the flow, for the
+ * dissectors which cannot inspect its pieces separately. Sets the
+ * 'resegmented_pkt' field of the dissection info.
+ * @param dissection_info The informations about the packet.
+ * @param tracking A pointer to the structure containing the information
+ *                 about the TCP connection.
+ * @return The contiguous payload, or NULL if no memory is available.
+ */
+const unsigned char *
+pfwl_reordering_tcp_contiguous(pfwl_dissection_info_t *dissection_info,
+                               pfwl_flow_info_private_t *tracking);
 
 /**
  * Only checks if the connection terminates.
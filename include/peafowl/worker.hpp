@@ -56,38 +56,136 @@ typedef struct L3_L4_input_task {
   void *user_pointer;
 } L3_L4_input_task_struct;
 
+/**
+ * L3 and L4 information of a packet, needed to dissect it from L4.
+ **/
 typedef struct L3_L4_output_task {
+  pfwl_dissection_info_l3_t l3;
+  pfwl_dissection_info_l4_t l4;
+  /** The L4 header (in the packet or in the rebuilt datagram). **/
+  const unsigned char *l4_pkt;
+  size_t l4_length;
+  uint32_t current_time;
   uint32_t hash_result;
-  uint16_t destination_worker;
-  uint8_t status;
-  pfwl_pkt_info_t pkt_infos;
+  /** The flow table partition of the bucket 'hash_result'. **/
+  uint16_t partition;
+  int8_t status;
   void *user_pointer;
 } L3_L4_output_task_struct;
 
-typedef struct L7_output_task {
-  pfwl_dissection_info_t result;
-  void *user_pointer;
-} L7_output_task_struct;
+typedef mc_pfwl_processing_result_t L7_output_task_struct;
 
 #define PFWL_CACHE_LINES_PADDING_REQUIRED(size)                                \
   (size % PFWL_CACHE_LINE_SIZE == 0 ? 0 : PFWL_CACHE_LINE_SIZE -               \
                                               (size % PFWL_CACHE_LINE_SIZE))
 
+/**
+ * The L7 output is not in the union, since the L7 workers read the
+ * L3_L4 output while writing it.
+ **/
 typedef struct mc_pfwl_task {
+  /** Number of packets in the task. **/
+  size_t size;
   union input_output_task {
-    L3_L4_input_task_struct
-        L3_L4_input_task_t[PFWL_MULTICORE_DEFAULT_GRAIN_SIZE];
+    L3_L4_input_task_struct L3_L4_input_task_t[PFWL_MULTICORE_MAX_GRAIN_SIZE];
     L3_L4_output_task_struct
-        L3_L4_output_task_t[PFWL_MULTICORE_DEFAULT_GRAIN_SIZE];
-    L7_output_task_struct L7_output_task_t[PFWL_MULTICORE_DEFAULT_GRAIN_SIZE];
+        L3_L4_output_task_t[PFWL_MULTICORE_MAX_GRAIN_SIZE];
   } input_output_task_t;
-  char padding[PFWL_CACHE_LINES_PADDING_REQUIRED(sizeof(input_output_task_t))];
+  char padding[PFWL_CACHE_LINES_PADDING_REQUIRED(
+      sizeof(size_t) + sizeof(input_output_task_t))];
+  L7_output_task_struct L7_output_task_t[PFWL_MULTICORE_MAX_GRAIN_SIZE];
 } mc_pfwl_task_t;
 
+/**
+ * Batching policy of a stage, and the statistics of its batches (only
+ * written by the node sending them).
+ **/
+typedef struct pfwl_batching {
+  uint32_t max_grain;
+  /** Maximum latency, in ticks. **/
+  ticks max_latency;
+  double ticks_per_us;
+  mc_pfwl_batching_stats_t stats;
+  char padding[PFWL_CACHE_LINE_SIZE];
+} pfwl_batching_t;
+
+/** Batch being filled for a destination. **/
+typedef struct pfwl_batch {
+  uint32_t grain;
+  /** When its first packet arrived. **/
+  ticks opened;
+} pfwl_batch_t;
+
+#define PFWL_BATCHING_NO_DEADLINE ((ticks) -1)
+
+/** Ticks of the timestamp counter in a microsecond. **/
+double pfwl_ticks_per_us();
+
+/**
+ * Load of an L7 worker. 'processed_tasks', 'packets' and 'busy_ticks' are
+ * written by the worker, 'node' when the state is created, the other
+ * fields by the L7 emitter. Each worker has its own cache line.
+ **/
+typedef struct pfwl_L7_worker_load {
+  uint64_t received_tasks;
+  uint64_t processed_tasks;
+  uint64_t packets;
+  /** Time spent dissecting packets. **/
+  uint64_t busy_ticks;
+  uint32_t partitions;
+  uint32_t migrations;
+  /** NUMA node of the processor of the worker, -1 if unknown. **/
+  int32_t node;
+  /** 0 if the worker must sleep. Protected by pfwl_L7_scaling_t::mutex. **/
+  uint32_t active;
+  char padding[PFWL_CACHE_LINES_PADDING_REQUIRED(4 * sizeof(uint64_t) +
+                                                 4 * sizeof(uint32_t))];
+} pfwl_L7_worker_load_t;
+
+/**
+ * Scaling controller and rebalancing parameters, and what the deactivated
+ * L7 workers sleep on.
+ **/
+typedef struct pfwl_L7_scaling {
+  mc_pfwl_scaling_parameters_t parameters;
+  uint8_t enabled;
+  /** Backlogs difference which starts a partition migration. **/
+  uint32_t rebalance_threshold;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  /** Set at the end of the stream, wakes up all the workers. **/
+  uint8_t terminating;
+} pfwl_L7_scaling_t;
+
+/** Task sent to an L7 worker to put it to sleep. **/
+#define PFWL_L7_WORKER_SLEEP ((void *) &pfwl_L7_worker_sleep_task)
+extern char pfwl_L7_worker_sleep_task;
+
 /*****************************************************/
 /*                      L3_L4 nodes.                 */
 /*****************************************************/
 
+class pfwl_L3_L4_scheduler : public ff::ff_loadbalancer {
+private:
+  char padding1[PFWL_CACHE_LINE_SIZE];
+  int victim;
+  char padding2[PFWL_CACHE_LINE_SIZE];
+
+protected:
+  inline size_t selectworker() {
+    return victim;
+  }
+
+public:
+  pfwl_L3_L4_scheduler(int max_num_workers)
+      : ff_loadbalancer(max_num_workers), victim(0) {
+  }
+
+  void set_victim(int v) {
+    victim = v;
+  }
+};
+
 class pfwl_L3_L4_emitter : public ffnode {
 private:
   char padding1[PFWL_CACHE_LINE_SIZE];
@@ -98,12 +196,34 @@ private:
   const uint16_t proc_id;
   ff::SWSR_Ptr_Buffer *tasks_pool;
   uint8_t initialized;
+  /** If not NULL, packets are steered to the L3_L4 workers. **/
+  pfwl_L3_L4_scheduler *const lb;
+  const uint16_t num_L3_L4_workers;
+  mc_pfwl_task_t **partially_filled;
+  uint *partially_filled_sizes;
+  pfwl_batching_t *const batching;
+  /** One for each worker (a single one if not steering). **/
+  pfwl_batch_t *batches;
+  ticks deadline;
+  /** When the last task (or empty task) was sent. **/
+  ticks last_tick;
+  /** The stream ended after the last returned task. **/
+  uint8_t eos;
   char padding2[PFWL_CACHE_LINE_SIZE];
 
+  void *steer();
+  void send_batch(uint16_t worker, ticks now, uint8_t timeout);
+  /** Sends the batches whose first packet waited for too long. **/
+  void expire(ticks now);
+  mc_pfwl_task_t *tick(ticks now);
+
 public:
   pfwl_L3_L4_emitter(pfwl_state_t *state, mc_pfwl_packet_reading_callback **cb,
                      void **user_data, uint8_t *terminating, uint16_t proc_id,
-                     ff::SWSR_Ptr_Buffer *tasks_pool);
+                     ff::SWSR_Ptr_Buffer *tasks_pool,
+                     pfwl_batching_t *batching,
+                     pfwl_L3_L4_scheduler *lb = NULL,
+                     uint16_t num_L3_L4_workers = 1);
   ~pfwl_L3_L4_emitter();
 #ifdef ENABLE_RECONFIGURATION
   void notifyRethreading(size_t oldNumWorkers, size_t newNumWorkers);
@@ -117,18 +237,15 @@ private:
   char padding1[PFWL_CACHE_LINE_SIZE];
   pfwl_state_t *const state;
   L3_L4_input_task_struct *in;
-  const uint32_t v4_table_size;
-  const uint32_t v6_table_size;
-  uint32_t v4_worker_table_size;
-  uint32_t v6_worker_table_size;
+  /** Result of the L3 parsing, only L3 and L4 are forwarded. **/
+  pfwl_dissection_info_t *dissection_info;
   const uint16_t worker_id;
   const uint16_t proc_id;
   char padding2[PFWL_CACHE_LINE_SIZE];
 
 public:
   pfwl_L3_L4_worker(pfwl_state_t *state, uint16_t worker_id,
-                    uint16_t num_L7_workers, uint16_t proc_id,
-                    uint32_t v4_table_size, uint32_t v6_table_size);
+                    uint16_t proc_id);
   ~pfwl_L3_L4_worker();
 
   int svc_init();
@@ -178,6 +295,19 @@ public:
   }
 };
 
+#define PFWL_L7_EMITTER_NO_MIGRATION UINT32_MAX
+#define PFWL_L7_EMITTER_NO_WORKER UINT16_MAX
+
+/**
+ * Sends each packet to the L7 worker owning the flow table partition of its
+ * flow. Partitions are moved from the workers with the longest queues to
+ * the ones with the shortest. To move a partition, its packets are held
+ * until the old owner processed the last task containing packets of the
+ * partition, and are then sent to the new owner. Thus, each partition is
+ * always accessed by one worker at a time, and its packets are processed
+ * in order. The memory of each partition is placed on the NUMA node of its
+ * owner.
+ **/
 class pfwl_L7_emitter : public ffnode {
 private:
   char padding1[PFWL_CACHE_LINE_SIZE];
@@ -185,18 +315,87 @@ private:
   uint *partially_filled_sizes;
   mc_pfwl_task_t **waiting_tasks;
   uint16_t waiting_tasks_size;
+  uint16_t waiting_tasks_capacity;
+  pfwl_batching_t *const batching;
+  /** Batch being filled for each worker. **/
+  pfwl_batch_t *batches;
+  ticks deadline;
   const uint16_t proc_id;
+  uint16_t num_L7_workers;
+  const uint16_t num_partitions;
+  /** Worker owning each partition. **/
+  uint16_t *owners;
+  /**
+   * For each partition, the sequence number (among the tasks sent to its
+   * owner) of the last task containing its packets.
+   **/
+  uint64_t *last_tasks;
+  /** Packets of each partition since the last load check. **/
+  uint32_t *partition_packets;
+  /** Tasks sent to each worker. **/
+  uint64_t *sent_tasks;
+  pfwl_L7_worker_load_t *const loads;
+  uint32_t tasks_since_check;
+  /** Partition being moved, if any. **/
+  uint32_t migrating;
+  uint16_t migration_from;
+  uint16_t migration_to;
+  uint64_t migration_fence;
+  L3_L4_output_task_struct *held;
+  uint32_t held_size;
+  pfwl_state_t *const state;
+  pfwl_L7_scaling_t *const scaling;
+  /** Workers [0, active_workers) receive packets. **/
+  uint16_t active_workers;
+  /** Inactive worker whose partitions are being moved away, if any. **/
+  uint16_t draining;
+  /**
+   * 1 after a scaling decision, until the partitions have been moved
+   * from the worker being deactivated, or to the one just activated.
+   **/
+  uint8_t reassigning;
+  unsigned long last_scaling;
+  ticks last_scaling_ticks;
+  /** busy_ticks of each worker at the last scaling decision. **/
+  uint64_t *last_busy_ticks;
   char padding2[PFWL_CACHE_LINE_SIZE];
 
+  void dispatch(const L3_L4_output_task_struct &packet, ticks now);
+  void send_batch(uint16_t worker, ticks now, uint8_t timeout);
+  /** Sends the batches whose first packet waited for too long. **/
+  void expire(ticks now);
+  void rebalance();
+  uint8_t handoff();
+  void reassign();
+  void scale();
+  void start_migration(uint32_t partition, uint16_t from, uint16_t to);
+  uint8_t migrate(uint8_t wait);
+  void wake(uint16_t worker);
+  void put_to_sleep(uint16_t worker);
+
 protected:
   pfwl_L7_scheduler *const lb;
 
 public:
-  pfwl_L7_emitter(pfwl_L7_scheduler *lb, uint16_t num_L7_workers,
-                  uint16_t proc_id);
+  pfwl_L7_emitter(pfwl_state_t *state, pfwl_L7_scheduler *lb,
+                  uint16_t num_L7_workers, uint16_t num_partitions,
+                  pfwl_L7_worker_load_t *loads, pfwl_L7_scaling_t *scaling,
+                  pfwl_batching_t *batching, uint16_t proc_id);
   ~pfwl_L7_emitter();
+  /**
+   * Evenly assigns the partitions to the workers. Must only be called
+   * while the workers are not running.
+   **/
+  void set_workers(uint16_t num_L7_workers);
+  /**
+   * Called at the end of the stream. Completes the ongoing migration, if
+   * any, sending the held packets and the partially filled batches, and
+   * wakes up the sleeping workers.
+   **/
+  void flush();
   int svc_init();
   void *svc(void *task);
+  void eosnotify(ssize_t id = -1);
 };
 
 static inline void sleepns(unsigned long ns) {
@@ -214,14 +413,19 @@ class pfwl_L7_worker : public ffnode {
 private:
   char padding1[PFWL_CACHE_LINE_SIZE];
   pfwl_state_t *const state;
-  L3_L4_output_task_struct *temp;
   const uint16_t worker_id;
   const uint16_t proc_id;
+  pfwl_L7_worker_load_t *const load;
+  pfwl_L7_scaling_t *const scaling;
+  uint64_t processed_tasks;
+  uint64_t busy_ticks;
 
   char padding2[PFWL_CACHE_LINE_SIZE];
 
 public:
-  pfwl_L7_worker(pfwl_state_t *state, uint16_t worker_id, uint16_t proc_id);
+  pfwl_L7_worker(pfwl_state_t *state, uint16_t worker_id,
+                 pfwl_L7_worker_load_t *load, pfwl_L7_scaling_t *scaling,
+                 uint16_t proc_id);
   ~pfwl_L7_worker();
 
   int svc_init();
@@ -246,6 +450,10 @@ public:
   void *svc(void *);
 };
 
+/**
+ * Reads the packets, parses their L3 and L4 headers and sends them to the
+ * L7 workers. 'batching' has an element for each stage.
+ **/
 class pfwl_collapsed_emitter : public dpi::pfwl_L7_emitter {
 private:
   char padding1[PFWL_CACHE_LINE_SIZE];
@@ -258,7 +466,8 @@ public:
   pfwl_collapsed_emitter(mc_pfwl_packet_reading_callback **cb, void **user_data,
                          uint8_t *terminating, ff::SWSR_Ptr_Buffer *tasks_pool,
                          pfwl_state_t *state, uint16_t num_L7_workers,
-                         uint32_t v4_table_size, uint32_t v6_table_size,
+                         uint16_t num_partitions, pfwl_L7_worker_load_t *loads,
+                         pfwl_L7_scaling_t *scaling, pfwl_batching_t *batching,
                          pfwl_L7_scheduler *lb, uint16_t proc_id);
   ~pfwl_collapsed_emitter();
   int svc_init();
@@ -0,0 +1,262 @@
+/*
+ * allocator.c
+ *
+ * =========================================================================
+ * Copyright (c) 2012-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#include <peafowl/allocator.h>
+#include <peafowl/config.h>
+
+#include <assert.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+/** The first cache line of each slab links it to the next one. **/
+#define PFWL_ALLOCATOR_SLAB_HEADER PFWL_CACHE_LINE_SIZE
+
+/** Highest NUMA node (plus one) which can be used. **/
+#define PFWL_NUMA_MAX_NODES 1024
+
+static inline int8_t pfwl_allocator_class(size_t size) {
+  if (size <= (1 << PFWL_ALLOCATOR_MIN_CLASS)) {
+    return 0;
+  } else if (size > (1 << PFWL_ALLOCATOR_MAX_CLASS)) {
+    return -1;
+  }
+  /** Number of bits needed to represent size - 1. **/
+  uint8_t bits = sizeof(unsigned long) * 8 - __builtin_clzl(size - 1);
+  return bits - PFWL_ALLOCATOR_MIN_CLASS;
+}
+
+static void pfwl_allocator_new_slab(pfwl_allocator_t *allocator,
+                                    int8_t size_class) {
+  void *slab;
+  /** Slabs placed on a node must not share pages with other objects. **/
+  size_t alignment = PFWL_CACHE_LINE_SIZE;
+  if (allocator->node >= 0) {
+    alignment = sysconf(_SC_PAGESIZE);
+  }
+  if (posix_memalign(&slab, alignment, PFWL_ALLOCATOR_SLAB_SIZE)) {
+    return;
+  }
+  if (allocator->node >= 0) {
+    /** Best effort, the slab is used even if it can't be moved. **/
+    pfwl_numa_bind(slab, PFWL_ALLOCATOR_SLAB_SIZE, allocator->node);
+  }
+  *(void **) slab = allocator->slabs;
+  allocator->slabs = slab;
+  allocator->reserved += PFWL_ALLOCATOR_SLAB_SIZE;
+
+  size_t object_size = 1 << (size_class + PFWL_ALLOCATOR_MIN_CLASS);
+  unsigned char *object = (unsigned char *) slab + PFWL_ALLOCATOR_SLAB_HEADER;
+  unsigned char *end = (unsigned char *) slab + PFWL_ALLOCATOR_SLAB_SIZE;
+  while (object + object_size <= end) {
+    *(void **) object = allocator->free_objects[size_class];
+    allocator->free_objects[size_class] = object;
+    object += object_size;
+  }
+}
+
+void pfwl_allocator_init(pfwl_allocator_t *allocator,
+                         pfwl_memory_allocator_t type) {
+  memset(allocator, 0, sizeof(pfwl_allocator_t));
+  allocator->type = type;
+  allocator->node = -1;
+}
+
+void pfwl_allocator_destroy(pfwl_allocator_t *allocator) {
+  void *slab = allocator->slabs;
+  while (slab) {
+    void *next = *(void **) slab;
+    free(slab);
+    slab = next;
+  }
+  int16_t node = allocator->node;
+  pfwl_allocator_init(allocator, allocator->type);
+  allocator->node = node;
+}
+
+uint8_t pfwl_allocator_set_node(pfwl_allocator_t *allocator, int16_t node) {
+  allocator->node = node;
+  if (node < 0) {
+    return 0;
+  }
+  uint8_t r = 0;
+  for (void *slab = allocator->slabs; slab; slab = *(void **) slab) {
+    r |= pfwl_numa_bind(slab, PFWL_ALLOCATOR_SLAB_SIZE, node);
+  }
+  return r;
+}
+
+void pfwl_allocator_account_alloc(pfwl_allocator_t *allocator,
+                                  pfwl_memory_type_t type, size_t size) {
+  allocator->used[type] += size;
+  if (allocator->used[type] > allocator->high_water[type]) {
+    allocator->high_water[type] = allocator->used[type];
+  }
+}
+
+void pfwl_allocator_account_free(pfwl_allocator_t *allocator,
+                                 pfwl_memory_type_t type, size_t size) {
+  allocator->used[type] -= size;
+}
+
+void *pfwl_allocator_alloc(pfwl_allocator_t *allocator, pfwl_memory_type_t type,
+                           size_t size) {
+  if (allocator == NULL) {
+    return malloc(size);
+  }
+  void *r = NULL;
+  int8_t size_class = pfwl_allocator_class(size);
+  if (allocator->type == PFWL_MEMORY_ALLOCATOR_SLAB && size_class >= 0) {
+    if (unlikely(allocator->free_objects[size_class] == NULL)) {
+      pfwl_allocator_new_slab(allocator, size_class);
+    }
+    r = allocator->free_objects[size_class];
+    if (likely(r != NULL)) {
+      allocator->free_objects[size_class] = *(void **) r;
+    }
+  } else {
+    r = malloc(size);
+  }
+  if (likely(r != NULL)) {
+    pfwl_allocator_account_alloc(allocator, type, size);
+  }
+  return r;
+}
+
+void pfwl_allocator_free(pfwl_allocator_t *allocator, pfwl_memory_type_t type,
+                         void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return;
+  }
+  if (allocator == NULL) {
+    free(ptr);
+    return;
+  }
+  int8_t size_class = pfwl_allocator_class(size);
+  if (allocator->type == PFWL_MEMORY_ALLOCATOR_SLAB && size_class >= 0) {
+    *(void **) ptr = allocator->free_objects[size_class];
+    allocator->free_objects[size_class] = ptr;
+  } else {
+    free(ptr);
+  }
+  pfwl_allocator_account_free(allocator, type, size);
+}
+
+void *pfwl_allocator_realloc(pfwl_allocator_t *allocator,
+                             pfwl_memory_type_t type, void *ptr,
+                             size_t old_size, size_t new_size) {
+  if (allocator == NULL) {
+    return realloc(ptr, new_size);
+  }
+  if (allocator->type == PFWL_MEMORY_ALLOCATOR_MALLOC) {
+    void *r = realloc(ptr, new_size);
+    if (r) {
+      pfwl_allocator_account_free(allocator, type, old_size);
+      pfwl_allocator_account_alloc(allocator, type, new_size);
+    }
+    return r;
+  }
+  if (ptr && pfwl_allocator_class(old_size) >= 0 &&
+      pfwl_allocator_class(old_size) == pfwl_allocator_class(new_size)) {
+    /** Still fits in the same object. **/
+    pfwl_allocator_account_free(allocator, type, old_size);
+    pfwl_allocator_account_alloc(allocator, type, new_size);
+    return ptr;
+  }
+  void *r = pfwl_allocator_alloc(allocator, type, new_size);
+  if (r && ptr) {
+    memcpy(r, ptr, old_size < new_size ? old_size : new_size);
+    pfwl_allocator_free(allocator, type, ptr, old_size);
+  }
+  return r;
+}
+
+void pfwl_allocator_get_stats(pfwl_allocator_t *allocator,
+                              pfwl_memory_stats_t *stats) {
+  for (size_t i = 0; i < PFWL_MEMORY_NUM; i++) {
+    stats->used[i] += allocator->used[i];
+    stats->high_water[i] += allocator->high_water[i];
+  }
+  stats->reserved += allocator->reserved;
+}
+
+uint8_t pfwl_numa_bind(void *ptr, size_t size, int16_t node) {
+#if defined(__linux__) && defined(SYS_mbind)
+  if (node < 0 || node >= PFWL_NUMA_MAX_NODES) {
+    return 1;
+  }
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t start = ((uintptr_t) ptr + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t) ptr + size) & ~(page - 1);
+  if (start >= end) {
+    /** No page fully contained in the area. **/
+    return 0;
+  }
+  unsigned long nodes[PFWL_NUMA_MAX_NODES / (sizeof(unsigned long) * 8)];
+  memset(nodes, 0, sizeof(nodes));
+  nodes[node / (sizeof(unsigned long) * 8)] =
+      1UL << (node % (sizeof(unsigned long) * 8));
+  /**
+   * Preferred rather than bound, so that the allocations do not fail when
+   * the node is out of memory. The kernel ignores the last bit of the mask.
+   **/
+  return syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, nodes,
+                 PFWL_NUMA_MAX_NODES + 1, MPOL_MF_MOVE) != 0;
+#else
+  (void) ptr;
+  (void) size;
+  (void) node;
+  return 1;
+#endif
+}
+
+int16_t pfwl_numa_node_of_cpu(uint16_t cpu) {
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+  DIR *dir = opendir(path);
+  if (!dir) {
+    return -1;
+  }
+  /** The directory of a processor links to the one of its node. **/
+  int node = -1;
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (!strncmp(entry->d_name, "node", 4) &&
+        sscanf(entry->d_name + 4, "%d", &node) == 1) {
+      break;
+    }
+    node = -1;
+  }
+  closedir(dir);
+  return node < PFWL_NUMA_MAX_NODES ? node : -1;
+}
@@ -34,15 +34,16 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <math.h>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
-
-#if PFWL_NUMA_AWARE
-#include <numa.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
 #endif
 
 #define PFWL_CACHE_LINES_PADDING_REQUIRED(size)                                \
@@ -56,18 +57,18 @@
       fprintf(stdout, fmt, __VA_ARGS__);                                       \
   } while (0)
 
-#define PFWL_FLOW_TABLE_MAX_IDLE_TIME 30 /** In seconds. **/
-#define PFWL_FLOW_TABLE_WALK_TIME 1      /** In seconds. **/
+#define PFWL_FLOW_TABLE_WALK_TIME 1 /** In seconds. **/
 
-static inline pfwl_flow_t *v4_flow_alloc() {
+static inline pfwl_flow_t *pfwl_flow_alloc(pfwl_allocator_t *allocator) {
   void *r;
-#if PFWL_NUMA_AWARE
-  r = numa_alloc_onnode(sizeof(ipv4_flow_t), PFWL_NUMA_AWARE_FLOW_TABLE_NODE);
-  assert(r);
-#else
+  if (allocator->type == PFWL_MEMORY_ALLOCATOR_SLAB) {
+    r = pfwl_allocator_alloc(allocator, PFWL_MEMORY_FLOWS, sizeof(pfwl_flow_t));
+    assert(r);
+    return (pfwl_flow_t *) r;
+  }
 #if PFWL_FLOW_TABLE_ALIGN_FLOWS
   int tmp =
-      posix_memalign((void **) &r, PFWL_CACHE_LINE_SIZE, sizeof(ipv4_flow_t));
+      posix_memalign((void **) &r, PFWL_CACHE_LINE_SIZE, sizeof(pfwl_flow_t));
   if (tmp) {
     assert("Failure on posix_memalign" == 0);
   }
@@ -75,16 +76,21 @@ static inline pfwl_flow_t *v4_flow_alloc() {
   r = malloc(sizeof(pfwl_flow_t));
   assert(r);
 #endif
-#endif
+  pfwl_allocator_account_alloc(allocator, PFWL_MEMORY_FLOWS,
+                               sizeof(pfwl_flow_t));
   return (pfwl_flow_t *) r;
 }
 
-static inline void pfwl_flow_free(pfwl_flow_t *flow) {
-#if PFWL_NUMA_AWARE
-  numa_free(flow, sizeof(ipv4_flow_t));
-#else
+static inline void pfwl_flow_free(pfwl_allocator_t *allocator,
+                                  pfwl_flow_t *flow) {
+  if (allocator->type == PFWL_MEMORY_ALLOCATOR_SLAB) {
+    pfwl_allocator_free(allocator, PFWL_MEMORY_FLOWS, flow,
+                        sizeof(pfwl_flow_t));
+    return;
+  }
   free(flow);
-#endif
+  pfwl_allocator_account_free(allocator, PFWL_MEMORY_FLOWS,
+                              sizeof(pfwl_flow_t));
 }
 
 typedef uint32_t(pfwl_fnv_hash_function)(pfwl_dissection_info_t *in,
@@ -102,21 +108,22 @@ typedef struct pfwl_flow_DB_partition_specific_informations {
                               // do not clean immediately, to give the user the
                               // possibility to get the last data found.
   uint64_t next_flow_id;
+  /** Released inspectors state, one list per type. **/
+  void *inspectors_state_free[PFWL_INSPECTOR_STATE_NUM];
+  /**
+   * Memory for flows, fragments and buffers of this partition. Its node is
+   * the NUMA node of the partition.
+   **/
+  pfwl_allocator_t allocator;
+  /** Sentinels of the expiration lists, one per pfwl_flow_timeout_t. **/
+  pfwl_flow_expiration_node_t expiration[PFWL_FLOW_TIMEOUT_NUM];
+  /** Out of order TCP segments of the flows of this partition. **/
+  pfwl_tcp_reassembly_partition_t tcp_reassembly;
 } pfwl_flow_DB_partition_specific_informations_t;
 
 typedef struct pfwl_flow_table_partition {
   struct pfwl_flow_table_real_partition {
     pfwl_flow_DB_partition_specific_informations_t info;
-#if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-    /**
-     * If an integer x is contained in this array, then
-     * memory_chunk_lower_bound[i] can be used.
-     **/
-    uint32_t *pool;
-    uint32_t pool_size;
-    pfwl_flow_t *memory_chunk_lower_bound;
-    pfwl_flow_t *memory_chunk_upper_bound;
-#endif
   } partition;
   /**
    * Using padding each partition will go in a separate cache line
@@ -127,6 +134,26 @@ typedef struct pfwl_flow_table_partition {
       sizeof(struct pfwl_flow_table_real_partition))];
 } pfwl_flow_table_partition_t;
 
+/**
+ * Bucket of the bucketed (open addressing) engine. It fits a cache line,
+ * so that a lookup only needs to compare the fingerprints stored in the
+ * bucket, and reads a flow only when its fingerprint matches.
+ **/
+#define PFWL_FLOW_TABLE_BUCKET_SLOTS 6
+
+typedef struct pfwl_flow_bucket {
+  uint16_t fingerprints[PFWL_FLOW_TABLE_BUCKET_SLOTS];
+  /**
+   * Number of flows whose home bucket precedes this one but that are
+   * stored after it (because this bucket was full when they were
+   * inserted). When zero, lookups can stop at this bucket.
+   **/
+  uint16_t displaced;
+  uint8_t used; // One bit per slot.
+  uint8_t padding;
+  pfwl_flow_t *flows[PFWL_FLOW_TABLE_BUCKET_SLOTS];
+} pfwl_flow_bucket_t;
+
 struct pfwl_flow_table {
   /**
    *  The flow table may be shared among multiple threads. In this
@@ -135,20 +162,20 @@ struct pfwl_flow_table {
    *  the thread's partition specific informations.
    */
   pfwl_flow_t *table;
+  pfwl_flow_bucket_t *buckets;
+  pfwl_flow_table_engine_t engine;
   pfwl_flow_cleaner_callback_t *flow_cleaner_callback;
   pfwl_flow_termination_callback_t *flow_termination_callback;
-#if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_MURMUR3_HASH
+  pfwl_flow_table_hash_t hash;
   uint32_t seed;
-#endif
   uint32_t total_size;
   pfwl_flow_table_partition_t *partitions;
   uint16_t num_partitions;
+  uint32_t partition_size;
   uint32_t max_active_flows;
   uint32_t max_active_flows_strict;
-#if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-  uint32_t individual_pool_size;
-  uint32_t start_pool_size;
-#endif
+  uint32_t timeouts[PFWL_FLOW_TIMEOUT_NUM]; /** In seconds. **/
+  pfwl_tcp_reassembly_budget_t tcp_reordering_budget;
 };
 
 #ifndef PFWL_DEBUG
@@ -172,38 +199,31 @@ static
 #endif
     uint8_t
     v6_equals(pfwl_flow_t *flow, pfwl_dissection_info_t *pkt_info) {
-  uint8_t i;
-
-  /*1: src=src and dst=dst. 2: src=dst and dst=src. */
-  uint8_t direction = 0;
-
-  for (i = 0; i < 16; i++) {
-    if (direction != 2 &&
-        pkt_info->l3.addr_src.ipv6.s6_addr[i] ==
-            flow->info.addr_src.ipv6.s6_addr[i] &&
-        pkt_info->l3.addr_dst.ipv6.s6_addr[i] ==
-            flow->info.addr_dst.ipv6.s6_addr[i]) {
-      direction = 1;
-    } else if (direction != 1 &&
-               pkt_info->l3.addr_src.ipv6.s6_addr[i] ==
-                   flow->info.addr_dst.ipv6.s6_addr[i] &&
-               pkt_info->l3.addr_dst.ipv6.s6_addr[i] ==
-                   flow->info.addr_src.ipv6.s6_addr[i]) {
-      direction = 2;
-    } else
-      return 0;
-  }
-
-  if (direction == 1)
-    return flow->info.port_src == pkt_info->l4.port_src &&
-           flow->info.port_dst == pkt_info->l4.port_dst &&
-           flow->info.protocol_l4 == pkt_info->l4.protocol;
-  else if (direction == 2)
-    return flow->info.port_src == pkt_info->l4.port_dst &&
-           flow->info.port_dst == pkt_info->l4.port_src &&
-           flow->info.protocol_l4 == pkt_info->l4.protocol;
-  else
-    return 0;
+  uint8_t same, swapped;
+#if defined(__SSE2__)
+  __m128i ps = _mm_loadu_si128((const __m128i *) &(pkt_info->l3.addr_src.ipv6));
+  __m128i pd = _mm_loadu_si128((const __m128i *) &(pkt_info->l3.addr_dst.ipv6));
+  __m128i fs = _mm_loadu_si128((const __m128i *) &(flow->info.addr_src.ipv6));
+  __m128i fd = _mm_loadu_si128((const __m128i *) &(flow->info.addr_dst.ipv6));
+  same = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(ps, fs),
+                                         _mm_cmpeq_epi8(pd, fd))) == 0xFFFF;
+  swapped = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(ps, fd),
+                                            _mm_cmpeq_epi8(pd, fs))) == 0xFFFF;
+#else
+  same = !memcmp(&(pkt_info->l3.addr_src.ipv6), &(flow->info.addr_src.ipv6),
+                 sizeof(struct in6_addr)) &&
+         !memcmp(&(pkt_info->l3.addr_dst.ipv6), &(flow->info.addr_dst.ipv6),
+                 sizeof(struct in6_addr));
+  swapped = !memcmp(&(pkt_info->l3.addr_src.ipv6), &(flow->info.addr_dst.ipv6),
+                    sizeof(struct in6_addr)) &&
+            !memcmp(&(pkt_info->l3.addr_dst.ipv6), &(flow->info.addr_src.ipv6),
+                    sizeof(struct in6_addr));
+#endif
+  return ((same && flow->info.port_src == pkt_info->l4.port_src &&
+           flow->info.port_dst == pkt_info->l4.port_dst) ||
+          (swapped && flow->info.port_src == pkt_info->l4.port_dst &&
+           flow->info.port_dst == pkt_info->l4.port_src)) &&
+         flow->info.protocol_l4 == pkt_info->l4.protocol;
 }
 
 #ifndef PFWL_DEBUG
@@ -218,6 +238,130 @@ static
   }
 }
 
+/**
+ * Direction independent 16 bits digest of the 5-tuple, stored in the
+ * buckets to avoid reading the flows which cannot match.
+ **/
+static inline uint16_t flow_fingerprint(const pfwl_dissection_info_t *pkt_info) {
+  uint32_t h;
+  if (pkt_info->l3.protocol == PFWL_PROTO_L3_IPV4) {
+    h = pkt_info->l3.addr_src.ipv4 + pkt_info->l3.addr_dst.ipv4;
+  } else {
+    const uint32_t *src = (const uint32_t *) &(pkt_info->l3.addr_src.ipv6);
+    const uint32_t *dst = (const uint32_t *) &(pkt_info->l3.addr_dst.ipv6);
+    h = (src[0] + dst[0]) ^ (src[1] + dst[1]) ^ (src[2] + dst[2]) ^
+        (src[3] + dst[3]);
+  }
+  h ^= ((uint32_t)(pkt_info->l4.port_src + pkt_info->l4.port_dst) << 8) ^
+       pkt_info->l4.protocol;
+  /** Murmur3 finalizer. **/
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return (uint16_t) h;
+}
+
+/**
+ * Buckets are probed linearly, wrapping around inside the partition
+ * the home bucket belongs to, so that different partitions never
+ * share buckets.
+ **/
+static inline uint32_t
+bucket_next(pfwl_flow_DB_partition_specific_informations_t *info,
+            uint32_t bucket) {
+  return bucket == info->highest_index ? info->lowest_index : bucket + 1;
+}
+
+static pfwl_flow_t *
+bucket_find_flow(pfwl_flow_table_t *db,
+                 pfwl_flow_DB_partition_specific_informations_t *info,
+                 uint32_t index, pfwl_dissection_info_t *pkt_info) {
+  uint16_t fingerprint = flow_fingerprint(pkt_info);
+  uint32_t b = index;
+  do {
+    pfwl_flow_bucket_t *bucket = &(db->buckets[b]);
+    for (uint8_t i = 0; i < PFWL_FLOW_TABLE_BUCKET_SLOTS; i++) {
+      if ((bucket->used & (1 << i)) &&
+          bucket->fingerprints[i] == fingerprint &&
+          flow_equals(bucket->flows[i], pkt_info)) {
+        return bucket->flows[i];
+      }
+    }
+    if (!bucket->displaced) {
+      break;
+    }
+    b = bucket_next(info, b);
+  } while (b != index);
+  return NULL;
+}
+
+static uint8_t
+bucket_insert_flow(pfwl_flow_table_t *db,
+                   pfwl_flow_DB_partition_specific_informations_t *info,
+                   uint32_t index, pfwl_flow_t *flow,
+                   pfwl_dissection_info_t *pkt_info) {
+  const uint8_t full = (1 << PFWL_FLOW_TABLE_BUCKET_SLOTS) - 1;
+  uint32_t b = index;
+  while (db->buckets[b].used == full) {
+    b = bucket_next(info, b);
+    if (b == index) {
+      return 1;
+    }
+  }
+  for (uint32_t d = index; d != b; d = bucket_next(info, d)) {
+    ++db->buckets[d].displaced;
+  }
+  pfwl_flow_bucket_t *bucket = &(db->buckets[b]);
+  uint8_t slot = __builtin_ctz(~bucket->used & full);
+  bucket->used |= (1 << slot);
+  bucket->fingerprints[slot] = flow_fingerprint(pkt_info);
+  bucket->flows[slot] = flow;
+  flow->bucket = index;
+  return 0;
+}
+
+static void
+bucket_remove_flow(pfwl_flow_table_t *db,
+                   pfwl_flow_DB_partition_specific_informations_t *info,
+                   pfwl_flow_t *flow) {
+  uint32_t b = flow->bucket;
+  while (1) {
+    pfwl_flow_bucket_t *bucket = &(db->buckets[b]);
+    for (uint8_t i = 0; i < PFWL_FLOW_TABLE_BUCKET_SLOTS; i++) {
+      if ((bucket->used & (1 << i)) && bucket->flows[i] == flow) {
+        bucket->used &= ~(1 << i);
+        bucket->flows[i] = NULL;
+        return;
+      }
+    }
+    --bucket->displaced;
+    b = bucket_next(info, b);
+    assert(b != flow->bucket);
+  }
+}
+
+static const size_t
+    pfwl_inspector_state_size[PFWL_INSPECTOR_STATE_NUM] = {
+        [PFWL_INSPECTOR_STATE_HTTP] = sizeof(pfwl_http_inspector_state_t),
+        [PFWL_INSPECTOR_STATE_SIP] = sizeof(pfwl_sip_internal_information_t),
+        [PFWL_INSPECTOR_STATE_STUN] = sizeof(pfwl_stun_internal_information_t),
+};
+
+static void pfwl_flow_table_free_inspectors_state_pool(
+    pfwl_flow_DB_partition_specific_informations_t *table_informations) {
+  for (uint8_t t = 0; t < PFWL_INSPECTOR_STATE_NUM; t++) {
+    while (table_informations->inspectors_state_free[t]) {
+      void *next = *(void **) table_informations->inspectors_state_free[t];
+      pfwl_allocator_free(&(table_informations->allocator), PFWL_MEMORY_FLOWS,
+                          table_informations->inspectors_state_free[t],
+                          pfwl_inspector_state_size[t]);
+      table_informations->inspectors_state_free[t] = next;
+    }
+  }
+}
+
 #ifndef PFWL_DEBUG
 static
 #endif
@@ -226,6 +370,8 @@ static
         pfwl_flow_DB_partition_specific_informations_t *table_informations,
         uint32_t lowest_index, uint32_t highest_index,
         uint32_t max_active_flows) {
+  /** Partitions may be set up again, drop the old pools. **/
+  pfwl_flow_table_free_inspectors_state_pool(table_informations);
   table_informations->lowest_index = lowest_index;
   table_informations->highest_index = highest_index;
   table_informations->max_active_flows = max_active_flows;
@@ -239,6 +385,16 @@ static
 static void pfwl_flow_table_update_flow_count(pfwl_flow_table_t *db) {
   pfwl_flow_t *cur;
   if (db != NULL) {
+    if (db->buckets != NULL) {
+      for (uint16_t j = 0; j < db->num_partitions; ++j) {
+        db->partitions[j].partition.info.active_flows = 0;
+        for (uint32_t i = db->partitions[j].partition.info.lowest_index;
+             i <= db->partitions[j].partition.info.highest_index; ++i) {
+          db->partitions[j].partition.info.active_flows +=
+              __builtin_popcount(db->buckets[i].used);
+        }
+      }
+    }
     if (db->table != NULL) {
       for (uint16_t j = 0; j < db->num_partitions; ++j) {
         db->partitions[j].partition.info.active_flows = 0;
@@ -255,60 +411,90 @@ static void pfwl_flow_table_update_flow_count(pfwl_flow_table_t *db) {
   }
 }
 
-#if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-pfwl_flow_DB_v4_t *pfwl_flow_table_create(uint32_t size,
-                                          uint32_t max_active_v4_flows,
-                                          uint16_t num_partitions,
-                                          uint32_t start_pool_size) {
-#else
 pfwl_flow_table_t *pfwl_flow_table_create(uint32_t expected_flows,
                                           uint8_t strict,
-                                          uint16_t num_partitions) {
-#endif
+                                          uint16_t num_partitions,
+                                          pfwl_flow_table_engine_t engine) {
   pfwl_flow_table_t *table = NULL;
-  if(expected_flows < PFWL_DEFAULT_FLOW_TABLE_AVG_BUCKET_SIZE){
-    expected_flows = PFWL_DEFAULT_FLOW_TABLE_AVG_BUCKET_SIZE;
+  uint32_t avg_bucket_size = PFWL_DEFAULT_FLOW_TABLE_AVG_BUCKET_SIZE;
+  if (engine == PFWL_FLOW_TABLE_ENGINE_BUCKETED) {
+    avg_bucket_size = PFWL_DEFAULT_FLOW_TABLE_FLOWS_PER_BUCKET;
+  }
+  if(expected_flows < avg_bucket_size){
+    expected_flows = avg_bucket_size;
+  }
+  uint32_t size = expected_flows / avg_bucket_size;
+  if (size < num_partitions) {
+    size = num_partitions;
   }
-  uint32_t size = expected_flows / PFWL_DEFAULT_FLOW_TABLE_AVG_BUCKET_SIZE;
   if (size != 0) {
     table = (pfwl_flow_table_t *) malloc(sizeof(pfwl_flow_table_t));
     assert(table);
-    table->table = (pfwl_flow_t *) malloc(sizeof(pfwl_flow_t) * size);
-    assert(table->table);
+    table->engine = engine;
+    table->table = NULL;
+    table->buckets = NULL;
+    if (engine == PFWL_FLOW_TABLE_ENGINE_BUCKETED) {
+      int tmp = posix_memalign((void **) &(table->buckets),
+                               PFWL_CACHE_LINE_SIZE,
+                               sizeof(pfwl_flow_bucket_t) * size);
+      if (tmp) {
+        assert("Failure on posix_memalign" == 0);
+      }
+      memset(table->buckets, 0, sizeof(pfwl_flow_bucket_t) * size);
+    } else {
+      table->table = (pfwl_flow_t *) malloc(sizeof(pfwl_flow_t) * size);
+      assert(table->table);
+      for (uint32_t i = 0; i < size; i++) {
+        /** Creation of sentinel node. **/
+        table->table[i].next = &(table->table[i]);
+        table->table[i].prev = &(table->table[i]);
+      }
+    }
     table->total_size = size;
     table->num_partitions = num_partitions;
     table->max_active_flows = expected_flows;
     table->max_active_flows_strict = strict;
     table->flow_cleaner_callback = NULL;
     table->flow_termination_callback = NULL;
-#if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-    table->start_pool_size = start_pool_size;
-#endif
-
-    for (uint32_t i = 0; i < table->total_size; i++) {
-      /** Creation of sentinel node. **/
-      table->table[i].next = &(table->table[i]);
-      table->table[i].prev = &(table->table[i]);
-    }
+    table->timeouts[PFWL_FLOW_TIMEOUT_TCP] = PFWL_DEFAULT_FLOW_TIMEOUT_TCP;
+    table->timeouts[PFWL_FLOW_TIMEOUT_TCP_CLOSED] =
+        PFWL_DEFAULT_FLOW_TIMEOUT_TCP_CLOSED;
+    table->timeouts[PFWL_FLOW_TIMEOUT_UDP] = PFWL_DEFAULT_FLOW_TIMEOUT_UDP;
+    table->timeouts[PFWL_FLOW_TIMEOUT_OTHER] = PFWL_DEFAULT_FLOW_TIMEOUT_OTHER;
+    table->tcp_reordering_budget.per_flow =
+        PFWL_TCP_REORDERING_DEFAULT_PER_FLOW_MEMORY_LIMIT;
+    table->tcp_reordering_budget.per_partition =
+        PFWL_TCP_REORDERING_DEFAULT_PER_PARTITION_MEMORY_LIMIT;
+    table->tcp_reordering_budget.total =
+        PFWL_TCP_REORDERING_DEFAULT_TOTAL_MEMORY_LIMIT;
+    table->tcp_reordering_budget.used = 0;
 
-#if PFWL_NUMA_AWARE
-    table->partitions = numa_alloc_onnode(sizeof(pfwl_flow_DB_v4_partition_t) *
-                                              table->num_partitions,
-                                          PFWL_NUMA_AWARE_FLOW_TABLE_NODE);
-    assert(table->partitions);
-#else
     int tmp = posix_memalign(
         (void **) &(table->partitions), PFWL_CACHE_LINE_SIZE,
         sizeof(pfwl_flow_table_partition_t) * table->num_partitions);
     if (tmp) {
       assert("Failure on posix_memalign" == 0);
     }
-#endif
+    memset(table->partitions, 0,
+           sizeof(pfwl_flow_table_partition_t) * table->num_partitions);
+    for (uint16_t j = 0; j < table->num_partitions; ++j) {
+      pfwl_allocator_init(&(table->partitions[j].partition.info.allocator),
+                          PFWL_MEMORY_ALLOCATOR_MALLOC);
+      for (uint8_t t = 0; t < PFWL_FLOW_TIMEOUT_NUM; t++) {
+        /** Creation of sentinel node. **/
+        pfwl_flow_expiration_node_t *sentinel =
+            &(table->partitions[j].partition.info.expiration[t]);
+        sentinel->next = sentinel;
+        sentinel->prev = sentinel;
+      }
+      pfwl_tcp_reassembly_partition_init(
+          &(table->partitions[j].partition.info.tcp_reassembly),
+          &(table->tcp_reordering_budget));
+    }
 
-#if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_MURMUR3_HASH
+    table->hash = (pfwl_flow_table_hash_t) PFWL_FLOW_TABLE_HASH_VERSION;
     srand((unsigned int) time(NULL));
     table->seed = rand();
-#endif
 
     pfwl_flow_table_setup_partitions(table, table->num_partitions);
   } else
@@ -316,6 +502,131 @@ pfwl_flow_table_t *pfwl_flow_table_create(uint32_t expected_flows,
   return table;
 }
 
+/** 1 if the code of the hash function was compiled. **/
+#define PFWL_HASH_COMPILED(h)                                                  \
+  (PFWL_FLOW_TABLE_HASH_VERSION == (h) || PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE == 1)
+
+uint8_t pfwl_flow_table_set_hash(pfwl_flow_table_t *db,
+                                 pfwl_flow_table_hash_t hash) {
+  switch (hash) {
+#if PFWL_HASH_COMPILED(PFWL_SIMPLE_HASH)
+  case PFWL_FLOW_TABLE_HASH_SIMPLE:
+#endif
+#if PFWL_HASH_COMPILED(PFWL_FNV_HASH)
+  case PFWL_FLOW_TABLE_HASH_FNV:
+#endif
+#if PFWL_HASH_COMPILED(PFWL_MURMUR3_HASH)
+  case PFWL_FLOW_TABLE_HASH_MURMUR3:
+#endif
+#if PFWL_HASH_COMPILED(PFWL_BKDR_HASH)
+  case PFWL_FLOW_TABLE_HASH_BKDR:
+#endif
+#if PFWL_HASH_COMPILED(PFWL_CRC32C_HASH)
+  case PFWL_FLOW_TABLE_HASH_CRC32C:
+#endif
+#if PFWL_HASH_COMPILED(PFWL_XXHASH_HASH)
+  case PFWL_FLOW_TABLE_HASH_XXHASH:
+#endif
+    break;
+  default:
+    return 1;
+  }
+  for (uint16_t j = 0; j < db->num_partitions; ++j) {
+    if (db->partitions[j].partition.info.active_flows) {
+      return 1;
+    }
+  }
+  db->hash = hash;
+  return 0;
+}
+
+uint8_t pfwl_flow_table_memory_in_use(pfwl_flow_table_t *db) {
+  for (uint16_t j = 0; j < db->num_partitions; ++j) {
+    if (db->partitions[j].partition.info.active_flows) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+uint8_t pfwl_flow_table_set_memory_allocator(pfwl_flow_table_t *db,
+                                             pfwl_memory_allocator_t type) {
+  if (pfwl_flow_table_memory_in_use(db)) {
+    return 1;
+  }
+  for (uint16_t j = 0; j < db->num_partitions; ++j) {
+    pfwl_flow_DB_partition_specific_informations_t *info =
+        &(db->partitions[j].partition.info);
+    pfwl_flow_table_free_inspectors_state_pool(info);
+    pfwl_allocator_destroy(&(info->allocator));
+    info->allocator.type = type;
+  }
+  return 0;
+}
+
+void pfwl_flow_table_set_tcp_reordering_limits(pfwl_flow_table_t *db,
+                                               uint32_t per_flow,
+                                               uint32_t per_partition,
+                                               uint32_t total) {
+  db->tcp_reordering_budget.per_flow = per_flow;
+  db->tcp_reordering_budget.per_partition = per_partition;
+  db->tcp_reordering_budget.total = total;
+}
+
+void pfwl_flow_table_get_tcp_reordering_stats(
+    pfwl_flow_table_t *db, pfwl_tcp_reordering_stats_t *stats) {
+  for (uint16_t j = 0; j < db->num_partitions; ++j) {
+    pfwl_tcp_reassembly_partition_t *p =
+        &(db->partitions[j].partition.info.tcp_reassembly);
+    stats->used += p->used;
+    stats->high_water += p->high_water;
+    stats->dropped_segments += p->dropped_segments;
+    stats->dropped_bytes += p->dropped_bytes;
+    stats->evicted_streams += p->evicted_streams;
+  }
+}
+
+void pfwl_flow_table_get_memory_stats(pfwl_flow_table_t *db,
+                                      pfwl_memory_stats_t *stats) {
+  for (uint16_t j = 0; j < db->num_partitions; ++j) {
+    pfwl_allocator_get_stats(&(db->partitions[j].partition.info.allocator),
+                             stats);
+  }
+}
+
+uint8_t pfwl_flow_table_set_partition_node(pfwl_flow_table_t *db,
+                                           uint16_t partition, int16_t node) {
+  pfwl_flow_DB_partition_specific_informations_t *info =
+      &(db->partitions[partition].partition.info);
+  uint8_t r = pfwl_allocator_set_node(&(info->allocator), node);
+  if (node >= 0) {
+    uint32_t entries = info->highest_index - info->lowest_index + 1;
+    if (db->buckets) {
+      r |= pfwl_numa_bind(&(db->buckets[info->lowest_index]),
+                          sizeof(pfwl_flow_bucket_t) * entries, node);
+    } else {
+      r |= pfwl_numa_bind(&(db->table[info->lowest_index]),
+                          sizeof(pfwl_flow_t) * entries, node);
+    }
+  }
+  return r;
+}
+
+void pfwl_flow_table_get_node_memory_stats(pfwl_flow_table_t *db, int16_t node,
+                                           pfwl_memory_stats_t *stats) {
+  for (uint16_t j = 0; j < db->num_partitions; ++j) {
+    pfwl_allocator_t *allocator = &(db->partitions[j].partition.info.allocator);
+    if ((allocator->node < 0 ? 0 : allocator->node) == node) {
+      pfwl_allocator_get_stats(allocator, stats);
+    }
+  }
+}
+
+void pfwl_flow_table_set_timeout(pfwl_flow_table_t *db,
+                                 pfwl_flow_timeout_t type, uint32_t seconds) {
+  db->timeouts[type] = seconds;
+}
+
 void pflw_flow_table_set_flow_cleaner_callback(
     pfwl_flow_table_t *db,
     pfwl_flow_cleaner_callback_t *flow_cleaner_callback) {
@@ -333,6 +644,7 @@ void pfwl_flow_table_setup_partitions(pfwl_flow_table_t *table,
   /** Partitions management. **/
   uint32_t partition_size =
       ceil((float) table->total_size / (float) table->num_partitions);
+  table->partition_size = partition_size;
   uint32_t partition_max_active_v4_flows =
       table->max_active_flows / table->num_partitions;
 
@@ -356,58 +668,34 @@ void pfwl_flow_table_setup_partitions(pfwl_flow_table_t *table,
       highest_index = table->total_size - 1;
     else
       highest_index += partition_size;
-
-#if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-    ipv4_flow_t *flow_pool;
-    uint32_t i;
-    table->individual_pool_size =
-        table->start_pool_size / table->num_partitions;
-#if PFWL_NUMA_AWARE
-    flow_pool =
-        numa_alloc_onnode(sizeof(ipv4_flow_t) * table->individual_pool_size,
-                          PFWL_NUMA_AWARE_FLOW_TABLE_NODE);
-    assert(flow_pool);
-    table->partitions[j].partition.pool =
-        numa_alloc_onnode(sizeof(uint32_t) * table->individual_pool_size,
-                          PFWL_NUMA_AWARE_FLOW_TABLE_NODE);
-    assert(table->partitions[j].partition.pool);
-#else
-    int tmp =
-        posix_memalign((void **) &flow_pool, PFWL_CACHE_LINE_SIZE,
-                       (sizeof(ipv4_flow_t) * table->individual_pool_size) +
-                           PFWL_CACHE_LINE_SIZE);
-    if (tmp) {
-      assert("Failure on posix_memalign" == 0);
-    }
-    tmp = posix_memalign((void **) &(table->partitions[j].partition.pool),
-                         PFWL_CACHE_LINE_SIZE,
-                         (sizeof(uint32_t) * table->individual_pool_size) +
-                             PFWL_CACHE_LINE_SIZE);
-    if (tmp) {
-      assert("Failure on posix_memalign" == 0);
-    }
-#endif
-    for (i = 0; i < table->individual_pool_size; i++) {
-      table->partitions[j].partition.pool[i] = i;
-    }
-    table->partitions[j].partition.pool_size = table->individual_pool_size;
-    table->partitions[j].partition.memory_chunk_lower_bound = flow_pool;
-    table->partitions[j].partition.memory_chunk_upper_bound =
-        flow_pool + table->individual_pool_size;
-#endif
   }
   debug_print("%s\n", "[flow_table.c]: Computing active v4 flows.");
   pfwl_flow_table_update_flow_count(table);
   debug_print("%s\n", "[flow_table.c]: Active v4 flows computation finished.");
 }
 
+uint16_t mc_pfwl_flow_table_partition(pfwl_flow_table_t *db, uint32_t index) {
+  uint32_t partition_id = index / db->partition_size;
+  if (partition_id >= db->num_partitions) {
+    partition_id = db->num_partitions - 1;
+  }
+  return partition_id;
+}
+
 void jsonrpc_delete_parser(void* parser);
 
 void mc_pfwl_flow_table_delete_flow(pfwl_flow_table_t *db,
                                     uint16_t partition_id,
                                     pfwl_flow_t *to_delete) {
-  to_delete->prev->next = to_delete->next;
-  to_delete->next->prev = to_delete->prev;
+  if (db->engine == PFWL_FLOW_TABLE_ENGINE_BUCKETED) {
+    bucket_remove_flow(db, &(db->partitions[partition_id].partition.info),
+                       to_delete);
+  } else {
+    to_delete->prev->next = to_delete->next;
+    to_delete->next->prev = to_delete->prev;
+  }
+  to_delete->expiration.prev->next = to_delete->expiration.next;
+  to_delete->expiration.next->prev = to_delete->expiration.prev;
 
   if (db->flow_cleaner_callback){
     (*(db->flow_cleaner_callback))(*(to_delete->info.udata));
@@ -417,11 +705,12 @@ void mc_pfwl_flow_table_delete_flow(pfwl_flow_table_t *db,
     (*(db->flow_termination_callback))(&(to_delete->info));
   }
   --db->partitions[partition_id].partition.info.active_flows;
-  free(to_delete->info_private.http_informations[0].temp_buffer);
-  free(to_delete->info_private.http_informations[1].temp_buffer);
   pfwl_reordering_tcp_delete_all_fragments(&(to_delete->info_private));
-  if (to_delete->info_private.last_rebuilt_tcp_data) {
-    free((void *) to_delete->info_private.last_rebuilt_tcp_data);
+  if (to_delete->info_private.tcp_rebuilt_buffer) {
+    pfwl_allocator_free(&(db->partitions[partition_id].partition.info.allocator),
+                        PFWL_MEMORY_BUFFERS,
+                        to_delete->info_private.tcp_rebuilt_buffer,
+                        to_delete->info_private.tcp_rebuilt_buffer_size);
   }
   if (to_delete->info_private.last_rebuilt_ip_fragments) {
     free((void *) to_delete->info_private.last_rebuilt_ip_fragments);
@@ -431,28 +720,9 @@ void mc_pfwl_flow_table_delete_flow(pfwl_flow_table_t *db,
       to_delete->info_private.flow_cleaners_dissectors[i](&(to_delete->info_private));
     }
   }
-
-#if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-  if (likely(
-          to_delete >=
-              db->partitions[partition_id].partition.memory_chunk_lower_bound &&
-          to_delete < db->partitions[partition_id]
-                          .partition.memory_chunk_upper_bound)) {
-    debug_print("%s\n", "[flow_table.c]: Reinserting the flow"
-                        " in the pool.");
-    db->partitions[partition_id]
-        .partition.pool[db->partitions[partition_id].partition.pool_size] =
-        to_delete -
-        db->partitions[partition_id].partition.memory_chunk_lower_bound;
-    ++db->partitions[partition_id].partition.pool_size;
-  } else {
-    debug_print("%s\n", "[flow_table.c]: Poolsize exceeded,"
-                        " removing the flow.");
-    v4_flow_free(to_delete);
-  }
-#else
-  pfwl_flow_free(to_delete);
-#endif
+  pfwl_inspector_state_release_all(&(to_delete->info_private));
+  pfwl_flow_free(&(db->partitions[partition_id].partition.info.allocator),
+                 to_delete);
 }
 
 void mc_pfwl_flow_table_delete_flow_later(pfwl_flow_table_t *db,
@@ -480,34 +750,78 @@ void pfwl_flow_table_delete_flow(pfwl_flow_table_t *db,
   })
 
 
-static uint32_t get_max_idle_time(pfwl_timestamp_unit_t unit){
-  switch(unit){
-  case PFWL_TIMESTAMP_UNIT_MILLISECONDS:{
-    return PFWL_FLOW_TABLE_MAX_IDLE_TIME / 1000.0;
-  }break;
-  case PFWL_TIMESTAMP_UNIT_SECONDS:{
-    return PFWL_FLOW_TABLE_MAX_IDLE_TIME;
-  }break;
-  default:{
-    return PFWL_FLOW_TABLE_MAX_IDLE_TIME;
+static inline uint32_t to_timestamp_unit(uint32_t seconds,
+                                         pfwl_timestamp_unit_t unit) {
+  switch (unit) {
+  case PFWL_TIMESTAMP_UNIT_MILLISECONDS: {
+    return seconds * 1000;
+  } break;
+  case PFWL_TIMESTAMP_UNIT_SECONDS: {
+    return seconds;
+  } break;
+  default: { return seconds; }
   }
+}
+
+static inline pfwl_flow_t *
+expiration_node_flow(pfwl_flow_expiration_node_t *node) {
+  return (pfwl_flow_t *) ((char *) node - offsetof(pfwl_flow_t, expiration));
+}
+
+static inline uint32_t flow_last_timestamp(pfwl_flow_t *flow) {
+  return MAX(flow->info.statistics[PFWL_STAT_TIMESTAMP_LAST][0],
+             flow->info.statistics[PFWL_STAT_TIMESTAMP_LAST][1]);
+}
+
+static inline pfwl_flow_timeout_t flow_timeout(pfwl_flow_t *flow) {
+  switch (flow->info.protocol_l4) {
+  case IPPROTO_TCP: {
+    if (flow->info_private.seen_rst ||
+        (BIT_IS_SET(flow->info_private.seen_fin, 0) &&
+         BIT_IS_SET(flow->info_private.seen_fin, 1))) {
+      return PFWL_FLOW_TIMEOUT_TCP_CLOSED;
+    }
+    return PFWL_FLOW_TIMEOUT_TCP;
+  } break;
+  case IPPROTO_UDP: {
+    return PFWL_FLOW_TIMEOUT_UDP;
+  } break;
+  default: { return PFWL_FLOW_TIMEOUT_OTHER; }
   }
 }
 
-static uint32_t get_walk_time(pfwl_timestamp_unit_t unit){
-  switch(unit){
-  case PFWL_TIMESTAMP_UNIT_MILLISECONDS:{
-    return PFWL_FLOW_TABLE_WALK_TIME / 1000.0;
-  }break;
-  case PFWL_TIMESTAMP_UNIT_SECONDS:{
-    return PFWL_FLOW_TABLE_WALK_TIME;
-  }break;
-  default:{
-    return PFWL_FLOW_TABLE_WALK_TIME;
+/**
+ * Moves the flow at the end of the expiration list matching its state.
+ * Since it is done every time the flow is updated, each list is sorted
+ * from the least to the most recently updated flow.
+ **/
+static inline void
+expiration_touch(pfwl_flow_DB_partition_specific_informations_t *info,
+                 pfwl_flow_t *flow) {
+  pfwl_flow_expiration_node_t *node = &(flow->expiration);
+  if (node->next) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
   }
+  flow->timeout = flow_timeout(flow);
+  pfwl_flow_expiration_node_t *sentinel = &(info->expiration[flow->timeout]);
+  node->next = sentinel;
+  node->prev = sentinel->prev;
+  node->prev->next = node;
+  sentinel->prev = node;
+}
+
+void pfwl_flow_table_update_expiration(pfwl_flow_t *flow) {
+  if (flow->timeout != flow_timeout(flow)) {
+    expiration_touch(flow->info_private.partition_info, flow);
   }
 }
 
+/**
+ * Deletes the expired flows. Since the expiration lists are sorted,
+ * only the flows at their head need to be checked and each flow
+ * is checked at most once after it expired.
+ **/
 #ifndef PFWL_DEBUG
 static
 #endif
@@ -516,40 +830,23 @@ static
                                      uint16_t partition_id,
                                      uint32_t current_time,
                                      pfwl_timestamp_unit_t unit) {
-  uint32_t i;
-#if !PFWL_USE_MTF
-  ipv4_flow_t *current;
-#endif
-  for (i = db->partitions[partition_id].partition.info.lowest_index;
-       i <= db->partitions[partition_id].partition.info.highest_index;
-       i++) {
-    /**
-     * Set the last timestamp for the sentinel node in such
-     * a way that we simplify the loop over the list.
-     **/
-    db->table[i].info.timestamp_last[0] = current_time;
-    db->table[i].info.timestamp_last[1] = 0;
-    db->table[i].info.statistics[PFWL_STAT_TIMESTAMP_LAST][0] = current_time;
-    db->table[i].info.statistics[PFWL_STAT_TIMESTAMP_LAST][1] = 0;
-
-
-#if PFWL_USE_MTF
-    while (current_time - MAX(db->table[i].prev->info.statistics[PFWL_STAT_TIMESTAMP_LAST][0],
-                              db->table[i].prev->info.statistics[PFWL_STAT_TIMESTAMP_LAST][1]) >
-           get_max_idle_time(unit)) {
-      mc_pfwl_flow_table_delete_flow(db, partition_id, db->table[i].prev);
-    }
-#else
-    current = db->table[i].prev;
-    while (current != &(db->table[i])) {
-      if (current_time - db->table[i].prev->info.last_timestamp >
-          get_max_idle_time(unit)) {
-        mc_pfwl_flow_table_delete_flow(db, flow_cleaner_callback, partition_id,
-                                       db->table[i].prev);
+  pfwl_flow_DB_partition_specific_informations_t *info =
+      &(db->partitions[partition_id].partition.info);
+  for (uint8_t t = 0; t < PFWL_FLOW_TIMEOUT_NUM; t++) {
+    pfwl_flow_expiration_node_t *sentinel = &(info->expiration[t]);
+    uint32_t timeout = to_timestamp_unit(db->timeouts[t], unit);
+    while (sentinel->next != sentinel) {
+      pfwl_flow_t *flow = expiration_node_flow(sentinel->next);
+      uint32_t last = flow_last_timestamp(flow);
+      /**
+       * Timestamps are not always monotonic (e.g. reordered captures),
+       * thus a flow updated 'in the future' is not expired.
+       **/
+      if (last >= current_time || current_time - last <= timeout) {
+        break;
       }
-      current = current->prev;
+      mc_pfwl_flow_table_delete_flow(db, partition_id, flow);
     }
-#endif
   }
 }
 
@@ -587,11 +884,95 @@ void pfwl_init_flow_info_internal(pfwl_flow_info_private_t *flow_info_private,
   flow_info_private->identification_terminated = 0;
   flow_info_private->trials = 0;
   flow_info_private->tcp_reordering_enabled = tcp_reordering_enabled;
-  flow_info_private->last_rebuilt_tcp_data = NULL;
   flow_info_private->last_rebuilt_ip_fragments = NULL;
   flow_info_private->udata_private = NULL;
 }
 
+pfwl_allocator_t *
+pfwl_flow_allocator(pfwl_flow_info_private_t *flow_info_private) {
+  pfwl_flow_DB_partition_specific_informations_t *info =
+      flow_info_private->partition_info;
+  if (info) {
+    return &(info->allocator);
+  }
+  return NULL;
+}
+
+pfwl_tcp_reassembly_partition_t *
+pfwl_flow_tcp_reassembly(pfwl_flow_info_private_t *flow_info_private) {
+  pfwl_flow_DB_partition_specific_informations_t *info =
+      flow_info_private->partition_info;
+  if (info) {
+    return &(info->tcp_reassembly);
+  }
+  return NULL;
+}
+
+void *pfwl_inspector_state_get(pfwl_flow_info_private_t *flow_info_private,
+                               pfwl_inspector_state_type_t type) {
+  void *r = flow_info_private->inspectors_state[type];
+  if (likely(r != NULL)) {
+    return r;
+  }
+  pfwl_flow_DB_partition_specific_informations_t *pool =
+      flow_info_private->partition_info;
+  if (pool && pool->inspectors_state_free[type]) {
+    r = pool->inspectors_state_free[type];
+    pool->inspectors_state_free[type] = *(void **) r;
+  } else {
+    r = pfwl_allocator_alloc(pfwl_flow_allocator(flow_info_private),
+                             PFWL_MEMORY_FLOWS, pfwl_inspector_state_size[type]);
+    assert(r);
+  }
+  memset(r, 0, pfwl_inspector_state_size[type]);
+  flow_info_private->inspectors_state[type] = r;
+  return r;
+}
+
+void pfwl_inspector_state_release(pfwl_flow_info_private_t *flow_info_private,
+                                  pfwl_inspector_state_type_t type) {
+  void *r = flow_info_private->inspectors_state[type];
+  if (r == NULL) {
+    return;
+  }
+  if (type == PFWL_INSPECTOR_STATE_HTTP) {
+    pfwl_http_inspector_state_t *http = (pfwl_http_inspector_state_t *) r;
+    for (uint8_t i = 0; i < 2; i++) {
+      pfwl_allocator_free(pfwl_flow_allocator(flow_info_private),
+                          PFWL_MEMORY_BUFFERS,
+                          http->http_informations[i].temp_buffer,
+                          http->http_informations[i].temp_buffer_size);
+      pfwl_http_used_buffer_t *used = http->http_informations[i].used_buffers;
+      while (used) {
+        pfwl_http_used_buffer_t *next = used->next;
+        pfwl_allocator_free(pfwl_flow_allocator(flow_info_private),
+                            PFWL_MEMORY_BUFFERS, used->data, used->size);
+        pfwl_allocator_free(pfwl_flow_allocator(flow_info_private),
+                            PFWL_MEMORY_BUFFERS, used,
+                            sizeof(pfwl_http_used_buffer_t));
+        used = next;
+      }
+    }
+  }
+  pfwl_flow_DB_partition_specific_informations_t *pool =
+      flow_info_private->partition_info;
+  if (pool) {
+    /** The first word of a released state links it to the next one. **/
+    *(void **) r = pool->inspectors_state_free[type];
+    pool->inspectors_state_free[type] = r;
+  } else {
+    free(r);
+  }
+  flow_info_private->inspectors_state[type] = NULL;
+}
+
+void pfwl_inspector_state_release_all(
+    pfwl_flow_info_private_t *flow_info_private) {
+  for (uint8_t t = 0; t < PFWL_INSPECTOR_STATE_NUM; t++) {
+    pfwl_inspector_state_release(flow_info_private, t);
+  }
+}
+
 static void pfwl_init_flow_info_public_internal(pfwl_flow_info_t *flow_info) {
   memset(flow_info, 0, sizeof(pfwl_flow_info_t));
   flow_info->statistics[PFWL_STAT_L4_TCP_WINDOW_SCALING][0] = -1;
@@ -617,10 +998,19 @@ pfwl_flow_t *mc_pfwl_flow_table_find_or_create_flow(
   }
 
   /** Flow searching. **/
-  pfwl_flow_t *head = &(db->table[index]);
-  pfwl_flow_t *iterator = head->next;
-  while (iterator != head && !flow_equals(iterator, pkt_info)) {
-    iterator = iterator->next;
+  pfwl_flow_DB_partition_specific_informations_t *info =
+      &(db->partitions[partition_id].partition.info);
+  pfwl_flow_t *head, *iterator;
+  if (db->engine == PFWL_FLOW_TABLE_ENGINE_BUCKETED) {
+    /** The bucketed engine has no sentinel, NULL plays its role. **/
+    head = NULL;
+    iterator = bucket_find_flow(db, info, index, pkt_info);
+  } else {
+    head = &(db->table[index]);
+    iterator = head->next;
+    while (iterator != head && !flow_equals(iterator, pkt_info)) {
+      iterator = iterator->next;
+    }
   }
 
   /**
@@ -647,25 +1037,7 @@ pfwl_flow_t *mc_pfwl_flow_table_find_or_create_flow(
             db->partitions[partition_id]
                 .partition.info.max_active_flows))
       return NULL;
-#if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-    if (likely(db->partitions[partition_id].partition.pool_size != 0)) {
-      debug_print("%s\n", "[flow_table.c]: New flow created, "
-                          "extracting an empty flow from the pool.");
-      /** Remove the flow from the pool. **/
-      uint32_t p =
-          db->partitions[partition_id]
-              .partition
-              .pool[--db->partitions[partition_id].partition.pool_size];
-      iterator =
-          &(db->partitions[partition_id].partition.memory_chunk_lower_bound[p]);
-    } else {
-      debug_print("%s\n", "[flow_table.c]: New flow created, "
-                          " pool exhausted, allocating a new flow.");
-      iterator = v4_flow_alloc();
-    }
-#else
-    iterator = v4_flow_alloc();
-#endif
+    iterator = pfwl_flow_alloc(&(info->allocator));
     assert(iterator);
 
     /**Creates new flow and inserts it in the list.**/
@@ -687,16 +1059,26 @@ pfwl_flow_t *mc_pfwl_flow_table_find_or_create_flow(
 
     iterator->info_private.info_public = &iterator->info;
     iterator->info_private.flow = iterator;
-
-    iterator->prev = head;
-    iterator->next = head->next;
-    iterator->prev->next = iterator;
-    iterator->next->prev = iterator;
+    iterator->expiration.next = NULL;
+    iterator->info_private.partition_info =
+        &(db->partitions[partition_id].partition.info);
+
+    if (db->engine == PFWL_FLOW_TABLE_ENGINE_BUCKETED) {
+      if (unlikely(bucket_insert_flow(db, info, index, iterator, pkt_info))) {
+        pfwl_flow_free(&(info->allocator), iterator);
+        return NULL;
+      }
+    } else {
+      iterator->prev = head;
+      iterator->next = head->next;
+      iterator->prev->next = iterator;
+      iterator->next->prev = iterator;
+    }
 
     ++db->partitions[partition_id].partition.info.active_flows;
   }
 #if PFWL_USE_MTF
-  else if (iterator->prev != head) {
+  else if (head && iterator->prev != head) {
     /**
      * Remove the flow from the current position. It will be inserted
      * in the first position (Move to front). In this way collisions
@@ -726,11 +1108,12 @@ pfwl_flow_t *mc_pfwl_flow_table_find_or_create_flow(
   }
   iterator->info.timestamp_last[pkt_info->l4.direction] = timestamp;
   iterator->info.statistics[PFWL_STAT_TIMESTAMP_LAST][pkt_info->l4.direction] = timestamp;
+  expiration_touch(info, iterator);
 
   if (unlikely(
           timestamp -
               db->partitions[partition_id].partition.info.last_walk >=
-          get_walk_time(unit))) {
+          to_timestamp_unit(PFWL_FLOW_TABLE_WALK_TIME, unit))) {
     pfwl_flow_table_check_expiration(db, partition_id, timestamp, unit);
     db->partitions[partition_id].partition.info.last_walk = timestamp;
   }
@@ -741,16 +1124,87 @@ pfwl_flow_t *mc_pfwl_flow_table_find_or_create_flow(
 uint32_t
 pfwl_compute_v4_hash_function(pfwl_flow_table_t *db,
                               const pfwl_dissection_info_t *const pkt_info) {
-#if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_FNV_HASH
-  uint32_t row = v4_fnv_hash_function(pkt_info) % db->total_size;
-#elif PFWL_FLOW_TABLE_HASH_VERSION == PFWL_MURMUR3_HASH
-  uint32_t row = v4_hash_murmur3(pkt_info, db->seed) % db->total_size;
-#elif PFWL_FLOW_TABLE_HASH_VERSION == PFWL_BKDR_HASH
-  uint32_t row = v4_hash_function_bkdr(pkt_info) % db->total_size;
-#else /** Default hash function is the simplest one. **/
-  uint32_t row = v4_hash_function_simple(pkt_info) % db->total_size;
+  uint32_t hash;
+  switch (db->hash) {
+#if PFWL_HASH_COMPILED(PFWL_FNV_HASH)
+  case PFWL_FLOW_TABLE_HASH_FNV:
+    hash = v4_fnv_hash_function(pkt_info);
+    break;
+#endif
+#if PFWL_HASH_COMPILED(PFWL_MURMUR3_HASH)
+  case PFWL_FLOW_TABLE_HASH_MURMUR3:
+    hash = v4_hash_murmur3(pkt_info, db->seed);
+    break;
+#endif
+#if PFWL_HASH_COMPILED(PFWL_BKDR_HASH)
+  case PFWL_FLOW_TABLE_HASH_BKDR:
+    hash = v4_hash_function_bkdr(pkt_info);
+    break;
+#endif
+#if PFWL_HASH_COMPILED(PFWL_CRC32C_HASH)
+  case PFWL_FLOW_TABLE_HASH_CRC32C:
+    hash = v4_hash_crc32c(pkt_info, db->seed);
+    break;
+#endif
+#if PFWL_HASH_COMPILED(PFWL_XXHASH_HASH)
+  case PFWL_FLOW_TABLE_HASH_XXHASH:
+    hash = v4_hash_xxhash(pkt_info, db->seed);
+    break;
 #endif
-  return row;
+  default:
+    hash = v4_hash_function_simple(pkt_info);
+    break;
+  }
+  return hash % db->total_size;
+}
+
+uint32_t
+pfwl_compute_v6_hash_function(pfwl_flow_table_t *db,
+                              const pfwl_dissection_info_t *const pkt_info) {
+  pfwl_flow_key_v6_t key;
+  uint32_t hash;
+  pfwl_flow_key_v6_make(pkt_info, &key);
+  switch (db->hash) {
+#if PFWL_HASH_COMPILED(PFWL_FNV_HASH)
+  case PFWL_FLOW_TABLE_HASH_FNV:
+    hash = v6_fnv_hash_function(&key);
+    break;
+#endif
+#if PFWL_HASH_COMPILED(PFWL_MURMUR3_HASH)
+  case PFWL_FLOW_TABLE_HASH_MURMUR3:
+    hash = v6_hash_murmur3(&key, db->seed);
+    break;
+#endif
+#if PFWL_HASH_COMPILED(PFWL_BKDR_HASH)
+  case PFWL_FLOW_TABLE_HASH_BKDR:
+    hash = v6_hash_function_bkdr(&key);
+    break;
+#endif
+#if PFWL_HASH_COMPILED(PFWL_CRC32C_HASH)
+  case PFWL_FLOW_TABLE_HASH_CRC32C:
+    hash = v6_hash_crc32c(&key, db->seed);
+    break;
+#endif
+#if PFWL_HASH_COMPILED(PFWL_XXHASH_HASH)
+  case PFWL_FLOW_TABLE_HASH_XXHASH:
+    hash = v6_hash_xxhash(&key, db->seed);
+    break;
+#endif
+  default:
+    hash = v6_hash_function_simple(&key);
+    break;
+  }
+  return hash % db->total_size;
+}
+
+uint32_t
+pfwl_compute_hash_function(pfwl_flow_table_t *db,
+                           const pfwl_dissection_info_t *const pkt_info) {
+  if (pkt_info->l3.protocol == PFWL_PROTO_L3_IPV4) {
+    return pfwl_compute_v4_hash_function(db, pkt_info);
+  } else {
+    return pfwl_compute_v6_hash_function(db, pkt_info);
+  }
 }
 
 pfwl_flow_t *pfwl_flow_table_find_or_create_flow(
@@ -758,27 +1212,22 @@ pfwl_flow_t *pfwl_flow_table_find_or_create_flow(
     char *protocols_to_inspect, uint8_t tcp_reordering_enabled,
     uint32_t timestamp, uint8_t syn, pfwl_timestamp_unit_t unit) {
   return mc_pfwl_flow_table_find_or_create_flow(
-      db, 0, pfwl_compute_v4_hash_function(db, pkt_info), pkt_info,
+      db, 0, pfwl_compute_hash_function(db, pkt_info), pkt_info,
       protocols_to_inspect, tcp_reordering_enabled, timestamp, syn, unit);
 }
 
-uint32_t
-pfwl_compute_v6_hash_function(pfwl_flow_table_t *db,
-                              const pfwl_dissection_info_t *const pkt_info) {
-#if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_FNV_HASH
-  uint32_t row = v6_fnv_hash_function(pkt_info) % db->total_size;
-#elif PFWL_FLOW_TABLE_HASH_VERSION == PFWL_MURMUR3_HASH
-  uint32_t row = v6_hash_murmur3(pkt_info, db->seed) % db->total_size;
-#elif PFWL_FLOW_TABLE_HASH_VERSION == PFWL_BKDR_HASH
-  uint32_t row = v6_hash_function_bkdr(pkt_info) % db->total_size;
-#else /** Default hash function is the simplest one. **/
-  uint32_t row = v6_hash_function_simple(pkt_info) % db->total_size;
-#endif
-  return row;
-}
-
 pfwl_flow_t *pfwl_flow_table_find_flow(pfwl_flow_table_t *db, uint32_t index,
                                        pfwl_dissection_info_t *pkt_info) {
+  if (db->engine == PFWL_FLOW_TABLE_ENGINE_BUCKETED) {
+    for (uint16_t j = 0; j < db->num_partitions; ++j) {
+      pfwl_flow_DB_partition_specific_informations_t *info =
+          &(db->partitions[j].partition.info);
+      if (index >= info->lowest_index && index <= info->highest_index) {
+        return bucket_find_flow(db, info, index, pkt_info);
+      }
+    }
+    return NULL;
+  }
   pfwl_flow_t *head = &(db->table[index]);
   pfwl_flow_t *iterator = head->next;
 
@@ -793,38 +1242,60 @@ pfwl_flow_t *pfwl_flow_table_find_flow(pfwl_flow_table_t *db, uint32_t index,
     return iterator;
 }
 
+void pfwl_flow_table_prefetch_entry(pfwl_flow_table_t *db,
+                                    const pfwl_dissection_info_t *pkt_info) {
+  uint32_t index = pfwl_compute_hash_function(db, pkt_info);
+  if (db->engine == PFWL_FLOW_TABLE_ENGINE_BUCKETED) {
+    __builtin_prefetch(&(db->buckets[index]), 0, 3);
+  } else {
+    __builtin_prefetch(&(db->table[index]), 0, 3);
+  }
+}
+
+void pfwl_flow_table_prefetch_flow(pfwl_flow_table_t *db,
+                                   const pfwl_dissection_info_t *pkt_info) {
+  uint32_t index = pfwl_compute_hash_function(db, pkt_info);
+  if (db->engine == PFWL_FLOW_TABLE_ENGINE_BUCKETED) {
+    uint16_t fingerprint = flow_fingerprint(pkt_info);
+    pfwl_flow_bucket_t *bucket = &(db->buckets[index]);
+    for (uint8_t i = 0; i < PFWL_FLOW_TABLE_BUCKET_SLOTS; i++) {
+      if ((bucket->used & (1 << i)) &&
+          bucket->fingerprints[i] == fingerprint) {
+        __builtin_prefetch(bucket->flows[i], 0, 3);
+      }
+    }
+  } else {
+    /** With MTF the flow is usually the first of the list. **/
+    __builtin_prefetch(db->table[index].next, 0, 3);
+  }
+}
+
 void pfwl_flow_table_delete(pfwl_flow_table_t *db) {
   if (db != NULL) {
-    if (db->table != NULL) {
+    if (db->table != NULL || db->buckets != NULL) {
       for (uint16_t j = 0; j < db->num_partitions; ++j) {
         for (uint32_t i = db->partitions[j].partition.info.lowest_index;
              i <= db->partitions[j].partition.info.highest_index; ++i) {
+          if (db->buckets) {
+            while (db->buckets[i].used) {
+              uint8_t s = __builtin_ctz(db->buckets[i].used);
+              mc_pfwl_flow_table_delete_flow(db, j, db->buckets[i].flows[s]);
+            }
+            continue;
+          }
           while (db->table[i].next != &(db->table[i])) {
             mc_pfwl_flow_table_delete_flow(db, j, db->table[i].next);
           }
         }
-#if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-#if PFWL_NUMA_AWARE
-        numa_free(db->partitions[j].partition.memory_chunk_lower_bound,
-                  sizeof(ipv6_flow_t) * db->individual_pool_size);
-        numa_free(db->partitions[j].partition.pool,
-                  sizeof(uint32_t) * db->individual_pool_size);
-#else
-        free(db->partitions[j].partition.memory_chunk_lower_bound);
-        free(db->partitions[j].partition.pool);
-#endif
-#endif
+        pfwl_flow_table_free_inspectors_state_pool(
+            &(db->partitions[j].partition.info));
+        pfwl_allocator_destroy(&(db->partitions[j].partition.info.allocator));
       }
     }
 
-#if PFWL_NUMA_AWARE
-    numa_free(db->partitions,
-              sizeof(pfwl_flow_DB_v4_partition_t) * db->num_partitions);
-    numa_free(db->table, sizeof(ipv4_flow_t) * db->total_size);
-#else
     free(db->partitions);
     free(db->table);
-#endif
+    free(db->buckets);
     free(db);
   }
 }
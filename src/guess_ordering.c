@@ -0,0 +1,195 @@
+/*
+ * guess_ordering.c
+ *
+ * =========================================================================
+ * Copyright (c) 2012-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#include <peafowl/guess_ordering.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PFWL_GUESS_CONTEXTS                                                    \
+  (2 * PFWL_GUESS_PORT_BUCKETS * PFWL_GUESS_BYTE_CLASSES)
+
+#define PFWL_GUESS_PROFILE_HEADER "peafowl-guess-profile"
+
+struct pfwl_guess_profile {
+  uint32_t matches[PFWL_GUESS_CONTEXTS][PFWL_PROTO_L7_NUM];
+  /** Protocols which matched at least once, the most frequent first. **/
+  uint8_t order[PFWL_GUESS_CONTEXTS][PFWL_PROTO_L7_NUM];
+  uint8_t order_length[PFWL_GUESS_CONTEXTS];
+};
+
+typedef char pfwl_guess_protocols_fit_in_order[PFWL_PROTO_L7_NUM <= 256 ? 1 : -1];
+
+pfwl_guess_profile_t *pfwl_guess_profile_create(void) {
+  return (pfwl_guess_profile_t *) calloc(1, sizeof(pfwl_guess_profile_t));
+}
+
+void pfwl_guess_profile_delete(pfwl_guess_profile_t *profile) {
+  free(profile);
+}
+
+uint8_t pfwl_guess_byte_class(const unsigned char *pkt, size_t length) {
+  unsigned char c = length ? pkt[0] : 0;
+  if (c >= 'A' && c <= 'Z') {
+    return 1;
+  } else if (c >= 'a' && c <= 'z') {
+    return 2;
+  } else if (c >= '0' && c <= '9') {
+    return 3;
+  } else if (c > 0x20 && c < 0x7F) {
+    return 4;
+  } else if (c == 0) {
+    return 5;
+  } else if (c < 0x80) {
+    return 6;
+  } else {
+    return 7;
+  }
+}
+
+static size_t pfwl_guess_context(uint8_t l4, uint16_t port_bucket,
+                                 uint8_t byte_class) {
+  return ((size_t) l4 * PFWL_GUESS_PORT_BUCKETS + port_bucket) *
+             PFWL_GUESS_BYTE_CLASSES +
+         (byte_class - 1);
+}
+
+static size_t pfwl_guess_context_packet(const pfwl_dissection_info_t *diss_info,
+                                        uint8_t byte_class) {
+  /** The server usually uses the lowest port. **/
+  uint16_t port_src = ntohs(diss_info->l4.port_src);
+  uint16_t port_dst = ntohs(diss_info->l4.port_dst);
+  uint16_t port = port_src < port_dst ? port_src : port_dst;
+  return pfwl_guess_context(diss_info->l4.protocol == IPPROTO_TCP ? 0 : 1,
+                            port % PFWL_GUESS_PORT_BUCKETS, byte_class);
+}
+
+const uint8_t *pfwl_guess_profile_get(const pfwl_guess_profile_t *profile,
+                                      const pfwl_dissection_info_t *diss_info,
+                                      uint8_t byte_class, size_t *num) {
+  size_t context = pfwl_guess_context_packet(diss_info, byte_class);
+  *num = profile->order_length[context];
+  return profile->order[context];
+}
+
+static void pfwl_guess_profile_add(pfwl_guess_profile_t *profile,
+                                   size_t context, pfwl_protocol_l7_t protocol,
+                                   uint32_t matches) {
+  uint32_t *m = profile->matches[context];
+  uint8_t *order = profile->order[context];
+  size_t pos;
+  if (!m[protocol]) {
+    pos = profile->order_length[context]++;
+    order[pos] = protocol;
+  } else {
+    for (pos = 0; order[pos] != protocol; pos++) {
+      ;
+    }
+  }
+  if (m[protocol] > UINT32_MAX - matches) {
+    /** Halve the counters of the context, keeping their order. **/
+    for (size_t i = 0; i < profile->order_length[context]; i++) {
+      m[order[i]] -= m[order[i]] / 2;
+    }
+    matches = matches / 2 + 1;
+  }
+  /** Both may still be close to the maximum (e.g. imported counters). **/
+  m[protocol] = m[protocol] > UINT32_MAX - matches ? UINT32_MAX
+                                                   : m[protocol] + matches;
+  /** Move the protocol before the ones which matched fewer times. **/
+  while (pos && m[order[pos - 1]] < m[protocol]) {
+    order[pos] = order[pos - 1];
+    order[--pos] = protocol;
+  }
+}
+
+void pfwl_guess_profile_update(pfwl_guess_profile_t *profile,
+                               const pfwl_dissection_info_t *diss_info,
+                               uint8_t byte_class, pfwl_protocol_l7_t protocol) {
+  pfwl_guess_profile_add(profile,
+                         pfwl_guess_context_packet(diss_info, byte_class),
+                         protocol, 1);
+}
+
+uint8_t pfwl_guess_profile_write(const pfwl_guess_profile_t *profile, FILE *f) {
+  if (fprintf(f, "%s %d %d\n", PFWL_GUESS_PROFILE_HEADER,
+              PFWL_GUESS_PORT_BUCKETS, PFWL_GUESS_BYTE_CLASSES) < 0) {
+    return 1;
+  }
+  for (uint8_t l4 = 0; l4 < 2; l4++) {
+    for (uint16_t bucket = 0; bucket < PFWL_GUESS_PORT_BUCKETS; bucket++) {
+      for (uint8_t c = 1; c <= PFWL_GUESS_BYTE_CLASSES; c++) {
+        size_t context = pfwl_guess_context(l4, bucket, c);
+        for (size_t i = 0; i < profile->order_length[context]; i++) {
+          pfwl_protocol_l7_t protocol = profile->order[context][i];
+          if (fprintf(f, "%s %u %u %s %u\n", l4 ? "udp" : "tcp", bucket, c,
+                      pfwl_get_L7_protocol_name(protocol),
+                      profile->matches[context][protocol]) < 0) {
+            return 1;
+          }
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+uint8_t pfwl_guess_profile_read(pfwl_guess_profile_t *profile, FILE *f) {
+  char header[32], l4[4], name[64];
+  unsigned int buckets, classes, bucket, c, matches;
+  memset(profile, 0, sizeof(pfwl_guess_profile_t));
+  if (fscanf(f, "%31s %u %u", header, &buckets, &classes) != 3 ||
+      strcmp(header, PFWL_GUESS_PROFILE_HEADER) ||
+      buckets != PFWL_GUESS_PORT_BUCKETS ||
+      classes != PFWL_GUESS_BYTE_CLASSES) {
+    return 1;
+  }
+  int r;
+  while ((r = fscanf(f, "%3s %u %u %63s %u", l4, &bucket, &c, name,
+                     &matches)) == 5) {
+    pfwl_protocol_l7_t protocol = pfwl_get_L7_protocol_id(name);
+    if ((strcmp(l4, "tcp") && strcmp(l4, "udp")) ||
+        bucket >= PFWL_GUESS_PORT_BUCKETS || !c ||
+        c > PFWL_GUESS_BYTE_CLASSES) {
+      memset(profile, 0, sizeof(pfwl_guess_profile_t));
+      return 1;
+    }
+    if (protocol < PFWL_PROTO_L7_NUM && matches) {
+      pfwl_guess_profile_add(profile,
+                             pfwl_guess_context(strcmp(l4, "tcp") ? 1 : 0,
+                                                bucket, c),
+                             protocol, matches);
+    }
+  }
+  if (r != EOF) {
+    memset(profile, 0, sizeof(pfwl_guess_profile_t));
+    return 1;
+  }
+  return 0;
+}
@@ -26,6 +26,64 @@
  */
 #include <peafowl/hash_functions.h>
 
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <nmmintrin.h>
+#define PFWL_HAVE_CRC32C_INSTRUCTION 1
+#endif
+
+void pfwl_flow_key_v4_make(const pfwl_dissection_info_t *const in,
+                           pfwl_flow_key_v4_t *key) {
+  memset(key, 0, sizeof(pfwl_flow_key_v4_t));
+  if (in->l3.addr_src.ipv4 < in->l3.addr_dst.ipv4 ||
+      (in->l3.addr_src.ipv4 == in->l3.addr_dst.ipv4 &&
+       in->l4.port_src <= in->l4.port_dst)) {
+    key->addr_low = in->l3.addr_src.ipv4;
+    key->port_low = in->l4.port_src;
+    key->addr_high = in->l3.addr_dst.ipv4;
+    key->port_high = in->l4.port_dst;
+  } else {
+    key->addr_low = in->l3.addr_dst.ipv4;
+    key->port_low = in->l4.port_dst;
+    key->addr_high = in->l3.addr_src.ipv4;
+    key->port_high = in->l4.port_src;
+  }
+  key->protocol = in->l4.protocol;
+}
+
+void pfwl_flow_key_v6_make(const pfwl_dissection_info_t *const in,
+                           pfwl_flow_key_v6_t *key) {
+  const struct in6_addr *src = &(in->l3.addr_src.ipv6);
+  const struct in6_addr *dst = &(in->l3.addr_dst.ipv6);
+  uint8_t src_is_low;
+#if defined(__SSE2__)
+  __m128i s = _mm_loadu_si128((const __m128i *) src);
+  __m128i d = _mm_loadu_si128((const __m128i *) dst);
+  /** One bit for each byte which differs between the two addresses. **/
+  uint32_t diff = ~((uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(s, d))) & 0xFFFF;
+  if (diff) {
+    uint32_t i = __builtin_ctz(diff);
+    src_is_low = src->s6_addr[i] < dst->s6_addr[i];
+  } else {
+    src_is_low = in->l4.port_src <= in->l4.port_dst;
+  }
+  _mm_storeu_si128((__m128i *) &(key->addr_low), src_is_low ? s : d);
+  _mm_storeu_si128((__m128i *) &(key->addr_high), src_is_low ? d : s);
+#else
+  int cmp = memcmp(src, dst, sizeof(struct in6_addr));
+  src_is_low = cmp < 0 || (cmp == 0 && in->l4.port_src <= in->l4.port_dst);
+  key->addr_low = src_is_low ? *src : *dst;
+  key->addr_high = src_is_low ? *dst : *src;
+#endif
+  key->port_low = src_is_low ? in->l4.port_src : in->l4.port_dst;
+  key->port_high = src_is_low ? in->l4.port_dst : in->l4.port_src;
+  key->protocol = in->l4.protocol;
+  memset(key->padding, 0, sizeof(key->padding));
+}
+
 #if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_FNV_HASH ||                           \
     PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE == 1
 
@@ -39,14 +97,8 @@
   hval += (hval << 1) + (hval << 4) + (hval << 7) + (hval << 8) + (hval << 24);
 #endif
 
-#ifndef PFWL_DEBUG
-#if PFWL_USE_INLINING == 1
-inline
-#endif
-#endif
-    /** FNV-1a 32-bit hash function. **/
-    uint32_t
-    v4_fnv_hash_function(const pfwl_dissection_info_t *const in) {
+/** FNV-1a 32-bit hash function. **/
+uint32_t v4_fnv_hash_function(const pfwl_dissection_info_t *const in) {
   uint32_t low_addr, high_addr;
   uint16_t low_port, high_port;
 
@@ -101,78 +153,31 @@ inline
   return hval;
 }
 
-static void get_v6_low_high_addr_port(const pfwl_dissection_info_t *const in,
-                                      struct in6_addr *low_addr,
-                                      struct in6_addr *high_addr,
-                                      uint16_t *low_port, uint16_t *high_port) {
-  uint8_t i = 0;
-  for (i = 0; i < 16; i++) {
-    if (in->l3.addr_src.ipv6.s6_addr[i] < in->l3.addr_dst.ipv6.s6_addr[i]) {
-      *low_addr = in->l3.addr_src.ipv6;
-      *high_addr = in->l3.addr_dst.ipv6;
-      *low_port = in->l4.port_src;
-      *high_port = in->l4.port_dst;
-      break;
-    } else if (in->l3.addr_src.ipv6.s6_addr[i] >
-               in->l3.addr_dst.ipv6.s6_addr[i]) {
-      *high_addr = in->l3.addr_src.ipv6;
-      *low_addr = in->l3.addr_dst.ipv6;
-      *high_port = in->l4.port_src;
-      *low_port = in->l4.port_dst;
-      break;
-    }
-  }
-
-  /** If i==16 the addresses are equal. **/
-  if (i == 16) {
-    if (in->l4.port_src <= in->l4.port_dst) {
-      *low_addr = in->l3.addr_src.ipv6;
-      *high_addr = in->l3.addr_dst.ipv6;
-      *low_port = in->l4.port_src;
-      *high_port = in->l4.port_dst;
-    } else {
-      *high_addr = in->l3.addr_src.ipv6;
-      *low_addr = in->l3.addr_dst.ipv6;
-      *high_port = in->l4.port_src;
-      *low_port = in->l4.port_dst;
-    }
-  }
-}
-
-#ifndef PFWL_DEBUG
-#if PFWL_USE_INLINING == 1
-inline
-#endif
-#endif
-    /** FNV-1a 32-bit hash function. **/
-    uint32_t
-    v6_fnv_hash_function(const pfwl_dissection_info_t *const in) {
-  struct in6_addr low_addr, high_addr;
-  uint16_t low_port, high_port;
-  get_v6_low_high_addr_port(in, &low_addr, &high_addr, &low_port, &high_port);
+/** FNV-1a 32-bit hash function. **/
+uint32_t v6_fnv_hash_function(const pfwl_flow_key_v6_t *const key) {
   uint8_t i = 0;
   uint32_t hval = FNV1A_32_INIT;
   for (i = 0; i < 16; i++) {
-    hval ^= low_addr.s6_addr[i];
+    hval ^= key->addr_low.s6_addr[i];
     PFWL_HVAL_SECOND_STEP(hval)
   }
 
   for (i = 0; i < 16; i++) {
-    hval ^= high_addr.s6_addr[i];
+    hval ^= key->addr_high.s6_addr[i];
     PFWL_HVAL_SECOND_STEP(hval)
   }
 
-  hval ^= in->l4.protocol;
+  hval ^= key->protocol;
   PFWL_HVAL_SECOND_STEP(hval)
 
-  hval ^= ((low_port >> 8) & 0xFF);
+  hval ^= ((key->port_low >> 8) & 0xFF);
   PFWL_HVAL_SECOND_STEP(hval)
-  hval ^= (low_port & 0xFF);
+  hval ^= (key->port_low & 0xFF);
   PFWL_HVAL_SECOND_STEP(hval)
 
-  hval ^= ((high_port >> 8) & 0xFF);
+  hval ^= ((key->port_high >> 8) & 0xFF);
   PFWL_HVAL_SECOND_STEP(hval)
-  hval ^= (high_port & 0xFF);
+  hval ^= (key->port_high & 0xFF);
   PFWL_HVAL_SECOND_STEP(hval)
 
   return hval;
@@ -374,34 +379,10 @@ uint32_t v4_hash_murmur3(const pfwl_dissection_info_t *const in,
   return result;
 }
 
-static void get_v6_key(const pfwl_dissection_info_t *const in, char *v6_key) {
-  struct in6_addr low_addr, high_addr;
-  uint16_t low_port, high_port;
-  get_v6_low_high_addr_port(in, &low_addr, &high_addr, &low_port, &high_port);
-  uint8_t i = 0;
-  for (i = 0; i < 16; i++) {
-    v6_key[i] = low_addr.s6_addr[i];
-  }
-
-  for (i = 0; i < 16; i++) {
-    v6_key[i + 16] = high_addr.s6_addr[i];
-  }
-
-  v6_key[32] = in->l4.protocol;
-
-  v6_key[33] = ((low_port >> 8) & 0xFF);
-  v6_key[34] = (low_port & 0xFF);
-
-  v6_key[35] = ((high_port >> 8) & 0xFF);
-  v6_key[36] = (high_port & 0xFF);
-}
-
-uint32_t v6_hash_murmur3(const pfwl_dissection_info_t *const in,
+uint32_t v6_hash_murmur3(const pfwl_flow_key_v6_t *const key,
                          uint32_t seed) {
-  char v6_key[37];
-  get_v6_key(in, v6_key);
   uint32_t result;
-  MurmurHash3_x86_32(v6_key, 37, seed, &result);
+  MurmurHash3_x86_32(key, sizeof(pfwl_flow_key_v6_t), seed, &result);
   return result;
 }
 #endif
@@ -413,15 +394,25 @@ uint32_t v4_hash_function_simple(const pfwl_dissection_info_t *const in) {
          in->l3.addr_dst.ipv4 + in->l4.protocol;
 }
 
-uint32_t v6_hash_function_simple(const pfwl_dissection_info_t *const in) {
+uint32_t v6_hash_function_simple(const pfwl_flow_key_v6_t *const key) {
+  uint32_t parts = 0;
+#if defined(__SSE2__)
+  /** Sums the bytes of both addresses, eight at a time. **/
+  __m128i sums = _mm_add_epi64(
+      _mm_sad_epu8(_mm_loadu_si128((const __m128i *) &(key->addr_low)),
+                   _mm_setzero_si128()),
+      _mm_sad_epu8(_mm_loadu_si128((const __m128i *) &(key->addr_high)),
+                   _mm_setzero_si128()));
+  parts = (uint32_t) _mm_cvtsi128_si32(sums) +
+          (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#else
   uint8_t i;
-  uint32_t partsrc = 0, partdst = 0;
   for (i = 0; i < 16; i++) {
-    partsrc += in->l3.addr_src.ipv6.s6_addr[i];
-    partdst += in->l3.addr_dst.ipv6.s6_addr[i];
+    parts += key->addr_low.s6_addr[i];
+    parts += key->addr_high.s6_addr[i];
   }
-  return in->l4.port_src + in->l4.port_dst + partsrc + partdst +
-         in->l4.protocol;
+#endif
+  return key->port_low + key->port_high + parts + key->protocol;
 }
 
 #endif
@@ -440,16 +431,161 @@ uint32_t v4_hash_function_bkdr(const pfwl_dissection_info_t *const in) {
   return (hash & 0x7FFFFFFF);
 }
 
-uint32_t v6_hash_function_bkdr(const pfwl_dissection_info_t *const in) {
+uint32_t v6_hash_function_bkdr(const pfwl_flow_key_v6_t *const key) {
   uint32_t seed = 131; // 31 131 1313 13131 131313 etc..
   uint32_t hash = 0;
-
-  char v6_key[37];
-  get_v6_key(in, v6_key);
-  for (int i = 0; i < 37; i++) {
+  const char *v6_key = (const char *) key;
+  for (size_t i = 0; i < sizeof(pfwl_flow_key_v6_t); i++) {
     hash = (hash * seed) + v6_key[i];
   }
 
   return (hash & 0x7FFFFFFF);
 }
 #endif
+
+#if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_CRC32C_HASH ||                        \
+    PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE == 1
+
+#define PFWL_CRC32C_POLY 0x82F63B78 /* Castagnoli, reversed */
+
+namespace {
+struct Crc32cTable {
+  uint32_t values[256];
+  uint8_t hardware;
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; j++) {
+        crc = (crc >> 1) ^ (PFWL_CRC32C_POLY & (0 - (crc & 1)));
+      }
+      values[i] = crc;
+    }
+#ifdef PFWL_HAVE_CRC32C_INSTRUCTION
+    hardware = __builtin_cpu_supports("sse4.2");
+#else
+    hardware = 0;
+#endif
+  }
+};
+const Crc32cTable crc32c_table;
+} // namespace
+
+#ifdef PFWL_HAVE_CRC32C_INSTRUCTION
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hardware(const unsigned char *data, size_t len, uint32_t crc) {
+  uint64_t crc64 = crc;
+  for (; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += sizeof(uint64_t);
+  }
+  crc = (uint32_t) crc64;
+  for (; len; --len) {
+    crc = _mm_crc32_u8(crc, *data++);
+  }
+  return crc;
+}
+#endif
+
+/** Both implementations give the same result. **/
+static uint32_t crc32c(const void *key, size_t len, uint32_t seed) {
+  const unsigned char *data = (const unsigned char *) key;
+  uint32_t crc = ~seed;
+#ifdef PFWL_HAVE_CRC32C_INSTRUCTION
+  if (crc32c_table.hardware) {
+    return ~crc32c_hardware(data, len, crc);
+  }
+#endif
+  for (size_t i = 0; i < len; i++) {
+    crc = crc32c_table.values[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+uint32_t v4_hash_crc32c(const pfwl_dissection_info_t *const in, uint32_t seed) {
+  pfwl_flow_key_v4_t key;
+  pfwl_flow_key_v4_make(in, &key);
+  return crc32c(&key, sizeof(key), seed);
+}
+
+uint32_t v6_hash_crc32c(const pfwl_flow_key_v6_t *const key, uint32_t seed) {
+  return crc32c(key, sizeof(pfwl_flow_key_v6_t), seed);
+}
+#endif
+
+#if PFWL_FLOW_TABLE_HASH_VERSION == PFWL_XXHASH_HASH ||                        \
+    PFWL_ACTIVATE_ALL_HASH_FUNCTIONS_CODE == 1
+
+// xxHash32, by Yann Collet (BSD 2-Clause License).
+#define PFWL_XXH_PRIME32_1 0x9E3779B1U
+#define PFWL_XXH_PRIME32_2 0x85EBCA77U
+#define PFWL_XXH_PRIME32_3 0xC2B2AE3DU
+#define PFWL_XXH_PRIME32_4 0x27D4EB2FU
+#define PFWL_XXH_PRIME32_5 0x165667B1U
+
+static inline uint32_t xxh_rotl32(uint32_t x, int r) {
+  return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t xxh_read32(const unsigned char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t xxh_round(uint32_t acc, uint32_t input) {
+  acc += input * PFWL_XXH_PRIME32_2;
+  acc = xxh_rotl32(acc, 13);
+  return acc * PFWL_XXH_PRIME32_1;
+}
+
+static uint32_t xxhash32(const void *key, size_t len, uint32_t seed) {
+  const unsigned char *p = (const unsigned char *) key;
+  const unsigned char *end = p + len;
+  uint32_t h;
+  if (len >= 16) {
+    const unsigned char *limit = end - 16;
+    uint32_t v1 = seed + PFWL_XXH_PRIME32_1 + PFWL_XXH_PRIME32_2;
+    uint32_t v2 = seed + PFWL_XXH_PRIME32_2;
+    uint32_t v3 = seed;
+    uint32_t v4 = seed - PFWL_XXH_PRIME32_1;
+    do {
+      v1 = xxh_round(v1, xxh_read32(p));
+      v2 = xxh_round(v2, xxh_read32(p + 4));
+      v3 = xxh_round(v3, xxh_read32(p + 8));
+      v4 = xxh_round(v4, xxh_read32(p + 12));
+      p += 16;
+    } while (p <= limit);
+    h = xxh_rotl32(v1, 1) + xxh_rotl32(v2, 7) + xxh_rotl32(v3, 12) +
+        xxh_rotl32(v4, 18);
+  } else {
+    h = seed + PFWL_XXH_PRIME32_5;
+  }
+  h += (uint32_t) len;
+  for (; p + 4 <= end; p += 4) {
+    h += xxh_read32(p) * PFWL_XXH_PRIME32_3;
+    h = xxh_rotl32(h, 17) * PFWL_XXH_PRIME32_4;
+  }
+  for (; p < end; p++) {
+    h += (*p) * PFWL_XXH_PRIME32_5;
+    h = xxh_rotl32(h, 11) * PFWL_XXH_PRIME32_1;
+  }
+  h ^= h >> 15;
+  h *= PFWL_XXH_PRIME32_2;
+  h ^= h >> 13;
+  h *= PFWL_XXH_PRIME32_3;
+  h ^= h >> 16;
+  return h;
+}
+
+uint32_t v4_hash_xxhash(const pfwl_dissection_info_t *const in, uint32_t seed) {
+  pfwl_flow_key_v4_t key;
+  pfwl_flow_key_v4_make(in, &key);
+  return xxhash32(&key, sizeof(key), seed);
+}
+
+uint32_t v6_hash_xxhash(const pfwl_flow_key_v6_t *const key, uint32_t seed) {
+  return xxhash32(key, sizeof(pfwl_flow_key_v6_t), seed);
+}
+#endif
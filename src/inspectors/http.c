@@ -45,6 +45,8 @@
 /**
  * Manages the case in which an HTTP request/response is divided in more
  * segments.
+ * @param data Will point to the complete field, if available.
+ * @param data_length Will contain the length of the complete field.
  * @return 1 if the HTTP field of interest is complete, 0 if more segments are
  * needed, 2 if an error occurred.
  */
@@ -54,23 +56,23 @@ static
     uint8_t
     pfwl_http_manage_pdu_reassembly(http_parser *parser, const char *at,
                                     size_t length,
-                                    pfwl_http_internal_informations_t *infos) {
-  if (infos->temp_buffer_dirty) {
-    free(infos->temp_buffer);
-    infos->temp_buffer = NULL;
-    infos->temp_buffer_size = 0;
-    infos->temp_buffer_dirty = 0;
-  }
-
+                                    pfwl_http_internal_informations_t *infos,
+                                    const unsigned char **data,
+                                    size_t *data_length) {
   /**
    * If I have old data present, I have anyway to concatenate the new data.
-   * Then, if copy==0, I can free the data after the use, otherwise I simply
+   * Then, if copy==0, I can use the data, otherwise I simply
    * return and I wait for other data.
    */
   if (infos->temp_buffer) {
-    char *tmp = realloc(infos->temp_buffer, infos->temp_buffer_size + length);
+    char *tmp = pfwl_allocator_realloc(
+        infos->allocator, PFWL_MEMORY_BUFFERS, infos->temp_buffer,
+        infos->temp_buffer_size, infos->temp_buffer_size + length);
     if (!tmp) {
-      free(infos->temp_buffer);
+      pfwl_allocator_free(infos->allocator, PFWL_MEMORY_BUFFERS,
+                          infos->temp_buffer, infos->temp_buffer_size);
+      infos->temp_buffer = NULL;
+      infos->temp_buffer_size = 0;
       return 2;
     }
     infos->temp_buffer = (unsigned char *) tmp;
@@ -80,7 +82,8 @@ static
 
   if (parser->copy) {
     if (infos->temp_buffer == NULL) {
-      infos->temp_buffer = malloc(length * sizeof(char));
+      infos->temp_buffer = pfwl_allocator_alloc(
+          infos->allocator, PFWL_MEMORY_BUFFERS, length * sizeof(char));
 
       if (!infos->temp_buffer)
         return 2;
@@ -89,27 +92,62 @@ static
     }
     return 0;
   }
+
+  if (infos->temp_buffer) {
+    /**
+     * The field will point to the buffer, which is thus kept until the
+     * next packet of the flow, when pfwl_http_release_used_buffers is called.
+     **/
+    pfwl_http_used_buffer_t *used = pfwl_allocator_alloc(
+        infos->allocator, PFWL_MEMORY_BUFFERS, sizeof(pfwl_http_used_buffer_t));
+    if (!used) {
+      pfwl_allocator_free(infos->allocator, PFWL_MEMORY_BUFFERS,
+                          infos->temp_buffer, infos->temp_buffer_size);
+      infos->temp_buffer = NULL;
+      infos->temp_buffer_size = 0;
+      return 2;
+    }
+    used->data = infos->temp_buffer;
+    used->size = infos->temp_buffer_size;
+    used->next = infos->used_buffers;
+    infos->used_buffers = used;
+    infos->temp_buffer = NULL;
+    infos->temp_buffer_size = 0;
+    *data = used->data;
+    *data_length = used->size;
+  } else {
+    *data = (const unsigned char *) at;
+    *data_length = length;
+  }
   return 1;
 }
 
+static void
+pfwl_http_release_used_buffers(pfwl_http_internal_informations_t *infos) {
+  while (infos->used_buffers) {
+    pfwl_http_used_buffer_t *next = infos->used_buffers->next;
+    pfwl_allocator_free(infos->allocator, PFWL_MEMORY_BUFFERS,
+                        infos->used_buffers->data, infos->used_buffers->size);
+    pfwl_allocator_free(infos->allocator, PFWL_MEMORY_BUFFERS,
+                        infos->used_buffers, sizeof(pfwl_http_used_buffer_t));
+    infos->used_buffers = next;
+  }
+}
+
 #ifndef PFWL_DEBUG
 static
 #endif
 int on_url(http_parser *parser, const char *at, size_t length) {
   pfwl_http_internal_informations_t *infos =
       (pfwl_http_internal_informations_t *) parser->data;
-  const unsigned char *real_data = (const unsigned char *) at;
-  size_t real_length = length;
-  uint8_t segmentation_result =
-      pfwl_http_manage_pdu_reassembly(parser, at, length, infos);
+  const unsigned char *real_data;
+  size_t real_length;
+  uint8_t segmentation_result = pfwl_http_manage_pdu_reassembly(
+      parser, at, length, infos, &real_data, &real_length);
   if (segmentation_result == 0) {
     return 0;
   } else if (segmentation_result == 2) {
     return 1;
-  } else if (infos->temp_buffer) {
-    real_data = infos->temp_buffer;
-    real_length = infos->temp_buffer_size;
-    infos->temp_buffer_dirty = 1;
   }
 
   pfwl_field_string_set(parser->extracted_fields, PFWL_FIELDS_L7_HTTP_URL,
@@ -124,18 +162,14 @@ static
     on_field(http_parser *parser, const char *at, size_t length) {
   pfwl_http_internal_informations_t *infos =
       (pfwl_http_internal_informations_t *) parser->data;
-  const unsigned char *real_data = (const unsigned char *) at;
-  size_t real_length = length;
-  uint8_t segmentation_result =
-      pfwl_http_manage_pdu_reassembly(parser, at, length, infos);
+  const unsigned char *real_data;
+  size_t real_length;
+  uint8_t segmentation_result = pfwl_http_manage_pdu_reassembly(
+      parser, at, length, infos, &real_data, &real_length);
   if (segmentation_result == 0) {
     return 0;
   } else if (segmentation_result == 2) {
     return 1;
-  } else if (infos->temp_buffer) {
-    real_data = infos->temp_buffer;
-    real_length = infos->temp_buffer_size;
-    infos->temp_buffer_dirty = 1;
   }
 
   if (infos->headers_length == PFWL_HTTP_MAX_HEADERS) {
@@ -154,18 +188,18 @@ static
     on_value(http_parser *parser, const char *at, size_t length) {
   pfwl_http_internal_informations_t *infos =
       (pfwl_http_internal_informations_t *) parser->data;
-  const unsigned char *real_data = (const unsigned char *) at;
-  size_t real_length = length;
-  uint8_t segmentation_result =
-      pfwl_http_manage_pdu_reassembly(parser, at, length, infos);
+  const unsigned char *real_data;
+  size_t real_length;
+  uint8_t segmentation_result = pfwl_http_manage_pdu_reassembly(
+      parser, at, length, infos, &real_data, &real_length);
   if (segmentation_result == 0) {
     return 0;
   } else if (segmentation_result == 2) {
     return 1;
-  } else if (infos->temp_buffer) {
-    real_data = infos->temp_buffer;
-    real_length = infos->temp_buffer_size;
-    infos->temp_buffer_dirty = 1;
+  }
+  /** The name of this header was in a previous packet. **/
+  if (infos->headers_length == 0) {
+    return 0;
   }
   infos->headers[infos->headers_length - 1].second.string.value = real_data;
   infos->headers[infos->headers_length - 1].second.string.length = real_length;
@@ -179,18 +213,14 @@ static
     on_body(http_parser *parser, const char *at, size_t length) {
   pfwl_http_internal_informations_t *infos =
       (pfwl_http_internal_informations_t *) parser->data;
-  const unsigned char *real_data = (const unsigned char *) at;
-  size_t real_length = length;
-  uint8_t segmentation_result =
-      pfwl_http_manage_pdu_reassembly(parser, at, length, infos);
+  const unsigned char *real_data;
+  size_t real_length;
+  uint8_t segmentation_result = pfwl_http_manage_pdu_reassembly(
+      parser, at, length, infos, &real_data, &real_length);
   if (segmentation_result == 0) {
     return 0;
   } else if (segmentation_result == 2) {
     return 1;
-  } else if (infos->temp_buffer) {
-    real_data = infos->temp_buffer;
-    real_length = infos->temp_buffer_size;
-    infos->temp_buffer_dirty = 1;
   }
 
   pfwl_field_string_set(parser->extracted_fields, PFWL_FIELDS_L7_HTTP_BODY,
@@ -209,7 +239,13 @@ uint8_t check_http(pfwl_state_t *state, const unsigned char *app_data,
   debug_print("%s\n", "-------------------------------------------");
   debug_print("%s\n", "[http.c] Executing HTTP inspector...");
 
-  http_parser *parser = &(flow_info_private->http[pkt_info->l4.direction]);
+  pfwl_http_inspector_state_t *http =
+      pfwl_inspector_state_get(flow_info_private, PFWL_INSPECTOR_STATE_HTTP);
+  http_parser *parser = &(http->http[pkt_info->l4.direction]);
+
+  /** Fields extracted from the previous packets are not needed anymore. **/
+  pfwl_http_release_used_buffers(&(http->http_informations[0]));
+  pfwl_http_release_used_buffers(&(http->http_informations[1]));
 
   /**
    * We assume that pfwl_tracking_informations_t is initialized to zero, so if
@@ -218,12 +254,15 @@ uint8_t check_http(pfwl_state_t *state, const unsigned char *app_data,
    */
   if (parser->data == NULL) {
     http_parser_init(parser, HTTP_BOTH);
-    bzero(&(flow_info_private->http_informations[pkt_info->l4.direction]),
+    bzero(&(http->http_informations[pkt_info->l4.direction]),
           sizeof(pfwl_http_internal_informations_t));
 
-    parser->extracted_fields = pkt_info->l7.protocol_fields;
-    parser->data = flow_info_private->http_informations;
+    parser->data = http->http_informations;
   }
+  /** Fields must go in the dissection info of the current packet. **/
+  parser->extracted_fields = pkt_info->l7.protocol_fields;
+  http->http_informations[0].allocator = pfwl_flow_allocator(flow_info_private);
+  http->http_informations[1].allocator = pfwl_flow_allocator(flow_info_private);
 
   http_parser_settings x = {0};
 
@@ -249,11 +288,25 @@ uint8_t check_http(pfwl_state_t *state, const unsigned char *app_data,
   x.on_message_begin = 0;
   x.on_message_complete = 0;
 
-  flow_info_private->http_informations->headers_length = 0;
-  memset(flow_info_private->http_informations->headers, 0,
-         sizeof(flow_info_private->http_informations->headers));
+  http->http_informations->headers_length = 0;
+  memset(http->http_informations->headers, 0,
+         sizeof(http->http_informations->headers));
 
-  http_parser_execute(parser, &x, (const char *) app_data, data_length);
+  if (pkt_info->l4.payload_spans_num) {
+    /**
+     * Resegmented payload, parsed piece by piece without copying it. Only
+     * the fields crossing two pieces are copied.
+     **/
+    for (size_t i = 0; i < pkt_info->l4.payload_spans_num; i++) {
+      const pfwl_span_t *span = &(pkt_info->l4.payload_spans[i]);
+      if (http_parser_execute(parser, &x, (const char *) span->data,
+                              span->length) != span->length) {
+        break;
+      }
+    }
+  } else {
+    http_parser_execute(parser, &x, (const char *) app_data, data_length);
+  }
 
   if (parser->http_errno == HPE_OK) {
     debug_print("%s\n", "[http.c] HTTP matches");
@@ -273,12 +326,12 @@ uint8_t check_http(pfwl_state_t *state, const unsigned char *app_data,
                             PFWL_FIELDS_L7_HTTP_STATUS_CODE,
                             parser->status_code);
     }
-    if (flow_info_private->http_informations->headers_length) {
+    if (http->http_informations->headers_length) {
       parser->extracted_fields[PFWL_FIELDS_L7_HTTP_HEADERS].present = 1;
       parser->extracted_fields[PFWL_FIELDS_L7_HTTP_HEADERS].mmap.values =
-          flow_info_private->http_informations->headers;
+          http->http_informations->headers;
       parser->extracted_fields[PFWL_FIELDS_L7_HTTP_HEADERS].mmap.length =
-          flow_info_private->http_informations->headers_length;
+          http->http_informations->headers_length;
     }
     return PFWL_PROTOCOL_MATCHES;
   } else {
@@ -301,6 +354,11 @@ uint8_t check_http(pfwl_state_t *state, const unsigned char *app_data,
       parser->data = NULL; // To force http_parser_init at next iteration
       return PFWL_PROTOCOL_MORE_DATA_NEEDED;
     } else {
+      if (!flow_info_private->identification_terminated) {
+        // HTTP will not be checked anymore on this flow.
+        pfwl_inspector_state_release(flow_info_private,
+                                     PFWL_INSPECTOR_STATE_HTTP);
+      }
       return PFWL_PROTOCOL_NO_MATCHES;
     }
   }
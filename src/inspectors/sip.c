@@ -1292,18 +1292,24 @@ uint8_t check_sip(pfwl_state_t *state, const unsigned char *app_data,
   }
   pfwl_dissector_accuracy_t accuracy =
       state->inspectors_accuracy[PFWL_PROTO_L7_SIP];
-  memset(&(flow_info_private->sip_informations), 0,
-         sizeof(flow_info_private->sip_informations));
   /* check if this is real SIP */
   if (!isalpha(app_data[0])) {
     return PFWL_PROTOCOL_NO_MATCHES;
   }
+  pfwl_sip_internal_information_t *sip_informations =
+      pfwl_inspector_state_get(flow_info_private, PFWL_INSPECTOR_STATE_SIP);
+  memset(sip_informations, 0, sizeof(pfwl_sip_internal_information_t));
 
   // TODO: TO be ported
   // msg->rcinfo.proto_type = PROTO_SIP;
 
   uint8_t r =
-      parse_packet(state, flow_info_private, app_data, data_length, &flow_info_private->sip_informations,
+      parse_packet(state, flow_info_private, app_data, data_length, sip_informations,
                    accuracy, pkt_info->l7.protocol_fields);
+  if (r == PFWL_PROTOCOL_NO_MATCHES &&
+      !flow_info_private->identification_terminated) {
+    // SIP will not be checked anymore on this flow.
+    pfwl_inspector_state_release(flow_info_private, PFWL_INSPECTOR_STATE_SIP);
+  }
   return r;
 }
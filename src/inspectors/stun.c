@@ -72,6 +72,8 @@ uint8_t check_stun(pfwl_state_t *state, const unsigned char *app_data,
           uint8_t family = app_data[offset + 5];
           uint16_t port = ntohs(get_u16(app_data, offset + 6));
           size_t addr_len = 0;
+          pfwl_stun_internal_information_t *stun =
+              pfwl_inspector_state_get(flow_info_private, PFWL_INSPECTOR_STATE_STUN);
           if(family == 0x01){
             // IPv4
             addr_len = 4;
@@ -80,7 +82,7 @@ uint8_t check_stun(pfwl_state_t *state, const unsigned char *app_data,
             if(type == STUN_XOR_MAPPED_ADDRESS){
               in.s_addr ^= STUN_MAGIC_COOKIE;
             }
-            inet_ntop(AF_INET, &in, flow_info_private->stun_mapped_address, sizeof(flow_info_private->stun_mapped_address));
+            inet_ntop(AF_INET, &in, stun->mapped_address, sizeof(stun->mapped_address));
           }else{
             // IPv6
             addr_len = 16;
@@ -92,7 +94,7 @@ uint8_t check_stun(pfwl_state_t *state, const unsigned char *app_data,
               in.__in6_u.__u6_addr32[2] ^= stun_packet->transaction_id_1;
               in.__in6_u.__u6_addr32[3] ^= stun_packet->transaction_id_2;
             }
-            inet_ntop(AF_INET6, &in, flow_info_private->stun_mapped_address, sizeof(flow_info_private->stun_mapped_address));
+            inet_ntop(AF_INET6, &in, stun->mapped_address, sizeof(stun->mapped_address));
           }
           if(type == STUN_XOR_MAPPED_ADDRESS){
 #if __BYTE_ORDER == __LITTLE_ENDIAN
@@ -102,7 +104,7 @@ uint8_t check_stun(pfwl_state_t *state, const unsigned char *app_data,
 #endif
           }
           pfwl_field_number_set(pkt_info->l7.protocol_fields, PFWL_FIELDS_L7_STUN_MAPPED_ADDRESS_PORT, port);
-          pfwl_field_string_set(pkt_info->l7.protocol_fields, PFWL_FIELDS_L7_STUN_MAPPED_ADDRESS, (const unsigned char*) flow_info_private->stun_mapped_address, addr_len);
+          pfwl_field_string_set(pkt_info->l7.protocol_fields, PFWL_FIELDS_L7_STUN_MAPPED_ADDRESS, (const unsigned char*) stun->mapped_address, addr_len);
         }
         offset += length + 4; /* 'Type' and 'length' lengths are not included in 'length'*/
       }
@@ -35,10 +35,6 @@
 #include <strings.h>
 #include <sys/types.h>
 
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-#include <ff/spin-lock.hpp>
-#endif
-
 #define PFWL_DEBUG_FRAGMENTATION_v4 0
 
 #define debug_print(fmt, ...)                                                  \
@@ -47,39 +43,41 @@
       fprintf(stderr, fmt, __VA_ARGS__);                                       \
   } while (0)
 
-#define PFWL_IP_FRAGMENTATION_MAX_DATAGRAM_SIZE 65535
 #define PFWL_IPv4_FRAGMENTATION_MINIMUM_MTU 576
 
 typedef struct pfwl_ipv4_fragmentation_flow pfwl_ipv4_fragmentation_flow_t;
 typedef struct pfwl_ipv4_fragmentation_source pfwl_ipv4_fragmentation_source_t;
 
-/* Is for a specific <(Source), Dest, Protocol, Identifier>. */
+/* Is for a specific <Source, Dest, Protocol, Identifier>. */
 typedef struct pfwl_ipv4_fragmentation_flow {
-  /* Pointer to IP header for the reassembled datagram. */
-  struct iphdr *iph;
-  /* Total data_length of the final datagram (without IP header). */
-  uint16_t len;
-  uint16_t id;
+  uint32_t src_ip;
   uint32_t dest_ip;
+  uint16_t id;
   uint8_t protocol;
-  /* Linked list of received fragments. */
-  pfwl_reassembly_fragment_t *fragments;
+  /* 1 if the fragment with offset 0 (and thus the header) was received. */
+  uint8_t header_received;
+  uint16_t row;
+  /* Previous and next flows in the same row of the table. */
+  pfwl_ipv4_fragmentation_flow_t *next;
+  pfwl_ipv4_fragmentation_flow_t *prev;
   /*
    * For a given source, pointer to the previous and next flows
-   * started from that source
+   * started from that source (from the oldest to the newest one).
    */
-  pfwl_ipv4_fragmentation_flow_t *next;
-  pfwl_ipv4_fragmentation_flow_t *prev;
+  pfwl_ipv4_fragmentation_flow_t *source_next;
+  pfwl_ipv4_fragmentation_flow_t *source_prev;
   pfwl_reassembly_timer_t timer;
   pfwl_ipv4_fragmentation_source_t *source;
+  pfwl_reassembly_ip_datagram_t datagram;
 } pfwl_ipv4_fragmentation_flow_t;
 
 /**
  *  For each source IP which have fragments "in fly" stores the
- *  fragments and the memory used by this flow.
+ *  flows and the memory used by them, to enforce the per host limit.
  **/
 typedef struct pfwl_ipv4_fragmentation_source {
   pfwl_ipv4_fragmentation_flow_t *flows;
+  pfwl_ipv4_fragmentation_flow_t *flows_tail;
   uint32_t source_used_mem;
   uint32_t src_ip;
   uint16_t row;
@@ -87,39 +85,106 @@ typedef struct pfwl_ipv4_fragmentation_source {
   pfwl_ipv4_fragmentation_source_t *next;
 } pfwl_ipv4_fragmentation_source_t;
 
-typedef struct pfwl_ipv4_fragmentation_state {
+/**
+ * Fragments managed by one thread. All the fragments of a datagram are
+ * managed by the same shard, so the shards are never shared.
+ **/
+typedef struct pfwl_ipv4_fragmentation_shard {
+  /**
+   * Hash table containing the flows, indexed by the whole
+   * <Source, Dest, Protocol, Identifier> key.
+   **/
+  pfwl_ipv4_fragmentation_flow_t **flows;
   /**
    * Is an hash table containing associations between source IP
    * address and fragments generated by that address.
    **/
   pfwl_ipv4_fragmentation_source_t **table;
   uint32_t total_used_mem;
-  uint16_t table_size;
+  /** Memory that the shard can use, taken from the total limit. **/
+  uint32_t credits;
 
   /** List of timers. **/
   pfwl_reassembly_timer_t *timer_head, *timer_tail;
 
+  /** Used for the flows and the sources. **/
+  pfwl_allocator_t allocator;
+  char padding[PFWL_CACHE_LINE_SIZE];
+} pfwl_ipv4_fragmentation_shard_t;
+
+typedef struct pfwl_ipv4_fragmentation_state {
+  pfwl_ipv4_fragmentation_shard_t *shards;
+  uint16_t shards_num;
+  uint16_t table_size;
+
   /** Memory limits. **/
   uint32_t per_source_memory_limit;
-  uint32_t total_memory_limit;
+  pfwl_reassembly_credits_t credits;
 
   /** Reassembly timeout. **/
   uint8_t timeout;
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-  ff::lock_t lock;
-#endif
+
+  pfwl_memory_allocator_t allocator_type;
 } pfwl_ipv4_fragmentation_state_t;
 
 #ifndef PFWL_DEBUG
 static
-#if PFWL_USE_INLINING == 1
-    inline
-#endif
 #endif
     void
-    pfwl_ipv4_fragmentation_delete_source(
-        pfwl_ipv4_fragmentation_state_t *state,
-        pfwl_ipv4_fragmentation_source_t *source);
+    pfwl_ipv4_fragmentation_delete_flow(pfwl_ipv4_fragmentation_shard_t *shard,
+                                        pfwl_ipv4_fragmentation_flow_t *flow);
+
+/**
+ * Releases some shards and all the fragments they store.
+ * @param shards The shards.
+ * @param shards_num The number of shards.
+ */
+static void
+pfwl_ipv4_fragmentation_destroy_shards(pfwl_ipv4_fragmentation_shard_t *shards,
+                                       uint16_t shards_num) {
+  for (uint16_t i = 0; i < shards_num; i++) {
+    pfwl_ipv4_fragmentation_shard_t *shard = &(shards[i]);
+    /** Deleting the last flow of a source also deletes the source. **/
+    while (shard->timer_head) {
+      pfwl_ipv4_fragmentation_delete_flow(
+          shard, (pfwl_ipv4_fragmentation_flow_t *) shard->timer_head->data);
+    }
+    free(shard->table);
+    free(shard->flows);
+    pfwl_allocator_destroy(&(shard->allocator));
+  }
+  free(shards);
+}
+
+/**
+ * Allocates the shards of a defragmentation state.
+ * @param state The state of the defragmentation module.
+ * @param shards_num The number of shards.
+ * @return The shards, NULL if no memory is available.
+ */
+static pfwl_ipv4_fragmentation_shard_t *
+pfwl_ipv4_fragmentation_create_shards(pfwl_ipv4_fragmentation_state_t *state,
+                                      uint16_t shards_num) {
+  pfwl_ipv4_fragmentation_shard_t *shards =
+      (pfwl_ipv4_fragmentation_shard_t *) calloc(
+          shards_num, sizeof(pfwl_ipv4_fragmentation_shard_t));
+  if (unlikely(shards == NULL)) {
+    return NULL;
+  }
+  for (uint16_t i = 0; i < shards_num; i++) {
+    pfwl_ipv4_fragmentation_shard_t *shard = &(shards[i]);
+    pfwl_allocator_init(&(shard->allocator), state->allocator_type);
+    shard->table = (pfwl_ipv4_fragmentation_source_t **) calloc(
+        state->table_size, sizeof(pfwl_ipv4_fragmentation_source_t *));
+    shard->flows = (pfwl_ipv4_fragmentation_flow_t **) calloc(
+        state->table_size, sizeof(pfwl_ipv4_fragmentation_flow_t *));
+    if (unlikely(shard->table == NULL || shard->flows == NULL)) {
+      pfwl_ipv4_fragmentation_destroy_shards(shards, i + 1);
+      return NULL;
+    }
+  }
+  return shards;
+}
 
 /**
  * Enables the IPv4 defragmentation.
@@ -132,30 +197,22 @@ pfwl_reordering_enable_ipv4_fragmentation(uint16_t table_size) {
       (pfwl_ipv4_fragmentation_state_t *) calloc(
           1, sizeof(pfwl_ipv4_fragmentation_state_t));
   if (unlikely(r == NULL)) {
-    free(r);
     return NULL;
   }
   r->table_size = table_size;
-  r->table = (pfwl_ipv4_fragmentation_source_t **) malloc(
-      table_size * sizeof(pfwl_ipv4_fragmentation_source_t *));
-  if (unlikely(r->table == NULL)) {
-    free(r);
-    return NULL;
-  }
-  uint16_t i;
-  for (i = 0; i < table_size; i++) {
-    r->table[i] = NULL;
-  }
-  r->timer_head = NULL;
-  r->timer_tail = NULL;
   r->per_source_memory_limit =
       PFWL_IPv4_FRAGMENTATION_DEFAULT_PER_HOST_MEMORY_LIMIT;
-  r->total_memory_limit = PFWL_IPv4_FRAGMENTATION_DEFAULT_TOTAL_MEMORY_LIMIT;
+  r->credits.limit = PFWL_IPv4_FRAGMENTATION_DEFAULT_TOTAL_MEMORY_LIMIT;
+  r->credits.taken = 0;
+  r->credits.shards = 1;
   r->timeout = PFWL_IPv4_FRAGMENTATION_DEFAULT_REASSEMBLY_TIMEOUT;
-  r->total_used_mem = 0;
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-  ff::init_unlocked(r->lock);
-#endif
+  r->allocator_type = PFWL_MEMORY_ALLOCATOR_MALLOC;
+  r->shards = pfwl_ipv4_fragmentation_create_shards(r, 1);
+  if (unlikely(r->shards == NULL)) {
+    free(r);
+    return NULL;
+  }
+  r->shards_num = 1;
   return r;
 }
 
@@ -167,7 +224,7 @@ void pfwl_reordering_ipv4_fragmentation_set_per_host_memory_limit(
 
 void pfwl_reordering_ipv4_fragmentation_set_total_memory_limit(
     pfwl_ipv4_fragmentation_state_t *frag_state, uint32_t total_memory_limit) {
-  frag_state->total_memory_limit = total_memory_limit;
+  frag_state->credits.limit = total_memory_limit;
 }
 
 void pfwl_reordering_ipv4_fragmentation_set_reassembly_timeout(
@@ -175,26 +232,69 @@ void pfwl_reordering_ipv4_fragmentation_set_reassembly_timeout(
   frag_state->timeout = timeout_seconds;
 }
 
+uint8_t pfwl_reordering_ipv4_fragmentation_set_shards(
+    pfwl_ipv4_fragmentation_state_t *frag_state, uint16_t shards_num) {
+  if (shards_num == 0) {
+    return 1;
+  }
+  for (uint16_t i = 0; i < frag_state->shards_num; i++) {
+    if (frag_state->shards[i].total_used_mem) {
+      return 1;
+    }
+  }
+  pfwl_ipv4_fragmentation_shard_t *shards =
+      pfwl_ipv4_fragmentation_create_shards(frag_state, shards_num);
+  if (unlikely(shards == NULL)) {
+    return 1;
+  }
+  pfwl_ipv4_fragmentation_destroy_shards(frag_state->shards,
+                                         frag_state->shards_num);
+  frag_state->shards = shards;
+  frag_state->shards_num = shards_num;
+  frag_state->credits.taken = 0;
+  frag_state->credits.shards = shards_num;
+  frag_state->credits.starving = 0;
+  return 0;
+}
+
 void pfwl_reordering_disable_ipv4_fragmentation(
     pfwl_ipv4_fragmentation_state_t *frag_state) {
   if (frag_state == NULL)
     return;
-  pfwl_ipv4_fragmentation_source_t *source, *tmp_source;
-  if (frag_state->table) {
-    uint16_t i;
-    for (i = 0; i < frag_state->table_size; i++) {
-      if (frag_state->table[i]) {
-        source = frag_state->table[i];
-        while (source) {
-          tmp_source = source->next;
-          pfwl_ipv4_fragmentation_delete_source(frag_state, source);
-          source = tmp_source;
-        }
-      }
+  pfwl_ipv4_fragmentation_destroy_shards(frag_state->shards,
+                                         frag_state->shards_num);
+  free(frag_state);
+}
+
+uint8_t pfwl_reordering_ipv4_fragmentation_memory_in_use(
+    pfwl_ipv4_fragmentation_state_t *frag_state) {
+  for (uint16_t i = 0; i < frag_state->shards_num; i++) {
+    if (frag_state->shards[i].total_used_mem) {
+      return 1;
     }
-    free(frag_state->table);
   }
-  free(frag_state);
+  return 0;
+}
+
+uint8_t pfwl_reordering_ipv4_fragmentation_set_memory_allocator(
+    pfwl_ipv4_fragmentation_state_t *frag_state,
+    pfwl_memory_allocator_t type) {
+  if (pfwl_reordering_ipv4_fragmentation_memory_in_use(frag_state)) {
+    return 1;
+  }
+  frag_state->allocator_type = type;
+  for (uint16_t i = 0; i < frag_state->shards_num; i++) {
+    pfwl_allocator_destroy(&(frag_state->shards[i].allocator));
+    pfwl_allocator_init(&(frag_state->shards[i].allocator), type);
+  }
+  return 0;
+}
+
+void pfwl_reordering_ipv4_fragmentation_get_memory_stats(
+    pfwl_ipv4_fragmentation_state_t *frag_state, pfwl_memory_stats_t *stats) {
+  for (uint16_t i = 0; i < frag_state->shards_num; i++) {
+    pfwl_allocator_get_stats(&(frag_state->shards[i].allocator), stats);
+  }
 }
 
 #ifndef PFWL_DEBUG
@@ -203,70 +303,26 @@ static
     inline
 #endif
 #endif
-    /** Robert Jenkins' 32 bit integer hash function. **/
     uint16_t
     pfwl_ipv4_fragmentation_hash_function(
         pfwl_ipv4_fragmentation_state_t *state, uint32_t src_ip) {
-  src_ip = (src_ip + 0x7ed55d16) + (src_ip << 12);
-  src_ip = (src_ip ^ 0xc761c23c) ^ (src_ip >> 19);
-  src_ip = (src_ip + 0x165667b1) + (src_ip << 5);
-  src_ip = (src_ip + 0xd3a2646c) ^ (src_ip << 9);
-  src_ip = (src_ip + 0xfd7046c5) + (src_ip << 3);
-  src_ip = (src_ip ^ 0xb55a4f09) ^ (src_ip >> 16);
-  return src_ip % state->table_size;
+  return pfwl_reassembly_mix(src_ip) % state->table_size;
 }
 
 #ifndef PFWL_DEBUG
 static
+#if PFWL_USE_INLINING == 1
+    inline
 #endif
-    void
-    pfwl_ipv4_fragmentation_delete_flow(pfwl_ipv4_fragmentation_state_t *state,
-                                        pfwl_ipv4_fragmentation_flow_t *flow) {
-  pfwl_reassembly_fragment_t *frag, *temp_frag;
-
-  pfwl_ipv4_fragmentation_source_t *source = flow->source;
-
-  source->source_used_mem -= sizeof(pfwl_ipv4_fragmentation_flow_t);
-  state->total_used_mem -= sizeof(pfwl_ipv4_fragmentation_flow_t);
-
-  /* Stop the timer and delete it. */
-  pfwl_reassembly_delete_timer(&(state->timer_head), &(state->timer_tail),
-                               &(flow->timer));
-
-  /* Release all fragment data. */
-  frag = flow->fragments;
-  while (frag) {
-    temp_frag = frag->next;
-    source->source_used_mem -= (frag->end - frag->offset);
-    state->total_used_mem -= (frag->end - frag->offset);
-
-    free(frag->ptr);
-    free(frag);
-    frag = temp_frag;
-  }
-
-  /** Delete the IP header. **/
-  if (flow->iph) {
-    uint8_t header_length = (flow->iph->ihl & 0x0f) * 4;
-    free(flow->iph);
-    source->source_used_mem -= header_length;
-    state->total_used_mem -= header_length;
-  }
-
-  /*
-   * Remove the flow from the list of the flows. If no more flows
-   * for this source, then delete the source.
-   */
-  if (flow->prev == NULL) {
-    source->flows = flow->next;
-    if (source->flows != NULL)
-      source->flows->prev = NULL;
-  } else {
-    flow->prev->next = flow->next;
-    if (flow->next)
-      flow->next->prev = flow->prev;
-  }
-  free(flow);
+#endif
+    uint16_t
+    pfwl_ipv4_fragmentation_flow_hash_function(
+        pfwl_ipv4_fragmentation_state_t *state, const struct iphdr *iph) {
+  uint32_t h = pfwl_reassembly_mix(iph->saddr);
+  h = pfwl_reassembly_mix(h ^ iph->daddr);
+  h = pfwl_reassembly_mix(h ^ (((uint32_t) iph->id << 8) |
+                                       iph->protocol));
+  return h % state->table_size;
 }
 
 #ifndef PFWL_DEBUG
@@ -277,29 +333,93 @@ static
 #endif
     void
     pfwl_ipv4_fragmentation_delete_source(
-        pfwl_ipv4_fragmentation_state_t *state,
+        pfwl_ipv4_fragmentation_shard_t *shard,
         pfwl_ipv4_fragmentation_source_t *source) {
   uint16_t row = source->row;
 
-  /** Delete all the flows belonging to this source. **/
-  pfwl_ipv4_fragmentation_flow_t *flow = source->flows, *temp_flow;
-  while (flow) {
-    temp_flow = flow->next;
-    pfwl_ipv4_fragmentation_delete_flow(state, flow);
-    flow = temp_flow;
-  }
-
   /** Delete this source from the list. **/
   if (source->prev)
     source->prev->next = source->next;
   else
-    state->table[row] = source->next;
+    shard->table[row] = source->next;
 
   if (source->next)
     source->next->prev = source->prev;
 
-  free(source);
-  state->total_used_mem -= sizeof(pfwl_ipv4_fragmentation_source_t);
+  pfwl_allocator_free(&(shard->allocator), PFWL_MEMORY_FRAGMENTS, source,
+                      sizeof(pfwl_ipv4_fragmentation_source_t));
+  shard->total_used_mem -= sizeof(pfwl_ipv4_fragmentation_source_t);
+}
+
+/**
+ * Updates the memory used by a flow, after its datagram buffer changed.
+ * @param shard The shard of the flow.
+ * @param flow The flow.
+ * @param old_memory The memory used by the buffer before the change.
+ */
+static void pfwl_ipv4_fragmentation_account(
+    pfwl_ipv4_fragmentation_shard_t *shard,
+    pfwl_ipv4_fragmentation_flow_t *flow, uint32_t old_memory) {
+  uint32_t new_memory = pfwl_reassembly_ip_datagram_memory(&(flow->datagram));
+  if (new_memory > old_memory) {
+    pfwl_allocator_account_alloc(&(shard->allocator), PFWL_MEMORY_FRAGMENTS,
+                                 new_memory - old_memory);
+  } else {
+    pfwl_allocator_account_free(&(shard->allocator), PFWL_MEMORY_FRAGMENTS,
+                                old_memory - new_memory);
+  }
+  shard->total_used_mem += new_memory - old_memory;
+  flow->source->source_used_mem += new_memory - old_memory;
+}
+
+/**
+ * Deletes a flow. If it was the last flow of its source, the source
+ * is deleted too.
+ **/
+#ifndef PFWL_DEBUG
+static
+#endif
+    void
+    pfwl_ipv4_fragmentation_delete_flow(pfwl_ipv4_fragmentation_shard_t *shard,
+                                        pfwl_ipv4_fragmentation_flow_t *flow) {
+  pfwl_ipv4_fragmentation_source_t *source = flow->source;
+
+  /* Release the buffer (if it was not given to the caller). */
+  uint32_t memory = pfwl_reassembly_ip_datagram_memory(&(flow->datagram));
+  pfwl_reassembly_ip_datagram_release(&(flow->datagram));
+  pfwl_ipv4_fragmentation_account(shard, flow, memory);
+
+  source->source_used_mem -= sizeof(pfwl_ipv4_fragmentation_flow_t);
+  shard->total_used_mem -= sizeof(pfwl_ipv4_fragmentation_flow_t);
+
+  /* Stop the timer and delete it. */
+  pfwl_reassembly_delete_timer(&(shard->timer_head), &(shard->timer_tail),
+                               &(flow->timer));
+
+  /* Remove the flow from its row. */
+  if (flow->prev)
+    flow->prev->next = flow->next;
+  else
+    shard->flows[flow->row] = flow->next;
+  if (flow->next)
+    flow->next->prev = flow->prev;
+
+  /* Remove the flow from the list of the flows of the source. */
+  if (flow->source_prev)
+    flow->source_prev->source_next = flow->source_next;
+  else
+    source->flows = flow->source_next;
+  if (flow->source_next)
+    flow->source_next->source_prev = flow->source_prev;
+  else
+    source->flows_tail = flow->source_prev;
+
+  pfwl_allocator_free(&(shard->allocator), PFWL_MEMORY_FRAGMENTS, flow,
+                      sizeof(pfwl_ipv4_fragmentation_flow_t));
+
+  if (source->flows == NULL) {
+    pfwl_ipv4_fragmentation_delete_source(shard, source);
+  }
 }
 
 #ifndef PFWL_DEBUG
@@ -308,16 +428,18 @@ static
     /**
      * Try to find the specific source. If it is not find, then creates it.
      * @param state The state of the defragmentation module.
+     * @param shard The shard managing the source.
      * @param addr The source address.
      * @return A pointer to the source.
      */
     pfwl_ipv4_fragmentation_source_t *
     pfwl_ipv4_fragmentation_find_or_create_source(
-        pfwl_ipv4_fragmentation_state_t *state, uint32_t addr) {
+        pfwl_ipv4_fragmentation_state_t *state,
+        pfwl_ipv4_fragmentation_shard_t *shard, uint32_t addr) {
   uint16_t hash_index = pfwl_ipv4_fragmentation_hash_function(state, addr);
   pfwl_ipv4_fragmentation_source_t *source, *head;
 
-  head = state->table[hash_index];
+  head = shard->table[hash_index];
 
   for (source = head; source != NULL; source = source->next) {
     if (source->src_ip == addr) {
@@ -326,23 +448,25 @@ static
   }
 
   /** Not found, so create it. **/
-  source = (pfwl_ipv4_fragmentation_source_t *) malloc(
+  source = (pfwl_ipv4_fragmentation_source_t *) pfwl_allocator_alloc(
+      &(shard->allocator), PFWL_MEMORY_FRAGMENTS,
       sizeof(pfwl_ipv4_fragmentation_source_t));
   if (unlikely(source == NULL)) {
     return NULL;
   }
   source->row = hash_index;
   source->flows = NULL;
+  source->flows_tail = NULL;
   source->src_ip = addr;
   source->source_used_mem = sizeof(pfwl_ipv4_fragmentation_source_t);
-  state->total_used_mem += sizeof(pfwl_ipv4_fragmentation_source_t);
+  shard->total_used_mem += sizeof(pfwl_ipv4_fragmentation_source_t);
 
   /** Insertion at the beginning of the list. **/
   source->prev = NULL;
   source->next = head;
   if (head)
     head->prev = source;
-  state->table[hash_index] = source;
+  shard->table[hash_index] = source;
 
   return source;
 }
@@ -350,53 +474,70 @@ static
 #ifndef PFWL_DEBUG
 static
 #endif
+    /**
+     * Finds the flow of a fragment.
+     * @param shard The shard managing the fragment.
+     * @param iph The header of the fragment.
+     * @param row The row of the table where the flow is (or must be) stored.
+     * @return A pointer to the flow, NULL if it does not exist.
+     */
     pfwl_ipv4_fragmentation_flow_t *
-    pfwl_ipv4_fragmentation_find_or_create_flow(
-        pfwl_ipv4_fragmentation_state_t *state,
-        pfwl_ipv4_fragmentation_source_t *source, const struct iphdr *iph,
-        uint32_t current_time) {
+    pfwl_ipv4_fragmentation_find_flow(pfwl_ipv4_fragmentation_shard_t *shard,
+                                      const struct iphdr *iph, uint16_t row) {
   pfwl_ipv4_fragmentation_flow_t *flow;
-  for (flow = source->flows; flow != NULL; flow = flow->next) {
-    /**
-     * The source is matched for sure because all the
-     * flows will have the same source.
-     **/
-    if (iph->id == flow->id && iph->daddr == flow->dest_ip &&
-        iph->protocol == flow->protocol) {
+  for (flow = shard->flows[row]; flow != NULL; flow = flow->next) {
+    if (iph->id == flow->id && iph->saddr == flow->src_ip &&
+        iph->daddr == flow->dest_ip && iph->protocol == flow->protocol) {
       return flow;
     }
   }
+  return NULL;
+}
 
-  /** Not found, create a new flow. **/
-  flow = (pfwl_ipv4_fragmentation_flow_t *) malloc(
-      sizeof(pfwl_ipv4_fragmentation_flow_t));
+#ifndef PFWL_DEBUG
+static
+#endif
+    pfwl_ipv4_fragmentation_flow_t *
+    pfwl_ipv4_fragmentation_create_flow(
+        pfwl_ipv4_fragmentation_state_t *state,
+        pfwl_ipv4_fragmentation_shard_t *shard,
+        pfwl_ipv4_fragmentation_source_t *source, const struct iphdr *iph,
+        uint16_t row, uint32_t current_time) {
+  pfwl_ipv4_fragmentation_flow_t *flow =
+      (pfwl_ipv4_fragmentation_flow_t *) pfwl_allocator_alloc(
+          &(shard->allocator), PFWL_MEMORY_FRAGMENTS,
+          sizeof(pfwl_ipv4_fragmentation_flow_t));
   if (unlikely(flow == NULL)) {
     return NULL;
   }
+  memset(flow, 0, sizeof(pfwl_ipv4_fragmentation_flow_t));
 
   source->source_used_mem += sizeof(pfwl_ipv4_fragmentation_flow_t);
-  state->total_used_mem += sizeof(pfwl_ipv4_fragmentation_flow_t);
+  shard->total_used_mem += sizeof(pfwl_ipv4_fragmentation_flow_t);
 
-  flow->fragments = NULL;
   flow->source = source;
-  flow->len = 0;
-  /* Add this entry to the queue of flows. */
-  flow->prev = NULL;
-  flow->next = source->flows;
+  flow->row = row;
+  flow->src_ip = iph->saddr;
+  flow->dest_ip = iph->daddr;
+  flow->id = iph->id;
+  flow->protocol = iph->protocol;
+  /* Add this entry to its row. */
+  flow->next = shard->flows[row];
   if (flow->next)
     flow->next->prev = flow;
-  source->flows = flow;
+  shard->flows[row] = flow;
+  /* Add this entry at the end of the flows of the source. */
+  flow->source_prev = source->flows_tail;
+  if (source->flows_tail)
+    source->flows_tail->source_next = flow;
+  else
+    source->flows = flow;
+  source->flows_tail = flow;
   /* Set the timer. */
   flow->timer.expiration_time = current_time + state->timeout;
   flow->timer.data = flow;
-  pfwl_reassembly_add_timer(&(state->timer_head), &(state->timer_tail),
+  pfwl_reassembly_add_timer(&(shard->timer_head), &(shard->timer_tail),
                             &(flow->timer));
-  /* Fragments will be added later. */
-  flow->fragments = NULL;
-  flow->iph = NULL;
-  flow->id = iph->id;
-  flow->dest_ip = iph->daddr;
-  flow->protocol = iph->protocol;
   return flow;
 }
 
@@ -405,61 +546,28 @@ static
 #endif
     unsigned char *
     pfwl_ipv4_fragmentation_build_complete_datagram(
-        pfwl_ipv4_fragmentation_state_t *state,
+        pfwl_ipv4_fragmentation_shard_t *shard,
         pfwl_ipv4_fragmentation_flow_t *flow) {
-  unsigned char *pkt_beginning, *pkt_data;
-  struct iphdr *iph;
-  uint16_t len;
-  int32_t count;
-
-  /* Allocate a new buffer for the datagram. */
-  uint8_t ihl = (flow->iph->ihl & 0x0f) * 4;
-  len = flow->len;
-
-  pfwl_ipv4_fragmentation_source_t *source = flow->source;
-
-  uint32_t tot_len = ihl + len;
-
-  if (tot_len > PFWL_IP_FRAGMENTATION_MAX_DATAGRAM_SIZE) {
-    pfwl_ipv4_fragmentation_delete_flow(state, flow);
-    if (source->flows == NULL)
-      pfwl_ipv4_fragmentation_delete_source(state, source);
-    return NULL;
-  }
-
-  if (unlikely((pkt_beginning = (unsigned char *) malloc(ihl + len)) == NULL)) {
-    pfwl_ipv4_fragmentation_delete_flow(state, flow);
-    if (source->flows == NULL)
-      pfwl_ipv4_fragmentation_delete_source(state, source);
-    return NULL;
-  }
-
-  memcpy(pkt_beginning, ((unsigned char *) flow->iph), ihl);
-  pkt_data = pkt_beginning + ihl;
-
-  count = pfwl_reassembly_ip_compact_fragments(flow->fragments, &pkt_data, len);
-
-  /**
-   * We recompacted the flow (datagram), so now
-   * we can delete it.
-   **/
-  pfwl_ipv4_fragmentation_delete_flow(state, flow);
-  if (source->flows == NULL)
-    pfwl_ipv4_fragmentation_delete_source(state, source);
-
-  /**
-   * Misbehaving packet, real size is different from that
-   * obtained from the last fragment.
-   **/
-  if (count == -1) {
+  /** The buffer already contains the datagram, it is given to the caller. **/
+  unsigned char *pkt_beginning = flow->datagram.buffer;
+  uint32_t memory = pfwl_reassembly_ip_datagram_memory(&(flow->datagram));
+  flow->datagram.buffer = NULL;
+  flow->datagram.capacity = 0;
+  pfwl_ipv4_fragmentation_account(shard, flow, memory);
+
+  uint8_t ihl = flow->datagram.header_length;
+  uint16_t len = flow->datagram.length;
+  pfwl_ipv4_fragmentation_delete_flow(shard, flow);
+
+  if (ihl + len > PFWL_IP_FRAGMENTATION_MAX_DATAGRAM_SIZE) {
     free(pkt_beginning);
     return NULL;
   }
 
   /** Put the correct informations in the IP header. **/
-  iph = (struct iphdr *) pkt_beginning;
+  struct iphdr *iph = (struct iphdr *) pkt_beginning;
   iph->frag_off = 0;
-  iph->tot_len = htons(ihl + count);
+  iph->tot_len = htons(ihl + len);
   return pkt_beginning;
 }
 
@@ -468,8 +576,10 @@ unsigned char *pfwl_reordering_manage_ipv4_fragment(
     uint32_t current_time, uint16_t offset, uint8_t more_fragments, int tid) {
   struct iphdr *iph = (struct iphdr *) data;
 
+  pfwl_ipv4_fragmentation_shard_t *shard;
   pfwl_ipv4_fragmentation_source_t *source;
   pfwl_ipv4_fragmentation_flow_t *flow;
+  unsigned char *r = NULL;
 
   uint16_t tot_len = ntohs(iph->tot_len);
 /**
@@ -496,103 +606,67 @@ unsigned char *pfwl_reordering_manage_ipv4_fragment(
     return NULL;
   }
 
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-  ff::spin_lock(state->lock);
-#endif
-  source = pfwl_ipv4_fragmentation_find_or_create_source(state, iph->saddr);
-  if (unlikely(source == NULL)) {
-    debug_print("%s\n", "ERROR: Impossible to create the source.");
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-    ff::spin_unlock(state->lock);
-#endif
-    return NULL;
-  }
-  debug_print("%s\n", "Source found or created.");
-
-  debug_print("Total memory occupied: %u\n", state->total_used_mem);
-  debug_print("Source memory occupied: %u\n", state->total_used_mem);
-
-  /** If source limit exceeded, then delete flows from that source. **/
-  while (source->flows &&
-         (source->source_used_mem) > state->per_source_memory_limit) {
-    debug_print("%s\n", "Source limit exceeded, cleaning...");
-    pfwl_ipv4_fragmentation_delete_flow(state, source->flows);
-    if (source->flows == NULL) {
-      pfwl_ipv4_fragmentation_delete_source(state, source);
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-      ff::spin_unlock(state->lock);
-#endif
-      return NULL;
-    }
-  }
-
+  /**
+   * All the fragments of a datagram are managed by the same thread, and
+   * thus by the same shard, which is only accessed by that thread.
+   **/
+  shard = &(state->shards[tid % state->shards_num]);
   /**
    * Control on global memory limit for ip fragmentation.
    * The timer are sorted for the one which will expire sooner to the
    * last that will expire. The loop stops when there are no more
-   * expired timers. pfwl_ipv4_fragmentation_delete_flow(..) update
-   * the timer timer_head after deleting the timer_head if it is
-   * expired.
+   * expired timers and the shard has credits for the memory it uses.
    **/
-  while ((state->timer_head) &&
-         ((state->timer_head->expiration_time < current_time) ||
-          (state->total_used_mem >= state->total_memory_limit))) {
-    pfwl_ipv4_fragmentation_source_t *tmpsource =
-        ((pfwl_ipv4_fragmentation_flow_t *) state->timer_head->data)->source;
+  while ((shard->timer_head) &&
+         ((shard->timer_head->expiration_time < current_time) ||
+          pfwl_reassembly_credits_exhausted(&(state->credits),
+                                            &(shard->credits),
+                                            shard->total_used_mem))) {
     pfwl_ipv4_fragmentation_delete_flow(
-        state, (pfwl_ipv4_fragmentation_flow_t *) state->timer_head->data);
-    if (source->flows == NULL) {
-      pfwl_ipv4_fragmentation_delete_source(state, tmpsource);
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-      ff::spin_unlock(state->lock);
-#endif
-      return NULL;
-    }
+        shard, (pfwl_ipv4_fragmentation_flow_t *) shard->timer_head->data);
   }
 
-  /* Find the flow. */
-  flow = pfwl_ipv4_fragmentation_find_or_create_flow(state, source, iph,
-                                                     current_time);
-  debug_print("%s\n", "Flow found or created.");
+  uint16_t row = pfwl_ipv4_fragmentation_flow_hash_function(state, iph);
+  flow = pfwl_ipv4_fragmentation_find_flow(shard, iph, row);
+  if (flow == NULL) {
+    source = pfwl_ipv4_fragmentation_find_or_create_source(
+        state, shard, iph->saddr);
+    if (unlikely(source == NULL)) {
+      debug_print("%s\n", "ERROR: Impossible to create the source.");
+      goto out;
+    }
+    flow = pfwl_ipv4_fragmentation_create_flow(state, shard, source, iph, row,
+                                               current_time);
+    if (unlikely(flow == NULL)) {
+      debug_print("%s\n", "ERROR: Impossible to create the flow.");
+      if (source->flows == NULL) {
+        pfwl_ipv4_fragmentation_delete_source(shard, source);
+      }
+      goto out;
+    }
+  }
+  source = flow->source;
 
-  if (unlikely(flow == NULL)) {
-    debug_print("%s\n", "ERROR: Impossible to create the flow.");
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-    ff::spin_unlock(state->lock);
-#endif
-    return NULL;
+  /** If source limit exceeded, then delete the oldest flows of the source. **/
+  while (source->source_used_mem > state->per_source_memory_limit &&
+         source->flows != flow) {
+    debug_print("%s\n", "Source limit exceeded, cleaning...");
+    pfwl_ipv4_fragmentation_delete_flow(shard, source->flows);
   }
+  if (source->source_used_mem > state->per_source_memory_limit) {
+    pfwl_ipv4_fragmentation_delete_flow(shard, flow);
+    goto out;
+  }
+  debug_print("%s\n", "Flow found or created.");
 
   /**
-   * If is a malformed fragment which starts after the end
+   * If is a malformed fragment which ends after the end
    * of the entire datagram.
    **/
-  if (unlikely(flow->len != 0 && offset > flow->len)) {
-    debug_print("%s\n", "Malformed fragment, starts after "
+  if (unlikely(flow->datagram.length != 0 && end > flow->datagram.length)) {
+    debug_print("%s\n", "Malformed fragment, ends after "
                         "the end of the entire datagram.");
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-    ff::spin_unlock(state->lock);
-#endif
-    return NULL;
-  }
-
-  /*
-   * If the first fragment is received for the first time,
-   * store the header
-   */
-  if (offset == 0 && flow->iph == NULL) {
-    debug_print("%s\n", "Received fragment with offset zero");
-    flow->iph = (struct iphdr *) malloc(ihl * sizeof(unsigned char));
-    if (unlikely(flow->iph == NULL)) {
-      pfwl_ipv4_fragmentation_delete_flow(state, flow);
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-      ff::spin_unlock(state->lock);
-#endif
-      return NULL;
-    }
-    state->total_used_mem += ihl;
-    source->source_used_mem += ihl;
-    memcpy(flow->iph, iph, ihl);
+    goto out;
   }
 
   /**
@@ -605,48 +679,56 @@ unsigned char *pfwl_reordering_manage_ipv4_fragment(
      * If the data with MF flag=0 was already received then this
      * fragment is useless.
      **/
-    if (flow->len != 0) {
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-      ff::spin_unlock(state->lock);
-#endif
-      return NULL;
+    if (flow->datagram.length != 0) {
+      goto out;
+    }
+    /** Misbehaving packet, some data was received after the end. **/
+    if (flow->datagram.intervals_num &&
+        flow->datagram.intervals[flow->datagram.intervals_num - 1].end > end) {
+      pfwl_ipv4_fragmentation_delete_flow(shard, flow);
+      goto out;
     }
-    flow->len = end;
+    flow->datagram.length = end;
   }
 
-  uint32_t bytes_removed;
-  uint32_t bytes_inserted;
-  pfwl_reassembly_insert_fragment(&(flow->fragments), data + ihl, offset, end,
-                                  &(bytes_removed), &(bytes_inserted));
-  state->total_used_mem += bytes_inserted;
-  state->total_used_mem -= bytes_removed;
-
-  source->source_used_mem += bytes_inserted;
-  source->source_used_mem -= bytes_removed;
-
+  {
+    uint32_t memory = pfwl_reassembly_ip_datagram_memory(&(flow->datagram));
+    uint8_t failed = 0;
+    /*
+     * If the first fragment is received for the first time,
+     * store the header
+     */
+    if (offset == 0 && !flow->header_received) {
+      debug_print("%s\n", "Received fragment with offset zero");
+      failed = pfwl_reassembly_ip_datagram_set_header(&(flow->datagram), data,
+                                                      ihl);
+      flow->header_received = !failed;
+    }
+    if (!failed) {
+      failed = pfwl_reassembly_ip_datagram_insert(&(flow->datagram),
+                                                  data + ihl, offset, end, ihl);
+    }
+    pfwl_ipv4_fragmentation_account(shard, flow, memory);
+    if (unlikely(failed)) {
+      debug_print("%s\n", "ERROR: Impossible to store the fragment.");
+      goto out;
+    }
+  }
   debug_print("%s\n", "Fragment inserted.");
 
   /**
    *  Check if with the new fragment that we inserted, the original
    *  datagram is now complete.
-   *  (Only possible if we received the fragment with MF flag=0
-   *  (so the len is set) and if we have a train of contiguous
-   *   fragments).
    **/
-  if (flow->len != 0 &&
-      pfwl_reassembly_ip_check_train_of_contiguous_fragments(flow->fragments)) {
-    unsigned char *r;
+  if (flow->header_received &&
+      pfwl_reassembly_ip_datagram_complete(&(flow->datagram))) {
     debug_print("%s\n", "Last fragment already received and train "
                         "of contiguous fragments present, returing the "
                         "recompacted datagram.");
-    r = pfwl_ipv4_fragmentation_build_complete_datagram(state, flow);
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-    ff::spin_unlock(state->lock);
-#endif
-    return r;
+    r = pfwl_ipv4_fragmentation_build_complete_datagram(shard, flow);
   }
-#if PFWL_THREAD_SAFETY_ENABLED == 1
-  ff::spin_unlock(state->lock);
-#endif
-  return NULL;
+out:
+  pfwl_reassembly_credits_release(&(state->credits), &(shard->credits),
+                                  shard->total_used_mem);
+  return r;
 }
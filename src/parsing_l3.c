@@ -51,7 +51,7 @@ pfwl_status_t mc_pfwl_parse_L3_header(pfwl_state_t *state,
                                       size_t p_length, uint32_t current_time,
                                       int tid,
                                       pfwl_dissection_info_t *dissection_info) {
-  memset(dissection_info, 0, sizeof(*dissection_info));
+  pfwl_dissection_info_reset(state, dissection_info);
   if (unlikely(p_length == 0)) {
     return PFWL_STATUS_OK;
   }
@@ -283,8 +283,9 @@ pfwl_status_t mc_pfwl_parse_L3_header(pfwl_state_t *state,
 
           to_return = PFWL_STATUS_IP_DATA_REBUILT;
           next_header = IPPROTO_IPV6;
-          length = ((struct ip6_hdr *) (pkt))->ip6_ctlun.ip6_un1.ip6_un1_plen +
-                   sizeof(struct ip6_hdr);
+          length =
+              ntohs(((struct ip6_hdr *) (pkt))->ip6_ctlun.ip6_un1.ip6_un1_plen) +
+              sizeof(struct ip6_hdr);
           /**
            * Force the next iteration to analyze the
            * reassembled IPv6 packet.
@@ -363,8 +364,8 @@ pfwl_status_t pfwl_dissect_L3(pfwl_state_t *state, const unsigned char *pkt,
                               size_t length, uint32_t current_time,
                               pfwl_dissection_info_t *dissection_info) {
   /**
-   * We can pass any thread id, indeed in this case we don't
-   * need lock synchronization.
+   * Single threaded, so all the fragments are managed by the first
+   * shard of the defragmentation state.
    **/
   return mc_pfwl_parse_L3_header(state, pkt, length, current_time, 0,
                                  dissection_info);
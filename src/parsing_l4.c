@@ -110,12 +110,8 @@ static void parse_tcp_opt_hdrs(pfwl_state_t *state, const unsigned char *pkt,
   }
 }
 
-pfwl_status_t
-mc_pfwl_parse_L4_header(pfwl_state_t *state, const unsigned char *pkt,
-                        size_t length, uint32_t timestamp, int tid,
-                        pfwl_dissection_info_t *dissection_info,
-                        pfwl_flow_info_private_t **flow_info_private) {
-  uint8_t syn = 0;
+pfwl_status_t mc_pfwl_parse_L4_ports(const unsigned char *pkt, size_t length,
+                                     pfwl_dissection_info_t *dissection_info) {
   switch (dissection_info->l4.protocol) {
   case IPPROTO_TCP: {
     struct tcphdr *tcp = (struct tcphdr *) pkt;
@@ -127,7 +123,6 @@ mc_pfwl_parse_L4_header(pfwl_state_t *state, const unsigned char *pkt,
     dissection_info->l4.port_src = tcp->source;
     dissection_info->l4.port_dst = tcp->dest;
     dissection_info->l4.length = (tcp->doff * 4);
-    syn = tcp->syn;    
   } break;
   case IPPROTO_UDP: {
     struct udphdr *udp = (struct udphdr *) pkt;
@@ -144,9 +139,23 @@ mc_pfwl_parse_L4_header(pfwl_state_t *state, const unsigned char *pkt,
   }
 
   dissection_info->l4.payload_length = length - dissection_info->l4.length;
-  pfwl_flow_t *flow = pfwl_flow_table_find_or_create_flow(
-      state->flow_table, dissection_info, state->protocols_to_inspect,
-      state->tcp_reordering_enabled, timestamp, syn, state->ts_unit);
+  return PFWL_STATUS_OK;
+}
+
+pfwl_status_t
+mc_pfwl_parse_L4_header(pfwl_state_t *state, const unsigned char *pkt,
+                        size_t length, uint32_t timestamp,
+                        uint16_t partition_id, uint32_t index,
+                        pfwl_dissection_info_t *dissection_info,
+                        pfwl_flow_info_private_t **flow_info_private) {
+  uint8_t syn = 0;
+  if (dissection_info->l4.protocol == IPPROTO_TCP) {
+    syn = ((struct tcphdr *) pkt)->syn;
+  }
+  pfwl_flow_t *flow = mc_pfwl_flow_table_find_or_create_flow(
+      state->flow_table, partition_id, index, dissection_info,
+      state->protocols_to_inspect, state->tcp_reordering_enabled, timestamp,
+      syn, state->ts_unit);
   if (unlikely(flow == NULL)) {
     return PFWL_ERROR_MAX_FLOWS;
   }
@@ -186,21 +195,20 @@ mc_pfwl_parse_L4_header(pfwl_state_t *state, const unsigned char *pkt,
   flow->info.statistics[PFWL_STAT_BYTES][direction] +=
       length + dissection_info->l3.length;
 
-  if (flow->info_private.last_rebuilt_tcp_data) {
-    free((void *) flow->info_private.last_rebuilt_tcp_data);
-    flow->info_private.last_rebuilt_tcp_data = NULL;
-  }
-
   pfwl_tcp_reordering_reordered_segment_t seg;
   seg.status = PFWL_TCP_REORDERING_STATUS_IN_ORDER;
-  seg.data = NULL;
+  seg.spans = NULL;
   seg.connection_terminated = 0;
 
   if (dissection_info->l4.protocol == IPPROTO_TCP &&
       state->active_protocols[0]) {
     if (flow->info_private.tcp_reordering_enabled) {
-      seg = pfwl_reordering_tcp_track_connection(dissection_info,
-                                                 &flow->info_private, pkt);
+      seg = pfwl_reordering_tcp_track_connection(
+          dissection_info, &flow->info_private, pkt,
+          state->tcp_reordering_pickup);
+      if (((struct tcphdr *) pkt)->fin || ((struct tcphdr *) pkt)->rst) {
+        pfwl_flow_table_update_expiration(flow);
+      }
 
       if(seg.status == PFWL_TCP_REORDERING_STATUS_OUT_OF_ORDER) {
         return PFWL_STATUS_TCP_OUT_OF_ORDER;
@@ -208,13 +216,17 @@ mc_pfwl_parse_L4_header(pfwl_state_t *state, const unsigned char *pkt,
         flow->info.statistics[PFWL_STAT_L4_TCP_COUNT_RETRANSMISSIONS][direction]++;
         return PFWL_STATUS_TCP_OUT_OF_ORDER;
       }else if (seg.status == PFWL_TCP_REORDERING_STATUS_REBUILT) {
-        dissection_info->l4.resegmented_pkt = seg.data;
         dissection_info->l4.resegmented_pkt_len = seg.data_length;
-        flow->info_private.last_rebuilt_tcp_data = seg.data;
+        dissection_info->l4.payload_spans = seg.spans;
+        dissection_info->l4.payload_spans_num = seg.spans_num;
       }
     } else {
-      if (pfwl_reordering_tcp_track_connection_light(pkt, dissection_info,
-                                                     &flow->info_private)) {
+      uint8_t terminated = pfwl_reordering_tcp_track_connection_light(
+          pkt, dissection_info, &flow->info_private);
+      if (((struct tcphdr *) pkt)->fin || ((struct tcphdr *) pkt)->rst) {
+        pfwl_flow_table_update_expiration(flow);
+      }
+      if (terminated) {
         return PFWL_STATUS_TCP_CONNECTION_TERMINATED;
       }
     }
@@ -226,22 +238,30 @@ pfwl_status_t pfwl_dissect_L4(pfwl_state_t *state, const unsigned char *pkt,
                               size_t length, uint32_t current_time,
                               pfwl_dissection_info_t *dissection_info,
                               pfwl_flow_info_private_t **flow_info_private) {
+  pfwl_status_t status = mc_pfwl_parse_L4_ports(pkt, length, dissection_info);
+  if (unlikely(status < 0)) {
+    return status;
+  }
   /**
-   * We can pass any thread id, indeed in this case we don't
-   * need lock synchronization.
+   * The sequential version always uses the first (and only)
+   * partition of the table.
    **/
-  return mc_pfwl_parse_L4_header(state, pkt, length, current_time, 0,
-                                 dissection_info, flow_info_private);
+  return mc_pfwl_parse_L4_header(
+      state, pkt, length, current_time, 0,
+      pfwl_compute_hash_function(state->flow_table, dissection_info),
+      dissection_info, flow_info_private);
 }
 
-pfwl_status_t pfwl_dissect_from_L4(pfwl_state_t *state,
-                                   const unsigned char *pkt, size_t length,
-                                   uint32_t timestamp,
-                                   pfwl_dissection_info_t *dissection_info) {
+pfwl_status_t mc_pfwl_dissect_from_L4(pfwl_state_t *state,
+                                      const unsigned char *pkt, size_t length,
+                                      uint32_t timestamp,
+                                      uint16_t partition_id, uint32_t index,
+                                      pfwl_dissection_info_t *dissection_info) {
   pfwl_status_t status;
   pfwl_flow_info_private_t *flow_info_private;
-  status = pfwl_dissect_L4(state, pkt, length, timestamp, dissection_info,
-                           &flow_info_private);
+  status = mc_pfwl_parse_L4_header(state, pkt, length, timestamp,
+                                   partition_id, index, dissection_info,
+                                   &flow_info_private);
 
   if (unlikely(status < 0)) {
     if (dissection_info->l3.refrag_pkt) {
@@ -252,7 +272,10 @@ pfwl_status_t pfwl_dissect_from_L4(pfwl_state_t *state,
     return status;
   }
 
-  dissection_info->flow_info = *flow_info_private->info_public;
+  dissection_info->flow_info_ref = flow_info_private->info_public;
+  if (state->flow_info_mode == PFWL_FLOW_INFO_MODE_COPY) {
+    dissection_info->flow_info = *flow_info_private->info_public;
+  }
   for(size_t i = 0; i < flow_info_private->info_public->protocols_l7_num; i++){
     dissection_info->l7.protocols[i] = flow_info_private->info_public->protocols_l7[i];
   }
@@ -272,16 +295,17 @@ pfwl_status_t pfwl_dissect_from_L4(pfwl_state_t *state,
   if (status == PFWL_STATUS_TCP_OUT_OF_ORDER) {
     return status;
   } else if (status == PFWL_STATUS_TCP_CONNECTION_TERMINATED) {
-    pfwl_flow_table_delete_flow_later(state->flow_table,
-                                      flow_info_private->flow);
+    mc_pfwl_flow_table_delete_flow_later(state->flow_table, partition_id,
+                                         flow_info_private->flow);
   }
 
   size_t l7_length;
   const unsigned char *l7_pkt;
 
   if (dissection_info->l4.resegmented_pkt_len) {
+    /** Made contiguous by pfwl_dissect_L7 only if needed. **/
     l7_length = dissection_info->l4.resegmented_pkt_len;
-    l7_pkt = dissection_info->l4.resegmented_pkt;
+    l7_pkt = dissection_info->l4.payload_spans[0].data;
     dissection_info->l4.payload_length = l7_length;
   } else {
     l7_length = length - dissection_info->l4.length;
@@ -324,6 +348,25 @@ pfwl_status_t pfwl_dissect_from_L4(pfwl_state_t *state,
   return status;
 }
 
+pfwl_status_t pfwl_dissect_from_L4(pfwl_state_t *state,
+                                   const unsigned char *pkt, size_t length,
+                                   uint32_t timestamp,
+                                   pfwl_dissection_info_t *dissection_info) {
+  pfwl_status_t status = mc_pfwl_parse_L4_ports(pkt, length, dissection_info);
+  if (unlikely(status < 0)) {
+    if (dissection_info->l3.refrag_pkt) {
+      free((unsigned char *) dissection_info->l3.refrag_pkt);
+      dissection_info->l3.refrag_pkt = NULL;
+      dissection_info->l3.refrag_pkt_len = 0;
+    }
+    return status;
+  }
+  return mc_pfwl_dissect_from_L4(
+      state, pkt, length, timestamp, 0,
+      pfwl_compute_hash_function(state->flow_table, dissection_info),
+      dissection_info);
+}
+
 static const char* pfwl_l4_protocols_names[IPPROTO_MAX] = {
   [0 ... IPPROTO_MAX - 1] = "Unknown",
 #ifdef IPPROTO_IP
@@ -26,11 +26,14 @@
  */
 #include <peafowl/config.h>
 #include <peafowl/flow_table.h>
+#include <peafowl/guess_ordering.h>
 #include <peafowl/hash_functions.h>
 #include <peafowl/inspectors/inspectors.h>
 #include <peafowl/ipv4_reassembly.h>
 #include <peafowl/ipv6_reassembly.h>
 #include <peafowl/peafowl.h>
+#include <peafowl/prefilter.h>
+#include <peafowl/tags.h>
 #include <peafowl/tcp_stream_management.h>
 #include <peafowl/utils.h>
 
@@ -186,6 +189,108 @@ static const pfwl_protocol_descriptor_t protocols_descriptors[PFWL_PROTO_L7_NUM]
   [PFWL_PROTO_L7_MQTT]     = {"MQTT"    , check_mqtt    , PFWL_L7_TRANSPORT_TCP       , NULL},
 };
 
+/**
+ * Conditions on the payload which must hold for the dissectors to match
+ * (see pfwl_prefilter_signature_t). They must be kept in sync with the
+ * dissectors. Protocols without signatures are always inspected.
+ **/
+static const pfwl_prefilter_signature_t sig_bgp[] = {
+  {PFWL_PREFILTER_TRANSPORT_TCP, 19, 0, 8, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_TCP, 0, 18, 0, {0}, {0}}, // Needs more data
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_bitcoin[] = {
+  {PFWL_PREFILTER_TRANSPORT_TCP, 0, 0, 4, {0xF9, 0xBE, 0xB4, 0xD9}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_TCP, 0, 0, 4, {0xFA, 0xBF, 0xB5, 0xDA}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_TCP, 0, 0, 4, {0x0B, 0x11, 0x09, 0x07}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_TCP, 0, 0, 4, {0xF9, 0xBE, 0xB4, 0xFE}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_dhcp[] = {
+  {PFWL_PREFILTER_TRANSPORT_UDP, 244, 0, 0, {0}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_dhcpv6[] = {
+  {PFWL_PREFILTER_TRANSPORT_UDP, 4, 0, 0, {0}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_dropbox[] = {
+  {PFWL_PREFILTER_TRANSPORT_UDP, 3, 0, 0, {0}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_hangout[] = {
+  {PFWL_PREFILTER_TRANSPORT_TCP_OR_UDP, 25, 0, 0, {0}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_mdns[] = {
+  {PFWL_PREFILTER_TRANSPORT_UDP, 12, 0, 0, {0}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_ntp[] = {
+  {PFWL_PREFILTER_TRANSPORT_UDP, 48, 0, 1, {0x00}, {0x20}}, // Versions 0-3
+  {PFWL_PREFILTER_TRANSPORT_UDP, 48, 0, 1, {0x20}, {0x38}}, // Version 4
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_quic[] = {
+  {PFWL_PREFILTER_TRANSPORT_UDP, 2, 0, 1, {0x0C}, {0xCC}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_rtcp[] = {
+  {PFWL_PREFILTER_TRANSPORT_UDP, 4, 0, 0, {0}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_rtp[] = {
+  {PFWL_PREFILTER_TRANSPORT_UDP, 12, 0, 1, {0x80}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_UDP, 12, 0, 1, {0xA0}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_skype[] = {
+  {PFWL_PREFILTER_TRANSPORT_UDP, 3, 3, 3, {0x00, 0x00, 0x0D}, {0x00, 0x00, 0x0F}},
+  {PFWL_PREFILTER_TRANSPORT_UDP, 16, 0, 3, {0x00, 0x00, 0x02}, {0x00, 0x00, 0xFF}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_spotify[] = {
+  {PFWL_PREFILTER_TRANSPORT_UDP, 7, 0, 7, {'S', 'p', 'o', 't', 'U', 'd', 'p'}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_TCP, 0, 0, 0, {0}, {0}}, // Also matched by address
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_stun[] = {
+  {PFWL_PREFILTER_TRANSPORT_TCP_OR_UDP, 0, 0, 8, {0x00, 0x00, 0x00, 0x00, 0x21, 0x12, 0xA4, 0x42},
+                                                 {0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+static const pfwl_prefilter_signature_t sig_telegram[] = {
+  {PFWL_PREFILTER_TRANSPORT_TCP, 57, 0, 1, {0xEF}, {0}},
+  {PFWL_PREFILTER_TRANSPORT_END, 0, 0, 0, {0}, {0}},
+};
+
+static const pfwl_prefilter_signature_t* prefilter_signatures[PFWL_PROTO_L7_NUM] = {
+  [PFWL_PROTO_L7_BGP]      = sig_bgp,
+  [PFWL_PROTO_L7_BITCOIN]  = sig_bitcoin,
+  [PFWL_PROTO_L7_DHCP]     = sig_dhcp,
+  [PFWL_PROTO_L7_DHCPv6]   = sig_dhcpv6,
+  [PFWL_PROTO_L7_DROPBOX]  = sig_dropbox,
+  [PFWL_PROTO_L7_HANGOUT]  = sig_hangout,
+  [PFWL_PROTO_L7_MDNS]     = sig_mdns,
+  [PFWL_PROTO_L7_NTP]      = sig_ntp,
+  [PFWL_PROTO_L7_QUIC]     = sig_quic,
+  [PFWL_PROTO_L7_RTCP]     = sig_rtcp,
+  [PFWL_PROTO_L7_RTP]      = sig_rtp,
+  [PFWL_PROTO_L7_SKYPE]    = sig_skype,
+  [PFWL_PROTO_L7_SPOTIFY]  = sig_spotify,
+  [PFWL_PROTO_L7_STUN]     = sig_stun,
+  [PFWL_PROTO_L7_TELEGRAM] = sig_telegram,
+};
+
+/**
+ * Dissectors which inspect a resegmented TCP payload piece by piece
+ * (diss_info->l4.payload_spans), ignoring the data they receive. For the
+ * others, the payload is first copied in a contiguous buffer.
+ **/
+static const uint8_t protocols_spans[PFWL_PROTO_L7_NUM] = {
+  [PFWL_PROTO_L7_HTTP] = 1,
+};
+
 typedef struct {
   pfwl_protocol_l7_t protocol;
   const char* name;
@@ -286,12 +391,81 @@ static int inspect_protocol(pfwl_protocol_l4_t protocol_l4,
        descr->transport == PFWL_L7_TRANSPORT_UDP);
 }
 
+void pfwl_dissect_L7_sub(pfwl_state_t *state, const unsigned char *pkt,
+                         size_t length, pfwl_dissection_info_t *diss_info,
+                         pfwl_flow_info_private_t *flow_info_private);
+
+/**
+ * Runs the dissector of a protocol, if it may still match the flow.
+ * Protocols for which 'plausible' is 0 are treated as if their
+ * dissector did not match, without running it.
+ * Returns 1 if the protocol matched, i.e. if no other protocol must be
+ * tried, 0 otherwise.
+ **/
+static uint8_t pfwl_dissect_L7_try(pfwl_state_t *state, const unsigned char *pkt,
+                                   size_t length, pfwl_dissection_info_t *diss_info,
+                                   pfwl_flow_info_private_t *flow_info_private,
+                                   const uint8_t *plausible, pfwl_protocol_l7_t i) {
+  uint8_t check_result = PFWL_PROTOCOL_NO_MATCHES;
+  if (BITTEST(flow_info_private->possible_matching_protocols, i)) {
+    pfwl_protocol_descriptor_t descr = protocols_descriptors[i];
+    if (plausible[i] && inspect_protocol(diss_info->l4.protocol, &descr)) {
+      debug_print("Checking: %s, possible matches %d\n", pfwl_get_L7_protocol_name(i), flow_info_private->possible_protocols);
+      check_result = (*(descr.dissector))(state, pkt, length, diss_info,
+                                          flow_info_private);
+      if (check_result == PFWL_PROTOCOL_MATCHES) {
+        if (state->guess_ordering == PFWL_GUESS_ORDERING_ADAPTIVE &&
+            !flow_info_private->info_public->protocols_l7_num) {
+          pfwl_guess_profile_update(state->guess_profile, diss_info,
+                                    flow_info_private->guess_byte_class, i);
+        }
+        flow_info_private->info_public->protocols_l7[flow_info_private->info_public->protocols_l7_num++] = i;
+
+        // Reset values
+        if(state->protocol_dependencies[i]){
+          for(size_t j = 0; j < PFWL_PROTO_L7_NUM; j++){
+            BITCLEAR(flow_info_private->possible_matching_protocols, j);
+          }
+          flow_info_private->trials = state->max_trials;
+
+          size_t j = 0;
+          flow_info_private->possible_protocols = 0;
+          pfwl_protocol_l7_t dep;
+          while((dep = state->protocol_dependencies[i][j]) != PFWL_PROTO_L7_NUM){
+            if(BITTEST(state->protocols_to_inspect, dep)){
+              BITSET(flow_info_private->possible_matching_protocols, dep);
+            }
+            ++j;
+          }
+          flow_info_private->possible_protocols = j;
+          debug_print("%s\n", "Going to dissect sub protocols.");
+          pfwl_dissect_L7_sub(state, pkt, length, diss_info, flow_info_private);
+        }else{
+          debug_print("%s\n", "Marking identification as terminated.");
+          flow_info_private->identification_terminated = 1;
+          flow_info_private->info_public->protocols_l7[flow_info_private->info_public->protocols_l7_num] = PFWL_PROTO_L7_UNKNOWN;
+          if(!flow_info_private->info_public->protocols_l7_num){
+            ++flow_info_private->info_public->protocols_l7_num;
+          }
+        }
+        return 1;
+      } else if (check_result == PFWL_PROTOCOL_NO_MATCHES) {
+        BITCLEAR(flow_info_private->possible_matching_protocols, i);
+        --(flow_info_private->possible_protocols);
+      }
+    } else {
+      BITCLEAR(flow_info_private->possible_matching_protocols, i);
+      --(flow_info_private->possible_protocols);
+    }
+  }
+  return 0;
+}
+
 void pfwl_dissect_L7_sub(pfwl_state_t *state, const unsigned char *pkt,
                          size_t length, pfwl_dissection_info_t *diss_info,
                          pfwl_flow_info_private_t *flow_info_private) {
   const pfwl_protocol_l7_t *well_known_ports;
   pfwl_protocol_l7_t i;
-  uint8_t check_result = PFWL_PROTOCOL_NO_MATCHES;
 
   if (!flow_info_private->identification_terminated) {
     // Set next protocol as not yet determined
@@ -313,53 +487,47 @@ void pfwl_dissect_L7_sub(pfwl_state_t *state, const unsigned char *pkt,
       first_to_check = 0;
     }
 
+    uint8_t plausible[PFWL_PROTO_L7_NUM];
+    if (length && !(diss_info->l4.payload_spans_num &&
+                    !diss_info->l4.resegmented_pkt)) {
+      pfwl_prefilter_match(state->prefilter, diss_info->l4.protocol, pkt,
+                           length, plausible);
+    } else {
+      memset(plausible, 1, sizeof(plausible));
+    }
+
+    /**
+     * With a learned ordering, the protocols which already matched in the
+     * same context are tried first. The others are then tried as usual.
+     **/
+    char tried[BITNSLOTS(PFWL_PROTO_L7_NUM)];
+    uint8_t learned = 0;
+    if (state->guess_ordering != PFWL_GUESS_ORDERING_PORTS &&
+        !flow_info_private->info_public->protocols_l7_num) {
+      if (!flow_info_private->guess_byte_class) {
+        flow_info_private->guess_byte_class = pfwl_guess_byte_class(pkt, length);
+      }
+      size_t num;
+      const uint8_t *order = pfwl_guess_profile_get(state->guess_profile, diss_info,
+                                                    flow_info_private->guess_byte_class, &num);
+      memset(tried, 0, sizeof(tried));
+      learned = 1;
+      for (size_t k = 0; k < num; k++) {
+        i = (pfwl_protocol_l7_t) order[k];
+        BITSET(tried, i);
+        if (pfwl_dissect_L7_try(state, pkt, length, diss_info, flow_info_private, plausible, i)) {
+          return;
+        }
+      }
+    }
+
     for (i = first_to_check; checked < PFWL_PROTO_L7_NUM;
          i = (i + 1) % PFWL_PROTO_L7_NUM, ++checked) {
-      if (BITTEST(flow_info_private->possible_matching_protocols, i)) {
-        pfwl_protocol_descriptor_t descr = protocols_descriptors[i];
-        if (inspect_protocol(diss_info->l4.protocol, &descr)) {
-          debug_print("Checking: %s, possible matches %d\n", pfwl_get_L7_protocol_name(i), flow_info_private->possible_protocols);
-          check_result = (*(descr.dissector))(state, pkt, length, diss_info,
-                                              flow_info_private);
-          if (check_result == PFWL_PROTOCOL_MATCHES) {
-            flow_info_private->info_public->protocols_l7[flow_info_private->info_public->protocols_l7_num++] = i;
-
-            // Reset values
-            if(state->protocol_dependencies[i]){
-              for(size_t j = 0; j < PFWL_PROTO_L7_NUM; j++){
-                BITCLEAR(flow_info_private->possible_matching_protocols, j);
-              }
-              flow_info_private->trials = state->max_trials;
-
-              size_t j = 0;
-              flow_info_private->possible_protocols = 0;
-              pfwl_protocol_l7_t dep;
-              while((dep = state->protocol_dependencies[i][j]) != PFWL_PROTO_L7_NUM){
-                if(BITTEST(state->protocols_to_inspect, dep)){
-                  BITSET(flow_info_private->possible_matching_protocols, dep);
-                }
-                ++j;
-              }
-              flow_info_private->possible_protocols = j;
-              debug_print("%s\n", "Going to dissect sub protocols.");
-              pfwl_dissect_L7_sub(state, pkt, length, diss_info, flow_info_private);
-            }else{
-              debug_print("%s\n", "Marking identification as terminated.");
-              flow_info_private->identification_terminated = 1;
-              flow_info_private->info_public->protocols_l7[flow_info_private->info_public->protocols_l7_num] = PFWL_PROTO_L7_UNKNOWN;
-              if(!flow_info_private->info_public->protocols_l7_num){
-                ++flow_info_private->info_public->protocols_l7_num;
-              }
-            }
-            break;
-          } else if (check_result == PFWL_PROTOCOL_NO_MATCHES) {
-            BITCLEAR(flow_info_private->possible_matching_protocols, i);
-            --(flow_info_private->possible_protocols);
-          }
-        } else {
-          BITCLEAR(flow_info_private->possible_matching_protocols, i);
-          --(flow_info_private->possible_protocols);
-        }
+      if (learned && BITTEST(tried, i)) {
+        continue;
+      }
+      if (pfwl_dissect_L7_try(state, pkt, length, diss_info, flow_info_private, plausible, i)) {
+        break;
       }
     }
   }
@@ -375,8 +543,32 @@ static int8_t pfwl_keep_inspecting(pfwl_state_t* state, pfwl_flow_info_private_t
   }
 }
 
-const char* pfwl_field_string_tag_get(void* db, pfwl_string_t* value);
-const char* pfwl_field_mmap_tag_get(void* db, pfwl_string_t* key, pfwl_string_t* value);
+/**
+ * Returns 1 if some of the dissectors which will be run on this packet
+ * need the payload to be contiguous, 0 otherwise.
+ **/
+static uint8_t pfwl_dissect_L7_needs_contiguous(pfwl_state_t* state,
+                                                pfwl_dissection_info_t *diss_info,
+                                                pfwl_flow_info_private_t *flow_info_private){
+  for(size_t i = 0; i < diss_info->l7.protocols_num; i++){
+    pfwl_protocol_l7_t proto = diss_info->l7.protocols[i];
+    if (proto < PFWL_PROTO_L7_NOT_DETERMINED && !protocols_spans[proto] &&
+        pfwl_keep_inspecting(state, flow_info_private, proto)) {
+      return 1;
+    }
+  }
+  if(!flow_info_private->identification_terminated){
+    for(size_t i = 0; i < PFWL_PROTO_L7_NUM; i++){
+      // Sub protocols are dissected on the same data
+      if (BITTEST(flow_info_private->possible_matching_protocols, i) &&
+          (!protocols_spans[i] ||
+           state->protocol_dependencies[i][0] != PFWL_PROTO_L7_NUM)) {
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
 
 pfwl_status_t pfwl_dissect_L7(pfwl_state_t *state, const unsigned char *pkt,
                               size_t length, pfwl_dissection_info_t *diss_info,
@@ -392,21 +584,34 @@ pfwl_status_t pfwl_dissect_L7(pfwl_state_t *state, const unsigned char *pkt,
   ((pfwl_flow_info_t *) flow_info_private->info_public)
       ->statistics[PFWL_STAT_L7_BYTES][diss_info->l4.direction] += length;
 
-  diss_info->flow_info.num_packets_l7[diss_info->l4.direction] =
-      flow_info_private->info_public->statistics[PFWL_STAT_L7_PACKETS][diss_info->l4.direction];
-  diss_info->flow_info.num_bytes_l7[diss_info->l4.direction] =
-      flow_info_private->info_public->statistics[PFWL_STAT_L7_BYTES][diss_info->l4.direction];
+  if (state->flow_info_mode == PFWL_FLOW_INFO_MODE_COPY) {
+    diss_info->flow_info.num_packets_l7[diss_info->l4.direction] =
+        flow_info_private->info_public->statistics[PFWL_STAT_L7_PACKETS][diss_info->l4.direction];
+    diss_info->flow_info.num_bytes_l7[diss_info->l4.direction] =
+        flow_info_private->info_public->statistics[PFWL_STAT_L7_BYTES][diss_info->l4.direction];
 
-  diss_info->flow_info.statistics[PFWL_STAT_L7_PACKETS][diss_info->l4.direction] =
-      flow_info_private->info_public->statistics[PFWL_STAT_L7_PACKETS][diss_info->l4.direction];
-  diss_info->flow_info.statistics[PFWL_STAT_L7_BYTES][diss_info->l4.direction] =
-      flow_info_private->info_public->statistics[PFWL_STAT_L7_BYTES][diss_info->l4.direction];
+    diss_info->flow_info.statistics[PFWL_STAT_L7_PACKETS][diss_info->l4.direction] =
+        flow_info_private->info_public->statistics[PFWL_STAT_L7_PACKETS][diss_info->l4.direction];
+    diss_info->flow_info.statistics[PFWL_STAT_L7_BYTES][diss_info->l4.direction] =
+        flow_info_private->info_public->statistics[PFWL_STAT_L7_BYTES][diss_info->l4.direction];
+  }
 
   if ((diss_info->l4.protocol == IPPROTO_TCP && !state->active_protocols[0]) ||
       (diss_info->l4.protocol == IPPROTO_UDP && !state->active_protocols[1])) {
     return PFWL_STATUS_OK;
   }
 
+  if (diss_info->l4.payload_spans_num && !diss_info->l4.resegmented_pkt) {
+    if (pfwl_dissect_L7_needs_contiguous(state, diss_info, flow_info_private)) {
+      pkt = pfwl_reordering_tcp_contiguous(diss_info, flow_info_private);
+      if (unlikely(!pkt)) {
+        return PFWL_STATUS_OK;
+      }
+    } else {
+      pkt = diss_info->l4.payload_spans[0].data;
+    }
+  }
+
   // Extract the fields for all the protocols we identified
   pfwl_protocol_descriptor_t descr;
   for(size_t i = 0; i < diss_info->l7.protocols_num; i++){
@@ -447,33 +652,7 @@ pfwl_status_t pfwl_dissect_L7(pfwl_state_t *state, const unsigned char *pkt,
 
   // Set tags
   if(state->tags_matchers_num){
-    for(size_t i = 0; i < PFWL_FIELDS_L7_NUM; i++){
-      pfwl_field_t field = diss_info->l7.protocol_fields[i];
-      if(state->tags_matchers[i] &&
-         field.present){
-
-        if(pfwl_get_L7_field_type(i) == PFWL_FIELD_TYPE_STRING){
-          const char* tag = pfwl_field_string_tag_get(state->tags_matchers[i], &field.basic.string);
-          if(tag){
-            diss_info->l7.tags[diss_info->l7.tags_num++] = tag;
-            if(diss_info->l7.tags_num == PFWL_TAGS_MAX){
-              break;
-            }
-          }
-        }else if(pfwl_get_L7_field_type(i) == PFWL_FIELD_TYPE_MMAP){
-          for(size_t j = 0; j < field.mmap.length; j++){
-            pfwl_pair_t pair = ((pfwl_pair_t*)field.mmap.values)[j];
-            const char* tag = pfwl_field_mmap_tag_get(state->tags_matchers[i], &pair.first.string, &pair.second.string);
-            if(tag){
-              diss_info->l7.tags[diss_info->l7.tags_num++] = tag;
-              if(diss_info->l7.tags_num == PFWL_TAGS_MAX){
-                break;
-              }
-            }
-          }
-        }
-      }
-    }
+    pfwl_field_tags_match(state, diss_info);
   }
 
   return PFWL_STATUS_OK;
@@ -531,6 +710,18 @@ pfwl_protocol_l7_t pfwl_get_L7_field_protocol(pfwl_field_id_t field) {
   return field_L7_descriptors[field].protocol;
 }
 
+static void pfwl_prefilter_build(pfwl_state_t *state) {
+  if (!state->prefilter) {
+    return;
+  }
+  pfwl_prefilter_clear(state->prefilter);
+  for (size_t i = 0; i < PFWL_PROTO_L7_NUM; i++) {
+    if (prefilter_signatures[i] && BITTEST(state->protocols_to_inspect, i)) {
+      pfwl_prefilter_add(state->prefilter, i, prefilter_signatures[i]);
+    }
+  }
+}
+
 uint8_t pfwl_protocol_l7_enable(pfwl_state_t *state,
                                 pfwl_protocol_l7_t protocol) {
   if (state && protocol < PFWL_PROTO_L7_NUM) {
@@ -577,6 +768,7 @@ uint8_t pfwl_protocol_l7_enable(pfwl_state_t *state,
       }
     }
     BITSET(state->protocols_to_inspect, protocol);
+    pfwl_prefilter_build(state);
     return 0;
   } else {
     return 1;
@@ -602,6 +794,7 @@ uint8_t pfwl_protocol_l7_disable(pfwl_state_t *state,
       }
     }
     BITCLEAR(state->protocols_to_inspect, protocol);
+    pfwl_prefilter_build(state);
     return 0;
   } else {
     return 1;
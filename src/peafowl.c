@@ -27,11 +27,14 @@
 
 #include <peafowl/config.h>
 #include <peafowl/flow_table.h>
+#include <peafowl/guess_ordering.h>
 #include <peafowl/hash_functions.h>
 #include <peafowl/inspectors/inspectors.h>
 #include <peafowl/ipv4_reassembly.h>
 #include <peafowl/ipv6_reassembly.h>
 #include <peafowl/peafowl.h>
+#include <peafowl/prefilter.h>
+#include <peafowl/tags.h>
 #include <peafowl/tcp_stream_management.h>
 #include <peafowl/utils.h>
 
@@ -58,13 +61,128 @@ uint8_t pfwl_set_expected_flows(pfwl_state_t *state, uint32_t flows,
   if (state) {
     assert(state->flow_table);
     pfwl_flow_table_delete(state->flow_table);
-    state->flow_table = pfwl_flow_table_create(flows, strict, 1);
+    state->flow_table = pfwl_flow_table_create(flows, strict,
+                                               state->flow_table_partitions,
+                                               state->flow_table_engine);
+    pfwl_flow_table_set_memory_allocator(state->flow_table,
+                                         state->memory_allocator);
+    pfwl_flow_table_set_hash(state->flow_table, state->flow_table_hash);
+    for (uint8_t t = 0; t < PFWL_FLOW_TIMEOUT_NUM; t++) {
+      pfwl_flow_table_set_timeout(state->flow_table, t,
+                                  state->flow_timeouts[t]);
+    }
+    pfwl_flow_table_set_tcp_reordering_limits(
+        state->flow_table, state->tcp_reordering_per_flow_memory_limit,
+        state->tcp_reordering_per_partition_memory_limit,
+        state->tcp_reordering_total_memory_limit);
+    state->expected_flows = flows;
+    state->expected_flows_strict = strict;
     return 0;
   }else{
     return 1;
   }
 }
 
+uint8_t pfwl_set_flow_table_engine(pfwl_state_t *state,
+                                   pfwl_flow_table_engine_t engine) {
+  if (state && (engine == PFWL_FLOW_TABLE_ENGINE_CHAINED ||
+                engine == PFWL_FLOW_TABLE_ENGINE_BUCKETED)) {
+    state->flow_table_engine = engine;
+    return pfwl_set_expected_flows(state, state->expected_flows,
+                                   state->expected_flows_strict);
+  } else {
+    return 1;
+  }
+}
+
+uint8_t pfwl_set_flow_table_hash(pfwl_state_t *state,
+                                 pfwl_flow_table_hash_t hash) {
+  if (state && !pfwl_flow_table_set_hash(state->flow_table, hash)) {
+    state->flow_table_hash = hash;
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+uint8_t pfwl_set_memory_allocator(pfwl_state_t *state,
+                                  pfwl_memory_allocator_t allocator) {
+  if (state && (allocator == PFWL_MEMORY_ALLOCATOR_MALLOC ||
+                allocator == PFWL_MEMORY_ALLOCATOR_SLAB)) {
+    // Checked before changing anything, not to mix the allocators.
+    if (pfwl_flow_table_memory_in_use(state->flow_table) ||
+        (state->ipv4_frag_state &&
+         pfwl_reordering_ipv4_fragmentation_memory_in_use(
+             state->ipv4_frag_state)) ||
+        (state->ipv6_frag_state &&
+         pfwl_reordering_ipv6_fragmentation_memory_in_use(
+             state->ipv6_frag_state))) {
+      return 1;
+    }
+    pfwl_flow_table_set_memory_allocator(state->flow_table, allocator);
+    if (state->ipv4_frag_state) {
+      pfwl_reordering_ipv4_fragmentation_set_memory_allocator(
+          state->ipv4_frag_state, allocator);
+    }
+    if (state->ipv6_frag_state) {
+      pfwl_reordering_ipv6_fragmentation_set_memory_allocator(
+          state->ipv6_frag_state, allocator);
+    }
+    state->memory_allocator = allocator;
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+uint8_t pfwl_set_flow_timeout(pfwl_state_t *state, pfwl_flow_timeout_t type,
+                              uint32_t seconds) {
+  if (state && type < PFWL_FLOW_TIMEOUT_NUM) {
+    state->flow_timeouts[type] = seconds;
+    pfwl_flow_table_set_timeout(state->flow_table, type, seconds);
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+uint8_t pfwl_get_memory_stats(pfwl_state_t *state,
+                              pfwl_memory_stats_t *stats) {
+  if (state && stats) {
+    memset(stats, 0, sizeof(pfwl_memory_stats_t));
+    pfwl_flow_table_get_memory_stats(state->flow_table, stats);
+    if (state->ipv4_frag_state) {
+      pfwl_reordering_ipv4_fragmentation_get_memory_stats(
+          state->ipv4_frag_state, stats);
+    }
+    if (state->ipv6_frag_state) {
+      pfwl_reordering_ipv6_fragmentation_get_memory_stats(
+          state->ipv6_frag_state, stats);
+    }
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+/** Used to give each state a unique identifier. **/
+static uint64_t pfwl_states_created = 0;
+
+/**
+ * The sequence number of the state is offset by the (randomized) address
+ * of the counter and scrambled, so that the identifier is still unique but
+ * a dissection info which was not zeroed is very unlikely to hold it.
+ **/
+static uint64_t pfwl_reset_id_create(void) {
+  uint64_t x = __sync_add_and_fetch(&pfwl_states_created, 1) +
+               (uint64_t)(uintptr_t) &pfwl_states_created;
+  /** splitmix64 finalizer, which is a bijection. **/
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  x = x ^ (x >> 31);
+  return x ? x : 1;
+}
+
 pfwl_state_t *pfwl_init_stateful_num_partitions(uint32_t expected_flows,
                                                 uint8_t strict,
                                                 uint16_t num_table_partitions) {
@@ -73,18 +191,24 @@ pfwl_state_t *pfwl_init_stateful_num_partitions(uint32_t expected_flows,
   assert(state);
 
   bzero(state, sizeof(pfwl_state_t));
+  state->reset_id = pfwl_reset_id_create();
 
-#if PFWL_FLOW_TABLE_USE_MEMORY_POOL
-  state->db4 = pfwl_flow_table_create_v4(
-      size_v4, max_active_v4_flows, num_table_partitions,
-      PFWL_FLOW_TABLE_MEMORY_POOL_DEFAULT_SIZE_v4);
-  state->db6 = pfwl_flow_table_create_v6(
-      size_v6, max_active_v6_flows, num_table_partitions,
-      PFWL_FLOW_TABLE_MEMORY_POOL_DEFAULT_SIZE_v6);
-#else
   state->flow_table =
-      pfwl_flow_table_create(expected_flows, strict, num_table_partitions);
-#endif
+      pfwl_flow_table_create(expected_flows, strict, num_table_partitions,
+                             PFWL_DEFAULT_FLOW_TABLE_ENGINE);
+  state->expected_flows = expected_flows;
+  state->expected_flows_strict = strict;
+  state->flow_table_partitions = num_table_partitions;
+  state->flow_table_engine = PFWL_DEFAULT_FLOW_TABLE_ENGINE;
+  state->flow_table_hash = (pfwl_flow_table_hash_t) PFWL_FLOW_TABLE_HASH_VERSION;
+  pfwl_set_flow_timeout(state, PFWL_FLOW_TIMEOUT_TCP,
+                        PFWL_DEFAULT_FLOW_TIMEOUT_TCP);
+  pfwl_set_flow_timeout(state, PFWL_FLOW_TIMEOUT_TCP_CLOSED,
+                        PFWL_DEFAULT_FLOW_TIMEOUT_TCP_CLOSED);
+  pfwl_set_flow_timeout(state, PFWL_FLOW_TIMEOUT_UDP,
+                        PFWL_DEFAULT_FLOW_TIMEOUT_UDP);
+  pfwl_set_flow_timeout(state, PFWL_FLOW_TIMEOUT_OTHER,
+                        PFWL_DEFAULT_FLOW_TIMEOUT_OTHER);
   // Must be called before pfwl_protocol_l7_enable_all
   memset(state->fields_to_extract, 0, sizeof(state->fields_to_extract));
   memset(state->fields_to_extract_num, 0, sizeof(state->fields_to_extract_num));
@@ -95,6 +219,10 @@ pfwl_state_t *pfwl_init_stateful_num_partitions(uint32_t expected_flows,
   }
 
   pfwl_set_max_trials(state, PFWL_DEFAULT_MAX_TRIALS_PER_FLOW);
+  state->prefilter = pfwl_prefilter_create();
+  assert(state->prefilter);
+  pfwl_field_tags_init(state);
+  assert(state->tags_updates);
   pfwl_protocol_l7_enable_all(state);
 
   pfwl_defragmentation_enable_ipv4(state,
@@ -103,6 +231,13 @@ pfwl_state_t *pfwl_init_stateful_num_partitions(uint32_t expected_flows,
                                    PFWL_IPv6_FRAGMENTATION_DEFAULT_TABLE_SIZE);
 
   pfwl_tcp_reordering_enable(state);
+  pfwl_tcp_reordering_set_per_flow_memory_limit(
+      state, PFWL_TCP_REORDERING_DEFAULT_PER_FLOW_MEMORY_LIMIT);
+  pfwl_tcp_reordering_set_per_partition_memory_limit(
+      state, PFWL_TCP_REORDERING_DEFAULT_PER_PARTITION_MEMORY_LIMIT);
+  pfwl_tcp_reordering_set_total_memory_limit(
+      state, PFWL_TCP_REORDERING_DEFAULT_TOTAL_MEMORY_LIMIT);
+  pfwl_set_memory_allocator(state, PFWL_DEFAULT_MEMORY_ALLOCATOR);
 
   state->l7_skip = NULL;
   state->ts_unit = PFWL_TIMESTAMP_UNIT_SECONDS;
@@ -113,6 +248,68 @@ pfwl_state_t *pfwl_init() {
   return pfwl_init_stateful_num_partitions(PFWL_DEFAULT_EXPECTED_FLOWS, 0, 1);
 }
 
+uint8_t pfwl_set_flow_info_mode(pfwl_state_t *state,
+                                pfwl_flow_info_mode_t mode) {
+  if (state && (mode == PFWL_FLOW_INFO_MODE_COPY ||
+                mode == PFWL_FLOW_INFO_MODE_REFERENCE)) {
+    state->flow_info_mode = mode;
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+static uint8_t pfwl_guess_profile_alloc(pfwl_state_t *state) {
+  if (!state->guess_profile) {
+    state->guess_profile = pfwl_guess_profile_create();
+  }
+  return state->guess_profile == NULL;
+}
+
+uint8_t pfwl_set_guess_ordering(pfwl_state_t *state,
+                                pfwl_guess_ordering_t ordering) {
+  if (state) {
+    if (ordering != PFWL_GUESS_ORDERING_PORTS &&
+        pfwl_guess_profile_alloc(state)) {
+      return 1;
+    }
+    state->guess_ordering = ordering;
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+uint8_t pfwl_guess_profile_export(pfwl_state_t *state, const char *filename) {
+  if (state && filename && !pfwl_guess_profile_alloc(state)) {
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+      return 1;
+    }
+    uint8_t r = pfwl_guess_profile_write(state->guess_profile, f);
+    if (fclose(f)) {
+      r = 1;
+    }
+    return r;
+  } else {
+    return 1;
+  }
+}
+
+uint8_t pfwl_guess_profile_import(pfwl_state_t *state, const char *filename) {
+  if (state && filename && !pfwl_guess_profile_alloc(state)) {
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+      return 1;
+    }
+    uint8_t r = pfwl_guess_profile_read(state->guess_profile, f);
+    fclose(f);
+    return r;
+  } else {
+    return 1;
+  }
+}
+
 uint8_t pfwl_set_max_trials(pfwl_state_t *state, uint16_t max_trials) {
   if(state){
     state->max_trials = max_trials;
@@ -128,6 +325,8 @@ uint8_t pfwl_defragmentation_enable_ipv4(pfwl_state_t *state,
     state->ipv4_frag_state =
         pfwl_reordering_enable_ipv4_fragmentation(table_size);
     assert(state->ipv4_frag_state);
+    pfwl_reordering_ipv4_fragmentation_set_memory_allocator(
+        state->ipv4_frag_state, state->memory_allocator);
     return 0;
   } else {
     return 1;
@@ -140,6 +339,8 @@ uint8_t pfwl_defragmentation_enable_ipv6(pfwl_state_t *state,
     state->ipv6_frag_state =
         pfwl_reordering_enable_ipv6_fragmentation(table_size);
     assert(state->ipv6_frag_state);
+    pfwl_reordering_ipv6_fragmentation_set_memory_allocator(
+        state->ipv6_frag_state, state->memory_allocator);
     return 0;
   } else {
     return 1;
@@ -260,13 +461,86 @@ uint8_t pfwl_tcp_reordering_disable(pfwl_state_t *state) {
   }
 }
 
+uint8_t pfwl_tcp_reordering_enable_pickup(pfwl_state_t *state) {
+  if (likely(state)) {
+    state->tcp_reordering_pickup = 1;
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+uint8_t pfwl_tcp_reordering_disable_pickup(pfwl_state_t *state) {
+  if (likely(state)) {
+    state->tcp_reordering_pickup = 0;
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+static void pfwl_tcp_reordering_apply_limits(pfwl_state_t *state) {
+  pfwl_flow_table_set_tcp_reordering_limits(
+      state->flow_table, state->tcp_reordering_per_flow_memory_limit,
+      state->tcp_reordering_per_partition_memory_limit,
+      state->tcp_reordering_total_memory_limit);
+}
+
+uint8_t pfwl_tcp_reordering_set_per_flow_memory_limit(
+    pfwl_state_t *state, uint32_t per_flow_memory_limit) {
+  if (likely(state)) {
+    state->tcp_reordering_per_flow_memory_limit = per_flow_memory_limit;
+    pfwl_tcp_reordering_apply_limits(state);
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+uint8_t pfwl_tcp_reordering_set_per_partition_memory_limit(
+    pfwl_state_t *state, uint32_t per_partition_memory_limit) {
+  if (likely(state)) {
+    state->tcp_reordering_per_partition_memory_limit =
+        per_partition_memory_limit;
+    pfwl_tcp_reordering_apply_limits(state);
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+uint8_t pfwl_tcp_reordering_set_total_memory_limit(
+    pfwl_state_t *state, uint32_t total_memory_limit) {
+  if (likely(state)) {
+    state->tcp_reordering_total_memory_limit = total_memory_limit;
+    pfwl_tcp_reordering_apply_limits(state);
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+uint8_t pfwl_tcp_reordering_get_stats(pfwl_state_t *state,
+                                      pfwl_tcp_reordering_stats_t *stats) {
+  if (state && stats) {
+    memset(stats, 0, sizeof(pfwl_tcp_reordering_stats_t));
+    pfwl_flow_table_get_tcp_reordering_stats(state->flow_table, stats);
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
 void pfwl_terminate(pfwl_state_t *state) {
   if (likely(state)) {
     pfwl_defragmentation_disable_ipv4(state);
     pfwl_defragmentation_disable_ipv6(state);
     pfwl_tcp_reordering_disable(state);
+    pfwl_field_tags_terminate(state);
 
     pfwl_flow_table_delete(state->flow_table);
+    pfwl_guess_profile_delete(state->guess_profile);
+    pfwl_prefilter_delete(state->prefilter);
     free(state);
   }
 }
@@ -276,7 +550,7 @@ pfwl_status_t pfwl_dissect_from_L2(pfwl_state_t *state,
                                    uint32_t timestamp,
                                    pfwl_protocol_l2_t datalink_type,
                                    pfwl_dissection_info_t *dissection_info) {
-  memset(dissection_info, 0, sizeof(pfwl_dissection_info_t));
+  pfwl_dissection_info_reset(state, dissection_info);
   pfwl_status_t status;
   status = pfwl_dissect_L2(pkt, datalink_type, dissection_info);
   if (unlikely(status < PFWL_STATUS_OK)) {
@@ -292,6 +566,21 @@ pfwl_flow_t *pfwl_parse_L4_internal(pfwl_state_t *state,
                                     uint32_t current_time,
                                     pfwl_dissection_info_t *dissection_info);
 
+/**
+ * Returns the L4 header of a packet whose L3 header has been parsed.
+ **/
+static inline const unsigned char *
+pfwl_get_L4_header(const unsigned char *pkt, pfwl_dissection_info_t *r,
+                   size_t *l4_pkt_len) {
+  if (r->l3.refrag_pkt) {
+    *l4_pkt_len = r->l3.refrag_pkt_len - r->l3.length;
+    return r->l3.refrag_pkt + r->l3.length;
+  } else {
+    *l4_pkt_len = r->l3.payload_length;
+    return pkt + r->l3.length;
+  }
+}
+
 pfwl_status_t pfwl_dissect_from_L3(pfwl_state_t *state,
                                    const unsigned char *pkt, size_t length,
                                    uint32_t timestamp,
@@ -303,16 +592,91 @@ pfwl_status_t pfwl_dissect_from_L3(pfwl_state_t *state,
     return status;
   }
 
-  const unsigned char *l4_pkt;
   size_t l4_pkt_len;
-  if (r->l3.refrag_pkt) {
-    l4_pkt = r->l3.refrag_pkt + r->l3.length;
-    l4_pkt_len = r->l3.refrag_pkt_len - r->l3.length;
+  const unsigned char *l4_pkt = pfwl_get_L4_header(pkt, r, &l4_pkt_len);
+  return pfwl_dissect_from_L4(state, l4_pkt, l4_pkt_len, timestamp, r);
+}
+
+/**
+ * Prefetches the flow table entry (stage 0) or the flow (stage 1) of a
+ * packet whose L3 header has been parsed. Ports are only needed to compute
+ * the hash, the L4 parser will set them again.
+ **/
+static inline void pfwl_prefetch_flow(pfwl_state_t *state,
+                                      const unsigned char *l4_pkt,
+                                      size_t l4_pkt_len,
+                                      pfwl_dissection_info_t *r,
+                                      uint8_t stage) {
+  if ((r->l4.protocol == IPPROTO_TCP || r->l4.protocol == IPPROTO_UDP) &&
+      l4_pkt_len >= 2 * sizeof(uint16_t)) {
+    /** Both TCP and UDP headers start with source and destination ports. **/
+    const uint16_t *ports = (const uint16_t *) l4_pkt;
+    r->l4.port_src = ports[0];
+    r->l4.port_dst = ports[1];
+  }
+  if (stage == 0) {
+    pfwl_flow_table_prefetch_entry(state->flow_table, r);
   } else {
-    l4_pkt = pkt + r->l3.length;
-    l4_pkt_len = r->l3.payload_length;
+    pfwl_flow_table_prefetch_flow(state->flow_table, r);
+  }
+  r->l4.port_src = 0;
+  r->l4.port_dst = 0;
+}
+
+void pfwl_dissect_batch(pfwl_state_t *state, const unsigned char *const *pkts,
+                        const size_t *lengths, const uint32_t *timestamps,
+                        size_t num_pkts, pfwl_protocol_l2_t datalink_type,
+                        pfwl_dissection_info_t *dissection_infos,
+                        pfwl_status_t *statuses) {
+  const unsigned char *l4_pkts[PFWL_DISSECT_BATCH_CHUNK];
+  size_t l4_pkts_len[PFWL_DISSECT_BATCH_CHUNK];
+  for (size_t first = 0; first < num_pkts; first += PFWL_DISSECT_BATCH_CHUNK) {
+    size_t chunk = num_pkts - first;
+    if (chunk > PFWL_DISSECT_BATCH_CHUNK) {
+      chunk = PFWL_DISSECT_BATCH_CHUNK;
+    }
+    /**
+     * Parse L2 and L3 headers of all the packets and prefetch the flow
+     * table entries. IP defragmentation does not depend on the flow
+     * table, so it can be done before looking up the flows of the
+     * previous packets.
+     **/
+    for (size_t i = 0; i < chunk; i++) {
+      const unsigned char *pkt = pkts[first + i];
+      size_t length = lengths[first + i];
+      pfwl_dissection_info_t *r = &(dissection_infos[first + i]);
+      pfwl_status_t *status = &(statuses[first + i]);
+      l4_pkts[i] = NULL;
+      pfwl_dissection_info_reset(state, r);
+      *status = pfwl_dissect_L2(pkt, datalink_type, r);
+      if (unlikely(*status < PFWL_STATUS_OK)) {
+        continue;
+      }
+      /** L3 parsing resets the L2 informations. **/
+      const unsigned char *l3_pkt = pkt + r->l2.length;
+      *status = pfwl_dissect_L3(state, l3_pkt, length - r->l2.length,
+                                timestamps[first + i], r);
+      if (unlikely(*status == PFWL_STATUS_IP_FRAGMENT || *status < 0)) {
+        continue;
+      }
+      l4_pkts[i] = pfwl_get_L4_header(l3_pkt, r, &l4_pkts_len[i]);
+      pfwl_prefetch_flow(state, l4_pkts[i], l4_pkts_len[i], r, 0);
+    }
+    /** The entries are now (hopefully) cached, prefetch the flows. **/
+    for (size_t i = 0; i < chunk; i++) {
+      if (l4_pkts[i]) {
+        pfwl_prefetch_flow(state, l4_pkts[i], l4_pkts_len[i],
+                           &(dissection_infos[first + i]), 1);
+      }
+    }
+    for (size_t i = 0; i < chunk; i++) {
+      if (l4_pkts[i]) {
+        statuses[first + i] = pfwl_dissect_from_L4(
+            state, l4_pkts[i], l4_pkts_len[i], timestamps[first + i],
+            &(dissection_infos[first + i]));
+      }
+    }
   }
-  return pfwl_dissect_from_L4(state, l4_pkt, l4_pkt_len, timestamp, r);
 }
 
 uint8_t pfwl_set_protocol_accuracy_L7(pfwl_state_t *state,
@@ -397,6 +761,49 @@ uint8_t pfwl_statistic_remove(pfwl_state_t* state, pfwl_statistic_t stat){
   return 0;
 }
 
+/**
+ * Adds all the fields of a protocol to the fields to reset between two
+ * packets. Inspectors may set any field of their protocol once one of them
+ * is required, so the whole protocol is added.
+ **/
+static void pfwl_fields_to_reset_add(pfwl_state_t *state,
+                                     pfwl_protocol_l7_t protocol) {
+  if (state->fields_to_reset_protocols[protocol]) {
+    return;
+  }
+  state->fields_to_reset_protocols[protocol] = 1;
+  for (size_t i = 0; i < PFWL_FIELDS_L7_NUM; i++) {
+    if (pfwl_get_L7_field_protocol((pfwl_field_id_t) i) == protocol) {
+      state->fields_to_reset[state->fields_to_reset_num++] = (pfwl_field_id_t) i;
+    }
+  }
+}
+
+void pfwl_dissection_info_reset(pfwl_state_t *state,
+                                pfwl_dissection_info_t *dissection_info) {
+  if (unlikely(dissection_info->l7.reset_id != state->reset_id)) {
+    memset(dissection_info, 0, sizeof(pfwl_dissection_info_t));
+    dissection_info->l7.reset_id = state->reset_id;
+    return;
+  }
+  memset(&(dissection_info->l2), 0, sizeof(dissection_info->l2));
+  memset(&(dissection_info->l3), 0, sizeof(dissection_info->l3));
+  memset(&(dissection_info->l4), 0, sizeof(dissection_info->l4));
+  if (dissection_info->flow_info.udata) {
+    /** Only filled with PFWL_FLOW_INFO_MODE_COPY. **/
+    memset(&(dissection_info->flow_info), 0, sizeof(dissection_info->flow_info));
+  }
+  dissection_info->flow_info_ref = NULL;
+  dissection_info->l7.protocol = 0;
+  memset(dissection_info->l7.protocols, 0, sizeof(dissection_info->l7.protocols));
+  dissection_info->l7.protocols_num = 0;
+  dissection_info->l7.tags_num = 0;
+  for (size_t i = 0; i < state->fields_to_reset_num; i++) {
+    memset(&(dissection_info->l7.protocol_fields[state->fields_to_reset[i]]), 0,
+           sizeof(pfwl_field_t));
+  }
+}
+
 uint8_t pfwl_field_add_L7_internal(pfwl_state_t *state, pfwl_field_id_t field,
                                    uint8_t* fields_to_extract, uint8_t* fields_to_extract_num) {
   if (state) {
@@ -406,6 +813,7 @@ uint8_t pfwl_field_add_L7_internal(pfwl_state_t *state, pfwl_field_id_t field,
         return 0;
       }
       ++fields_to_extract_num[protocol];
+      pfwl_fields_to_reset_add(state, protocol);
       pfwl_protocol_l7_enable(state, protocol);
       pfwl_set_protocol_accuracy_L7(
           state, protocol,
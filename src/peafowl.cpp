@@ -445,6 +445,11 @@ size_t DissectionInfoL4::getResegmentedPacketLength() const{
   return _dissectionInfo.resegmented_pkt_len;
 }
 
+std::vector<Span> DissectionInfoL4::getPayloadSpans() const{
+  return std::vector<Span>(_dissectionInfo.payload_spans,
+                           _dissectionInfo.payload_spans + _dissectionInfo.payload_spans_num);
+}
+
 ProtocolL4 DissectionInfoL4::getProtocol() const{
   return _dissectionInfo.protocol;
 }
@@ -498,9 +503,17 @@ pfwl_dissection_info_l7_t DissectionInfoL7::getNative() const{
   return _dissectionInfo;
 }
 
+static const pfwl_flow_info_t& getFlowInfoNative(const pfwl_dissection_info_t& info){
+  // With PFWL_FLOW_INFO_MODE_REFERENCE flow_info is not filled.
+  if(!info.flow_info.udata && info.flow_info_ref){
+    return *info.flow_info_ref;
+  }
+  return info.flow_info;
+}
+
 DissectionInfo::DissectionInfo(pfwl_dissection_info_t info, Status status):
   _dissectionInfo(info), _l2(info.l2), _l3(info.l3),
-  _l4(info.l4), _l7(info.l7), _flowInfo(info.flow_info),
+  _l4(info.l4), _l7(info.l7), _flowInfo(getFlowInfoNative(info)),
   _status(status){
   ;
 }
@@ -511,7 +524,7 @@ DissectionInfo& DissectionInfo::operator=(const pfwl_dissection_info_t& info){
   _l3 = info.l3;
   _l4 = info.l4;
   _l7 = info.l7;
-  _flowInfo = info.flow_info;
+  _flowInfo = getFlowInfoNative(info);
   return *this;
 }
 
@@ -629,6 +642,7 @@ void DefragmentationOptions::disableIPv6(){
 
 Peafowl::Peafowl(){
   _state = pfwl_init();
+  memset(&_dissectionInfo, 0, sizeof(_dissectionInfo));
 }
 
 Peafowl::~Peafowl(){
@@ -653,6 +667,62 @@ void Peafowl::setExpectedFlows(uint32_t flows, uint8_t strict){
   }
 }
 
+void Peafowl::setFlowTableEngine(FlowTableEngine engine){
+  if(pfwl_set_flow_table_engine(_state, engine)){
+    throw std::runtime_error("pfwl_set_flow_table_engine failed\n");
+  }
+}
+
+void Peafowl::setFlowTableHash(FlowTableHash hash){
+  if(pfwl_set_flow_table_hash(_state, hash)){
+    throw std::runtime_error("pfwl_set_flow_table_hash failed\n");
+  }
+}
+
+void Peafowl::setMemoryAllocator(MemoryAllocator allocator){
+  if(pfwl_set_memory_allocator(_state, allocator)){
+    throw std::runtime_error("pfwl_set_memory_allocator failed\n");
+  }
+}
+
+MemoryStats Peafowl::getMemoryStats(){
+  MemoryStats stats;
+  if(pfwl_get_memory_stats(_state, &stats)){
+    throw std::runtime_error("pfwl_get_memory_stats failed\n");
+  }
+  return stats;
+}
+
+void Peafowl::setFlowTimeout(FlowTimeout type, uint32_t seconds){
+  if(pfwl_set_flow_timeout(_state, type, seconds)){
+    throw std::runtime_error("pfwl_set_flow_timeout failed\n");
+  }
+}
+
+void Peafowl::setFlowInfoMode(FlowInfoMode mode){
+  if(pfwl_set_flow_info_mode(_state, mode)){
+    throw std::runtime_error("pfwl_set_flow_info_mode failed\n");
+  }
+}
+
+void Peafowl::setGuessOrdering(GuessOrdering ordering){
+  if(pfwl_set_guess_ordering(_state, ordering)){
+    throw std::runtime_error("pfwl_set_guess_ordering failed\n");
+  }
+}
+
+void Peafowl::guessProfileExport(const std::string& filename){
+  if(pfwl_guess_profile_export(_state, filename.c_str())){
+    throw std::runtime_error("pfwl_guess_profile_export failed\n");
+  }
+}
+
+void Peafowl::guessProfileImport(const std::string& filename){
+  if(pfwl_guess_profile_import(_state, filename.c_str())){
+    throw std::runtime_error("pfwl_guess_profile_import failed\n");
+  }
+}
+
 void Peafowl::setMaxTrials(uint16_t maxTrials){
   if(pfwl_set_max_trials(_state, maxTrials)){
     throw std::runtime_error("pfwl_set_max_trials failed\n");
@@ -714,6 +784,44 @@ void Peafowl::tcpReorderingDisable(){
   }
 }
 
+void Peafowl::tcpReorderingEnablePickup(){
+  if(pfwl_tcp_reordering_enable_pickup(_state)){
+    throw std::runtime_error("pfwl_tcp_reordering_enable_pickup failed\n");
+  }
+}
+
+void Peafowl::tcpReorderingDisablePickup(){
+  if(pfwl_tcp_reordering_disable_pickup(_state)){
+    throw std::runtime_error("pfwl_tcp_reordering_disable_pickup failed\n");
+  }
+}
+
+void Peafowl::setTcpReorderingPerFlowMemoryLimit(uint32_t limit){
+  if(pfwl_tcp_reordering_set_per_flow_memory_limit(_state, limit)){
+    throw std::runtime_error("pfwl_tcp_reordering_set_per_flow_memory_limit failed\n");
+  }
+}
+
+void Peafowl::setTcpReorderingPerPartitionMemoryLimit(uint32_t limit){
+  if(pfwl_tcp_reordering_set_per_partition_memory_limit(_state, limit)){
+    throw std::runtime_error("pfwl_tcp_reordering_set_per_partition_memory_limit failed\n");
+  }
+}
+
+void Peafowl::setTcpReorderingTotalMemoryLimit(uint32_t limit){
+  if(pfwl_tcp_reordering_set_total_memory_limit(_state, limit)){
+    throw std::runtime_error("pfwl_tcp_reordering_set_total_memory_limit failed\n");
+  }
+}
+
+TcpReorderingStats Peafowl::getTcpReorderingStats(){
+  TcpReorderingStats stats;
+  if(pfwl_tcp_reordering_get_stats(_state, &stats)){
+    throw std::runtime_error("pfwl_tcp_reordering_get_stats failed\n");
+  }
+  return stats;
+}
+
 void Peafowl::protocolL7Enable(ProtocolL7 protocol){
   if(pfwl_protocol_l7_enable(_state, protocol)){
     throw std::runtime_error("pfwl_protocol_l7_enable failed\n");
@@ -745,43 +853,75 @@ void Peafowl::setTimestampUnit(TimestampUnit unit){
 }
 
 DissectionInfo Peafowl::dissectFromL2(const std::string &pkt, uint32_t timestamp, ProtocolL2 datalinkType){
-  pfwl_dissection_info_t info;
-  Status s = pfwl_dissect_from_L2(_state, (const unsigned char*) pkt.c_str(), pkt.size(), timestamp, datalinkType, &info);
-  return DissectionInfo(info, s);
+  Status s = pfwl_dissect_from_L2(_state, (const unsigned char*) pkt.c_str(), pkt.size(), timestamp, datalinkType, &_dissectionInfo);
+  return DissectionInfo(_dissectionInfo, s);
+}
+
+std::vector<DissectionInfo> Peafowl::dissectBatch(const std::vector<std::string>& pkts,
+                                                  const std::vector<uint32_t>& timestamps,
+                                                  ProtocolL2 datalinkType){
+  if(pkts.size() != timestamps.size()){
+    throw std::runtime_error("pfwl_dissect_batch failed\n");
+  }
+  std::vector<const unsigned char*> data(pkts.size());
+  std::vector<size_t> lengths(pkts.size());
+  for(size_t i = 0; i < pkts.size(); i++){
+    data[i] = (const unsigned char*) pkts[i].c_str();
+    lengths[i] = pkts[i].size();
+  }
+  std::vector<pfwl_dissection_info_t> infos(pkts.size());
+  std::vector<pfwl_status_t> statuses(pkts.size());
+  // The flow of a packet may be deleted while the following packets of the
+  // batch are dissected, so flow_info_ref cannot be read once the batch is
+  // over. The flow information is copied while dissecting, whatever the mode.
+  pfwl_flow_info_mode_t mode = _state->flow_info_mode;
+  pfwl_set_flow_info_mode(_state, PFWL_FLOW_INFO_MODE_COPY);
+  pfwl_dissect_batch(_state, data.data(), lengths.data(), timestamps.data(),
+                     pkts.size(), datalinkType, infos.data(), statuses.data());
+  pfwl_set_flow_info_mode(_state, mode);
+  std::vector<DissectionInfo> r;
+  r.reserve(pkts.size());
+  for(size_t i = 0; i < pkts.size(); i++){
+    infos[i].flow_info_ref = NULL;
+    r.push_back(DissectionInfo(infos[i], statuses[i]));
+  }
+  return r;
 }
 
 DissectionInfo Peafowl::dissectFromL3(const std::string &pkt, uint32_t timestamp){
-  pfwl_dissection_info_t info;
-  Status s = pfwl_dissect_from_L3(_state, (const unsigned char*) pkt.c_str(), pkt.size(), timestamp, &info);
-  return DissectionInfo(info, s);
+  Status s = pfwl_dissect_from_L3(_state, (const unsigned char*) pkt.c_str(), pkt.size(), timestamp, &_dissectionInfo);
+  return DissectionInfo(_dissectionInfo, s);
 }
 
 DissectionInfo Peafowl::dissectFromL4(const std::string &pkt, uint32_t timestamp){
   pfwl_dissection_info_t info;
+  memset(&info, 0, sizeof(info));
   Status s = pfwl_dissect_from_L4(_state, (const unsigned char*) pkt.c_str(), pkt.size(), timestamp, &info);
   return DissectionInfo(info, s);
 }
 
 DissectionInfo Peafowl::dissectL2(const std::string &pkt, pfwl_protocol_l2_t datalinkType){
   pfwl_dissection_info_t info;
+  memset(&info, 0, sizeof(info));
   Status s = pfwl_dissect_L2((const unsigned char*) pkt.c_str(), datalinkType, &info);
   return DissectionInfo(info, s);
 }
 
 DissectionInfo Peafowl::dissectL3(const std::string &pkt, uint32_t timestamp){
-  pfwl_dissection_info_t info;
-  Status s = pfwl_dissect_L3(_state, (const unsigned char*) pkt.c_str(), pkt.size(), timestamp, &info);
-  return DissectionInfo(info, s);
+  Status s = pfwl_dissect_L3(_state, (const unsigned char*) pkt.c_str(), pkt.size(), timestamp, &_dissectionInfo);
+  return DissectionInfo(_dissectionInfo, s);
 }
 
 DissectionInfo Peafowl::dissectL4(const std::string &pkt, uint32_t timestamp, FlowInfoPrivate &flowInfoPrivate){
   pfwl_dissection_info_t info;
+  memset(&info, 0, sizeof(info));
   Status s = pfwl_dissect_L4(_state, (const unsigned char*) pkt.c_str(), pkt.size(), timestamp, &info, &(flowInfoPrivate._info));
   return DissectionInfo(info, s);
 }
 
 DissectionInfo Peafowl::dissectL7(const std::string &pkt, FlowInfoPrivate &flowInfoPrivate){
   pfwl_dissection_info_t info;
+  memset(&info, 0, sizeof(info));
   Status s = pfwl_dissect_L7(_state, (const unsigned char*) pkt.c_str(), pkt.size(), &info, flowInfoPrivate._info);
   return DissectionInfo(info, s);
 }
@@ -900,12 +1040,24 @@ ProtocolL2 convertPcapDlt(int dlt){
   return pfwl_convert_pcap_dlt(dlt);
 }
 
+uint16_t shardOf(const std::string& pkt, ProtocolL2 datalinkType,
+                 uint16_t shards){
+  return pfwl_shard_of((const unsigned char*) pkt.c_str(), pkt.size(),
+                       datalinkType, shards);
+}
+
 void Peafowl::fieldTagsLoadL7(FieldId field, const char* tagsFile){
   if(pfwl_field_tags_load_L7(_state, field, tagsFile)){
     throw std::runtime_error("pfwl_field_tags_load_L7 failed\n");
   }
 }
 
+void Peafowl::fieldTagsLoadL7Mmap(FieldId field, const char* dbFile){
+  if(pfwl_field_tags_load_L7_mmap(_state, field, dbFile)){
+    throw std::runtime_error("pfwl_field_tags_load_L7_mmap failed\n");
+  }
+}
+
 void Peafowl::fieldStringTagsAddL7(FieldId field, const std::string& value, FieldMatching matchingType, const std::string& tag){
   pfwl_field_string_tags_add_L7(_state, field, value.c_str(), matchingType, tag.c_str());
 }
@@ -918,6 +1070,12 @@ void Peafowl::fieldTagsUnloadL7(FieldId field){
   pfwl_field_tags_unload_L7(_state, field);
 }
 
+void Peafowl::fieldTagsPublishL7(FieldId field, FieldTags* tags){
+  if(pfwl_field_tags_publish_L7(_state, field, tags)){
+    throw std::runtime_error("pfwl_field_tags_publish_L7 failed\n");
+  }
+}
+
 void Peafowl::statisticAdd(Statistic stat){
   if(pfwl_statistic_add(_state, stat)){
     throw std::runtime_error("pfwl_statistic_add failed\n");
@@ -26,6 +26,8 @@
  */
 
 #include <peafowl/flow_table.h>
+#include <peafowl/ipv4_reassembly.h>
+#include <peafowl/ipv6_reassembly.h>
 #include <peafowl/peafowl_mc.h>
 #include <peafowl/worker.hpp>
 
@@ -40,7 +42,7 @@
 #include <stddef.h>
 #include <vector>
 
-#define PFWL_DEBUG_MC_API 1
+#define PFWL_DEBUG_MC_API 0
 #define debug_print(fmt, ...)                                                  \
   do {                                                                         \
     if (PFWL_DEBUG_MC_API)                                                     \
@@ -49,7 +51,7 @@
 
 #define PFWL_MULTICORE_STATUS_UPDATER_TID 1
 
-typedef struct mc_pfwl_library_state {
+struct mc_pfwl_state {
   pfwl_state_t *sequential_state;
   ff::SWSR_Ptr_Buffer *tasks_pool;
 
@@ -66,6 +68,13 @@ typedef struct mc_pfwl_library_state {
 
   uint16_t available_processors;
   unsigned int *mapping;
+  /** Flow table partitions, moved between the L7 workers. **/
+  uint16_t num_partitions;
+  /** Load of each L7 worker. **/
+  dpi::pfwl_L7_worker_load_t *workers_loads;
+  /** Changes the number of active L7 workers. **/
+  dpi::pfwl_L7_scaling_t scaling;
+  dpi::pfwl_batching_t batching[MC_PFWL_BATCHING_STAGES_NUM];
   /******************************************************/
   /*                 Nodes for single farm.             */
   /******************************************************/
@@ -87,6 +96,8 @@ typedef struct mc_pfwl_library_state {
   dpi::pfwl_L3_L4_emitter *L3_L4_emitter;
 #if PFWL_MULTICORE_L3_L4_FARM_TYPE == PFWL_MULTICORE_L3_L4_ORDERED_FARM
   ff::ff_ofarm *L3_L4_farm;
+#elif PFWL_MULTICORE_L3_L4_FARM_TYPE == PFWL_MULTICORE_L3_L4_STEERED_FARM
+  ff::ff_farm<dpi::pfwl_L3_L4_scheduler> *L3_L4_farm;
 #else
   ff::ff_farm<> *L3_L4_farm;
 #endif
@@ -105,14 +116,13 @@ typedef struct mc_pfwl_library_state {
   /******************************************************/
   struct timeval start_time;
   struct timeval stop_time;
-} mc_pfwl_state_t;
+};
 
 #ifndef PFWL_DEBUG
 static inline
 #endif
     void
-    mc_pfwl_create_double_farm(mc_pfwl_state_t *state, uint32_t size_v4,
-                               uint32_t size_v6) {
+    mc_pfwl_create_double_farm(mc_pfwl_state_t *state) {
   uint16_t last_mapped = 0;
   /******************************************/
   /*         Create the first farm.         */
@@ -130,9 +140,27 @@ static inline
   state->L3_L4_emitter = new (tmp) dpi::pfwl_L3_L4_emitter(
       state->sequential_state, &(state->reading_callback),
       &(state->read_process_callbacks_user_data), &(state->terminating),
-      state->mapping[last_mapped], state->tasks_pool);
+      state->mapping[last_mapped], state->tasks_pool,
+      &(state->batching[MC_PFWL_BATCHING_STAGE_L3_L4]));
   last_mapped = (last_mapped + 1) % state->available_processors;
   state->L3_L4_farm->setEmitterF(state->L3_L4_emitter);
+#elif PFWL_MULTICORE_L3_L4_FARM_TYPE == PFWL_MULTICORE_L3_L4_STEERED_FARM
+  tmp = malloc(sizeof(ff::ff_farm<dpi::pfwl_L3_L4_scheduler>));
+  assert(tmp);
+  state->L3_L4_farm = new (tmp) ff::ff_farm<dpi::pfwl_L3_L4_scheduler>(
+      false, PFWL_MULTICORE_L3_L4_FARM_INPUT_BUFFER_SIZE,
+      PFWL_MULTICORE_L3_L4_FARM_OUTPUT_BUFFER_SIZE, false,
+      state->available_processors, true);
+  tmp = malloc(sizeof(dpi::pfwl_L3_L4_emitter));
+  assert(tmp);
+  state->L3_L4_emitter = new (tmp) dpi::pfwl_L3_L4_emitter(
+      state->sequential_state, &(state->reading_callback),
+      &(state->read_process_callbacks_user_data), &(state->terminating),
+      state->mapping[last_mapped], state->tasks_pool,
+      &(state->batching[MC_PFWL_BATCHING_STAGE_L3_L4]),
+      state->L3_L4_farm->getlb(), state->double_farm_L3_L4_active_workers);
+  last_mapped = (last_mapped + 1) % state->available_processors;
+  state->L3_L4_farm->add_emitter(state->L3_L4_emitter);
 #else
   tmp = malloc(sizeof(ff::ff_farm<>));
   assert(tmp);
@@ -145,7 +173,8 @@ static inline
   state->L3_L4_emitter = new (tmp) dpi::pfwl_L3_L4_emitter(
       state->sequential_state, &(state->reading_callback),
       &(state->read_process_callbacks_user_data), &(state->terminating),
-      state->mapping[last_mapped], state->tasks_pool);
+      state->mapping[last_mapped], state->tasks_pool,
+      &(state->batching[MC_PFWL_BATCHING_STAGE_L3_L4]));
   last_mapped = (last_mapped + 1) % state->available_processors;
   state->L3_L4_farm->add_emitter(state->L3_L4_emitter);
 #if PFWL_MULTICORE_L3_L4_FARM_TYPE == PFWL_MULTICORE_L3_L4_ON_DEMAND
@@ -158,8 +187,7 @@ static inline
     tmp = malloc(sizeof(dpi::pfwl_L3_L4_worker));
     assert(tmp);
     dpi::pfwl_L3_L4_worker *w1 = new (tmp) dpi::pfwl_L3_L4_worker(
-        state->sequential_state, i, (state->double_farm_L7_active_workers),
-        state->mapping[last_mapped], size_v4, size_v6);
+        state->sequential_state, i, state->mapping[last_mapped]);
     state->L3_L4_workers->push_back(w1);
     last_mapped = (last_mapped + 1) % state->available_processors;
   }
@@ -190,17 +218,24 @@ static inline
   tmp = malloc(sizeof(dpi::pfwl_L7_emitter));
   assert(tmp);
   state->L7_emitter = new (tmp) dpi::pfwl_L7_emitter(
-      state->L7_farm->getlb(), state->double_farm_L7_active_workers,
+      state->sequential_state, state->L7_farm->getlb(),
+      state->double_farm_L7_active_workers, state->num_partitions,
+      state->workers_loads, &(state->scaling),
+      &(state->batching[MC_PFWL_BATCHING_STAGE_L7]),
       state->mapping[last_mapped]);
   last_mapped = (last_mapped + 1) % state->available_processors;
   state->L7_farm->add_emitter(state->L7_emitter);
 
   state->L7_workers = new std::vector<ff::ff_node *>;
   for (uint i = 0; i < state->double_farm_L7_active_workers; i++) {
+    state->workers_loads[i].node =
+        pfwl_numa_node_of_cpu(state->mapping[last_mapped]);
     tmp = malloc(sizeof(dpi::pfwl_L7_worker));
     assert(tmp);
-    dpi::pfwl_L7_worker *w2 = new (tmp) dpi::pfwl_L7_worker(
-        state->sequential_state, i, state->mapping[last_mapped]);
+    dpi::pfwl_L7_worker *w2 = new (tmp)
+        dpi::pfwl_L7_worker(state->sequential_state, i,
+                            &(state->workers_loads[i]), &(state->scaling),
+                            state->mapping[last_mapped]);
     state->L7_workers->push_back(w2);
     last_mapped = (last_mapped + 1) % state->available_processors;
   }
@@ -233,8 +268,7 @@ static inline
 static inline
 #endif
     void
-    mc_pfwl_create_single_farm(mc_pfwl_state_t *state, uint32_t size_v4,
-                               uint32_t size_v6) {
+    mc_pfwl_create_single_farm(mc_pfwl_state_t *state) {
   uint16_t last_mapped = 0;
   state->single_farm = new ff::ff_farm<dpi::pfwl_L7_scheduler>(
       false, PFWL_MULTICORE_L7_FARM_INPUT_BUFFER_SIZE,
@@ -245,16 +279,21 @@ static inline
   state->single_farm_emitter = new dpi::pfwl_collapsed_emitter(
       &(state->reading_callback), &(state->read_process_callbacks_user_data),
       &(state->terminating), state->tasks_pool, state->sequential_state,
-      (state->single_farm_active_workers), size_v4, size_v6,
-      state->single_farm->getlb(), state->mapping[last_mapped]);
+      (state->single_farm_active_workers), state->num_partitions,
+      state->workers_loads, &(state->scaling), state->batching,
+      state->single_farm->getlb(),
+      state->mapping[last_mapped]);
   assert(state->single_farm_emitter);
   last_mapped = (last_mapped + 1) % state->available_processors;
   state->single_farm->add_emitter(state->single_farm_emitter);
 
   state->single_farm_workers = new std::vector<ff::ff_node *>;
   for (uint16_t i = 0; i < state->single_farm_active_workers; i++) {
+    state->workers_loads[i].node =
+        pfwl_numa_node_of_cpu(state->mapping[last_mapped]);
     dpi::pfwl_L7_worker *w = new dpi::pfwl_L7_worker(
-        state->sequential_state, i, state->mapping[last_mapped]);
+        state->sequential_state, i, &(state->workers_loads[i]),
+        &(state->scaling), state->mapping[last_mapped]);
     assert(w);
     state->single_farm_workers->push_back(w);
     last_mapped = (last_mapped + 1) % state->available_processors;
@@ -300,11 +339,45 @@ static inline ssize_t get_num_cores() {
   return n;
 }
 
+/**
+ * Gives a shard of the defragmentation state to each thread which
+ * manages IP fragments. If the fragments can't be steered, IP
+ * defragmentation is only possible with one L3_L4 worker and it is
+ * disabled otherwise.
+ * @param state A pointer to the state of the library.
+ * @return 1 if succeeded, 0 otherwise.
+ */
+static uint8_t mc_pfwl_fragmentation_setup(mc_pfwl_state_t *state) {
+  pfwl_state_t *sequential_state = state->sequential_state;
+  uint16_t shards = 1;
+  if (state->parallel_module_type == MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM) {
+#if PFWL_MULTICORE_L3_L4_FARM_TYPE == PFWL_MULTICORE_L3_L4_STEERED_FARM
+    shards = state->double_farm_L3_L4_active_workers;
+#else
+    if (state->double_farm_L3_L4_active_workers > 1) {
+      pfwl_defragmentation_disable_ipv4(sequential_state);
+      pfwl_defragmentation_disable_ipv6(sequential_state);
+      return 0;
+    }
+#endif
+  }
+  if (sequential_state->ipv4_frag_state &&
+      pfwl_reordering_ipv4_fragmentation_set_shards(
+          (pfwl_ipv4_fragmentation_state_t *) sequential_state->ipv4_frag_state,
+          shards)) {
+    return 0;
+  }
+  if (sequential_state->ipv6_frag_state &&
+      pfwl_reordering_ipv6_fragmentation_set_shards(
+          (pfwl_ipv6_fragmentation_state_t *) sequential_state->ipv6_frag_state,
+          shards)) {
+    return 0;
+  }
+  return 1;
+}
+
 mc_pfwl_state_t *
-mc_pfwl_init_stateful(uint32_t size_v4, uint32_t size_v6,
-                      uint32_t max_active_v4_flows,
-                      uint32_t max_active_v6_flows,
-                      mc_pfwl_parallelism_details_t parallelism_details) {
+mc_pfwl_init(mc_pfwl_parallelism_details_t parallelism_details) {
   mc_pfwl_state_t *state = NULL;
   if (posix_memalign((void **) &state, PFWL_CACHE_LINE_SIZE,
                      sizeof(mc_pfwl_state_t) + PFWL_CACHE_LINE_SIZE)) {
@@ -339,7 +412,7 @@ mc_pfwl_init_stateful(uint32_t size_v4, uint32_t size_v6,
 
   state->terminating = 0;
 
-  uint16_t hash_table_partitions;
+  uint16_t L7_workers;
 
   state->double_farm_L3_L4_active_workers =
       parallelism_details.double_farm_num_L3_workers;
@@ -351,17 +424,42 @@ mc_pfwl_init_stateful(uint32_t size_v4, uint32_t size_v6,
            state->double_farm_L7_active_workers > 0);
     debug_print("%s\n", "[mc_pfwl_peafowl.cpp]: A pipeline of two "
                         "farms will be activated.");
-    hash_table_partitions = state->double_farm_L7_active_workers;
+    L7_workers = state->double_farm_L7_active_workers;
   } else {
     assert(state->single_farm_active_workers > 0);
     debug_print("%s\n", "[mc_pfwl_peafowl.cpp]: Only one farm will "
                         "be activated.");
-    hash_table_partitions = state->single_farm_active_workers;
+    L7_workers = state->single_farm_active_workers;
+  }
+
+  /**
+   * The flow table is split into more partitions than L7 workers, so that
+   * the L7 emitter can move some of them from the most loaded workers to
+   * the least loaded ones.
+   **/
+  assert(L7_workers * PFWL_MULTICORE_PARTITIONS_PER_WORKER <= UINT16_MAX);
+  state->num_partitions = L7_workers * PFWL_MULTICORE_PARTITIONS_PER_WORKER;
+  if (posix_memalign((void **) &(state->workers_loads), PFWL_CACHE_LINE_SIZE,
+                     sizeof(dpi::pfwl_L7_worker_load_t) * L7_workers)) {
+    throw std::runtime_error("posix_memalign failed.");
+  }
+  bzero(state->workers_loads, sizeof(dpi::pfwl_L7_worker_load_t) * L7_workers);
+  state->scaling.enabled = 0;
+  state->scaling.rebalance_threshold = PFWL_MULTICORE_REBALANCE_THRESHOLD;
+  state->scaling.terminating = 0;
+  pthread_mutex_init(&(state->scaling.mutex), NULL);
+  pthread_cond_init(&(state->scaling.cond), NULL);
+  memset(state->batching, 0, sizeof(state->batching));
+  for (uint i = 0; i < MC_PFWL_BATCHING_STAGES_NUM; i++) {
+    state->batching[i].ticks_per_us = dpi::pfwl_ticks_per_us();
+    state->batching[i].max_grain = PFWL_MULTICORE_MAX_GRAIN_SIZE;
+    state->batching[i].max_latency =
+        PFWL_MULTICORE_DEFAULT_MAX_BATCH_LATENCY_US *
+        state->batching[i].ticks_per_us;
   }
 
   state->sequential_state = pfwl_init_stateful_num_partitions(
-      size_v4, size_v6, max_active_v4_flows, max_active_v6_flows,
-      hash_table_partitions);
+      PFWL_DEFAULT_EXPECTED_FLOWS, 0, state->num_partitions);
 
 /******************************/
 /*   Create the tasks pool.   */
@@ -378,10 +476,11 @@ mc_pfwl_init_stateful(uint32_t size_v4, uint32_t size_v6,
 #endif
 
   if (parallelism_form == MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM) {
-    mc_pfwl_create_double_farm(state, size_v4, size_v6);
+    mc_pfwl_create_double_farm(state);
   } else {
-    mc_pfwl_create_single_farm(state, size_v4, size_v6);
+    mc_pfwl_create_single_farm(state);
   }
+  mc_pfwl_fragmentation_setup(state);
 
   state->is_running = 0;
   state->stop_time.tv_sec = 0;
@@ -404,6 +503,79 @@ void mc_pfwl_print_stats(mc_pfwl_state_t *state) {
   }
 }
 
+uint16_t mc_pfwl_get_workers_load(mc_pfwl_state_t *state,
+                                  mc_pfwl_worker_load_t *loads,
+                                  uint16_t loads_size) {
+  uint16_t workers;
+  if (state->parallel_module_type == MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM) {
+    workers = state->double_farm_L7_active_workers;
+  } else {
+    workers = state->single_farm_active_workers;
+  }
+  if (workers > loads_size) {
+    workers = loads_size;
+  }
+  for (uint16_t i = 0; i < workers; i++) {
+    dpi::pfwl_L7_worker_load_t *l = &(state->workers_loads[i]);
+    uint64_t processed = __atomic_load_n(&l->processed_tasks, __ATOMIC_RELAXED);
+    uint64_t received = __atomic_load_n(&l->received_tasks, __ATOMIC_RELAXED);
+    loads[i].packets = __atomic_load_n(&l->packets, __ATOMIC_RELAXED);
+    // The two counters are not read atomically.
+    loads[i].backlog = received > processed ? received - processed : 0;
+    loads[i].partitions = __atomic_load_n(&l->partitions, __ATOMIC_RELAXED);
+    loads[i].migrations = __atomic_load_n(&l->migrations, __ATOMIC_RELAXED);
+    loads[i].node = l->node;
+    loads[i].active = __atomic_load_n(&l->active, __ATOMIC_RELAXED);
+  }
+  return workers;
+}
+
+uint8_t mc_pfwl_get_batching_stats(mc_pfwl_state_t *state,
+                                   mc_pfwl_batching_stage_t stage,
+                                   mc_pfwl_batching_stats_t *stats) {
+  if (stage >= MC_PFWL_BATCHING_STAGES_NUM) {
+    return 0;
+  }
+  const mc_pfwl_batching_stats_t *s = &(state->batching[stage].stats);
+  stats->batches = __atomic_load_n(&s->batches, __ATOMIC_RELAXED);
+  stats->timeouts = __atomic_load_n(&s->timeouts, __ATOMIC_RELAXED);
+  for (uint i = 0; i < MC_PFWL_BATCHING_HISTOGRAM_BUCKETS; i++) {
+    stats->sizes[i] = __atomic_load_n(&s->sizes[i], __ATOMIC_RELAXED);
+    stats->latencies[i] = __atomic_load_n(&s->latencies[i], __ATOMIC_RELAXED);
+  }
+  return 1;
+}
+
+uint16_t mc_pfwl_get_nodes_memory_stats(mc_pfwl_state_t *state,
+                                        pfwl_memory_stats_t *stats,
+                                        uint16_t stats_size) {
+  if (state->is_running) {
+    return 0;
+  }
+  uint16_t workers;
+  if (state->parallel_module_type == MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM) {
+    workers = state->double_farm_L7_active_workers;
+  } else {
+    workers = state->single_farm_active_workers;
+  }
+  uint16_t nodes = 1;
+  for (uint16_t i = 0; i < workers; i++) {
+    if (state->workers_loads[i].node >= nodes) {
+      nodes = state->workers_loads[i].node + 1;
+    }
+  }
+  if (nodes > stats_size) {
+    nodes = stats_size;
+  }
+  for (uint16_t i = 0; i < nodes; i++) {
+    memset(&(stats[i]), 0, sizeof(pfwl_memory_stats_t));
+    pfwl_flow_table_get_node_memory_stats(
+        (pfwl_flow_table_t *) state->sequential_state->flow_table, i,
+        &(stats[i]));
+  }
+  return nodes;
+}
+
 void mc_pfwl_terminate(mc_pfwl_state_t *state) {
   if (likely(state)) {
     if (state->parallel_module_type == MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM) {
@@ -415,6 +587,7 @@ void mc_pfwl_terminate(mc_pfwl_state_t *state) {
       state->L3_L4_farm->~ff_farm();
 #endif
       free(state->L3_L4_farm);
+      state->L3_L4_collector->~pfwl_L3_L4_collector();
       free(state->L3_L4_collector);
 
       while (!state->L3_L4_workers->empty()) {
@@ -429,6 +602,7 @@ void mc_pfwl_terminate(mc_pfwl_state_t *state) {
       free(state->L7_emitter);
       state->L7_farm->~ff_farm();
       free(state->L7_farm);
+      state->L7_collector->~pfwl_L7_collector();
       free(state->L7_collector);
 
       while (!state->L7_workers->empty()) {
@@ -451,6 +625,9 @@ void mc_pfwl_terminate(mc_pfwl_state_t *state) {
       delete state->single_farm_workers;
     }
     pfwl_terminate(state->sequential_state);
+    free(state->workers_loads);
+    pthread_mutex_destroy(&(state->scaling.mutex));
+    pthread_cond_destroy(&(state->scaling.cond));
 
 #if PFWL_MULTICORE_USE_TASKS_POOL
     state->tasks_pool->~SWSR_Ptr_Buffer();
@@ -470,12 +647,70 @@ void mc_pfwl_set_core_callbacks(
 }
 
 #ifdef ENABLE_RECONFIGURATION
-void mc_pfwl_set_reconf_parameters(mc_pfwl_library_state_t *state,
+void mc_pfwl_set_reconf_parameters(mc_pfwl_state_t *state,
                                    nornir::Parameters *p) {
   state->adp_params = p;
 }
 #endif
 
+uint8_t mc_pfwl_set_scaling(mc_pfwl_state_t *state,
+                            mc_pfwl_scaling_parameters_t parameters) {
+  uint16_t workers;
+  if (state->parallel_module_type == MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM) {
+    workers = state->double_farm_L7_active_workers;
+  } else {
+    workers = state->single_farm_active_workers;
+  }
+  if (!parameters.min_workers) {
+    parameters.min_workers = 1;
+  }
+  if (!parameters.period_ms) {
+    parameters.period_ms = PFWL_MULTICORE_SCALING_DEFAULT_PERIOD_MS;
+  }
+  if (!parameters.low_utilization) {
+    parameters.low_utilization =
+        PFWL_MULTICORE_SCALING_DEFAULT_LOW_UTILIZATION;
+  }
+  if (!parameters.high_utilization) {
+    parameters.high_utilization =
+        PFWL_MULTICORE_SCALING_DEFAULT_HIGH_UTILIZATION;
+  }
+  if (!parameters.high_backlog) {
+    parameters.high_backlog = PFWL_MULTICORE_SCALING_DEFAULT_HIGH_BACKLOG;
+  }
+  if (state->is_running || !PFWL_MULTICORE_REBALANCE_INTERVAL ||
+      parameters.min_workers > workers ||
+      parameters.low_utilization >= parameters.high_utilization) {
+    return 0;
+  }
+  state->scaling.parameters = parameters;
+  state->scaling.enabled = 1;
+  return 1;
+}
+
+uint8_t mc_pfwl_set_rebalance_threshold(mc_pfwl_state_t *state,
+                                        uint32_t threshold) {
+  if (state->is_running || !PFWL_MULTICORE_REBALANCE_INTERVAL) {
+    return 0;
+  }
+  state->scaling.rebalance_threshold = threshold;
+  return 1;
+}
+
+uint8_t mc_pfwl_set_batching(mc_pfwl_state_t *state, uint32_t max_grain,
+                             uint32_t max_latency_us) {
+  if (state->is_running || !max_grain ||
+      max_grain > PFWL_MULTICORE_MAX_GRAIN_SIZE || !max_latency_us) {
+    return 0;
+  }
+  for (uint i = 0; i < MC_PFWL_BATCHING_STAGES_NUM; i++) {
+    state->batching[i].max_grain = max_grain;
+    state->batching[i].max_latency =
+        max_latency_us * state->batching[i].ticks_per_us;
+  }
+  return 1;
+}
+
 void mc_pfwl_run(mc_pfwl_state_t *state) {
   // Real start
   debug_print("%s\n", "[mc_pfwl_peafowl.cpp]: Run preparation...");
@@ -524,13 +759,13 @@ void mc_pfwl_wait_end(mc_pfwl_state_t *state) {
   state->is_running = 0;
 }
 
-uint8_t mc_pfwl_set_expected_flows(mc_pfwl_state_t *state, uint32_t flows_v4,
-                                   uint32_t flows_v6, uint8_t strict) {
+uint8_t mc_pfwl_set_expected_flows(mc_pfwl_state_t *state, uint32_t flows,
+                                   uint8_t strict) {
   if (state->is_running) {
     return 0;
   }
-  return pfwl_set_expected_flows(state->sequential_state, flows_v4, flows_v6,
-                                 strict);
+  // The table is created again with the same number of partitions.
+  return !pfwl_set_expected_flows(state->sequential_state, flows, strict);
 }
 
 uint8_t mc_pfwl_set_max_trials(mc_pfwl_state_t *state, uint16_t max_trials) {
@@ -539,7 +774,7 @@ uint8_t mc_pfwl_set_max_trials(mc_pfwl_state_t *state, uint16_t max_trials) {
   }
   uint8_t r;
   r = pfwl_set_max_trials(state->sequential_state, max_trials);
-  return r;
+  return !r;
 }
 
 uint8_t mc_pfwl_ipv4_fragmentation_enable(mc_pfwl_state_t *state,
@@ -549,7 +784,10 @@ uint8_t mc_pfwl_ipv4_fragmentation_enable(mc_pfwl_state_t *state,
   }
   uint8_t r;
   r = pfwl_defragmentation_enable_ipv4(state->sequential_state, table_size);
-  return r;
+  if (!mc_pfwl_fragmentation_setup(state)) {
+    return 0;
+  }
+  return !r;
 }
 
 uint8_t mc_pfwl_ipv6_fragmentation_enable(mc_pfwl_state_t *state,
@@ -559,7 +797,10 @@ uint8_t mc_pfwl_ipv6_fragmentation_enable(mc_pfwl_state_t *state,
   }
   uint8_t r;
   r = pfwl_defragmentation_enable_ipv6(state->sequential_state, table_size);
-  return r;
+  if (!mc_pfwl_fragmentation_setup(state)) {
+    return 0;
+  }
+  return !r;
 }
 
 uint8_t mc_pfwl_ipv4_fragmentation_set_per_host_memory_limit(
@@ -570,7 +811,7 @@ uint8_t mc_pfwl_ipv4_fragmentation_set_per_host_memory_limit(
   uint8_t r;
   r = pfwl_defragmentation_set_per_host_memory_limit_ipv4(
       state->sequential_state, per_host_memory_limit);
-  return r;
+  return !r;
 }
 
 uint8_t mc_pfwl_ipv6_fragmentation_set_per_host_memory_limit(
@@ -581,7 +822,7 @@ uint8_t mc_pfwl_ipv6_fragmentation_set_per_host_memory_limit(
   uint8_t r;
   r = pfwl_defragmentation_set_per_host_memory_limit_ipv6(
       state->sequential_state, per_host_memory_limit);
-  return r;
+  return !r;
 }
 
 uint8_t
@@ -593,7 +834,7 @@ mc_pfwl_ipv4_fragmentation_set_total_memory_limit(mc_pfwl_state_t *state,
   uint8_t r;
   r = pfwl_defragmentation_set_total_memory_limit_ipv4(state->sequential_state,
                                                        total_memory_limit);
-  return r;
+  return !r;
 }
 
 uint8_t
@@ -605,7 +846,7 @@ mc_pfwl_ipv6_fragmentation_set_total_memory_limit(mc_pfwl_state_t *state,
   uint8_t r;
   r = pfwl_defragmentation_set_total_memory_limit_ipv6(state->sequential_state,
                                                        total_memory_limit);
-  return r;
+  return !r;
 }
 
 uint8_t
@@ -617,7 +858,7 @@ mc_pfwl_ipv4_fragmentation_set_reassembly_timeout(mc_pfwl_state_t *state,
   uint8_t r;
   r = pfwl_defragmentation_set_reassembly_timeout_ipv4(state->sequential_state,
                                                        timeout_seconds);
-  return r;
+  return !r;
 }
 
 uint8_t
@@ -629,7 +870,7 @@ mc_pfwl_ipv6_fragmentation_set_reassembly_timeout(mc_pfwl_state_t *state,
   uint8_t r;
   r = pfwl_defragmentation_set_reassembly_timeout_ipv6(state->sequential_state,
                                                        timeout_seconds);
-  return r;
+  return !r;
 }
 
 uint8_t mc_pfwl_ipv4_fragmentation_disable(mc_pfwl_state_t *state) {
@@ -638,7 +879,7 @@ uint8_t mc_pfwl_ipv4_fragmentation_disable(mc_pfwl_state_t *state) {
   }
   uint8_t r;
   r = pfwl_defragmentation_disable_ipv4(state->sequential_state);
-  return r;
+  return !r;
 }
 
 uint8_t mc_pfwl_ipv6_fragmentation_disable(mc_pfwl_state_t *state) {
@@ -647,7 +888,7 @@ uint8_t mc_pfwl_ipv6_fragmentation_disable(mc_pfwl_state_t *state) {
   }
   uint8_t r;
   r = pfwl_defragmentation_disable_ipv6(state->sequential_state);
-  return r;
+  return !r;
 }
 
 uint8_t mc_pfwl_tcp_reordering_enable(mc_pfwl_state_t *state) {
@@ -656,7 +897,7 @@ uint8_t mc_pfwl_tcp_reordering_enable(mc_pfwl_state_t *state) {
   }
   uint8_t r;
   r = pfwl_tcp_reordering_enable(state->sequential_state);
-  return r;
+  return !r;
 }
 
 uint8_t mc_pfwl_tcp_reordering_disable(mc_pfwl_state_t *state) {
@@ -665,7 +906,7 @@ uint8_t mc_pfwl_tcp_reordering_disable(mc_pfwl_state_t *state) {
   }
   uint8_t r;
   r = pfwl_tcp_reordering_disable(state->sequential_state);
-  return r;
+  return !r;
 }
 
 uint8_t mc_pfwl_enable_protocol(mc_pfwl_state_t *state,
@@ -673,7 +914,7 @@ uint8_t mc_pfwl_enable_protocol(mc_pfwl_state_t *state,
   if (state->is_running) {
     return 0;
   }
-  return pfwl_protocol_l7_enable(state->sequential_state, protocol);
+  return !pfwl_protocol_l7_enable(state->sequential_state, protocol);
 }
 
 uint8_t mc_pfwl_disable_protocol(mc_pfwl_state_t *state,
@@ -681,7 +922,7 @@ uint8_t mc_pfwl_disable_protocol(mc_pfwl_state_t *state,
   if (state->is_running) {
     return 0;
   }
-  return pfwl_protocol_l7_disable(state->sequential_state, protocol);
+  return !pfwl_protocol_l7_disable(state->sequential_state, protocol);
 }
 
 uint8_t mc_pfwl_inspect_all(mc_pfwl_state_t *state) {
@@ -690,7 +931,7 @@ uint8_t mc_pfwl_inspect_all(mc_pfwl_state_t *state) {
   }
   uint8_t r;
   r = pfwl_protocol_l7_enable_all(state->sequential_state);
-  return r;
+  return !r;
 }
 
 uint8_t mc_pfwl_inspect_nothing(mc_pfwl_state_t *state) {
@@ -699,7 +940,7 @@ uint8_t mc_pfwl_inspect_nothing(mc_pfwl_state_t *state) {
   }
   uint8_t r;
   r = pfwl_protocol_l7_disable_all(state->sequential_state);
-  return r;
+  return !r;
 }
 
 uint8_t
@@ -710,28 +951,19 @@ mc_pfwl_set_flow_cleaner_callback(mc_pfwl_state_t *state,
   }
   uint8_t r;
   r = pfwl_set_flow_cleaner_callback(state->sequential_state, cleaner);
-  return r;
-}
-
-uint8_t mc_pfwl_http_activate_callbacks(mc_pfwl_state_t *state,
-                                        pfwl_http_callbacks_t *callbacks,
-                                        void *user_data) {
-  if (state->is_running) {
-    return 0;
-  }
-  uint8_t r;
-  r = pfwl_http_activate_callbacks(state->sequential_state, callbacks,
-                                   user_data);
-  return r;
+  return !r;
 }
 
-uint8_t mc_pfwl_http_disable_callbacks(mc_pfwl_state_t *state) {
-  if (state->is_running) {
+uint8_t mc_pfwl_field_tags_publish_L7(mc_pfwl_state_t *state,
+                                      pfwl_field_id_t field,
+                                      pfwl_field_tags_t *tags) {
+  // Enabling a field changes what the workers are reading.
+  if (state->is_running && field < PFWL_FIELDS_L7_NUM &&
+      !state->sequential_state->fields_to_extract[field]) {
     return 0;
   }
-  uint8_t r;
-  r = pfwl_http_disable_callbacks(state->sequential_state);
-  return r;
+  // All the workers share the sequential state.
+  return !pfwl_field_tags_publish_L7(state->sequential_state, field, tags);
 }
 
 const char **const mc_pfwl_get_protocol_strings() {
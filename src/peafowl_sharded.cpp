@@ -0,0 +1,262 @@
+/*
+ * peafowl_sharded.cpp
+ *
+ * =========================================================================
+ * Copyright (c) 2016-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#include <peafowl/config.h>
+#include <peafowl/peafowl_mc.h>
+
+#include <ff/mapping_utils.hpp>
+#include <ff/utils.hpp>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+static_assert((PFWL_SHARDED_QUEUE_SIZE & (PFWL_SHARDED_QUEUE_SIZE - 1)) == 0,
+              "PFWL_SHARDED_QUEUE_SIZE must be a power of 2");
+
+/** Ticks waited by a shard when all its queues are empty. **/
+#define PFWL_SHARDED_IDLE_TICKS 1000
+
+typedef struct pfwl_sharded_packet {
+  const unsigned char *pkt;
+  size_t length;
+  uint32_t timestamp;
+  void *user_pointer;
+} pfwl_sharded_packet_t;
+
+/**
+ * Queue from a producer to a shard. Each index is only written by one of
+ * the two sides, which keeps a copy of the other index. The cache line of
+ * the other side is thus read only when the queue looks full (or empty).
+ **/
+typedef struct pfwl_sharded_queue {
+  alignas(PFWL_CACHE_LINE_SIZE) uint32_t tail;
+  uint32_t cached_head;
+  alignas(PFWL_CACHE_LINE_SIZE) uint32_t head;
+  uint32_t cached_tail;
+  alignas(PFWL_CACHE_LINE_SIZE)
+      pfwl_sharded_packet_t packets[PFWL_SHARDED_QUEUE_SIZE];
+} pfwl_sharded_queue_t;
+
+typedef struct pfwl_shard {
+  pfwl_sharded_state_t *sharded;
+  pfwl_state_t *state;
+  pfwl_dissection_info_t *dissection_info;
+  uint16_t id;
+  uint16_t proc_id;
+  pthread_t thread;
+} pfwl_shard_t;
+
+struct pfwl_sharded_state {
+  pfwl_shard_t *shards;
+  /** The queue from producer 'p' to shard 's' is queues[p * num_shards + s]. **/
+  pfwl_sharded_queue_t *queues;
+  uint16_t num_shards;
+  uint16_t num_producers;
+  pfwl_protocol_l2_t datalink_type;
+  pfwl_sharded_callback *callback;
+  void *callback_data;
+  uint8_t terminating;
+  uint8_t is_running;
+};
+
+static void pfwl_sharded_free(pfwl_sharded_state_t *state) {
+  for (uint16_t i = 0; i < state->num_shards; i++) {
+    if (state->shards[i].state) {
+      pfwl_terminate(state->shards[i].state);
+    }
+    free(state->shards[i].dissection_info);
+  }
+  free(state->shards);
+  free(state->queues);
+  delete state;
+}
+
+pfwl_sharded_state_t *pfwl_sharded_init(uint16_t num_shards,
+                                        uint16_t num_producers,
+                                        pfwl_protocol_l2_t datalink_type,
+                                        const uint16_t *mapping) {
+  if (!num_shards || !num_producers) {
+    return NULL;
+  }
+  pfwl_sharded_state_t *state = new pfwl_sharded_state_t();
+  state->num_shards = num_shards;
+  state->num_producers = num_producers;
+  state->datalink_type = datalink_type;
+  state->shards = (pfwl_shard_t *) calloc(num_shards, sizeof(pfwl_shard_t));
+  size_t queues_size =
+      sizeof(pfwl_sharded_queue_t) * num_shards * num_producers;
+  if (!state->shards ||
+      posix_memalign((void **) &state->queues, PFWL_CACHE_LINE_SIZE,
+                     queues_size)) {
+    state->num_shards = 0;
+    pfwl_sharded_free(state);
+    return NULL;
+  }
+  memset(state->queues, 0, queues_size);
+
+  for (uint16_t i = 0; i < num_shards; i++) {
+    pfwl_shard_t *shard = &(state->shards[i]);
+    shard->sharded = state;
+    shard->id = i;
+    shard->proc_id = mapping ? mapping[i] : i;
+    shard->state = pfwl_init();
+    if (!shard->state ||
+        posix_memalign((void **) &shard->dissection_info,
+                       PFWL_CACHE_LINE_SIZE, sizeof(pfwl_dissection_info_t))) {
+      pfwl_sharded_free(state);
+      return NULL;
+    }
+    memset(shard->dissection_info, 0, sizeof(pfwl_dissection_info_t));
+  }
+  return state;
+}
+
+pfwl_state_t *pfwl_sharded_get_state(pfwl_sharded_state_t *state,
+                                     uint16_t shard) {
+  if (shard >= state->num_shards) {
+    return NULL;
+  }
+  return state->shards[shard].state;
+}
+
+void pfwl_sharded_set_callback(pfwl_sharded_state_t *state,
+                               pfwl_sharded_callback *callback,
+                               void *callback_data) {
+  state->callback = callback;
+  state->callback_data = callback_data;
+}
+
+/**
+ * Dissects the packets waiting in a queue.
+ * @return The number of dissected packets.
+ **/
+static uint32_t pfwl_sharded_drain(pfwl_shard_t *shard,
+                                   pfwl_sharded_queue_t *queue) {
+  uint32_t head = queue->head;
+  if (head == queue->cached_tail) {
+    queue->cached_tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    if (head == queue->cached_tail) {
+      return 0;
+    }
+  }
+  pfwl_sharded_state_t *sharded = shard->sharded;
+  uint32_t available = queue->cached_tail - head;
+  for (uint32_t i = 0; i < available; i++) {
+    pfwl_sharded_packet_t *packet =
+        &(queue->packets[(head + i) & (PFWL_SHARDED_QUEUE_SIZE - 1)]);
+    pfwl_status_t status = pfwl_dissect_from_L2(
+        shard->state, packet->pkt, packet->length, packet->timestamp,
+        sharded->datalink_type, shard->dissection_info);
+    if (sharded->callback) {
+      sharded->callback(shard->id, status, shard->dissection_info,
+                        packet->user_pointer, sharded->callback_data);
+    }
+  }
+  /** The slots are given back only when the packets have been used. **/
+  __atomic_store_n(&queue->head, head + available, __ATOMIC_RELEASE);
+  return available;
+}
+
+static void *pfwl_sharded_shard_loop(void *arg) {
+  pfwl_shard_t *shard = (pfwl_shard_t *) arg;
+  pfwl_sharded_state_t *sharded = shard->sharded;
+  ff_mapThreadToCpu(shard->proc_id, -20);
+  while (true) {
+    /**
+     * Read before draining the queues: if it is set, all the packets have
+     * already been queued, and the shard can stop once they are empty.
+     **/
+    uint8_t terminating =
+        __atomic_load_n(&sharded->terminating, __ATOMIC_ACQUIRE);
+    uint32_t dissected = 0;
+    for (uint16_t p = 0; p < sharded->num_producers; p++) {
+      dissected += pfwl_sharded_drain(
+          shard, &(sharded->queues[p * sharded->num_shards + shard->id]));
+    }
+    if (!dissected) {
+      if (terminating) {
+        break;
+      }
+      ff::ticks_wait(PFWL_SHARDED_IDLE_TICKS);
+    }
+  }
+  return NULL;
+}
+
+uint8_t pfwl_sharded_run(pfwl_sharded_state_t *state) {
+  if (state->is_running) {
+    return 0;
+  }
+  for (uint16_t i = 0; i < state->num_shards; i++) {
+    if (pthread_create(&(state->shards[i].thread), NULL,
+                       pfwl_sharded_shard_loop, &(state->shards[i]))) {
+      /** Stops the threads already started. **/
+      __atomic_store_n(&state->terminating, 1, __ATOMIC_RELEASE);
+      for (uint16_t j = 0; j < i; j++) {
+        pthread_join(state->shards[j].thread, NULL);
+      }
+      state->terminating = 0;
+      return 0;
+    }
+  }
+  state->is_running = 1;
+  return 1;
+}
+
+uint8_t pfwl_sharded_dissect(pfwl_sharded_state_t *state, uint16_t producer,
+                             const unsigned char *pkt, size_t length,
+                             uint32_t timestamp, void *user_pointer) {
+  uint16_t shard =
+      pfwl_shard_of(pkt, length, state->datalink_type, state->num_shards);
+  pfwl_sharded_queue_t *queue =
+      &(state->queues[producer * state->num_shards + shard]);
+  uint32_t tail = queue->tail;
+  if (tail - queue->cached_head == PFWL_SHARDED_QUEUE_SIZE) {
+    queue->cached_head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    if (tail - queue->cached_head == PFWL_SHARDED_QUEUE_SIZE) {
+      return 0;
+    }
+  }
+  pfwl_sharded_packet_t *packet =
+      &(queue->packets[tail & (PFWL_SHARDED_QUEUE_SIZE - 1)]);
+  packet->pkt = pkt;
+  packet->length = length;
+  packet->timestamp = timestamp;
+  packet->user_pointer = user_pointer;
+  __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+void pfwl_sharded_terminate(pfwl_sharded_state_t *state) {
+  if (state->is_running) {
+    __atomic_store_n(&state->terminating, 1, __ATOMIC_RELEASE);
+    for (uint16_t i = 0; i < state->num_shards; i++) {
+      pthread_join(state->shards[i].thread, NULL);
+    }
+  }
+  pfwl_sharded_free(state);
+}
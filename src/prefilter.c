@@ -0,0 +1,141 @@
+/*
+ * prefilter.c
+ *
+ * =========================================================================
+ * Copyright (c) 2012-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#include <peafowl/prefilter.h>
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Signatures are stored by columns, so that the comparison of a payload
+ * against all of them is a single loop the compiler can vectorize.
+ **/
+typedef struct {
+  uint64_t value[PFWL_PREFILTER_MAX_SIGNATURES];
+  uint64_t mask[PFWL_PREFILTER_MAX_SIGNATURES];
+  size_t min_length[PFWL_PREFILTER_MAX_SIGNATURES];
+  size_t max_length[PFWL_PREFILTER_MAX_SIGNATURES];
+  uint8_t protocol[PFWL_PREFILTER_MAX_SIGNATURES];
+  size_t signatures_num;
+  /** 1 for the protocols having signatures on this transport. **/
+  uint8_t filtered[PFWL_PROTO_L7_NUM];
+} pfwl_prefilter_table_t;
+
+struct pfwl_prefilter {
+  pfwl_prefilter_table_t tables[2]; ///< TCP, UDP
+};
+
+pfwl_prefilter_t *pfwl_prefilter_create(void) {
+  return (pfwl_prefilter_t *) calloc(1, sizeof(pfwl_prefilter_t));
+}
+
+void pfwl_prefilter_delete(pfwl_prefilter_t *prefilter) {
+  free(prefilter);
+}
+
+void pfwl_prefilter_clear(pfwl_prefilter_t *prefilter) {
+  memset(prefilter, 0, sizeof(pfwl_prefilter_t));
+}
+
+static uint8_t pfwl_prefilter_on_table(const pfwl_prefilter_signature_t *s,
+                                       size_t table) {
+  return s->transport == PFWL_PREFILTER_TRANSPORT_TCP_OR_UDP ||
+         (table == 0 && s->transport == PFWL_PREFILTER_TRANSPORT_TCP) ||
+         (table == 1 && s->transport == PFWL_PREFILTER_TRANSPORT_UDP);
+}
+
+void pfwl_prefilter_add(pfwl_prefilter_t *prefilter,
+                        pfwl_protocol_l7_t protocol,
+                        const pfwl_prefilter_signature_t *signatures) {
+  for (size_t t = 0; t < 2; t++) {
+    pfwl_prefilter_table_t *table = &prefilter->tables[t];
+    size_t num = 0;
+    for (const pfwl_prefilter_signature_t *s = signatures;
+         s->transport != PFWL_PREFILTER_TRANSPORT_END; s++) {
+      num += pfwl_prefilter_on_table(s, t);
+    }
+    if (table->filtered[protocol] ||
+        table->signatures_num + num > PFWL_PREFILTER_MAX_SIGNATURES) {
+      continue;
+    }
+    for (const pfwl_prefilter_signature_t *s = signatures;
+         s->transport != PFWL_PREFILTER_TRANSPORT_END; s++) {
+      if (!pfwl_prefilter_on_table(s, t)) {
+        continue;
+      }
+      unsigned char value[PFWL_PREFILTER_BYTES], mask[PFWL_PREFILTER_BYTES];
+      size_t bytes_length = s->bytes_length < PFWL_PREFILTER_BYTES
+                                ? s->bytes_length
+                                : PFWL_PREFILTER_BYTES;
+      uint8_t masked = 0;
+      for (size_t k = 0; k < PFWL_PREFILTER_BYTES; k++) {
+        masked |= s->mask[k];
+      }
+      memset(value, 0, sizeof(value));
+      memset(mask, 0, sizeof(mask));
+      for (size_t k = 0; k < bytes_length; k++) {
+        mask[k] = masked ? s->mask[k] : 0xFF;
+        value[k] = s->bytes[k] & mask[k];
+      }
+      size_t i = table->signatures_num++;
+      memcpy(&table->value[i], value, sizeof(value));
+      memcpy(&table->mask[i], mask, sizeof(mask));
+      // The payload must contain all the bytes which are checked.
+      table->min_length[i] = s->min_length > bytes_length ? s->min_length
+                                                          : bytes_length;
+      table->max_length[i] = s->max_length ? s->max_length : SIZE_MAX;
+      table->protocol[i] = (uint8_t) protocol;
+    }
+    table->filtered[protocol] = 1;
+  }
+}
+
+void pfwl_prefilter_match(const pfwl_prefilter_t *prefilter,
+                          pfwl_protocol_l4_t protocol_l4,
+                          const unsigned char *pkt, size_t length,
+                          uint8_t *plausible) {
+  const pfwl_prefilter_table_t *table =
+      &prefilter->tables[protocol_l4 == IPPROTO_TCP ? 0 : 1];
+  uint8_t matches[PFWL_PREFILTER_MAX_SIGNATURES];
+  uint64_t word = 0;
+  memcpy(&word, pkt,
+         length < PFWL_PREFILTER_BYTES ? length : PFWL_PREFILTER_BYTES);
+
+  for (size_t i = 0; i < table->signatures_num; i++) {
+    matches[i] = (length >= table->min_length[i]) &
+                 (length <= table->max_length[i]) &
+                 ((word & table->mask[i]) == table->value[i]);
+  }
+
+  for (size_t p = 0; p < PFWL_PROTO_L7_NUM; p++) {
+    plausible[p] = !table->filtered[p];
+  }
+  for (size_t i = 0; i < table->signatures_num; i++) {
+    plausible[table->protocol[i]] |= matches[i];
+  }
+}
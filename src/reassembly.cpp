@@ -25,10 +25,14 @@
  * =========================================================================
  */
 #include <peafowl/config.h>
+#include <peafowl/ipv4_reassembly.h>
 #include <peafowl/reassembly.h>
 #include <peafowl/utils.h>
 
+#include <arpa/inet.h>
 #include <inttypes.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -85,194 +89,214 @@ uint32_t pfwl_reassembly_fragment_length(uint32_t offset, uint32_t end) {
     return PFWL_MAX_INT_32 - offset + 1 + end;
 }
 
-#ifndef PFWL_DEBUG
-static
-#endif
-    pfwl_reassembly_fragment_t *
-    pfwl_reassembly_create_fragment(uint32_t offset, uint32_t end,
-                                    const unsigned char *ptr) {
-  pfwl_reassembly_fragment_t *fragment;
-  fragment = (pfwl_reassembly_fragment_t *) calloc(
-      1, sizeof(pfwl_reassembly_fragment_t));
-  if (unlikely(fragment == NULL)) {
-    free(fragment);
-    return NULL;
+uint32_t pfwl_reassembly_ip_datagram_memory(
+    const pfwl_reassembly_ip_datagram_t *datagram) {
+  if (datagram->buffer) {
+    return datagram->header_length + datagram->capacity;
   }
+  return 0;
+}
 
-  /* Fill in the structure. */
-  fragment->offset = offset;
-  fragment->end = end;
-  fragment->tcp_fin = 0;
-
-  uint32_t length = pfwl_reassembly_fragment_length(offset, end);
-  fragment->ptr = (unsigned char *) malloc(sizeof(unsigned char) * (length));
-
-  if (unlikely(fragment->ptr == NULL)) {
-    free(fragment);
-    return NULL;
+/**
+ * Changes the space reserved for the header and for the data of a
+ * datagram, keeping the data already stored.
+ **/
+static uint8_t pfwl_reassembly_ip_datagram_resize(
+    pfwl_reassembly_ip_datagram_t *datagram, uint16_t header_length,
+    uint16_t capacity) {
+  uint16_t old_header_length = datagram->header_length;
+  uint16_t data_length =
+      datagram->intervals_num
+          ? datagram->intervals[datagram->intervals_num - 1].end
+          : 0;
+  unsigned char *buffer = datagram->buffer;
+  /** The data is moved before shrinking and after growing the buffer. **/
+  if (buffer && header_length < old_header_length) {
+    memmove(buffer + header_length, buffer + old_header_length, data_length);
+  }
+  buffer = (unsigned char *) realloc(buffer, header_length + capacity);
+  if (unlikely(buffer == NULL)) {
+    if (datagram->buffer && header_length < old_header_length) {
+      memmove(datagram->buffer + old_header_length,
+              datagram->buffer + header_length, data_length);
+    }
+    return 1;
   }
-  memcpy(fragment->ptr, ptr, length);
-  return fragment;
+  if (datagram->buffer && header_length > old_header_length) {
+    memmove(buffer + header_length, buffer + old_header_length, data_length);
+  }
+  datagram->buffer = buffer;
+  datagram->header_length = header_length;
+  datagram->capacity = capacity;
+  return 0;
 }
 
-pfwl_reassembly_fragment_t *
-pfwl_reassembly_insert_fragment(pfwl_reassembly_fragment_t **head,
-                                const unsigned char *data, uint32_t offset,
-                                uint32_t end, uint32_t *bytes_removed,
-                                uint32_t *bytes_inserted) {
-  pfwl_reassembly_fragment_t *prev, *next, *iterator, *tmp;
-  uint32_t fragment_start = 0;
-  *bytes_removed = 0;
-  *bytes_inserted = 0;
-
-  /*
-   * Find the position in which this fragment must be put.
-   */
-
-  prev = NULL;
-  for (next = (*head); next != NULL; next = next->next) {
-    if (pfwl_reassembly_after_or_equal(next->offset, offset)) {
-      break;
+uint8_t pfwl_reassembly_ip_datagram_set_header(
+    pfwl_reassembly_ip_datagram_t *datagram, const unsigned char *header,
+    uint16_t length) {
+  if (datagram->header_length != length || datagram->buffer == NULL) {
+    if (pfwl_reassembly_ip_datagram_resize(datagram, length,
+                                           datagram->capacity)) {
+      return 1;
     }
-    prev = next;
   }
+  memcpy(datagram->buffer, header, length);
+  return 0;
+}
 
-  /**
-   *  If there are no overlaps, I should put the fragment after prev
-   *  and before next.
-   *
-   *  In the general case we will have (in sequence, some of this points
-   *  may be missing):
-   *   1. Partially or total overlap with the previous fragment.
-   *      (The overlapped part will be left in the old data).
-   *   2. A gap in which we have to insert a part of the new fragment.
-   *      (The new part will be inserted from the new fragment).
-   *   3. A train of completely overlapped fragments.
-   *      (Will be replaced by new fragment)
-   *   4. A partially overlapped fragment. (The overlapped part will
-   *      be left in the old data).
-   */
+uint8_t pfwl_reassembly_ip_datagram_insert(
+    pfwl_reassembly_ip_datagram_t *datagram, const unsigned char *data,
+    uint16_t offset, uint16_t end, uint16_t header_length) {
+  pfwl_reassembly_ip_interval_t *intervals = datagram->intervals;
+  uint8_t num = datagram->intervals_num;
+  uint8_t first, last;
+
+  /** Intervals overlapping or adjacent to the fragment: [first, last). **/
+  for (first = 0; first < num && intervals[first].end < offset; first++)
+    ;
+  for (last = first; last < num && intervals[last].start <= end; last++)
+    ;
+  if (first == last && num == PFWL_IP_FRAGMENTATION_MAX_HOLES) {
+    return 1;
+  }
 
   /**
-   *  Check for overlaps with the previous fragment. We will leave the
-   *  previous fragment untouched and in case copy the new part.
+   * The buffer is sized from the first fragment: if the length of the
+   * datagram is not known yet, we leave space for another fragment like
+   * this one.
    **/
-  if (prev != NULL && pfwl_reassembly_before(offset, prev->end)) {
-    /** If is contained in the previous fragment don't do anything.**/
-    if (pfwl_reassembly_before_or_equal(end, prev->end)) {
-      return NULL;
+  uint32_t needed = datagram->length ? datagram->length : end;
+  if (datagram->buffer == NULL || needed > datagram->capacity) {
+    uint32_t capacity = needed;
+    if (!datagram->length) {
+      capacity = datagram->capacity ? 2 * datagram->capacity
+                                    : (uint32_t) end + (end - offset);
+      if (capacity < needed) {
+        capacity = needed;
+      }
+      if (capacity > PFWL_IP_FRAGMENTATION_MAX_DATAGRAM_SIZE) {
+        capacity = PFWL_IP_FRAGMENTATION_MAX_DATAGRAM_SIZE;
+      }
+    }
+    if (datagram->buffer) {
+      header_length = datagram->header_length;
+    }
+    if (pfwl_reassembly_ip_datagram_resize(datagram, header_length,
+                                           capacity)) {
+      return 1;
     }
-    offset = prev->end;
-    fragment_start = pfwl_reassembly_fragment_length(offset, prev->end);
   }
 
-  /**
-   *  Check for overlaps with the subsequent segments (can be more
-   *  than one). If there are completely overlapped segments, they
-   *  will be removed and replaced by the new fragment. The
-   *  alternative was to add only the missing parts, but this could
-   *  lead to an high number of small fragments. Anyway, to avoid
-   *  this and to have a more compact list of fragments we incur in
-   *  the cost of reallocate and copy again already present data.
-   */
-  for (iterator = next; iterator != NULL;) {
-    /**
-     * This data doesn't overlaps. The data are ordered so the
-     * successive will not overlap too.
-     **/
-    if (pfwl_reassembly_after_or_equal(iterator->offset, end)) {
-      break;
+  /** Copies only the parts not already received. **/
+  unsigned char *where = datagram->buffer + datagram->header_length;
+  uint16_t position = offset;
+  for (uint8_t i = first; i < last && position < end; i++) {
+    if (intervals[i].start > position) {
+      memcpy(where + position, data + (position - offset),
+             intervals[i].start - position);
     }
-
-    /**
-     * If the fragment 'iterator' is completely overlapped by the
-     * new fragment, then remove it.
-     **/
-    if (pfwl_reassembly_after_or_equal(end, iterator->end)) {
-      if (iterator->prev != NULL) {
-        iterator->prev->next = iterator->next;
-      } else {
-        (*head) = iterator->next;
-      }
-
-      if (iterator->next != NULL)
-        iterator->next->prev = iterator->prev;
-
-      tmp = iterator->next;
-
-      (*bytes_removed) +=
-          pfwl_reassembly_fragment_length(iterator->offset, iterator->end);
-
-      free(iterator->ptr);
-      free(iterator);
-
-      /**
-       * We deleted iterator, so we put the pointer back to the
-       * previous fragment. The for loop will then go to the
-       * successive data.
-       **/
-      iterator = tmp;
-      /** We have also to update next. **/
-      next = tmp;
-    } else {
-      /**
-       * If it is partially overlapped, then we left the overlapped
-       * part in the old fragment.
-       **/
-      end = iterator->offset;
-      iterator = iterator->next;
+    if (intervals[i].end > position) {
+      position = intervals[i].end;
     }
   }
+  if (position < end) {
+    memcpy(where + position, data + (position - offset), end - position);
+  }
 
-  /** Insert the new fragment in the list. **/
-  tmp = pfwl_reassembly_create_fragment(offset, end, data + fragment_start);
-
-  if (unlikely(tmp == NULL))
-    return NULL;
-
-  (*bytes_inserted) += pfwl_reassembly_fragment_length(offset, end);
+  if (first == last) {
+    memmove(&intervals[first + 1], &intervals[first],
+            (num - first) * sizeof(pfwl_reassembly_ip_interval_t));
+    intervals[first].start = offset;
+    intervals[first].end = end;
+    ++datagram->intervals_num;
+  } else {
+    if (intervals[first].start > offset) {
+      intervals[first].start = offset;
+    }
+    intervals[first].end =
+        intervals[last - 1].end > end ? intervals[last - 1].end : end;
+    memmove(&intervals[first + 1], &intervals[last],
+            (num - last) * sizeof(pfwl_reassembly_ip_interval_t));
+    datagram->intervals_num -= last - first - 1;
+  }
+  return 0;
+}
 
-  tmp->prev = prev;
-  tmp->next = next;
-  if (prev)
-    prev->next = tmp;
-  else
-    (*head) = tmp;
+uint8_t pfwl_reassembly_ip_datagram_complete(
+    const pfwl_reassembly_ip_datagram_t *datagram) {
+  return datagram->length != 0 && datagram->intervals_num == 1 &&
+         datagram->intervals[0].start == 0 &&
+         datagram->intervals[0].end == datagram->length;
+}
 
-  if (next)
-    next->prev = tmp;
-  return tmp;
+void pfwl_reassembly_ip_datagram_release(
+    pfwl_reassembly_ip_datagram_t *datagram) {
+  free(datagram->buffer);
+  datagram->buffer = NULL;
+  datagram->capacity = 0;
 }
 
-uint8_t pfwl_reassembly_ip_check_train_of_contiguous_fragments(
-    pfwl_reassembly_fragment_t *head) {
-  if (!head)
-    return 0;
-  uint16_t offset = 0;
+uint8_t pfwl_reassembly_credits_exhausted(pfwl_reassembly_credits_t *credits,
+                                          uint32_t *held, uint32_t used) {
+  uint32_t limit = credits->limit;
+  uint32_t taken = __atomic_load_n(&(credits->taken), __ATOMIC_RELAXED);
+  uint8_t starving = __atomic_load_n(&(credits->starving), __ATOMIC_RELAXED);
+  uint32_t fair_share = limit / credits->shards;
+  uint32_t excess = 0;
+  if (unlikely(taken > limit)) {
+    excess = taken - limit < *held ? taken - limit : *held;
+  } else if (unlikely(starving) && *held > fair_share) {
+    excess = *held - fair_share;
+  }
+  if (excess) {
+    __sync_sub_and_fetch(&(credits->taken), excess);
+    *held -= excess;
+  }
+  while (used >= *held) {
+    /** Leave the credits given back to the starving shards. **/
+    if (unlikely(starving) && *held >= fair_share) {
+      return 1;
+    }
+    taken = __atomic_load_n(&(credits->taken), __ATOMIC_RELAXED);
+    if (taken >= limit) {
+      __atomic_store_n(&(credits->starving), 1, __ATOMIC_RELAXED);
+      return 1;
+    }
+    uint32_t grant = limit - taken < PFWL_IP_FRAGMENTATION_CREDITS_GRAIN
+                         ? limit - taken
+                         : PFWL_IP_FRAGMENTATION_CREDITS_GRAIN;
+    if (__sync_bool_compare_and_swap(&(credits->taken), taken,
+                                     taken + grant)) {
+      *held += grant;
+    }
+  }
+  if (unlikely(starving) && *held <= fair_share) {
+    __atomic_store_n(&(credits->starving), 0, __ATOMIC_RELAXED);
+  }
+  return 0;
+}
 
-  /* Check all fragment offsets to see if they connect. */
-  while (head) {
-    if (head->offset > offset)
-      return 0;
-    offset = head->end;
-    head = head->next;
+void pfwl_reassembly_credits_release(pfwl_reassembly_credits_t *credits,
+                                     uint32_t *held, uint32_t used) {
+  if (*held > (uint64_t) used + 2 * PFWL_IP_FRAGMENTATION_CREDITS_GRAIN) {
+    uint32_t excess = *held - used - PFWL_IP_FRAGMENTATION_CREDITS_GRAIN;
+    *held -= excess;
+    __sync_sub_and_fetch(&(credits->taken), excess);
   }
-  return 1;
 }
 
-int32_t pfwl_reassembly_ip_compact_fragments(pfwl_reassembly_fragment_t *head,
-                                             unsigned char **where,
-                                             uint32_t len) {
-  /* Copy the data portions of all fragments into the new buffer. */
-  uint32_t count = 0;
-  while (head != NULL) {
-    uint32_t fragment_length = head->end - head->offset;
-    if (unlikely(head->offset + fragment_length > len)) {
-      return -1;
+uint16_t pfwl_reassembly_ip_shard(const unsigned char *pkt, size_t length,
+                                  uint16_t shards) {
+  uint32_t h = 0;
+  if (length >= sizeof(struct iphdr) && (pkt[0] >> 4) == 4) {
+    const struct iphdr *iph = (const struct iphdr *) pkt;
+    h = pfwl_reassembly_mix(iph->saddr ^ iph->daddr);
+  } else if (length >= sizeof(struct ip6_hdr) && (pkt[0] >> 4) == 6) {
+    const struct ip6_hdr *ip6 = (const struct ip6_hdr *) pkt;
+    for (uint8_t i = 0; i < 4; i++) {
+      h ^= ip6->ip6_src.s6_addr32[i] ^ ip6->ip6_dst.s6_addr32[i];
     }
-    memcpy(((*where) + head->offset), head->ptr, fragment_length);
-    count += fragment_length;
-    head = head->next;
+    h = pfwl_reassembly_mix(h);
   }
-  return count;
+  return h % shards;
 }
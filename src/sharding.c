@@ -0,0 +1,126 @@
+/*
+ * sharding.c
+ *
+ * =========================================================================
+ * Copyright (c) 2012-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#include <peafowl/hash_functions.h>
+#include <peafowl/ipv4_reassembly.h>
+#include <peafowl/peafowl.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <stdint.h>
+#include <string.h>
+
+/** Different from the flow table one, so that shards and buckets differ. **/
+#define PFWL_SHARDING_SEED 0x5bd1e995
+
+uint16_t pfwl_shard_of(const unsigned char *pkt, size_t length,
+                       pfwl_protocol_l2_t datalink_type, uint16_t shards) {
+  /** Only the L2 length, the addresses and the L4 key are filled. **/
+  pfwl_dissection_info_t info;
+  if (shards <= 1 ||
+      pfwl_dissect_L2(pkt, datalink_type, &info) != PFWL_STATUS_OK ||
+      info.l2.length >= length) {
+    return 0;
+  }
+
+  uint8_t version = 0, next_header = 0, fragment = 0;
+  size_t offset = info.l2.length;
+  /** Each iteration parses an IP header, the following ones are tunneled. **/
+  do {
+    const unsigned char *ip = pkt + offset;
+    size_t ip_length = length - offset;
+    if (ip_length >= sizeof(struct iphdr) && (ip[0] >> 4) == 4) {
+      const struct iphdr *ip4 = (const struct iphdr *) ip;
+      if (ip4->ihl * 4 < sizeof(struct iphdr) || ip4->ihl * 4 > ip_length) {
+        break;
+      }
+      version = 4;
+      info.l3.addr_src.ipv4 = ip4->saddr;
+      info.l3.addr_dst.ipv4 = ip4->daddr;
+      fragment = (ntohs(ip4->frag_off) & (PFWL_IPv4_FRAGMENTATION_MF |
+                                          PFWL_IPv4_FRAGMENTATION_OFFSET_MASK))
+                     ? 1
+                     : 0;
+      next_header = ip4->protocol;
+      offset += ip4->ihl * 4;
+    } else if (ip_length >= sizeof(struct ip6_hdr) && (ip[0] >> 4) == 6) {
+      const struct ip6_hdr *ip6 = (const struct ip6_hdr *) ip;
+      version = 6;
+      info.l3.addr_src.ipv6 = ip6->ip6_src;
+      info.l3.addr_dst.ipv6 = ip6->ip6_dst;
+      next_header = ip6->ip6_nxt;
+      offset += sizeof(struct ip6_hdr);
+      while ((next_header == IPPROTO_HOPOPTS ||
+              next_header == IPPROTO_ROUTING ||
+              next_header == IPPROTO_DSTOPTS) &&
+             offset + 2 <= length) {
+        next_header = pkt[offset];
+        offset += (pkt[offset + 1] + 1) * 8;
+      }
+      if (offset > length) {
+        /** Truncated extension headers, the ports cannot be read. **/
+        break;
+      }
+      fragment = next_header == IPPROTO_FRAGMENT;
+    } else {
+      break;
+    }
+  } while (!fragment && offset < length &&
+           (next_header == IPPROTO_IPIP || next_header == IPPROTO_IPV6));
+
+  if (version == 0) {
+    return 0;
+  }
+
+  /**
+   * Only the first fragment carries the ports, so fragments are assigned
+   * by their addresses and all of them reach the same shard. Datagrams
+   * which may be fragmented (i.e. anything but TCP, which sizes its
+   * segments on the path MTU) are assigned by their addresses even when
+   * they are not, so that the rebuilt ones are dissected together with the
+   * other packets of their flow.
+   **/
+  info.l4.protocol = 0;
+  info.l4.port_src = 0;
+  info.l4.port_dst = 0;
+  if (!fragment && next_header == IPPROTO_TCP && offset + 4 <= length) {
+    info.l4.protocol = next_header;
+    memcpy(&info.l4.port_src, pkt + offset, sizeof(uint16_t));
+    memcpy(&info.l4.port_dst, pkt + offset + 2, sizeof(uint16_t));
+  }
+
+  uint32_t hash;
+  if (version == 4) {
+    hash = v4_hash_murmur3(&info, PFWL_SHARDING_SEED);
+  } else {
+    pfwl_flow_key_v6_t key;
+    pfwl_flow_key_v6_make(&info, &key);
+    hash = v6_hash_murmur3(&key, PFWL_SHARDING_SEED);
+  }
+  return hash % shards;
+}
@@ -25,7 +25,7 @@
  * =========================================================================
  */
 #include <peafowl/peafowl.h>
-#include <peafowl/external/radix_tree/radix_tree.hpp>
+#include <peafowl/tags.h>
 
 #include "./external/rapidjson/document.h"
 #include "./external/rapidjson/error/en.h"
@@ -37,10 +37,24 @@
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <set>
+#include <vector>
 #include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace rapidjson;
 
+#define PFWL_TAGS_NONE UINT32_MAX
+#define PFWL_TAGS_SPARSE_EDGES 6
+
 static pfwl_field_matching_t getFieldMatchingType(const std::string& matchingType){
   if(!matchingType.compare("PREFIX")){
     return PFWL_FIELD_MATCHING_PREFIX;
@@ -48,52 +62,949 @@ static pfwl_field_matching_t getFieldMatchingType(const std::string& matchingTyp
     return PFWL_FIELD_MATCHING_EXACT;
   }else if(!matchingType.compare("SUFFIX")){
     return PFWL_FIELD_MATCHING_SUFFIX;
+  }else if(!matchingType.compare("DOMAIN")){
+    return PFWL_FIELD_MATCHING_DOMAIN;
   }else{
     return PFWL_FIELD_MATCHING_ERROR;
   }
 }
 
+static inline unsigned char pfwl_tags_fold(unsigned char c){
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static std::string pfwl_tags_fold(const char* s){
+  std::string r(s);
+  std::transform(r.begin(), r.end(), r.begin(), [](char c){
+    return (char) pfwl_tags_fold((unsigned char) c);
+  });
+  return r;
+}
+
+/**
+ * Length of a host name without its port (e.g. an HTTP Host
+ * 'example.com:8080') and its trailing dot (e.g. 'example.com.').
+ **/
+static size_t pfwl_tags_domain_length(const unsigned char* s, size_t length){
+  size_t i = length;
+  while(i && s[i - 1] >= '0' && s[i - 1] <= '9'){
+    --i;
+  }
+  if(i && i < length && s[i - 1] == ':'){
+    length = i - 1;
+  }
+  if(length && s[length - 1] == '.'){
+    --length;
+  }
+  return length;
+}
+
+/**
+ * Tags of the rules ending in a node. 'longest' is the tag of a prefix rule
+ * (or of a suffix rule, if the trie is built on the reversed strings), which
+ * also matches any longer string. In the trie of the reversed strings
+ * 'exact' is the tag of a domain rule, which also matches any longer string
+ * continuing with a '.' (i.e. its subdomains).
+ **/
+typedef struct{
+  uint32_t longest;
+  uint32_t exact;
+}pfwl_tags_rule_t;
+
 typedef struct{
-  radix_tree<std::string, std::string> prefixes;
-  radix_tree<std::string, std::string> exact;
-  radix_tree<std::string, std::string> suffixes;
-}pfwl_field_matching_db_t;
-
-static void pfwl_field_string_tags_add_internal(pfwl_field_matching_db_t* db, const char* value, pfwl_field_matching_t matchingType, const char* tag){
-  std::string toMatchStr(value);
-  std::transform(toMatchStr.begin(), toMatchStr.end(), toMatchStr.begin(), ::tolower);
-
-  switch(matchingType){
-  case PFWL_FIELD_MATCHING_PREFIX:{
-    db->prefixes[toMatchStr] = tag;
-  }break;
-  case PFWL_FIELD_MATCHING_EXACT:{
-    db->exact[toMatchStr] = tag;
-  }break;
-  case PFWL_FIELD_MATCHING_SUFFIX:{
-    std::reverse(toMatchStr.begin(), toMatchStr.end());
-    db->suffixes[toMatchStr] = tag;
-  }break;
-  case PFWL_FIELD_MATCHING_ERROR:{
-    ;
-  }break;
-  }
-}
-
-static void pfwl_field_mmap_tags_add_internal(std::map<std::string, pfwl_field_matching_db_t>* db, const char* key, const char* value, pfwl_field_matching_t matchingType, const char* tag){
-  std::string keyStr(key);
-  std::transform(keyStr.begin(), keyStr.end(), keyStr.begin(), ::tolower);
-  pfwl_field_string_tags_add_internal(&(*db)[keyStr], value, matchingType, tag);
-}
-
-static void* pfwl_field_tags_load_L7(pfwl_field_id_t field, const char* fileName){
-  void* db = NULL;
-  if(pfwl_get_L7_field_type(field) == PFWL_FIELD_TYPE_STRING){
-    db = new pfwl_field_matching_db_t;
-  }else if(pfwl_get_L7_field_type(field) == PFWL_FIELD_TYPE_MMAP){
-    db = new std::map<std::string, pfwl_field_matching_db_t>;
+  /**
+   * The labels and targets of the edges are in [edges, edges + edges_num),
+   * or in the row of _dense starting at 'edges' if edges_num is higher than
+   * PFWL_TAGS_SPARSE_EDGES.
+   **/
+  uint32_t edges;
+  uint32_t edges_num;
+  pfwl_tags_rule_t rule;
+}pfwl_tags_node_t;
+
+/**
+ * Compiled databases files. All the sections start at multiples of 8 bytes,
+ * and are stored with the byte order of the host which compiled them:
+ *
+ * - pfwl_tags_file_header_t
+ * - tags: 'tags_num' \0 terminated strings ('tags_size' bytes)
+ * - the forward and backward tries of the values
+ * - the trie of the keys and, for each key, the forward and backward tries
+ *   of its values (multimap fields only)
+ *
+ * Each trie is a pfwl_tags_trie_header_t followed by its arrays.
+ **/
+#define PFWL_TAGS_FILE_MAGIC "PFWLTAGS"
+#define PFWL_TAGS_FILE_VERSION 1
+#define PFWL_TAGS_FILE_BYTE_ORDER 0x01020304
+
+typedef struct{
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t type;
+  uint32_t tags_num;
+  uint64_t tags_size;
+  uint32_t keys_num;
+  uint32_t reserved;
+}pfwl_tags_file_header_t;
+
+typedef struct{
+  uint32_t nodes_num;
+  uint32_t labels_num;
+  uint32_t dense_num;
+  uint32_t classes_num;
+}pfwl_tags_trie_header_t;
+
+static size_t pfwl_tags_padded(size_t size){
+  return (size + 7) & ~((size_t) 7);
+}
+
+/** @return 0 if succeeded, 1 otherwise. **/
+static uint8_t pfwl_tags_write(FILE* f, const void* data, size_t size){
+  static const char padding[8] = {0};
+  size_t pad = pfwl_tags_padded(size) - size;
+  if((size && fwrite(data, size, 1, f) != 1) ||
+     (pad && fwrite(padding, pad, 1, f) != 1)){
+    return 1;
+  }
+  return 0;
+}
+
+/** Cursor over a mapped file. **/
+typedef struct{
+  const unsigned char* next;
+  const unsigned char* end;
+}pfwl_tags_cursor_t;
+
+/** @return A pointer to the next 'size' bytes, or NULL if the file is too short. **/
+static const void* pfwl_tags_read(pfwl_tags_cursor_t* cursor, size_t size){
+  size_t padded = pfwl_tags_padded(size);
+  if(padded < size || (size_t) (cursor->end - cursor->next) < padded){
+    return NULL;
+  }
+  const void* r = cursor->next;
+  cursor->next += padded;
+  return r;
+}
+
+/**
+ * Immutable trie, stored in flat arrays. The edges of each node are
+ * contiguous, so that each byte of the field costs either a scan of a few
+ * labels or (for nodes with many edges) one access to a row of _dense.
+ * Strings are case folded when the rules are added and while matching, so
+ * that no copy of the field is needed.
+ * The arrays are either owned by the trie or part of a mapped file.
+ **/
+class pfwl_tags_trie{
+private:
+  pfwl_tags_trie_header_t _header;
+  const pfwl_tags_node_t* _nodes;
+  const unsigned char* _labels;
+  const uint32_t* _targets;
+  /**
+   * Nodes with many edges store them in a row of _dense, indexed by the
+   * class of the byte. Bytes not present in any rule have class 0.
+   **/
+  const uint32_t* _dense;
+  const uint16_t* _classes;
+  bool _mapped;
+
+  std::vector<pfwl_tags_node_t> _nodesStorage;
+  std::vector<unsigned char> _labelsStorage;
+  std::vector<uint32_t> _targetsStorage;
+  std::vector<uint32_t> _denseStorage;
+  uint16_t _classesStorage[256];
+
+  void view(){
+    _header.nodes_num = _nodesStorage.size();
+    _header.labels_num = _labelsStorage.size();
+    _header.dense_num = _denseStorage.size();
+    _nodes = _nodesStorage.data();
+    _labels = _labelsStorage.data();
+    _targets = _targetsStorage.data();
+    _dense = _denseStorage.data();
+    _classes = _classesStorage;
+    _mapped = false;
+  }
+
+  inline uint32_t child(const pfwl_tags_node_t& node, unsigned char c) const{
+    if(node.edges_num > PFWL_TAGS_SPARSE_EDGES){
+      return _dense[node.edges + _classes[c]];
+    }
+    const unsigned char* labels = _labels + node.edges;
+    for(uint32_t i = 0; i < node.edges_num; i++){
+      if(labels[i] == c){
+        return _targets[node.edges + i];
+      }
+    }
+    return PFWL_TAGS_NONE;
+  }
+
+  /** @return 1 if 'tag' is neither PFWL_TAGS_NONE nor lower than 'limit'. **/
+  static uint8_t invalidTag(uint32_t tag, uint32_t limit){
+    return tag != PFWL_TAGS_NONE && tag >= limit;
+  }
+public:
+  pfwl_tags_trie(){
+    compile(std::map<std::string, pfwl_tags_rule_t>());
+  }
+
+  pfwl_tags_trie(const pfwl_tags_trie& other){
+    *this = other;
+  }
+
+  pfwl_tags_trie& operator=(const pfwl_tags_trie& other){
+    if(this != &other){
+      _header = other._header;
+      _nodesStorage = other._nodesStorage;
+      _labelsStorage = other._labelsStorage;
+      _targetsStorage = other._targetsStorage;
+      _denseStorage = other._denseStorage;
+      memcpy(_classesStorage, other._classesStorage, sizeof(_classesStorage));
+      view();
+      if(other._mapped){
+        _nodes = other._nodes;
+        _labels = other._labels;
+        _targets = other._targets;
+        _dense = other._dense;
+        _classes = other._classes;
+        _header = other._header;
+        _mapped = true;
+      }
+    }
+    return *this;
+  }
+
+  /**
+   * Builds the trie breadth first, so that the children of each node are
+   * created (and thus their edges stored) together.
+   **/
+  void compile(const std::map<std::string, pfwl_tags_rule_t>& rules){
+    typedef struct{
+      size_t first;
+      size_t last;
+      size_t depth;
+      uint32_t node;
+    }pfwl_tags_range_t;
+
+    std::vector<std::pair<const std::string*, pfwl_tags_rule_t>> sorted;
+    sorted.reserve(rules.size());
+    for(auto& r : rules){
+      sorted.push_back(std::make_pair(&r.first, r.second));
+    }
+
+    memset(_classesStorage, 0, sizeof(_classesStorage));
+    _header.classes_num = 1;
+    for(auto& r : sorted){
+      for(unsigned char c : *r.first){
+        if(!_classesStorage[c]){
+          _classesStorage[c] = _header.classes_num++;
+        }
+      }
+    }
+
+    std::vector<pfwl_tags_node_t> nodes;
+    std::vector<unsigned char> labels;
+    std::vector<uint32_t> targets;
+    std::vector<uint32_t> dense;
+    nodes.push_back({0, 0, {PFWL_TAGS_NONE, PFWL_TAGS_NONE}});
+    std::vector<pfwl_tags_range_t> queue;
+    queue.push_back({0, sorted.size(), 0, 0});
+    for(size_t q = 0; q < queue.size(); q++){
+      pfwl_tags_range_t r = queue[q];
+      size_t i = r.first;
+      // Strings are sorted, thus the one ending here (if any) is the first.
+      if(i < r.last && sorted[i].first->size() == r.depth){
+        nodes[r.node].rule = sorted[i].second;
+        ++i;
+      }
+      nodes[r.node].edges = labels.size();
+      while(i < r.last){
+        unsigned char c = (*sorted[i].first)[r.depth];
+        size_t j = i + 1;
+        while(j < r.last && (unsigned char) (*sorted[j].first)[r.depth] == c){
+          ++j;
+        }
+        uint32_t node = nodes.size();
+        nodes.push_back({0, 0, {PFWL_TAGS_NONE, PFWL_TAGS_NONE}});
+        labels.push_back(c);
+        targets.push_back(node);
+        queue.push_back({i, j, r.depth + 1, node});
+        i = j;
+      }
+      pfwl_tags_node_t& n = nodes[r.node];
+      n.edges_num = labels.size() - n.edges;
+      if(n.edges_num > PFWL_TAGS_SPARSE_EDGES){
+        size_t row = dense.size();
+        dense.resize(row + _header.classes_num, PFWL_TAGS_NONE);
+        for(uint32_t e = n.edges; e < n.edges + n.edges_num; e++){
+          dense[row + _classesStorage[labels[e]]] = targets[e];
+        }
+        labels.resize(n.edges);
+        targets.resize(n.edges);
+        n.edges = row;
+      }
+    }
+    // Copies, rather than shrink_to_fit, which may keep the slack.
+    _nodesStorage.assign(nodes.begin(), nodes.end());
+    _labelsStorage.assign(labels.begin(), labels.end());
+    _targetsStorage.assign(targets.begin(), targets.end());
+    _denseStorage.assign(dense.begin(), dense.end());
+    view();
+  }
+
+  /**
+   * Adds the rules stored in the trie to 'rules', visiting it depth first.
+   **/
+  void decompile(std::map<std::string, pfwl_tags_rule_t>& rules) const{
+    uint16_t classes = 0;
+    unsigned char bytes[257];
+    for(size_t c = 0; c < 256; c++){
+      if(_classes[c]){
+        bytes[_classes[c]] = c;
+        ++classes;
+      }
+    }
+    std::vector<std::pair<uint32_t, std::string>> stack;
+    stack.push_back(std::make_pair(0, std::string()));
+    while(!stack.empty()){
+      std::pair<uint32_t, std::string> top = stack.back();
+      stack.pop_back();
+      const pfwl_tags_node_t& node = _nodes[top.first];
+      if(node.rule.longest != PFWL_TAGS_NONE || node.rule.exact != PFWL_TAGS_NONE){
+        rules[top.second] = node.rule;
+      }
+      if(node.edges_num > PFWL_TAGS_SPARSE_EDGES){
+        for(uint16_t c = 1; c <= classes; c++){
+          if(_dense[node.edges + c] != PFWL_TAGS_NONE){
+            stack.push_back(std::make_pair(_dense[node.edges + c], top.second + (char) bytes[c]));
+          }
+        }
+      }else{
+        for(uint32_t e = node.edges; e < node.edges + node.edges_num; e++){
+          stack.push_back(std::make_pair(_targets[e], top.second + (char) _labels[e]));
+        }
+      }
+    }
+  }
+
+  /** @return 0 if succeeded, 1 otherwise. **/
+  uint8_t save(FILE* f) const{
+    return pfwl_tags_write(f, &_header, sizeof(_header)) ||
+           pfwl_tags_write(f, _classes, 256 * sizeof(uint16_t)) ||
+           pfwl_tags_write(f, _nodes, _header.nodes_num * sizeof(pfwl_tags_node_t)) ||
+           pfwl_tags_write(f, _labels, _header.labels_num) ||
+           pfwl_tags_write(f, _targets, _header.labels_num * sizeof(uint32_t)) ||
+           pfwl_tags_write(f, _dense, _header.dense_num * sizeof(uint32_t));
   }
 
+  /**
+   * Uses the arrays stored in a mapped file, after checking that all the
+   * edges and tags are in bounds.
+   * @param longestLimit Upper bound of the 'longest' tags.
+   * @param exactLimit Upper bound of the 'exact' tags.
+   * @return 0 if succeeded, 1 otherwise.
+   **/
+  uint8_t load(pfwl_tags_cursor_t* cursor, uint32_t longestLimit, uint32_t exactLimit){
+    const pfwl_tags_trie_header_t* header = (const pfwl_tags_trie_header_t*) pfwl_tags_read(cursor, sizeof(pfwl_tags_trie_header_t));
+    if(!header || !header->nodes_num || header->classes_num > 257 ||
+       header->classes_num == 0){
+      return 1;
+    }
+    const uint16_t* classes = (const uint16_t*) pfwl_tags_read(cursor, 256 * sizeof(uint16_t));
+    const pfwl_tags_node_t* nodes = (const pfwl_tags_node_t*) pfwl_tags_read(cursor, (size_t) header->nodes_num * sizeof(pfwl_tags_node_t));
+    const unsigned char* labels = (const unsigned char*) pfwl_tags_read(cursor, header->labels_num);
+    const uint32_t* targets = (const uint32_t*) pfwl_tags_read(cursor, (size_t) header->labels_num * sizeof(uint32_t));
+    const uint32_t* dense = (const uint32_t*) pfwl_tags_read(cursor, (size_t) header->dense_num * sizeof(uint32_t));
+    if(!classes || !nodes || !labels || !targets || !dense){
+      return 1;
+    }
+    for(size_t c = 0; c < 256; c++){
+      if(classes[c] >= header->classes_num){
+        return 1;
+      }
+    }
+    // Each node but the root must have exactly one parent, otherwise
+    // decompile() could loop forever.
+    std::vector<bool> reached(header->nodes_num, false);
+    reached[0] = true;
+    for(uint32_t i = 0; i < header->nodes_num; i++){
+      const pfwl_tags_node_t& n = nodes[i];
+      if(invalidTag(n.rule.longest, longestLimit) || invalidTag(n.rule.exact, exactLimit)){
+        return 1;
+      }
+      const uint32_t* children;
+      uint32_t childrenNum;
+      bool isDense = n.edges_num > PFWL_TAGS_SPARSE_EDGES;
+      if(isDense){
+        if((uint64_t) n.edges + header->classes_num > header->dense_num){
+          return 1;
+        }
+        children = dense + n.edges;
+        childrenNum = header->classes_num;
+      }else{
+        if((uint64_t) n.edges + n.edges_num > header->labels_num){
+          return 1;
+        }
+        children = targets + n.edges;
+        childrenNum = n.edges_num;
+      }
+      for(uint32_t j = 0; j < childrenNum; j++){
+        if(isDense && children[j] == PFWL_TAGS_NONE){
+          continue;
+        }
+        if(children[j] >= header->nodes_num || reached[children[j]]){
+          return 1;
+        }
+        reached[children[j]] = true;
+      }
+    }
+    _header = *header;
+    _nodes = nodes;
+    _labels = labels;
+    _targets = targets;
+    _dense = dense;
+    _classes = classes;
+    _mapped = true;
+    return 0;
+  }
+
+  /**
+   * Walks the trie with the (case folded) bytes of the string, from the
+   * last one if 'reversed' is true.
+   * @param exact Will be set to the tag of the rule exactly matching the
+   * string, or to PFWL_TAGS_NONE. Always PFWL_TAGS_NONE if 'reversed'.
+   * @param depth If not NULL, will be set to the length of the returned rule.
+   * @return The tag of the longest rule matching the beginning (the end,
+   * including domain rules, if 'reversed') of the string, or PFWL_TAGS_NONE.
+   **/
+  template <bool reversed>
+  uint32_t match(const unsigned char* s, size_t length, uint32_t* exact,
+                 size_t* depth = NULL) const{
+    const pfwl_tags_node_t* node = &_nodes[0];
+    uint32_t longest = node->rule.longest;
+    size_t longestDepth = 0;
+    *exact = PFWL_TAGS_NONE;
+    size_t i;
+    for(i = 0; i < length; i++){
+      uint32_t next = child(*node, pfwl_tags_fold(reversed ? s[length - 1 - i] : s[i]));
+      if(next == PFWL_TAGS_NONE){
+        break;
+      }
+      node = &_nodes[next];
+      if(node->rule.longest != PFWL_TAGS_NONE){
+        longest = node->rule.longest;
+        longestDepth = i + 1;
+      }
+      if(reversed && node->rule.exact != PFWL_TAGS_NONE &&
+         (i + 1 == length || s[length - 2 - i] == '.')){
+        longest = node->rule.exact;
+        longestDepth = i + 1;
+      }
+    }
+    if(!reversed && i == length){
+      *exact = node->rule.exact;
+    }
+    if(depth){
+      *depth = longestDepth;
+    }
+    return longest;
+  }
+
+  /**
+   * Walks the trie with the (case folded) bytes of the string, from the
+   * last one, only matching domain rules.
+   * @param depth Will be set to the length of the returned rule.
+   * @return The tag of the longest domain rule matching the string, or
+   * PFWL_TAGS_NONE.
+   **/
+  uint32_t matchDomain(const unsigned char* s, size_t length, size_t* depth) const{
+    const pfwl_tags_node_t* node = &_nodes[0];
+    uint32_t domain = PFWL_TAGS_NONE;
+    for(size_t i = 0; i < length; i++){
+      uint32_t next = child(*node, pfwl_tags_fold(s[length - 1 - i]));
+      if(next == PFWL_TAGS_NONE){
+        break;
+      }
+      node = &_nodes[next];
+      if(node->rule.exact != PFWL_TAGS_NONE &&
+         (i + 1 == length || s[length - 2 - i] == '.')){
+        domain = node->rule.exact;
+        *depth = i + 1;
+      }
+    }
+    return domain;
+  }
+};
+
+/**
+ * Rules for a string (or for the values of a multimap key). Prefix and
+ * exact rules share the same trie, suffix and domain rules are stored
+ * reversed in a second one. Once compiled, the rules are only kept in the tries.
+ **/
+class pfwl_tags_matcher{
+private:
+  std::map<std::string, pfwl_tags_rule_t> _forwardRules;
+  std::map<std::string, pfwl_tags_rule_t> _backwardRules;
+  pfwl_tags_trie _forward;
+  pfwl_tags_trie _backward;
+public:
+  void add(const std::string& value, pfwl_field_matching_t matchingType, uint32_t tag){
+    pfwl_tags_rule_t none = {PFWL_TAGS_NONE, PFWL_TAGS_NONE};
+    switch(matchingType){
+    case PFWL_FIELD_MATCHING_PREFIX:{
+      _forwardRules.insert(std::make_pair(value, none)).first->second.longest = tag;
+    }break;
+    case PFWL_FIELD_MATCHING_EXACT:{
+      _forwardRules.insert(std::make_pair(value, none)).first->second.exact = tag;
+    }break;
+    case PFWL_FIELD_MATCHING_SUFFIX:{
+      std::string reversed(value.rbegin(), value.rend());
+      _backwardRules.insert(std::make_pair(reversed, none)).first->second.longest = tag;
+    }break;
+    case PFWL_FIELD_MATCHING_DOMAIN:{
+      // "*.example.com", ".example.com" and "example.com." are the same as
+      // "example.com".
+      size_t first = value.compare(0, 2, "*.") ? (value.compare(0, 1, ".") ? 0 : 1) : 2;
+      size_t last = value.size();
+      if(last > first && value[last - 1] == '.'){
+        --last;
+      }
+      if(last > first){
+        std::string reversed(value.rbegin() + (value.size() - last), value.rend() - first);
+        _backwardRules.insert(std::make_pair(reversed, none)).first->second.exact = tag;
+      }
+    }break;
+    case PFWL_FIELD_MATCHING_ERROR:{
+      ;
+    }break;
+    }
+  }
+
+  void compile(){
+    _forward.compile(_forwardRules);
+    _backward.compile(_backwardRules);
+    _forwardRules.clear();
+    _backwardRules.clear();
+  }
+
+  /** Makes the rules of a compiled matcher modifiable again. **/
+  void decompile(){
+    _forward.decompile(_forwardRules);
+    _backward.decompile(_backwardRules);
+  }
+
+  uint8_t save(FILE* f) const{
+    return _forward.save(f) || _backward.save(f);
+  }
+
+  uint8_t load(pfwl_tags_cursor_t* cursor, uint32_t tags){
+    return _forward.load(cursor, tags, tags) || _backward.load(cursor, tags, tags);
+  }
+
+  /**
+   * Prefix rules have the priority over exact rules, which have the
+   * priority over suffix and domain rules. Among prefix (suffix and domain)
+   * rules, the longest one wins. A domain rule wins over a suffix rule of
+   * the same length. Domain rules ignore the port and the trailing dot of
+   * the string.
+   **/
+  uint32_t match(const unsigned char* s, size_t length) const{
+    uint32_t exact;
+    uint32_t tag = _forward.match<false>(s, length, &exact);
+    if(tag != PFWL_TAGS_NONE){
+      return tag;
+    }
+    if(exact != PFWL_TAGS_NONE){
+      return exact;
+    }
+    size_t depth;
+    tag = _backward.match<true>(s, length, &exact, &depth);
+    size_t domainLength = pfwl_tags_domain_length(s, length);
+    if(domainLength != length){
+      size_t domainDepth;
+      uint32_t domain = _backward.matchDomain(s, domainLength, &domainDepth);
+      if(domain != PFWL_TAGS_NONE && (tag == PFWL_TAGS_NONE || domainDepth >= depth)){
+        tag = domain;
+      }
+    }
+    return tag;
+  }
+};
+
+/**
+ * Tags are interned, so that the tags returned in the dissection info stay
+ * valid after the rules containing them are replaced.
+ **/
+static std::mutex pfwl_tags_strings_lock;
+static std::set<std::string> pfwl_tags_strings;
+
+static const char* pfwl_tags_intern(const char* tag){
+  std::lock_guard<std::mutex> guard(pfwl_tags_strings_lock);
+  return pfwl_tags_strings.insert(tag).first->c_str();
+}
+
+/**
+ * Tags database of a field. Once published into a state it is never
+ * modified, and it is shared by all the states it has been published into.
+ * Rules added to a database which has not been published yet are compiled
+ * when it is published, so that loading many rules costs one compilation
+ * only. The tries of a database can be stored in a file, and used directly
+ * from its mapping.
+ **/
+class pfwl_field_tags_db{
+private:
+  pfwl_field_type_t _type;
+  std::vector<const char*> _tags;
+  std::map<std::string, uint32_t> _tagsIds;
+  /** String fields. **/
+  pfwl_tags_matcher _values;
+  /** Multimap fields, the exact tags of _keys are positions in _keysValues. **/
+  std::map<std::string, pfwl_tags_rule_t> _keysRules;
+  pfwl_tags_trie _keys;
+  std::vector<pfwl_tags_matcher> _keysValues;
+  bool _compiled;
+  /** The references held by the user and by the states. **/
+  uint32_t _references;
+  void* _mapping;
+  size_t _mappingSize;
+
+  uint32_t getTagId(const char* tag){
+    auto it = _tagsIds.find(tag);
+    if(it != _tagsIds.end()){
+      return it->second;
+    }
+    _tags.push_back(pfwl_tags_intern(tag));
+    _tagsIds[tag] = _tags.size() - 1;
+    return _tags.size() - 1;
+  }
+
+  inline const char* getTag(uint32_t id) const{
+    return id == PFWL_TAGS_NONE ? NULL : _tags[id];
+  }
+
+  void decompile(){
+    if(_compiled){
+      _values.decompile();
+      _keys.decompile(_keysRules);
+      for(auto& v : _keysValues){
+        v.decompile();
+      }
+      _compiled = false;
+    }
+  }
+public:
+  pfwl_field_tags_db(pfwl_field_type_t type):
+    _type(type), _compiled(false), _references(1), _mapping(NULL), _mappingSize(0){;}
+
+  /** Copies the rules (but not the references) of another database. **/
+  pfwl_field_tags_db(const pfwl_field_tags_db& other):
+    _type(other._type), _tags(other._tags), _tagsIds(other._tagsIds),
+    _values(other._values), _keysRules(other._keysRules), _keys(other._keys),
+    _keysValues(other._keysValues), _compiled(other._compiled),
+    _references(1), _mapping(NULL), _mappingSize(0){
+    // The tries may point to the mapping of 'other'.
+    decompile();
+  }
+
+  ~pfwl_field_tags_db(){
+    if(_mapping){
+      munmap(_mapping, _mappingSize);
+    }
+  }
+
+  pfwl_field_type_t getType() const{
+    return _type;
+  }
+
+  void acquire(){
+    __sync_fetch_and_add(&_references, 1);
+  }
+
+  void release(){
+    if(__sync_sub_and_fetch(&_references, 1) == 0){
+      delete this;
+    }
+  }
+
+  void add(const char* value, pfwl_field_matching_t matchingType, const char* tag){
+    decompile();
+    _values.add(pfwl_tags_fold(value), matchingType, getTagId(tag));
+  }
+
+  void add(const char* key, const char* value, pfwl_field_matching_t matchingType, const char* tag){
+    decompile();
+    pfwl_tags_rule_t rule = {PFWL_TAGS_NONE, (uint32_t) _keysValues.size()};
+    auto it = _keysRules.insert(std::make_pair(pfwl_tags_fold(key), rule)).first;
+    if(it->second.exact == _keysValues.size()){
+      _keysValues.push_back(pfwl_tags_matcher());
+    }
+    _keysValues[it->second.exact].add(pfwl_tags_fold(value), matchingType, getTagId(tag));
+  }
+
+  void compile(){
+    if(!_compiled){
+      _values.compile();
+      _keys.compile(_keysRules);
+      _keysRules.clear();
+      for(auto& v : _keysValues){
+        v.compile();
+      }
+      _compiled = true;
+    }
+  }
+
+  /** @return 0 if succeeded, 1 otherwise. **/
+  uint8_t save(const char* fileName){
+    compile();
+    FILE* f = fopen(fileName, "wb");
+    if(!f){
+      return 1;
+    }
+    std::string tags;
+    for(const char* t : _tags){
+      tags.append(t, strlen(t) + 1);
+    }
+    pfwl_tags_file_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PFWL_TAGS_FILE_MAGIC, sizeof(header.magic));
+    header.version = PFWL_TAGS_FILE_VERSION;
+    header.byte_order = PFWL_TAGS_FILE_BYTE_ORDER;
+    header.type = _type;
+    header.tags_num = _tags.size();
+    header.tags_size = tags.size();
+    header.keys_num = _keysValues.size();
+    uint8_t r = pfwl_tags_write(f, &header, sizeof(header)) ||
+                pfwl_tags_write(f, tags.data(), tags.size()) ||
+                _values.save(f) || _keys.save(f);
+    for(size_t i = 0; i < _keysValues.size() && !r; i++){
+      r = _keysValues[i].save(f);
+    }
+    if(fclose(f)){
+      r = 1;
+    }
+    return r;
+  }
+
+  /**
+   * Maps a file written by save().
+   * @return The database, or NULL if the file cannot be mapped or is not
+   * valid.
+   **/
+  static pfwl_field_tags_db* map(const char* fileName){
+    int fd = open(fileName, O_RDONLY);
+    if(fd == -1){
+      return NULL;
+    }
+    struct stat st;
+    if(fstat(fd, &st) || (size_t) st.st_size < sizeof(pfwl_tags_file_header_t)){
+      close(fd);
+      return NULL;
+    }
+    void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED){
+      return NULL;
+    }
+
+    pfwl_tags_cursor_t cursor;
+    cursor.next = (const unsigned char*) mapping;
+    cursor.end = cursor.next + st.st_size;
+    const pfwl_tags_file_header_t* header = (const pfwl_tags_file_header_t*) pfwl_tags_read(&cursor, sizeof(pfwl_tags_file_header_t));
+    pfwl_field_tags_db* db = NULL;
+    if(!memcmp(header->magic, PFWL_TAGS_FILE_MAGIC, sizeof(header->magic)) &&
+       header->version == PFWL_TAGS_FILE_VERSION &&
+       header->byte_order == PFWL_TAGS_FILE_BYTE_ORDER &&
+       (header->type == PFWL_FIELD_TYPE_STRING || header->type == PFWL_FIELD_TYPE_MMAP)){
+      db = new pfwl_field_tags_db((pfwl_field_type_t) header->type);
+      db->_mapping = mapping;
+      db->_mappingSize = st.st_size;
+      db->_compiled = true;
+      const char* tags = (const char*) pfwl_tags_read(&cursor, header->tags_size);
+      uint8_t r = !tags;
+      size_t offset = 0;
+      for(uint32_t i = 0; i < header->tags_num && !r; i++){
+        const char* end = (const char*) memchr(tags + offset, '\0', header->tags_size - offset);
+        if(!end){
+          r = 1;
+        }else{
+          db->getTagId(tags + offset);
+          offset = end + 1 - tags;
+        }
+      }
+      r = r || db->_tags.size() != header->tags_num ||
+          db->_values.load(&cursor, header->tags_num) ||
+          db->_keys.load(&cursor, 0, header->keys_num);
+      if(!r){
+        db->_keysValues.resize(header->keys_num);
+      }
+      for(uint32_t i = 0; i < header->keys_num && !r; i++){
+        r = db->_keysValues[i].load(&cursor, header->tags_num);
+      }
+      if(r){
+        delete db;
+        db = NULL;
+      }
+    }else{
+      munmap(mapping, st.st_size);
+    }
+    return db;
+  }
+
+  const char* match(const pfwl_string_t* value) const{
+    return getTag(_values.match(value->value, value->length));
+  }
+
+  const char* match(const pfwl_string_t* key, const pfwl_string_t* value) const{
+    uint32_t values;
+    _keys.match<false>(key->value, key->length, &values);
+    if(values == PFWL_TAGS_NONE){
+      return NULL;
+    }
+    return getTag(_keysValues[values].match(value->value, value->length));
+  }
+};
+
+struct pfwl_field_tags{
+  pfwl_field_id_t field;
+  pfwl_field_tags_db* db;
+};
+
+/**
+ * Epoch based reclamation. A thread matching fields stores in its slot the
+ * global epoch it observed, and clears the slot when done. Replaced
+ * databases are tagged with a new epoch, and released when no thread is
+ * matching with an older one. Threads which cannot get a slot are counted
+ * in pfwl_tags_anonymous_readers, and prevent any release while matching.
+ **/
+typedef struct{
+  uint64_t epoch;
+  uint8_t used;
+  char padding[PFWL_CACHE_LINE_SIZE - sizeof(uint64_t) - sizeof(uint8_t)];
+}pfwl_tags_reader_t;
+
+static pfwl_tags_reader_t pfwl_tags_readers[PFWL_TAGS_MAX_READERS] __attribute__((aligned(PFWL_CACHE_LINE_SIZE)));
+static uint64_t pfwl_tags_epoch = 1;
+static uint32_t pfwl_tags_anonymous_readers = 0;
+
+class pfwl_tags_reader_slot{
+public:
+  pfwl_tags_reader_t* reader;
+
+  pfwl_tags_reader_slot():reader(NULL){
+    for(size_t i = 0; i < PFWL_TAGS_MAX_READERS; i++){
+      if(!__atomic_load_n(&pfwl_tags_readers[i].used, __ATOMIC_RELAXED) &&
+         __sync_bool_compare_and_swap(&pfwl_tags_readers[i].used, 0, 1)){
+        reader = &pfwl_tags_readers[i];
+        break;
+      }
+    }
+  }
+
+  ~pfwl_tags_reader_slot(){
+    if(reader){
+      __atomic_store_n(&reader->used, 0, __ATOMIC_RELEASE);
+    }
+  }
+};
+
+static thread_local pfwl_tags_reader_slot pfwl_tags_slot;
+
+static inline pfwl_tags_reader_t* pfwl_tags_read_lock(){
+  pfwl_tags_reader_t* reader = pfwl_tags_slot.reader;
+  if(likely(reader)){
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&pfwl_tags_epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    // The slot must be visible before reading the databases.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }else{
+    __sync_fetch_and_add(&pfwl_tags_anonymous_readers, 1);
+  }
+  return reader;
+}
+
+static inline void pfwl_tags_read_unlock(pfwl_tags_reader_t* reader){
+  if(likely(reader)){
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+  }else{
+    __sync_fetch_and_sub(&pfwl_tags_anonymous_readers, 1);
+  }
+}
+
+/** @return The oldest epoch observed by a thread still matching. **/
+static uint64_t pfwl_tags_oldest_reader(){
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&pfwl_tags_anonymous_readers, __ATOMIC_ACQUIRE)){
+    return 0;
+  }
+  uint64_t oldest = UINT64_MAX;
+  for(size_t i = 0; i < PFWL_TAGS_MAX_READERS; i++){
+    uint64_t epoch = __atomic_load_n(&pfwl_tags_readers[i].epoch, __ATOMIC_ACQUIRE);
+    if(epoch && epoch < oldest){
+      oldest = epoch;
+    }
+  }
+  return oldest;
+}
+
+/**
+ * Writers side of a state. Only the published databases
+ * (state->tags_matchers) are accessed by the threads dissecting packets.
+ **/
+typedef struct{
+  std::mutex lock;
+  /** Rules added with the pfwl_*_tags_add calls, not published yet. **/
+  pfwl_field_tags_db* pending[PFWL_FIELDS_L7_NUM];
+  uint8_t dirty;
+  /** Replaced databases, with the epoch at which they were replaced. **/
+  std::vector<std::pair<pfwl_field_tags_db*, uint64_t>> retired;
+}pfwl_field_tags_updates_t;
+
+static void pfwl_field_tags_reclaim(pfwl_field_tags_updates_t* updates){
+  if(updates->retired.empty()){
+    return;
+  }
+  uint64_t oldest = pfwl_tags_oldest_reader();
+  size_t kept = 0;
+  for(auto& r : updates->retired){
+    if(r.second <= oldest){
+      r.first->release();
+    }else{
+      updates->retired[kept++] = r;
+    }
+  }
+  updates->retired.resize(kept);
+}
+
+/**
+ * Must be called with the lock held. 'db' may be NULL. It does not enable
+ * the field, since it may be called by any thread dissecting packets.
+ **/
+static void pfwl_field_tags_replace(pfwl_state_t* state, pfwl_field_id_t field, pfwl_field_tags_db* db){
+  pfwl_field_tags_updates_t* updates = static_cast<pfwl_field_tags_updates_t*>(state->tags_updates);
+  void* old = __atomic_exchange_n(&state->tags_matchers[field], static_cast<void*>(db), __ATOMIC_SEQ_CST);
+  if(old){
+    // Threads which observe this epoch (or a later one) see the new database.
+    uint64_t epoch = __atomic_add_fetch(&pfwl_tags_epoch, 1, __ATOMIC_SEQ_CST);
+    updates->retired.push_back(std::make_pair(static_cast<pfwl_field_tags_db*>(old), epoch));
+  }
+  size_t num = 0;
+  for(size_t i = 0; i < PFWL_FIELDS_L7_NUM; i++){
+    if(state->tags_matchers[i] || updates->pending[i]){
+      ++num;
+    }
+  }
+  __atomic_store_n(&state->tags_matchers_num, num, __ATOMIC_RELEASE);
+  pfwl_field_tags_reclaim(updates);
+}
+
+static pfwl_field_tags_db* pfwl_field_tags_load(pfwl_field_id_t field, const char* fileName){
+  pfwl_field_type_t type = pfwl_get_L7_field_type(field);
+  if(type != PFWL_FIELD_TYPE_STRING && type != PFWL_FIELD_TYPE_MMAP){
+    return NULL;
+  }
+  pfwl_field_tags_db* db = new pfwl_field_tags_db(type);
+
   if(fileName){
     std::ifstream ifs(fileName);
     IStreamWrapper isw(ifs);
@@ -101,6 +1012,7 @@ static void* pfwl_field_tags_load_L7(pfwl_field_id_t field, const char* fileName
     d.ParseStream(isw);
 
     if (d.HasParseError()){
+      delete db;
       return NULL;
     }
 
@@ -110,101 +1022,258 @@ static void* pfwl_field_tags_load_L7(pfwl_field_id_t field, const char* fileName
         const Value& stringToMatch = (*itr)["value"];
         const Value& matchingType = (*itr)["matchingType"];
         const Value& tag = (*itr)["tag"];
-        if(pfwl_get_L7_field_type(field) == PFWL_FIELD_TYPE_STRING){
-          pfwl_field_string_tags_add_internal(static_cast<pfwl_field_matching_db_t*>(db), stringToMatch.GetString(), getFieldMatchingType(matchingType.GetString()), tag.GetString());
-        }else if(pfwl_get_L7_field_type(field) == PFWL_FIELD_TYPE_MMAP){
+        if(type == PFWL_FIELD_TYPE_STRING){
+          db->add(stringToMatch.GetString(), getFieldMatchingType(matchingType.GetString()), tag.GetString());
+        }else{
           const Value& key = (*itr)["key"];
-          pfwl_field_mmap_tags_add_internal(static_cast<std::map<std::string, pfwl_field_matching_db_t>*>(db), key.GetString(), stringToMatch.GetString(), getFieldMatchingType(matchingType.GetString()), tag.GetString());
+          db->add(key.GetString(), stringToMatch.GetString(), getFieldMatchingType(matchingType.GetString()), tag.GetString());
         }
     }
   }
+  db->compile();
   return db;
 }
 
-
 extern "C" const char* pfwl_field_string_tag_get(void* db, pfwl_string_t* value){
-  pfwl_field_matching_db_t* db_real = static_cast<pfwl_field_matching_db_t*>(db);
-  std::string field_str((const char*) value->value, value->length);
-  std::transform(field_str.begin(), field_str.end(), field_str.begin(), ::tolower);
+  return static_cast<pfwl_field_tags_db*>(db)->match(value);
+}
+
+extern "C" const char* pfwl_field_mmap_tag_get(void* db, pfwl_string_t* key, pfwl_string_t* value){
+  return static_cast<pfwl_field_tags_db*>(db)->match(key, value);
+}
 
-  // Prefixes match
-  auto iterator = db_real->prefixes.longest_match(field_str);
-  if(iterator != db_real->prefixes.end()){
-    return iterator->second.c_str();
+extern "C" uint8_t pfwl_field_tags_init(pfwl_state_t* state){
+  pfwl_field_tags_updates_t* updates = new (std::nothrow) pfwl_field_tags_updates_t;
+  if(!updates){
+    return 1;
   }
+  memset(updates->pending, 0, sizeof(updates->pending));
+  updates->dirty = 0;
+  state->tags_updates = updates;
+  return 0;
+}
 
-  // Extact match
-  iterator = db_real->exact.find(field_str);
-  if(iterator != db_real->exact.end()){
-    return iterator->second.c_str();
+extern "C" void pfwl_field_tags_terminate(pfwl_state_t* state){
+  pfwl_field_tags_updates_t* updates = static_cast<pfwl_field_tags_updates_t*>(state->tags_updates);
+  if(!updates){
+    return;
   }
+  for(size_t i = 0; i < PFWL_FIELDS_L7_NUM; i++){
+    if(updates->pending[i]){
+      updates->pending[i]->release();
+    }
+    if(state->tags_matchers[i]){
+      static_cast<pfwl_field_tags_db*>(state->tags_matchers[i])->release();
+      state->tags_matchers[i] = NULL;
+    }
+  }
+  // Nobody is dissecting packets with this state anymore, but the
+  // databases may still be used through other states.
+  for(auto& r : updates->retired){
+    r.first->release();
+  }
+  state->tags_matchers_num = 0;
+  delete updates;
+  state->tags_updates = NULL;
+}
 
-  // Suffixes match
-  std::reverse(field_str.begin(), field_str.end());
-  iterator = db_real->suffixes.longest_match(field_str);
-  if(iterator != db_real->suffixes.end()){
-    return iterator->second.c_str();
+extern "C" void pfwl_field_tags_flush(pfwl_state_t* state, uint8_t wait){
+  pfwl_field_tags_updates_t* updates = static_cast<pfwl_field_tags_updates_t*>(state->tags_updates);
+  if(wait){
+    updates->lock.lock();
+  }else if(!updates->lock.try_lock()){
+    return;
   }
-  return NULL;
+  if(updates->dirty){
+    for(size_t i = 0; i < PFWL_FIELDS_L7_NUM; i++){
+      pfwl_field_tags_db* db = updates->pending[i];
+      if(db){
+        db->compile();
+        updates->pending[i] = NULL;
+        pfwl_field_tags_replace(state, (pfwl_field_id_t) i, db);
+      }
+    }
+    __atomic_store_n(&updates->dirty, 0, __ATOMIC_RELEASE);
+  }
+  updates->lock.unlock();
 }
 
-extern "C" const char* pfwl_field_mmap_tag_get(void* db, pfwl_string_t* key, pfwl_string_t* value){
-  std::map<std::string, pfwl_field_matching_db_t>* db_real = static_cast<std::map<std::string, pfwl_field_matching_db_t>*>(db);
-  std::string key_str((const char*) key->value, key->length);
-  std::transform(key_str.begin(), key_str.end(), key_str.begin(), ::tolower);
-  return pfwl_field_string_tag_get(static_cast<void*>(&(*db_real)[key_str]), value);
+extern "C" void pfwl_field_tags_match(pfwl_state_t* state, pfwl_dissection_info_t* diss_info){
+  pfwl_field_tags_updates_t* updates = static_cast<pfwl_field_tags_updates_t*>(state->tags_updates);
+  if(unlikely(__atomic_load_n(&updates->dirty, __ATOMIC_ACQUIRE))){
+    pfwl_field_tags_flush(state, 0);
+  }
+
+  pfwl_tags_reader_t* reader = pfwl_tags_read_lock();
+  for(size_t i = 0; i < PFWL_FIELDS_L7_NUM; i++){
+    pfwl_field_t* field = &diss_info->l7.protocol_fields[i];
+    if(!field->present){
+      continue;
+    }
+    const pfwl_field_tags_db* db = static_cast<const pfwl_field_tags_db*>(__atomic_load_n(&state->tags_matchers[i], __ATOMIC_ACQUIRE));
+    if(!db){
+      continue;
+    }
+    if(db->getType() == PFWL_FIELD_TYPE_STRING){
+      const char* tag = db->match(&field->basic.string);
+      if(tag){
+        diss_info->l7.tags[diss_info->l7.tags_num++] = tag;
+        if(diss_info->l7.tags_num == PFWL_TAGS_MAX){
+          break;
+        }
+      }
+    }else{
+      for(size_t j = 0; j < field->mmap.length; j++){
+        pfwl_pair_t* pair = &((pfwl_pair_t*) field->mmap.values)[j];
+        const char* tag = db->match(&pair->first.string, &pair->second.string);
+        if(tag){
+          diss_info->l7.tags[diss_info->l7.tags_num++] = tag;
+          if(diss_info->l7.tags_num == PFWL_TAGS_MAX){
+            break;
+          }
+        }
+      }
+      if(diss_info->l7.tags_num == PFWL_TAGS_MAX){
+        break;
+      }
+    }
+  }
+  pfwl_tags_read_unlock(reader);
 }
 
-extern "C" int pfwl_field_tags_load_L7(pfwl_state_t* state, pfwl_field_id_t field, const char* tags_file){
-  if(!state->tags_matchers[field]){
-    state->tags_matchers_num++;
+extern "C" pfwl_field_tags_t* pfwl_field_tags_compile_L7(pfwl_field_id_t field, const char* tags_file){
+  pfwl_field_tags_db* db = pfwl_field_tags_load(field, tags_file);
+  if(!db){
+    return NULL;
+  }
+  pfwl_field_tags_t* tags = new pfwl_field_tags_t;
+  tags->field = field;
+  tags->db = db;
+  return tags;
+}
+
+extern "C" uint8_t pfwl_field_tags_publish_L7(pfwl_state_t* state, pfwl_field_id_t field, pfwl_field_tags_t* tags){
+  if(!tags || tags->field != field){
+    return 1;
+  }
+  pfwl_field_tags_updates_t* updates = static_cast<pfwl_field_tags_updates_t*>(state->tags_updates);
+  std::lock_guard<std::mutex> guard(updates->lock);
+  if(!state->fields_to_extract[field]){
     pfwl_field_add_L7(state, field);
-  }else{
+  }
+  // Rules added and not published yet are overridden.
+  if(updates->pending[field]){
+    updates->pending[field]->release();
+    updates->pending[field] = NULL;
+  }
+  tags->db->acquire();
+  pfwl_field_tags_replace(state, field, tags->db);
+  return 0;
+}
+
+extern "C" void pfwl_field_tags_release_L7(pfwl_field_tags_t* tags){
+  if(tags){
+    tags->db->release();
+    delete tags;
+  }
+}
+
+extern "C" int pfwl_field_tags_load_L7(pfwl_state_t* state, pfwl_field_id_t field, const char* tags_file){
+  pfwl_field_tags_t* tags = pfwl_field_tags_compile_L7(field, tags_file);
+  if(!tags){
     pfwl_field_tags_unload_L7(state, field);
+    return 1;
   }
-  state->tags_matchers[field] = pfwl_field_tags_load_L7(field, tags_file);
-  if(!state->tags_matchers[field] && tags_file){
+  pfwl_field_tags_publish_L7(state, field, tags);
+  pfwl_field_tags_release_L7(tags);
+  return 0;
+}
+
+extern "C" uint8_t pfwl_field_tags_save_L7(pfwl_field_tags_t* tags, const char* db_file){
+  if(!tags){
     return 1;
-  }else{
-    return 0;
   }
+  return tags->db->save(db_file);
+}
+
+extern "C" pfwl_field_tags_t* pfwl_field_tags_map_L7(pfwl_field_id_t field, const char* db_file){
+  pfwl_field_tags_db* db = pfwl_field_tags_db::map(db_file);
+  if(!db){
+    return NULL;
+  }
+  if(db->getType() != pfwl_get_L7_field_type(field)){
+    db->release();
+    return NULL;
+  }
+  pfwl_field_tags_t* tags = new pfwl_field_tags_t;
+  tags->field = field;
+  tags->db = db;
+  return tags;
+}
+
+extern "C" int pfwl_field_tags_load_L7_mmap(pfwl_state_t* state, pfwl_field_id_t field, const char* db_file){
+  pfwl_field_tags_t* tags = pfwl_field_tags_map_L7(field, db_file);
+  if(!tags){
+    pfwl_field_tags_unload_L7(state, field);
+    return 1;
+  }
+  pfwl_field_tags_publish_L7(state, field, tags);
+  pfwl_field_tags_release_L7(tags);
+  return 0;
+}
+
+/**
+ * Returns the database collecting the rules added to a field, copying the
+ * published one if needed. Must be called with the lock held.
+ **/
+static pfwl_field_tags_db* pfwl_field_tags_pending(pfwl_state_t* state, pfwl_field_id_t field){
+  pfwl_field_tags_updates_t* updates = static_cast<pfwl_field_tags_updates_t*>(state->tags_updates);
+  if(!updates->pending[field]){
+    pfwl_field_type_t type = pfwl_get_L7_field_type(field);
+    if(state->tags_matchers[field]){
+      updates->pending[field] = new pfwl_field_tags_db(*static_cast<pfwl_field_tags_db*>(state->tags_matchers[field]));
+    }else if(type == PFWL_FIELD_TYPE_STRING || type == PFWL_FIELD_TYPE_MMAP){
+      updates->pending[field] = new pfwl_field_tags_db(type);
+    }else{
+      return NULL;
+    }
+    // Enabled here, since the rules are then published by whichever
+    // thread dissects the next packet.
+    if(!state->fields_to_extract[field]){
+      pfwl_field_add_L7(state, field);
+    }
+    if(!state->tags_matchers[field]){
+      __atomic_add_fetch(&state->tags_matchers_num, 1, __ATOMIC_RELEASE);
+    }
+  }
+  __atomic_store_n(&updates->dirty, 1, __ATOMIC_RELEASE);
+  return updates->pending[field];
 }
 
 extern "C" void pfwl_field_string_tags_add_L7(pfwl_state_t* state, pfwl_field_id_t field, const char* toMatch, pfwl_field_matching_t matchingType, const char* tag){
-  if(!state->tags_matchers[field]){
-    pfwl_field_tags_load_L7(state, field, NULL);
+  pfwl_field_tags_updates_t* updates = static_cast<pfwl_field_tags_updates_t*>(state->tags_updates);
+  std::lock_guard<std::mutex> guard(updates->lock);
+  pfwl_field_tags_db* db = pfwl_field_tags_pending(state, field);
+  if(db && db->getType() == PFWL_FIELD_TYPE_STRING){
+    db->add(toMatch, matchingType, tag);
   }
-  pfwl_field_string_tags_add_internal(static_cast<pfwl_field_matching_db_t*>(state->tags_matchers[field]), toMatch, matchingType, tag);
 }
 
 extern "C" void pfwl_field_mmap_tags_add_L7(pfwl_state_t* state, pfwl_field_id_t field, const char* key, const char* value, pfwl_field_matching_t matchingType, const char* tag){
-  if(!state->tags_matchers[field]){
-    pfwl_field_tags_load_L7(state, field, NULL);
+  pfwl_field_tags_updates_t* updates = static_cast<pfwl_field_tags_updates_t*>(state->tags_updates);
+  std::lock_guard<std::mutex> guard(updates->lock);
+  pfwl_field_tags_db* db = pfwl_field_tags_pending(state, field);
+  if(db && db->getType() == PFWL_FIELD_TYPE_MMAP){
+    db->add(key, value, matchingType, tag);
   }
-  pfwl_field_mmap_tags_add_internal(static_cast<std::map<std::string, pfwl_field_matching_db_t>*>(state->tags_matchers[field]), key, value, matchingType, tag);
 }
 
 extern "C" void pfwl_field_tags_unload_L7(pfwl_state_t* state, pfwl_field_id_t field){
-  if(state->tags_matchers[field]){
-    state->tags_matchers_num--;
-    delete static_cast<pfwl_field_matching_db_t*>(state->tags_matchers[field]);
-    state->tags_matchers[field] = NULL;
-  }
-}
-
-#if 0
-int main(int argc, char** argv){
-  void* db = pfwl_tags_load(argv[1]);
-  const char* match;
-  match = pfwl_tag_get(db, "googlesyndication.co.uk", strlen("googlesyndication.co.uk"));
-  if(match)
-    std::cout << match << std::endl;
-  match = pfwl_tag_get(db, "www.google.com", strlen("www.google.com"));
-  if(match)
-    std::cout << match << std::endl;
-  match = pfwl_tag_get(db, ".dash.row.aiv-cdn.net");
-  if(match)
-    std::cout << match << std::endl;
-  return 0;
+  pfwl_field_tags_updates_t* updates = static_cast<pfwl_field_tags_updates_t*>(state->tags_updates);
+  std::lock_guard<std::mutex> guard(updates->lock);
+  if(updates->pending[field]){
+    updates->pending[field]->release();
+    updates->pending[field] = NULL;
+  }
+  pfwl_field_tags_replace(state, field, NULL);
 }
-#endif
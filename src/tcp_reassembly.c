@@ -0,0 +1,413 @@
+/*
+ * tcp_reassembly.c
+ *
+ * =========================================================================
+ * Copyright (c) 2012-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+#include <peafowl/flow_table.h>
+#include <peafowl/tcp_reassembly.h>
+#include <peafowl/utils.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PFWL_TCP_REORDERING_WINDOW_MASK (PFWL_TCP_REORDERING_WINDOW - 1)
+
+static inline uint32_t chunk_of(uint32_t seq) {
+  return (seq & PFWL_TCP_REORDERING_WINDOW_MASK) /
+         PFWL_TCP_REORDERING_CHUNK_SIZE;
+}
+
+/** Mask of the chunks containing the bytes in [start, end). **/
+static uint64_t chunks_mask(uint32_t start, uint32_t end) {
+  uint64_t mask = 0;
+  uint32_t first = chunk_of(start);
+  uint32_t last = chunk_of(end - 1);
+  for (uint32_t c = first;; c = (c + 1) % PFWL_TCP_REORDERING_CHUNKS) {
+    mask |= 1ULL << c;
+    if (c == last) {
+      break;
+    }
+  }
+  return mask;
+}
+
+static uint64_t allocated_mask(pfwl_tcp_reassembly_stream_t *stream) {
+  uint64_t mask = 0;
+  for (uint32_t c = 0; c < PFWL_TCP_REORDERING_CHUNKS; c++) {
+    if (stream->chunks[c]) {
+      mask |= 1ULL << c;
+    }
+  }
+  return mask;
+}
+
+static inline pfwl_allocator_t *
+stream_allocator(pfwl_tcp_reassembly_stream_t *stream) {
+  return pfwl_flow_allocator(stream->flow);
+}
+
+static void account(pfwl_tcp_reassembly_partition_t *partition,
+                    pfwl_tcp_reassembly_stream_t *stream, int64_t bytes) {
+  stream->memory += bytes;
+  partition->used += bytes;
+  if (partition->used > partition->high_water) {
+    partition->high_water = partition->used;
+  }
+  __sync_add_and_fetch(&(partition->budget->used), bytes);
+}
+
+static void lru_remove(pfwl_tcp_reassembly_stream_t *stream) {
+  stream->lru_prev->lru_next = stream->lru_next;
+  stream->lru_next->lru_prev = stream->lru_prev;
+}
+
+/** Moves the stream to the tail (most recently updated) of the list. **/
+static void lru_touch(pfwl_tcp_reassembly_partition_t *partition,
+                      pfwl_tcp_reassembly_stream_t *stream) {
+  pfwl_tcp_reassembly_stream_t *sentinel =
+      (pfwl_tcp_reassembly_stream_t *) partition;
+  if (stream->lru_next) {
+    lru_remove(stream);
+  }
+  stream->lru_next = sentinel;
+  stream->lru_prev = sentinel->lru_prev;
+  sentinel->lru_prev->lru_next = stream;
+  sentinel->lru_prev = stream;
+}
+
+void pfwl_tcp_reassembly_partition_init(
+    pfwl_tcp_reassembly_partition_t *partition,
+    pfwl_tcp_reassembly_budget_t *budget) {
+  memset(partition, 0, sizeof(pfwl_tcp_reassembly_partition_t));
+  partition->budget = budget;
+  partition->lru_prev = (pfwl_tcp_reassembly_stream_t *) partition;
+  partition->lru_next = (pfwl_tcp_reassembly_stream_t *) partition;
+}
+
+void pfwl_tcp_reassembly_release(pfwl_tcp_reassembly_stream_t *stream) {
+  pfwl_allocator_t *allocator = stream_allocator(stream);
+  for (uint32_t c = 0; c < PFWL_TCP_REORDERING_CHUNKS; c++) {
+    if (stream->chunks[c]) {
+      pfwl_allocator_free(allocator, PFWL_MEMORY_FRAGMENTS, stream->chunks[c],
+                          PFWL_TCP_REORDERING_CHUNK_SIZE);
+    }
+  }
+  account(stream->partition, stream, -(int64_t) stream->memory);
+  lru_remove(stream);
+  stream->flow->tcp_streams[stream->direction] = NULL;
+  pfwl_allocator_free(allocator, PFWL_MEMORY_FRAGMENTS, stream,
+                      sizeof(pfwl_tcp_reassembly_stream_t));
+}
+
+/**
+ * Drops all the data of a stream to make room for other data. The
+ * connection will resynchronize on the next segment of that direction.
+ **/
+static void evict(pfwl_tcp_reassembly_stream_t *stream) {
+  pfwl_tcp_reassembly_partition_t *partition = stream->partition;
+  if (stream->pending) {
+    /** That data has already been delivered, it is not a loss. **/
+    pfwl_flow_info_private_t *flow = stream->flow;
+    uint8_t direction = stream->direction;
+    pfwl_tcp_reassembly_commit(stream);
+    if (!flow->tcp_streams[direction]) {
+      return;
+    }
+  }
+  for (uint8_t i = 0; i < stream->intervals_num; i++) {
+    partition->dropped_bytes +=
+        stream->intervals[i].end - stream->intervals[i].start;
+  }
+  ++partition->evicted_streams;
+  SET_BIT(stream->flow->tcp_gap, stream->direction);
+  pfwl_tcp_reassembly_release(stream);
+}
+
+static uint32_t flow_memory(pfwl_flow_info_private_t *flow) {
+  uint32_t r = 0;
+  for (uint8_t d = 0; d < 2; d++) {
+    if (flow->tcp_streams[d]) {
+      r += flow->tcp_streams[d]->memory;
+    }
+  }
+  return r;
+}
+
+/**
+ * Makes room for 'bytes' more bytes for the stream of 'flow' in
+ * 'direction', dropping the least recently updated streams if needed.
+ * Only streams of the same partition can be dropped, since the others
+ * are managed by other threads.
+ * @return 0 if there is enough room, 1 otherwise.
+ **/
+static uint8_t reserve(pfwl_tcp_reassembly_partition_t *partition,
+                       pfwl_flow_info_private_t *flow, uint8_t direction,
+                       uint32_t bytes) {
+  pfwl_tcp_reassembly_budget_t *budget = partition->budget;
+  pfwl_tcp_reassembly_stream_t *other = flow->tcp_streams[1 - direction];
+  while (flow_memory(flow) + bytes > budget->per_flow) {
+    if (!other) {
+      return 1;
+    }
+    evict(other);
+    other = NULL;
+  }
+  while (partition->used + bytes > budget->per_partition ||
+         budget->used + bytes > budget->total) {
+    pfwl_tcp_reassembly_stream_t *victim = partition->lru_next;
+    if (victim == flow->tcp_streams[direction]) {
+      victim = victim->lru_next;
+    }
+    if (victim == (pfwl_tcp_reassembly_stream_t *) partition) {
+      return 1;
+    }
+    evict(victim);
+  }
+  return 0;
+}
+
+/** Copies data in the ring, starting from the sequence number seq. **/
+static void ring_write(pfwl_tcp_reassembly_stream_t *stream, uint32_t seq,
+                       const unsigned char *data, uint32_t length) {
+  while (length) {
+    uint32_t offset = seq % PFWL_TCP_REORDERING_CHUNK_SIZE;
+    uint32_t n = PFWL_TCP_REORDERING_CHUNK_SIZE - offset;
+    if (n > length) {
+      n = length;
+    }
+    memcpy(stream->chunks[chunk_of(seq)] + offset, data, n);
+    seq += n;
+    data += n;
+    length -= n;
+  }
+}
+
+/** Releases the chunks not containing any buffered data. **/
+static void release_unused_chunks(pfwl_tcp_reassembly_stream_t *stream) {
+  uint64_t used = 0;
+  for (uint8_t i = 0; i < stream->intervals_num; i++) {
+    used |= chunks_mask(stream->intervals[i].start, stream->intervals[i].end);
+  }
+  uint64_t unused = allocated_mask(stream) & ~used;
+  while (unused) {
+    uint32_t c = __builtin_ctzll(unused);
+    pfwl_allocator_free(stream_allocator(stream), PFWL_MEMORY_FRAGMENTS,
+                        stream->chunks[c], PFWL_TCP_REORDERING_CHUNK_SIZE);
+    stream->chunks[c] = NULL;
+    account(stream->partition, stream,
+            -(int64_t) PFWL_TCP_REORDERING_CHUNK_SIZE);
+    unused &= unused - 1;
+  }
+}
+
+/**
+ * Index of the first interval ending at or after 'rel' (binary search).
+ * Positions are relative to 'base'.
+ **/
+static uint8_t find_interval(pfwl_tcp_reassembly_stream_t *stream,
+                             uint32_t base, uint32_t rel) {
+  uint8_t low = 0, high = stream->intervals_num;
+  while (low < high) {
+    uint8_t mid = (low + high) / 2;
+    if (stream->intervals[mid].end - base < rel) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+uint8_t pfwl_tcp_reassembly_insert(pfwl_tcp_reassembly_partition_t *partition,
+                                   pfwl_flow_info_private_t *flow,
+                                   uint8_t direction, uint32_t expected_seq,
+                                   uint32_t seq, const unsigned char *data,
+                                   uint32_t length, uint8_t fin) {
+  /** All the data must lie in the window starting at the expected chunk. **/
+  uint32_t base = expected_seq - expected_seq % PFWL_TCP_REORDERING_CHUNK_SIZE;
+  uint32_t start = seq - base, end = start + length;
+  pfwl_tcp_reassembly_stream_t *stream = flow->tcp_streams[direction];
+  uint32_t needed = 0;
+  uint8_t first = 0, last = 0;
+
+  if (stream && stream->pending) {
+    pfwl_tcp_reassembly_commit(stream);
+    stream = flow->tcp_streams[direction];
+  }
+
+  if (unlikely(!partition || end > PFWL_TCP_REORDERING_WINDOW)) {
+    goto drop;
+  }
+
+  if (length) {
+    if (stream) {
+      /** Intervals [first, last) overlap or touch the new data. **/
+      first = find_interval(stream, base, start);
+      for (last = first; last < stream->intervals_num &&
+                         stream->intervals[last].start - base <= end;
+           last++)
+        ;
+      if (first == last &&
+          stream->intervals_num == PFWL_TCP_REORDERING_MAX_HOLES) {
+        goto drop;
+      }
+      if (last - first == 1 && stream->intervals[first].start - base <= start &&
+          stream->intervals[first].end - base >= end) {
+        /** Already stored. **/
+        goto stored;
+      }
+    }
+    uint64_t missing =
+        chunks_mask(seq, seq + length) & ~(stream ? allocated_mask(stream) : 0);
+    needed = __builtin_popcountll(missing) * PFWL_TCP_REORDERING_CHUNK_SIZE;
+  }
+  if (!stream) {
+    needed += sizeof(pfwl_tcp_reassembly_stream_t);
+  }
+  if (reserve(partition, flow, direction, needed)) {
+    goto drop;
+  }
+
+  if (!stream) {
+    stream = (pfwl_tcp_reassembly_stream_t *) pfwl_allocator_alloc(
+        pfwl_flow_allocator(flow), PFWL_MEMORY_FRAGMENTS,
+        sizeof(pfwl_tcp_reassembly_stream_t));
+    if (unlikely(!stream)) {
+      goto drop;
+    }
+    memset(stream, 0, sizeof(pfwl_tcp_reassembly_stream_t));
+    stream->partition = partition;
+    stream->flow = flow;
+    stream->direction = direction;
+    flow->tcp_streams[direction] = stream;
+    account(partition, stream, sizeof(pfwl_tcp_reassembly_stream_t));
+  }
+  lru_touch(partition, stream);
+
+  if (length) {
+    uint64_t missing = chunks_mask(seq, seq + length) & ~allocated_mask(stream);
+    while (missing) {
+      uint32_t c = __builtin_ctzll(missing);
+      stream->chunks[c] = (unsigned char *) pfwl_allocator_alloc(
+          pfwl_flow_allocator(flow), PFWL_MEMORY_FRAGMENTS,
+          PFWL_TCP_REORDERING_CHUNK_SIZE);
+      if (unlikely(!stream->chunks[c])) {
+        release_unused_chunks(stream);
+        goto drop;
+      }
+      account(partition, stream, PFWL_TCP_REORDERING_CHUNK_SIZE);
+      missing &= missing - 1;
+    }
+
+    /** Only copy the bytes we do not have yet, and merge the intervals. **/
+    uint32_t cursor = start;
+    for (uint8_t i = first; i < last; i++) {
+      uint32_t s = stream->intervals[i].start - base;
+      if (s > cursor) {
+        ring_write(stream, base + cursor, data + (cursor - start), s - cursor);
+      }
+      if (stream->intervals[i].end - base > cursor) {
+        cursor = stream->intervals[i].end - base;
+      }
+    }
+    if (cursor < end) {
+      ring_write(stream, base + cursor, data + (cursor - start), end - cursor);
+    }
+
+    pfwl_tcp_reassembly_interval_t merged;
+    merged.start = seq;
+    merged.end = seq + length;
+    if (first < last) {
+      if (stream->intervals[first].start - base < start) {
+        merged.start = stream->intervals[first].start;
+      }
+      if (stream->intervals[last - 1].end - base > end) {
+        merged.end = stream->intervals[last - 1].end;
+      }
+    }
+    memmove(&(stream->intervals[first + 1]), &(stream->intervals[last]),
+            (stream->intervals_num - last) *
+                sizeof(pfwl_tcp_reassembly_interval_t));
+    stream->intervals[first] = merged;
+    stream->intervals_num = stream->intervals_num - (last - first) + 1;
+  }
+
+stored:
+  if (fin) {
+    stream->fin = 1;
+    stream->fin_seq = seq + length;
+  }
+  return 0;
+
+drop:
+  if (partition) {
+    ++partition->dropped_segments;
+    partition->dropped_bytes += length;
+  }
+  return 1;
+}
+
+uint32_t pfwl_tcp_reassembly_spans(pfwl_tcp_reassembly_stream_t *stream,
+                                   const unsigned char *data, uint32_t length,
+                                   uint8_t *fin) {
+  pfwl_tcp_reassembly_interval_t interval = stream->intervals[0];
+  uint8_t n = 0;
+  if (length) {
+    stream->spans[n].data = data;
+    stream->spans[n].length = length;
+    ++n;
+  }
+  for (uint32_t seq = interval.start; seq != interval.end;) {
+    uint32_t offset = seq % PFWL_TCP_REORDERING_CHUNK_SIZE;
+    uint32_t piece = PFWL_TCP_REORDERING_CHUNK_SIZE - offset;
+    if (piece > interval.end - seq) {
+      piece = interval.end - seq;
+    }
+    stream->spans[n].data = stream->chunks[chunk_of(seq)] + offset;
+    stream->spans[n].length = piece;
+    ++n;
+    seq += piece;
+  }
+  stream->spans_num = n;
+  stream->pending = 1;
+  *fin = stream->fin && stream->fin_seq == interval.end;
+  return length + interval.end - interval.start;
+}
+
+void pfwl_tcp_reassembly_commit(pfwl_tcp_reassembly_stream_t *stream) {
+  if (!stream->pending) {
+    return;
+  }
+  stream->pending = 0;
+  if (stream->fin && stream->fin_seq == stream->intervals[0].end) {
+    stream->fin = 0;
+  }
+  --stream->intervals_num;
+  memmove(&(stream->intervals[0]), &(stream->intervals[1]),
+          stream->intervals_num * sizeof(pfwl_tcp_reassembly_interval_t));
+  if (!stream->intervals_num && !stream->fin) {
+    pfwl_tcp_reassembly_release(stream);
+  } else {
+    release_unused_chunks(stream);
+  }
+}
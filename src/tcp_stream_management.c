@@ -26,6 +26,7 @@
  */
 #include <peafowl/flow_table.h>
 #include <peafowl/reassembly.h>
+#include <peafowl/tcp_reassembly.h>
 #include <peafowl/tcp_stream_management.h>
 #include <peafowl/utils.h>
 
@@ -48,76 +49,37 @@
 void pfwl_reordering_tcp_delete_all_fragments(
     pfwl_flow_info_private_t *victim) {
   if (victim) {
-    pfwl_reassembly_fragment_t *frag = victim->segments[0], *temp_frag;
-
-    while (frag) {
-      temp_frag = frag->next;
-      free(frag->ptr);
-      free(frag);
-      frag = temp_frag;
-    }
-
-    frag = victim->segments[1];
-    while (frag) {
-      temp_frag = frag->next;
-      free(frag->ptr);
-      free(frag);
-      frag = temp_frag;
+    for (uint8_t d = 0; d < 2; d++) {
+      if (victim->tcp_streams[d]) {
+        pfwl_tcp_reassembly_release(victim->tcp_streams[d]);
+      }
     }
   }
 }
 
-#ifndef PFWL_DEBUG
-static
-#endif
-    uint32_t
-    pfwl_reordering_tcp_length_contiguous_segments(
-        pfwl_reassembly_fragment_t *head) {
-  uint32_t r = 0;
-  uint32_t last_end = head->offset;
-  while (head) {
-    if (head->offset != last_end) {
-      return r;
+const unsigned char *
+pfwl_reordering_tcp_contiguous(pfwl_dissection_info_t *dissection_info,
+                               pfwl_flow_info_private_t *tracking) {
+  size_t length = dissection_info->l4.resegmented_pkt_len;
+  if (length > tracking->tcp_rebuilt_buffer_size) {
+    unsigned char *buffer = (unsigned char *) pfwl_allocator_realloc(
+        pfwl_flow_allocator(tracking), PFWL_MEMORY_BUFFERS,
+        tracking->tcp_rebuilt_buffer, tracking->tcp_rebuilt_buffer_size,
+        length);
+    if (unlikely(!buffer)) {
+      return NULL;
     }
-    r += pfwl_reassembly_fragment_length(head->offset, head->end);
-    if (head->tcp_fin) {
-      ++r;
-    }
-    last_end = head->end;
-    head = head->next;
+    tracking->tcp_rebuilt_buffer = buffer;
+    tracking->tcp_rebuilt_buffer_size = length;
   }
-  return r;
-}
-
-/**
- * Group a certain number of contiguous segments copying them in
- * where and freeing the old structures used to store them.
- */
-#ifndef PFWL_DEBUG
-static
-#endif
-    void
-    pfwl_reordering_tcp_group_contiguous_segments(
-        pfwl_reassembly_fragment_t **head, unsigned char **where) {
-  /* Copy the data portions of all segments into the new buffer. */
-  uint32_t offset = 0, last_end = (*head)->offset;
-  pfwl_reassembly_fragment_t *fragment = *head;
-  pfwl_reassembly_fragment_t *tmp;
-  while (fragment != NULL && fragment->offset == last_end) {
-    uint32_t fragment_length =
-        pfwl_reassembly_fragment_length(fragment->offset, fragment->end);
-    if (fragment_length != 0)
-      memcpy(((*where) + offset), fragment->ptr, fragment_length);
-    offset += fragment_length;
-    tmp = fragment->next;
-    last_end = fragment->end;
-    free(fragment->ptr);
-    free(fragment);
-    fragment = tmp;
+  unsigned char *where = tracking->tcp_rebuilt_buffer;
+  for (size_t i = 0; i < dissection_info->l4.payload_spans_num; i++) {
+    memcpy(where, dissection_info->l4.payload_spans[i].data,
+           dissection_info->l4.payload_spans[i].length);
+    where += dissection_info->l4.payload_spans[i].length;
   }
-  *head = fragment;
-  if (fragment)
-    fragment->prev = NULL;
+  dissection_info->l4.resegmented_pkt = tracking->tcp_rebuilt_buffer;
+  return tracking->tcp_rebuilt_buffer;
 }
 
 /**
@@ -167,34 +129,57 @@ static
   if (tcph->rst == 1) {
     tracking->seen_rst = 1;
   }
-  /**
-   * We pass a dummy variable because the memory bound on TCP
-   * reordering is not implemented at the moment.
-   **/
-  uint32_t dummy;
-  pfwl_reassembly_fragment_t *frag;
+  pfwl_direction_t direction = dissection_info->l4.direction;
 
   if (dissection_info->l4.payload_length == 0) {
     debug_print("%s\n", "The segment has no payload");
-    if (tcph->fin == 1 &&
-        !BIT_IS_SET(tracking->seen_fin, dissection_info->l4.direction) &&
-        (frag = pfwl_reassembly_insert_fragment(
-             &(tracking->segments[dissection_info->l4.direction]),
-             pkt + dissection_info->l4.length, received_seq_num, end, &dummy,
-             &dummy))) {
-      frag->tcp_fin = 1;
-      SET_BIT(tracking->seen_fin, dissection_info->l4.direction);
+    if (tcph->fin != 1 || BIT_IS_SET(tracking->seen_fin, direction)) {
+      return;
     }
+  }
 
-    return;
+  if (!pfwl_tcp_reassembly_insert(
+          pfwl_flow_tcp_reassembly(tracking), tracking, direction,
+          tracking->expected_seq_num[direction], received_seq_num,
+          pkt + dissection_info->l4.length, end - received_seq_num,
+          tcph->fin) &&
+      tcph->fin == 1) {
+    SET_BIT(tracking->seen_fin, direction);
   }
+}
 
-  frag = pfwl_reassembly_insert_fragment(
-      &(tracking->segments[dissection_info->l4.direction]),
-      pkt + dissection_info->l4.length, received_seq_num, end, &dummy, &dummy);
-  if (frag && tcph->fin == 1) {
-    frag->tcp_fin = 1;
-    SET_BIT(tracking->seen_fin, dissection_info->l4.direction);
+/**
+ * Checks the acknowledgment number of a segment against the guess made
+ * when the connection was picked up for the other direction. Once the
+ * peer acknowledges the data preceding the pickup point, no data sent
+ * before it is expected anymore. If it acknowledges more data than
+ * we saw, the missing data will not be retransmitted and the direction
+ * is resynchronized on its next segment.
+ * @param tcph The TCP header of the segment.
+ * @param tracking A pointer to the structure containing the
+ *                 informations about the TCP connection.
+ * @param direction The direction of the segment.
+ */
+static void pfwl_reordering_tcp_check_pickup(const struct tcphdr *tcph,
+                                             pfwl_flow_info_private_t *tracking,
+                                             uint8_t direction) {
+  uint8_t other = 1 - direction;
+  if (!tcph->ack || !BIT_IS_SET(tracking->tcp_speculative, other) ||
+      !BIT_IS_SET(tracking->first_packet_arrived, other)) {
+    return;
+  }
+  uint32_t ack = ntohl(tcph->ack_seq);
+  if (pfwl_reassembly_before(ack, tracking->tcp_pickup_seq[other])) {
+    return;
+  }
+  debug_print("Pickup confirmed for direction: %d\n", other);
+  CLEAR_BIT(tracking->tcp_speculative, other);
+  if (pfwl_reassembly_after(ack, tracking->expected_seq_num[other])) {
+    debug_print("%s\n", "Acknowledged data never seen, resynchronizing");
+    if (tracking->tcp_streams[other]) {
+      pfwl_tcp_reassembly_release(tracking->tcp_streams[other]);
+    }
+    SET_BIT(tracking->tcp_gap, other);
   }
 }
 
@@ -213,7 +198,7 @@ static
  * 		   is the data_length of the application data. If the data
  * 		   fills an hole in the sequence numbers space, the field
  * 		   'status' is one, 'data' will contain a pointer to the
- * 		   status segment (it must be freed after using it) and
+ * 		   status segment (owned by the flow) and
  * 		   'data_length' will contain the data_length of the new
  * 		   reordered segment (data part only).
  */
@@ -226,7 +211,8 @@ static
         pfwl_flow_info_private_t *tracking) {
 
   pfwl_tcp_reordering_reordered_segment_t to_return;
-  to_return.data = NULL;
+  to_return.spans = NULL;
+  to_return.spans_num = 0;
   to_return.data_length = 0;
   to_return.connection_terminated = 0;
   to_return.status = PFWL_TCP_REORDERING_STATUS_IN_ORDER;
@@ -239,6 +225,31 @@ static
   /** Automatically wrapped when exceed the 32bit limit. **/
   uint32_t end = received_seq_num + dissection_info->l4.payload_length;
 
+  if (BIT_IS_SET(tracking->tcp_gap, direction)) {
+    /**
+     * Out of order data has been dropped because of the memory limits
+     * (or the connection has just been picked up), resynchronize on this
+     * segment.
+     **/
+    debug_print("%s\n", "Resynchronizing after dropped data");
+    CLEAR_BIT(tracking->tcp_gap, direction);
+    tracking->expected_seq_num[direction] = expected_seq_num =
+        received_seq_num + tcph->syn;
+    if (BIT_IS_SET(tracking->tcp_speculative, direction) &&
+        !BIT_IS_SET(tracking->first_packet_arrived, direction)) {
+      SET_BIT(tracking->first_packet_arrived, direction);
+      tracking->tcp_pickup_seq[direction] = expected_seq_num;
+    }
+    if (tcph->syn) {
+      /** The SYN takes a sequence number but carries no data. **/
+      return to_return;
+    }
+  }
+
+  if (tracking->tcp_speculative) {
+    pfwl_reordering_tcp_check_pickup(tcph, tracking, direction);
+  }
+
   debug_print("Direction: %d\n", direction);
   debug_print("Received Seq Num: %" PRIu32 " Expected: %" PRIu32 "\n",
               received_seq_num,
@@ -263,8 +274,9 @@ static
      * we can delete the flow informations.
      **/
     if ((BIT_IS_SET(tracking->seen_fin, 0) &&
-         BIT_IS_SET(tracking->seen_fin, 1) && tracking->segments[0] == NULL &&
-         tracking->segments[1] == NULL)) {
+         BIT_IS_SET(tracking->seen_fin, 1) &&
+         tracking->tcp_streams[0] == NULL &&
+         tracking->tcp_streams[1] == NULL)) {
       if (BIT_IS_SET(tracking->seen_fin_ack, 0)) {
         to_return.connection_terminated = 1;
       } else {
@@ -291,36 +303,37 @@ static
      * If there was out of order segments and this segment fills an
      * hole, then group the segment together to make a bigger ordered
      * segment. We check offset<=end because the received fragment
-     * could overlap with the pool_head of the segments.
+     * could overlap with the first out of order segment.
      **/
-    if (tracking->segments[direction] &&
-        tracking->segments[direction]->offset <= end) {
-      uint32_t overlap =
-          end - tracking->segments[dissection_info->l4.direction]->offset;
+    pfwl_tcp_reassembly_stream_t *stream = tracking->tcp_streams[direction];
+    if (stream && stream->intervals_num &&
+        pfwl_reassembly_before_or_equal(stream->intervals[0].start, end)) {
+      uint32_t overlap = end - stream->intervals[0].start;
       uint32_t pkt_length = dissection_info->l4.payload_length - overlap;
+      uint8_t fin = 0;
 
       debug_print("%s\n", "The segment fills an 'hole'");
 
-      uint32_t new_length =
-          pfwl_reordering_tcp_length_contiguous_segments(
-              tracking->segments[dissection_info->l4.direction]) +
-          pkt_length;
-      unsigned char *buffer =
-          (unsigned char *) malloc(sizeof(char) * (new_length));
-      assert(buffer);
-
-      memcpy(buffer, pkt + dissection_info->l4.length, pkt_length);
-      unsigned char *where = buffer + pkt_length;
-      pfwl_reordering_tcp_group_contiguous_segments(
-          &(tracking->segments[dissection_info->l4.direction]), &where);
-
-      to_return.data = buffer;
-      to_return.data_length = new_length;
+      /**
+       * The data is not copied, it stays in the packet and in the stream
+       * until the next segment of this flow.
+       **/
+      to_return.data_length = pfwl_tcp_reassembly_spans(
+          stream, pkt + dissection_info->l4.length, pkt_length, &fin);
+      to_return.spans = stream->spans;
+      to_return.spans_num = stream->spans_num;
       to_return.status = PFWL_TCP_REORDERING_STATUS_REBUILT;
 
       /**Update expected sequence number. **/
-      tracking->expected_seq_num[dissection_info->l4.direction] =
-          received_seq_num + new_length;
+      tracking->expected_seq_num[direction] =
+          received_seq_num + to_return.data_length + fin;
+    } else if (stream && !stream->intervals_num && stream->fin &&
+               pfwl_reassembly_before_or_equal(stream->fin_seq, end)) {
+      /** The out of order FIN is now in order. **/
+      if (stream->fin_seq == end) {
+        ++tracking->expected_seq_num[direction];
+      }
+      pfwl_tcp_reassembly_release(stream);
     } else {
       debug_print("%s\n", "The segment doesn't fill an 'hole'");
     }
@@ -335,12 +348,34 @@ static
 
     if (pfwl_reassembly_fragment_length(expected_seq_num, received_seq_num) >
         PFWL_TCP_MAX_OUT_OF_ORDER_BYTES) {
+      pfwl_tcp_reassembly_partition_t *partition =
+          pfwl_flow_tcp_reassembly(tracking);
+      if (partition) {
+        ++partition->dropped_segments;
+        partition->dropped_bytes += dissection_info->l4.payload_length;
+      }
       return to_return;
     } else {
       pfwl_reordering_tcp_analyze_out_of_order(pkt, dissection_info, tracking,
                                                received_seq_num);
     }
     return to_return;
+  } else if (BIT_IS_SET(tracking->tcp_speculative, direction) &&
+             dissection_info->l4.payload_length &&
+             pfwl_reassembly_before(received_seq_num,
+                                    tracking->tcp_pickup_seq[direction]) &&
+             pfwl_reassembly_fragment_length(
+                 received_seq_num, tracking->tcp_pickup_seq[direction]) <=
+                 PFWL_TCP_MAX_OUT_OF_ORDER_BYTES) {
+    /**
+     * Sent before the segment on which the connection was picked up
+     * and arrived later, thus never inspected. It is inspected as it
+     * is, without changing the expected sequence number.
+     **/
+    debug_print("Received segment preceding the pickup. SeqNum: %" PRIu32
+                "\n",
+                received_seq_num);
+    return to_return;
   } else {
     debug_print("Received old segment. SeqNum: %" PRIu32 "\n",
                 received_seq_num);
@@ -377,15 +412,23 @@ uint8_t pfwl_reordering_tcp_track_connection_light(
 pfwl_tcp_reordering_reordered_segment_t
 pfwl_reordering_tcp_track_connection(pfwl_dissection_info_t *dissection_info,
                                      pfwl_flow_info_private_t *tracking,
-                                     const unsigned char *pkt) {
+                                     const unsigned char *pkt, uint8_t pickup) {
   pfwl_tcp_reordering_reordered_segment_t to_return;
-  to_return.data = NULL;
+  to_return.spans = NULL;
+  to_return.spans_num = 0;
   to_return.data_length = 0;
   to_return.connection_terminated = 0;
   to_return.status = PFWL_TCP_REORDERING_STATUS_IN_ORDER;
 
   struct tcphdr *tcph = (struct tcphdr *) pkt;
 
+  /** Removes the data delivered with the previous segment, if any. **/
+  for (uint8_t d = 0; d < 2; d++) {
+    if (tracking->tcp_streams[d]) {
+      pfwl_tcp_reassembly_commit(tracking->tcp_streams[d]);
+    }
+  }
+
   if (tracking->seen_ack) {
     debug_print("%s\n", "Connection already established, check "
                         "sequence numbers");
@@ -433,6 +476,22 @@ pfwl_reordering_tcp_track_connection(pfwl_dissection_info_t *dissection_info,
      */
     return pfwl_reordering_tcp_analyze_sequence_numbers(pkt, dissection_info,
                                                         tracking);
+  } else if (pickup) {
+    /**
+     * Received a segment of a connection from which we didn't see the
+     * handshake. Instead of waiting to be hooked, we guess that the first
+     * segment of each direction is in order, so that it can be inspected
+     * immediately. The guess is checked (and the state repaired) by
+     * pfwl_reordering_tcp_analyze_sequence_numbers while the directions
+     * are speculative. As for hooked connections, seen_syn is left to 0.
+     */
+    debug_print("%s\n", "Picking up the connection.");
+    tracking->seen_ack = 1;
+    tracking->tcp_gap = 3;
+    tracking->tcp_speculative = 3;
+    tracking->first_packet_arrived = 0;
+    return pfwl_reordering_tcp_analyze_sequence_numbers(pkt, dissection_info,
+                                                        tracking);
   } else {
     /**
      *  Received segments from connections from which we didn't see
@@ -27,6 +27,8 @@
 
 #include <ff/mapping_utils.hpp>
 #include <peafowl/flow_table.h>
+#include <peafowl/inspectors/inspectors.h>
+#include <peafowl/reassembly.h>
 #include <peafowl/worker.hpp>
 
 #include <math.h>
@@ -40,6 +42,8 @@
 
 namespace dpi {
 
+char pfwl_L7_worker_sleep_task;
+
 #ifndef PFWL_DEBUG
 static inline
 #endif
@@ -59,6 +63,8 @@ static inline
   r = new mc_pfwl_task_t;
 #endif
 #endif
+  /** The dissection infos are reused across packets, so they start zeroed. **/
+  memset(r, 0, sizeof(mc_pfwl_task_t));
   return r;
 }
 
@@ -78,17 +84,79 @@ static inline
 #endif
 }
 
+double pfwl_ticks_per_us() {
+  static double ticks_per_us = 0;
+  if (!ticks_per_us) {
+    unsigned long start_ns = getns();
+    ticks start = getticks();
+    sleepns(1000000);
+    ticks_per_us = (getticks() - start) * 1000.0 / (getns() - start_ns);
+  }
+  return ticks_per_us;
+}
+
+static inline void pfwl_stats_increment(uint64_t *counter) {
+  __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+static inline uint pfwl_histogram_bucket(uint64_t value) {
+  uint bucket = 63 - __builtin_clzll(value | 1);
+  return bucket < MC_PFWL_BATCHING_HISTOGRAM_BUCKETS
+             ? bucket
+             : MC_PFWL_BATCHING_HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * Accounts a batch of 'size' packets being sent, and adapts the grain of
+ * its destination: a batch filled within the latency bound means that
+ * packets arrive fast enough to fill a larger one, a batch sent because of
+ * the bound that they should not wait for as many packets.
+ **/
+static inline void pfwl_batch_sent(pfwl_batching_t *batching,
+                                   pfwl_batch_t *batch, uint32_t size,
+                                   ticks now, uint8_t timeout) {
+  mc_pfwl_batching_stats_t *stats = &(batching->stats);
+  pfwl_stats_increment(&stats->batches);
+  pfwl_stats_increment(&stats->sizes[pfwl_histogram_bucket(size)]);
+  uint64_t waited_us =
+      size > 1 ? (now - batch->opened) / batching->ticks_per_us : 0;
+  pfwl_stats_increment(&stats->latencies[pfwl_histogram_bucket(waited_us)]);
+  if (timeout) {
+    pfwl_stats_increment(&stats->timeouts);
+    if (batch->grain > 1) {
+      batch->grain /= 2;
+    }
+  } else if (size == batch->grain && batch->grain < batching->max_grain) {
+    batch->grain = std::min(batch->grain * 2, batching->max_grain);
+  }
+}
+
 /*****************************************************/
 /*                      L3_L4 nodes.                 */
 /*****************************************************/
-pfwl_L3_L4_emitter::pfwl_L3_L4_emitter(pfwl_state_t *state,
-                                       mc_pfwl_packet_reading_callback **cb,
-                                       void **user_data, uint8_t *terminating,
-                                       uint16_t proc_id,
-                                       ff::SWSR_Ptr_Buffer *tasks_pool)
+pfwl_L3_L4_emitter::pfwl_L3_L4_emitter(
+    pfwl_state_t *state, mc_pfwl_packet_reading_callback **cb,
+    void **user_data, uint8_t *terminating, uint16_t proc_id,
+    ff::SWSR_Ptr_Buffer *tasks_pool, pfwl_batching_t *batching,
+    pfwl_L3_L4_scheduler *lb, uint16_t num_L3_L4_workers)
     : state(state), cb(cb), user_data(user_data), terminating(terminating),
-      proc_id(proc_id), tasks_pool(tasks_pool), initialized(0) {
-  ;
+      proc_id(proc_id), tasks_pool(tasks_pool), initialized(0), lb(lb),
+      num_L3_L4_workers(num_L3_L4_workers), partially_filled(NULL),
+      partially_filled_sizes(NULL), batching(batching),
+      deadline(PFWL_BATCHING_NO_DEADLINE), last_tick(0), eos(0) {
+  batches = new pfwl_batch_t[num_L3_L4_workers];
+  for (uint i = 0; i < num_L3_L4_workers; i++) {
+    batches[i].grain = 1;
+    batches[i].opened = 0;
+  }
+  if (lb) {
+    partially_filled = new mc_pfwl_task_t *[num_L3_L4_workers];
+    partially_filled_sizes = new uint[num_L3_L4_workers];
+    for (uint i = 0; i < num_L3_L4_workers; i++) {
+      partially_filled[i] = NULL;
+      partially_filled_sizes[i] = 0;
+    }
+  }
 }
 
 int pfwl_L3_L4_emitter::svc_init() {
@@ -108,10 +176,12 @@ int pfwl_L3_L4_emitter::svc_init() {
   return 0;
 }
 
-void *pfwl_L3_L4_emitter::svc(void *task) {
-  mc_pfwl_packet_reading_result_t packet;
+#ifndef PFWL_DEBUG
+static inline
+#endif
+    mc_pfwl_task_t *
+    pfwl_get_task(ff::SWSR_Ptr_Buffer *tasks_pool) {
   mc_pfwl_task_t *r = NULL;
-
 #if PFWL_MULTICORE_USE_TASKS_POOL
   if (!tasks_pool->empty()) {
     tasks_pool->pop((void **) &r);
@@ -121,15 +191,159 @@ void *pfwl_L3_L4_emitter::svc(void *task) {
 #else
   r = pfwl_allocate_task();
 #endif
+  return r;
+}
+
+void pfwl_L3_L4_emitter::send_batch(uint16_t worker, ticks now,
+                                    uint8_t timeout) {
+  mc_pfwl_task_t *r = partially_filled[worker];
+  r->size = partially_filled_sizes[worker];
+  pfwl_batch_sent(batching, &(batches[worker]), r->size, now, timeout);
+  lb->set_victim(worker);
+  while (ff_send_out((void *) r, -1, SPINTICKS) == false)
+    ;
+  partially_filled[worker] = NULL;
+  partially_filled_sizes[worker] = 0;
+  last_tick = now;
+}
+
+void pfwl_L3_L4_emitter::expire(ticks now) {
+  deadline = PFWL_BATCHING_NO_DEADLINE;
+  for (uint i = 0; i < num_L3_L4_workers; i++) {
+    if (!partially_filled_sizes[i]) {
+      continue;
+    }
+    if (now - batches[i].opened >= batching->max_latency) {
+      send_batch(i, now, 1);
+    } else {
+      deadline = std::min(deadline, batches[i].opened + batching->max_latency);
+    }
+  }
+}
+
+/**
+ * Called when the reading callback has no packet. If nothing has been sent
+ * for half of the maximum latency, returns an empty task, so that the
+ * following stages check the deadlines of their batches even if no other
+ * packet arrives.
+ **/
+mc_pfwl_task_t *pfwl_L3_L4_emitter::tick(ticks now) {
+  if (now - last_tick < batching->max_latency / 2) {
+    return NULL;
+  }
+  last_tick = now;
+  mc_pfwl_task_t *r = pfwl_get_task(tasks_pool);
+  r->size = 0;
+  return r;
+}
+
+/**
+ * Appends each packet to the task of the L3_L4 worker which must process
+ * it, and sends the task to the worker when it is full. All the fragments
+ * of a datagram are sent to the same worker, which is the only one
+ * accessing its shard of the defragmentation state.
+ **/
+void *pfwl_L3_L4_emitter::steer() {
+  mc_pfwl_packet_reading_result_t packet = (*(*cb))(*user_data);
+  ticks now = getticks();
+  if (packet.pkt == MC_PFWL_NO_PACKET) {
+    if (now >= deadline) {
+      expire(now);
+    }
+    mc_pfwl_task_t *r = tick(now);
+    if (r) {
+      lb->set_victim(0);
+      while (ff_send_out((void *) r, -1, SPINTICKS) == false)
+        ;
+    }
+    return (void *) ff::FF_GO_ON;
+  }
+  if (unlikely(packet.pkt == NULL)) {
+    worker_debug_print("%s\n", "[worker.cpp]: No more task to "
+                               "process, terminating.");
+    *terminating = 1;
+    for (uint i = 0; i < num_L3_L4_workers; i++) {
+      if (partially_filled_sizes[i]) {
+        send_batch(i, now, 0);
+      }
+    }
+    return (void *) ff::FF_EOS;
+  }
+
+  uint16_t worker =
+      pfwl_reassembly_ip_shard(packet.pkt, packet.length, num_L3_L4_workers);
+  mc_pfwl_task_t *r = partially_filled[worker];
+  if (r == NULL) {
+    r = pfwl_get_task(tasks_pool);
+    partially_filled[worker] = r;
+  }
+  uint pfs = partially_filled_sizes[worker];
+  r->input_output_task_t.L3_L4_input_task_t[pfs].user_pointer =
+      packet.user_pointer;
+  r->input_output_task_t.L3_L4_input_task_t[pfs].current_time =
+      packet.current_time;
+  r->input_output_task_t.L3_L4_input_task_t[pfs].length = packet.length;
+  r->input_output_task_t.L3_L4_input_task_t[pfs].pkt = packet.pkt;
+  partially_filled_sizes[worker] = pfs + 1;
+  if (!pfs) {
+    batches[worker].opened = now;
+    if (deadline == PFWL_BATCHING_NO_DEADLINE) {
+      deadline = now + batching->max_latency;
+    }
+  }
+  if (pfs + 1 == batches[worker].grain) {
+    send_batch(worker, now, 0);
+  }
+
+  if (unlikely(now >= deadline)) {
+    expire(now);
+  }
+  return (void *) ff::FF_GO_ON;
+}
+
+/**
+ * Reads packets until the task is full, or its first packet waited for the
+ * maximum latency.
+ **/
+void *pfwl_L3_L4_emitter::svc(void *task) {
+  mc_pfwl_packet_reading_result_t packet;
+  mc_pfwl_task_t *r = NULL;
+
+  if (lb) {
+    return steer();
+  }
+  if (unlikely(eos)) {
+    return (void *) ff::FF_EOS;
+  }
 
-  for (uint i = 0; i < PFWL_MULTICORE_DEFAULT_GRAIN_SIZE; i++) {
+  pfwl_batch_t *batch = &(batches[0]);
+  uint8_t timeout = 0;
+  ticks now = 0;
+  uint i = 0;
+  while (i < batch->grain && !timeout) {
     packet = (*(*cb))(*user_data);
+    if (packet.pkt == MC_PFWL_NO_PACKET) {
+      now = getticks();
+      if (!i) {
+        r = tick(now);
+        return r ? (void *) r : (void *) ff::FF_GO_ON;
+      }
+      timeout = now - batch->opened >= batching->max_latency;
+      continue;
+    }
     if (unlikely(packet.pkt == NULL)) {
       worker_debug_print("%s\n", "[worker.cpp]: No more task to "
                                  "process, terminating.");
       *terminating = 1;
-      pfwl_free_task(r);
-      return (void *) ff::FF_EOS;
+      if (!i) {
+        return (void *) ff::FF_EOS;
+      }
+      // The packets already read are returned first.
+      eos = 1;
+      break;
+    }
+    if (!i) {
+      r = pfwl_get_task(tasks_pool);
     }
 
     r->input_output_task_t.L3_L4_input_task_t[i].user_pointer =
@@ -142,53 +356,68 @@ void *pfwl_L3_L4_emitter::svc(void *task) {
     __builtin_prefetch(&(r->input_output_task_t.L3_L4_input_task_t[i + 5]), 1,
                        0);
 #endif
+    // With a grain of 1 the packets never wait.
+    if (batch->grain > 1) {
+      now = getticks();
+      if (!i) {
+        batch->opened = now;
+      } else if (i + 1 < batch->grain &&
+                 now - batch->opened >= batching->max_latency) {
+        timeout = 1;
+      }
+    }
+    ++i;
   }
+  r->size = i;
+  pfwl_batch_sent(batching, batch, i, now, timeout);
+  last_tick = now;
   return (void *) r;
 }
 
 pfwl_L3_L4_emitter::~pfwl_L3_L4_emitter() {
-  ;
+  if (lb) {
+    for (uint i = 0; i < num_L3_L4_workers; i++) {
+      if (partially_filled[i]) {
+        pfwl_free_task(partially_filled[i]);
+      }
+    }
+    delete[] partially_filled;
+    delete[] partially_filled_sizes;
+  }
+  delete[] batches;
 }
 
 #ifdef ENABLE_RECONFIGURATION
 void pfwl_L3_L4_emitter::notifyRethreading(size_t oldNumWorkers,
                                            size_t newNumWorkers) {
-  worker_debug_print("%s\n", "[mc_pfwl_api.cpp]: Changing v4 table partitions");
-  pfwl_flow_table_setup_partitions_v4((pfwl_flow_DB_v4_t *) state->db4,
-                                      newNumWorkers);
-  worker_debug_print("%s\n", "[mc_pfwl_api.cpp]: Changing v6 table partitions");
-  pfwl_flow_table_setup_partitions_v6((pfwl_flow_DB_v6_t *) state->db6,
-                                      newNumWorkers);
+  /** The flow table partitions do not depend on the number of L7 workers. **/
 }
 #endif
 
 pfwl_L3_L4_worker::pfwl_L3_L4_worker(pfwl_state_t *state, uint16_t worker_id,
-                                     uint16_t num_L7_workers, uint16_t proc_id,
-                                     uint32_t v4_table_size,
-                                     uint32_t v6_table_size)
-    : state(state), v4_table_size(v4_table_size), v6_table_size(v6_table_size),
-      worker_id(worker_id), proc_id(proc_id) {
+                                     uint16_t proc_id)
+    : state(state), worker_id(worker_id), proc_id(proc_id) {
   if (posix_memalign((void **) &in, PFWL_CACHE_LINE_SIZE,
                      sizeof(L3_L4_input_task_struct) *
-                         PFWL_MULTICORE_DEFAULT_GRAIN_SIZE)) {
+                         PFWL_MULTICORE_MAX_GRAIN_SIZE)) {
     throw std::runtime_error("posix_memalign failed.");
   }
-  v4_worker_table_size = ceil((float) v4_table_size / (float) (num_L7_workers));
-  v6_worker_table_size = ceil((float) v6_table_size / (float) (num_L7_workers));
+  if (posix_memalign((void **) &dissection_info, PFWL_CACHE_LINE_SIZE,
+                     sizeof(pfwl_dissection_info_t))) {
+    throw std::runtime_error("posix_memalign failed.");
+  }
+  bzero(dissection_info, sizeof(pfwl_dissection_info_t));
 }
 
 pfwl_L3_L4_worker::~pfwl_L3_L4_worker() {
   free(in);
+  free(dissection_info);
 }
 
 #ifdef ENABLE_RECONFIGURATION
 void pfwl_L3_L4_worker::notifyRethreading(size_t oldNumWorkers,
                                           size_t newNumWorkers) {
-  v4_worker_table_size = ceil((float) v4_table_size / (float) (newNumWorkers));
-  v6_worker_table_size = ceil((float) v6_table_size / (float) (newNumWorkers));
-  worker_debug_print("[worker.cpp]: L3_L4 worker. v4_worker_table_size: %d "
-                     "v6_worker_table_size: %d\n",
-                     v4_worker_table_size, v6_worker_table_size);
+  /** The flow table partitions do not depend on the number of L7 workers. **/
 }
 #endif
 
@@ -208,58 +437,53 @@ void *pfwl_L3_L4_worker::svc(void *task) {
    * the generated output tasks.
    **/
   memcpy(in, real_task->input_output_task_t.L3_L4_input_task_t,
-         PFWL_MULTICORE_DEFAULT_GRAIN_SIZE * sizeof(L3_L4_input_task_struct));
+         real_task->size * sizeof(L3_L4_input_task_struct));
 
-  pfwl_pkt_info_t pkt_infos;
-  for (uint i = 0; i < PFWL_MULTICORE_DEFAULT_GRAIN_SIZE; i++) {
+  for (uint i = 0; i < real_task->size; i++) {
 #if PFWL_MULTICORE_PREFETCH
     __builtin_prefetch(&(in[i + 2]), 0, 0);
     __builtin_prefetch((in[i + 2]).pkt, 0, 0);
 #endif
-
-    real_task->input_output_task_t.L3_L4_output_task_t[i].status =
+    L3_L4_output_task_struct *out =
+        &(real_task->input_output_task_t.L3_L4_output_task_t[i]);
+    pfwl_status_t status =
         mc_pfwl_parse_L3_header(this->state, in[i].pkt, in[i].length,
-                                &pkt_infos, in[i].current_time, worker_id);
+                                in[i].current_time, worker_id, dissection_info);
 
     /* To have always a consistent value temp L7 worker selection. */
-    real_task->input_output_task_t.L3_L4_output_task_t[i].hash_result = 0;
-    real_task->input_output_task_t.L3_L4_output_task_t[i].destination_worker =
-        0;
-    real_task->input_output_task_t.L3_L4_output_task_t[i].user_pointer =
-        in[i].user_pointer;
-
-    if (likely(real_task->input_output_task_t.L3_L4_output_task_t[i].status >=
-               0)) {
-      if (pkt_infos.protocol_l4 != IPPROTO_TCP &&
-          pkt_infos.protocol_l4 != IPPROTO_UDP) {
-        continue;
-      }
+    out->hash_result = 0;
+    out->partition = 0;
+    out->user_pointer = in[i].user_pointer;
+    out->current_time = in[i].current_time;
+    out->l4_pkt = NULL;
+    out->l4_length = 0;
 
-      if (likely(real_task->input_output_task_t.L3_L4_output_task_t[i].status !=
-                 PFWL_STATUS_IP_FRAGMENT)) {
-        real_task->input_output_task_t.L3_L4_output_task_t[i].pkt_infos =
-            pkt_infos;
-        if (pkt_infos.ip_version == PFWL_PROTO_L3_IPV4) {
-          real_task->input_output_task_t.L3_L4_output_task_t[i].hash_result =
-              pfwl_compute_v4_hash_function(
-                  (pfwl_flow_DB_v4 *) this->state->flow_table, &pkt_infos);
-          real_task->input_output_task_t.L3_L4_output_task_t[i]
-              .destination_worker =
-              real_task->input_output_task_t.L3_L4_output_task_t[i]
-                  .hash_result /
-              v4_worker_table_size;
-        } else {
-          real_task->input_output_task_t.L3_L4_output_task_t[i].hash_result =
-              pfwl_compute_v6_hash_function(
-                  (pfwl_flow_DB_v6 *) this->state->db6, &pkt_infos);
-          real_task->input_output_task_t.L3_L4_output_task_t[i]
-              .destination_worker =
-              real_task->input_output_task_t.L3_L4_output_task_t[i]
-                  .hash_result /
-              v6_worker_table_size;
-        }
+    if (likely(status >= 0 && status != PFWL_STATUS_IP_FRAGMENT)) {
+      if (dissection_info->l3.refrag_pkt) {
+        out->l4_length =
+            dissection_info->l3.refrag_pkt_len - dissection_info->l3.length;
+        out->l4_pkt =
+            dissection_info->l3.refrag_pkt + dissection_info->l3.length;
+      } else {
+        out->l4_length = dissection_info->l3.payload_length;
+        out->l4_pkt = in[i].pkt + dissection_info->l3.length;
+      }
+      status =
+          mc_pfwl_parse_L4_ports(out->l4_pkt, out->l4_length, dissection_info);
+      if (likely(status >= 0)) {
+        out->hash_result = pfwl_compute_hash_function(
+            (pfwl_flow_table_t *) this->state->flow_table, dissection_info);
+        out->partition = mc_pfwl_flow_table_partition(
+            (pfwl_flow_table_t *) this->state->flow_table, out->hash_result);
+      } else if (dissection_info->l3.refrag_pkt) {
+        free((unsigned char *) dissection_info->l3.refrag_pkt);
+        dissection_info->l3.refrag_pkt = NULL;
+        dissection_info->l3.refrag_pkt_len = 0;
       }
     }
+    out->status = status;
+    out->l3 = dissection_info->l3;
+    out->l4 = dissection_info->l4;
   }
   return real_task;
 }
@@ -285,9 +509,21 @@ void *pfwl_L3_L4_collector::svc(void *task) {
 /*                          L7 nodes.                              */
 /*******************************************************************/
 
-pfwl_L7_emitter::pfwl_L7_emitter(pfwl_L7_scheduler *lb, uint16_t num_L7_workers,
-                                 uint16_t proc_id)
-    : proc_id(proc_id), lb(lb) {
+pfwl_L7_emitter::pfwl_L7_emitter(pfwl_state_t *state, pfwl_L7_scheduler *lb,
+                                 uint16_t num_L7_workers,
+                                 uint16_t num_partitions,
+                                 pfwl_L7_worker_load_t *loads,
+                                 pfwl_L7_scaling_t *scaling,
+                                 pfwl_batching_t *batching, uint16_t proc_id)
+    : waiting_tasks_capacity(num_L7_workers * 2 + 1), batching(batching),
+      deadline(PFWL_BATCHING_NO_DEADLINE), proc_id(proc_id),
+      num_L7_workers(num_L7_workers),
+      num_partitions(num_partitions), loads(loads), tasks_since_check(0),
+      migrating(PFWL_L7_EMITTER_NO_MIGRATION), migration_from(0),
+      migration_to(0), migration_fence(0), held_size(0), state(state),
+      scaling(scaling), active_workers(num_L7_workers),
+      draining(PFWL_L7_EMITTER_NO_WORKER), reassigning(0), last_scaling(0),
+      last_scaling_ticks(0), lb(lb) {
   if (posix_memalign((void **) &partially_filled_sizes, PFWL_CACHE_LINE_SIZE,
                      (sizeof(uint) * num_L7_workers) + PFWL_CACHE_LINE_SIZE)) {
     throw std::runtime_error("posix_memalign failed.");
@@ -301,8 +537,14 @@ pfwl_L7_emitter::pfwl_L7_emitter(pfwl_L7_scheduler *lb, uint16_t num_L7_workers,
   }
   bzero(partially_filled, sizeof(mc_pfwl_task_t) * num_L7_workers);
 
+  /**
+   * Received tasks are reused to send packets to the workers. Since the
+   * grains of the received and of the sent tasks differ, the tasks beyond
+   * waiting_tasks_capacity are freed, and new ones are allocated when none
+   * is waiting.
+   **/
   if (posix_memalign((void **) &waiting_tasks, PFWL_CACHE_LINE_SIZE,
-                     (sizeof(mc_pfwl_task_t *) * num_L7_workers * 2) +
+                     (sizeof(mc_pfwl_task_t *) * waiting_tasks_capacity) +
                          PFWL_CACHE_LINE_SIZE)) {
     throw std::runtime_error("posix_memalign failed.");
   }
@@ -312,11 +554,48 @@ pfwl_L7_emitter::pfwl_L7_emitter(pfwl_L7_scheduler *lb, uint16_t num_L7_workers,
     waiting_tasks[i] = pfwl_allocate_task();
     ++waiting_tasks_size;
   }
+
+  owners = new uint16_t[num_partitions];
+  last_tasks = new uint64_t[num_partitions]();
+  partition_packets = new uint32_t[num_partitions]();
+  sent_tasks = new uint64_t[num_L7_workers]();
+  last_busy_ticks = new uint64_t[num_L7_workers]();
+  held = new L3_L4_output_task_struct[PFWL_MULTICORE_MIGRATION_BUFFER_SIZE];
+  batches = new pfwl_batch_t[num_L7_workers];
+  for (uint i = 0; i < num_L7_workers; i++) {
+    batches[i].grain = 1;
+    batches[i].opened = 0;
+  }
+  set_workers(num_L7_workers);
 }
 
 pfwl_L7_emitter::~pfwl_L7_emitter() {
+  for (uint i = 0; i < waiting_tasks_size; i++) {
+    pfwl_free_task(waiting_tasks[i]);
+  }
+  free(waiting_tasks);
   free(partially_filled_sizes);
   free(partially_filled);
+  delete[] owners;
+  delete[] last_tasks;
+  delete[] partition_packets;
+  delete[] sent_tasks;
+  delete[] last_busy_ticks;
+  delete[] held;
+  delete[] batches;
+}
+
+void pfwl_L7_emitter::set_workers(uint16_t num_L7_workers) {
+  this->num_L7_workers = num_L7_workers;
+  for (uint16_t i = 0; i < num_L7_workers; i++) {
+    __atomic_store_n(&loads[i].partitions, 0, __ATOMIC_RELAXED);
+  }
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    owners[i] = (i * num_L7_workers) / num_partitions;
+    last_tasks[i] = 0;
+    __atomic_store_n(&loads[owners[i]].partitions,
+                     loads[owners[i]].partitions + 1, __ATOMIC_RELAXED);
+  }
 }
 
 int pfwl_L7_emitter::svc_init() {
@@ -324,73 +603,422 @@ int pfwl_L7_emitter::svc_init() {
                      "on processor: %d\n",
                      proc_id);
   ff_mapThreadToCpu(proc_id, -20);
+  /**
+   * The workers did not receive any packet yet. Done here since the table
+   * may have been created again after the emitter.
+   **/
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    pfwl_flow_table_set_partition_node((pfwl_flow_table_t *) state->flow_table,
+                                       i, loads[owners[i]].node);
+  }
+  active_workers = num_L7_workers;
+  draining = PFWL_L7_EMITTER_NO_WORKER;
+  reassigning = 0;
+  pthread_mutex_lock(&scaling->mutex);
+  scaling->terminating = 0;
+  for (uint16_t i = 0; i < num_L7_workers; i++) {
+    loads[i].active = 1;
+    last_busy_ticks[i] =
+        __atomic_load_n(&loads[i].busy_ticks, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&scaling->mutex);
+  last_scaling = getns();
+  last_scaling_ticks = getticks();
+  return 0;
+}
+
+/**
+ * Appends a packet to the task of the worker owning its partition, and
+ * sends the task when it is full.
+ **/
+void pfwl_L7_emitter::dispatch(const L3_L4_output_task_struct &packet,
+                               ticks now) {
+  uint16_t destination_worker = owners[packet.partition];
+  worker_debug_print("[worker.cpp]: L7 emitter: Inserted"
+                     " a task into the queue of worker: "
+                     "%d\n",
+                     destination_worker);
+  uint pfs = partially_filled_sizes[destination_worker];
+#if PFWL_MULTICORE_PREFETCH
+  __builtin_prefetch(&(partially_filled[destination_worker]
+                           .input_output_task_t.L3_L4_output_task_t[pfs]),
+                     1, 0);
+#endif
+  // The packet will be in the next task sent to the worker.
+  last_tasks[packet.partition] = sent_tasks[destination_worker] + 1;
+  partially_filled[destination_worker]
+      .input_output_task_t.L3_L4_output_task_t[pfs] = packet;
+  partially_filled_sizes[destination_worker] = pfs + 1;
+  if (!pfs) {
+    batches[destination_worker].opened = now;
+    if (deadline == PFWL_BATCHING_NO_DEADLINE) {
+      deadline = now + batching->max_latency;
+    }
+  }
+  if (pfs + 1 == batches[destination_worker].grain) {
+    send_batch(destination_worker, now, 0);
+  }
+}
+
+void pfwl_L7_emitter::send_batch(uint16_t worker, ticks now,
+                                 uint8_t timeout) {
+  mc_pfwl_task_t *out;
+  if (waiting_tasks_size) {
+    out = waiting_tasks[--waiting_tasks_size];
+  } else {
+    out = pfwl_allocate_task();
+  }
+  out->size = partially_filled_sizes[worker];
+  memcpy(out->input_output_task_t.L3_L4_output_task_t,
+         partially_filled[worker].input_output_task_t.L3_L4_output_task_t,
+         sizeof(L3_L4_output_task_struct) * out->size);
+  pfwl_batch_sent(batching, &(batches[worker]), out->size, now, timeout);
+  lb->set_victim(worker);
+  while (ff_send_out((void *) out, -1, SPINTICKS) == false)
+    ;
+  partially_filled_sizes[worker] = 0;
+  ++sent_tasks[worker];
+  __atomic_store_n(&loads[worker].received_tasks, sent_tasks[worker],
+                   __ATOMIC_RELAXED);
+}
+
+void pfwl_L7_emitter::expire(ticks now) {
+  deadline = PFWL_BATCHING_NO_DEADLINE;
+  for (uint16_t i = 0; i < num_L7_workers; i++) {
+    if (!partially_filled_sizes[i]) {
+      continue;
+    }
+    if (now - batches[i].opened >= batching->max_latency) {
+      send_batch(i, now, 1);
+    } else {
+      deadline = std::min(deadline, batches[i].opened + batching->max_latency);
+    }
+  }
+}
+
+/**
+ * Completes the migration of a partition, once its old owner processed
+ * all the tasks containing its packets.
+ * @param wait If 1, waits for the old owner to process them.
+ * @return 1 if the migration has been completed, 0 otherwise.
+ **/
+uint8_t pfwl_L7_emitter::migrate(uint8_t wait) {
+  while (__atomic_load_n(&loads[migration_from].processed_tasks,
+                         __ATOMIC_ACQUIRE) < migration_fence) {
+    if (!wait) {
+      return 0;
+    }
+    ff::ticks_wait(SPINTICKS);
+  }
+  uint32_t partition = migrating;
+  owners[partition] = migration_to;
+  // Nobody is using the partition, its memory can follow it.
+  if (loads[migration_to].node != loads[migration_from].node) {
+    pfwl_flow_table_set_partition_node((pfwl_flow_table_t *) state->flow_table,
+                                       partition, loads[migration_to].node);
+  }
+  last_tasks[partition] = 0;
+  migrating = PFWL_L7_EMITTER_NO_MIGRATION;
+  __atomic_store_n(&loads[migration_from].partitions,
+                   loads[migration_from].partitions - 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&loads[migration_to].partitions,
+                   loads[migration_to].partitions + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&loads[migration_to].migrations,
+                   loads[migration_to].migrations + 1, __ATOMIC_RELAXED);
+  worker_debug_print("[worker.cpp]: L7 emitter: Partition %u moved from "
+                     "worker %u to worker %u\n",
+                     partition, migration_from, migration_to);
+  ticks now = getticks();
+  for (uint32_t i = 0; i < held_size; i++) {
+    dispatch(held[i], now);
+  }
+  held_size = 0;
+  return 1;
+}
+
+void pfwl_L7_emitter::start_migration(uint32_t partition, uint16_t from,
+                                      uint16_t to) {
+  migrating = partition;
+  migration_from = from;
+  migration_to = to;
+  migration_fence = last_tasks[partition];
+  held_size = 0;
+  migrate(0);
+}
+
+/**
+ * Starts moving a partition away from the worker being deactivated, or
+ * to an active worker owning much fewer partitions than the others (i.e.
+ * just activated). The partition is taken from the worker owning the most.
+ * @return 1 if a migration has been started, 0 otherwise.
+ **/
+uint8_t pfwl_L7_emitter::handoff() {
+  uint16_t fewest = 0, most = 0;
+  for (uint16_t i = 1; i < active_workers; i++) {
+    if (loads[i].partitions < loads[fewest].partitions) {
+      fewest = i;
+    }
+    if (loads[i].partitions > loads[most].partitions) {
+      most = i;
+    }
+  }
+  uint16_t from;
+  if (draining != PFWL_L7_EMITTER_NO_WORKER) {
+    from = draining;
+  } else if (loads[fewest].partitions + 1 < num_partitions / active_workers) {
+    from = most;
+  } else {
+    return 0;
+  }
+  for (uint32_t i = 0; i < num_partitions; i++) {
+    if (owners[i] == from && last_tasks[i] <= sent_tasks[from]) {
+      start_migration(i, from, fewest);
+      return 1;
+    }
+  }
   return 0;
 }
 
+/**
+ * Moves the next partition after a scaling decision. Called after each
+ * completed migration rather than at each check, so that the workers are
+ * deactivated (or used) without waiting for many checks.
+ **/
+void pfwl_L7_emitter::reassign() {
+  if (draining != PFWL_L7_EMITTER_NO_WORKER && !loads[draining].partitions) {
+    put_to_sleep(draining);
+    draining = PFWL_L7_EMITTER_NO_WORKER;
+  }
+  if (!handoff() && draining == PFWL_L7_EMITTER_NO_WORKER) {
+    reassigning = 0;
+  }
+}
+
+void pfwl_L7_emitter::wake(uint16_t worker) {
+  pthread_mutex_lock(&scaling->mutex);
+  loads[worker].active = 1;
+  pthread_cond_broadcast(&scaling->cond);
+  pthread_mutex_unlock(&scaling->mutex);
+}
+
+/**
+ * The worker goes to sleep after the tasks it already received, and does
+ * not receive other tasks since it does not own partitions.
+ **/
+void pfwl_L7_emitter::put_to_sleep(uint16_t worker) {
+  pthread_mutex_lock(&scaling->mutex);
+  loads[worker].active = 0;
+  pthread_mutex_unlock(&scaling->mutex);
+  lb->set_victim(worker);
+  while (ff_send_out(PFWL_L7_WORKER_SLEEP, -1, SPINTICKS) == false)
+    ;
+}
+
+/**
+ * Once per period, activates a worker if the active ones are busy or
+ * their queues are growing, or starts deactivating one if they are
+ * mostly idle. A worker being deactivated which is needed again is kept,
+ * with the partitions it still owns.
+ **/
+void pfwl_L7_emitter::scale() {
+  unsigned long now = getns();
+  if (now - last_scaling < scaling->parameters.period_ms * 1000000UL) {
+    return;
+  }
+  ticks now_ticks = getticks();
+  double elapsed = now_ticks - last_scaling_ticks;
+  mc_pfwl_scaling_stats_t stats;
+  stats.utilization = 0;
+  stats.backlog = 0;
+  for (uint16_t i = 0; i < active_workers; i++) {
+    uint64_t processed =
+        __atomic_load_n(&loads[i].processed_tasks, __ATOMIC_RELAXED);
+    uint64_t busy = __atomic_load_n(&loads[i].busy_ticks, __ATOMIC_RELAXED);
+    stats.utilization += elapsed ? (busy - last_busy_ticks[i]) / elapsed : 0;
+    stats.backlog += sent_tasks[i] - processed;
+  }
+  stats.utilization /= active_workers;
+  stats.backlog /= active_workers;
+  for (uint16_t i = 0; i < num_L7_workers; i++) {
+    last_busy_ticks[i] =
+        __atomic_load_n(&loads[i].busy_ticks, __ATOMIC_RELAXED);
+  }
+  last_scaling = now;
+  last_scaling_ticks = now_ticks;
+
+  const mc_pfwl_scaling_parameters_t *p = &(scaling->parameters);
+  stats.decision = MC_PFWL_SCALING_NONE;
+  if (stats.utilization > p->high_utilization ||
+      stats.backlog > p->high_backlog) {
+    if (draining != PFWL_L7_EMITTER_NO_WORKER) {
+      draining = PFWL_L7_EMITTER_NO_WORKER;
+      ++active_workers;
+      stats.decision = MC_PFWL_SCALING_UP;
+    } else if (active_workers < num_L7_workers) {
+      wake(active_workers);
+      ++active_workers;
+      stats.decision = MC_PFWL_SCALING_UP;
+    }
+  } else if (stats.utilization < p->low_utilization &&
+             draining == PFWL_L7_EMITTER_NO_WORKER &&
+             active_workers > p->min_workers) {
+    draining = --active_workers;
+    stats.decision = MC_PFWL_SCALING_DOWN;
+  }
+  if (stats.decision != MC_PFWL_SCALING_NONE) {
+    reassigning = 1;
+  }
+  stats.active_workers = active_workers;
+  if (p->callback) {
+    p->callback(&stats, p->callback_data);
+  }
+}
+
+/**
+ * If the queue of the most loaded worker is much longer than the one of
+ * the least loaded, starts moving a partition between them. The partition
+ * received the most packets since the last check, without exceeding half
+ * of the difference between the packets received by the two workers
+ * (otherwise the two workers would just swap their roles). An elephant
+ * flow thus stays where it is, and the other partitions are moved away
+ * from its worker.
+ **/
+void pfwl_L7_emitter::rebalance() {
+  tasks_since_check = 0;
+  if (scaling->enabled) {
+    scale();
+  }
+  if (migrating == PFWL_L7_EMITTER_NO_MIGRATION && reassigning) {
+    reassign();
+  }
+  if (migrating == PFWL_L7_EMITTER_NO_MIGRATION && !reassigning &&
+      active_workers > 1) {
+    uint16_t busiest = 0, idlest = 0;
+    uint64_t max_backlog = 0, min_backlog = UINT64_MAX;
+    for (uint16_t i = 0; i < active_workers; i++) {
+      uint64_t backlog =
+          sent_tasks[i] -
+          __atomic_load_n(&loads[i].processed_tasks, __ATOMIC_RELAXED);
+      if (backlog >= max_backlog) {
+        max_backlog = backlog;
+        busiest = i;
+      }
+      if (backlog < min_backlog) {
+        min_backlog = backlog;
+        idlest = i;
+      }
+    }
+
+    if (max_backlog - min_backlog >= scaling->rebalance_threshold) {
+      uint64_t busiest_packets = 0, idlest_packets = 0;
+      uint32_t busiest_partitions = 0;
+      for (uint32_t i = 0; i < num_partitions; i++) {
+        if (owners[i] == busiest) {
+          busiest_packets += partition_packets[i];
+          ++busiest_partitions;
+        } else if (owners[i] == idlest) {
+          idlest_packets += partition_packets[i];
+        }
+      }
+      // If the busiest worker received fewer packets, they are more
+      // expensive to process.
+      uint64_t limit = busiest_packets > idlest_packets
+                           ? (busiest_packets - idlest_packets) / 2
+                           : busiest_packets / 2;
+      uint32_t candidate = PFWL_L7_EMITTER_NO_MIGRATION;
+      uint32_t candidate_packets = 0;
+      for (uint32_t i = 0; i < num_partitions && busiest_partitions > 1; i++) {
+        // Partitions with packets in the partially filled task can't be
+        // moved, since that task has not been sent yet.
+        if (owners[i] == busiest && partition_packets[i] > candidate_packets &&
+            partition_packets[i] <= limit &&
+            last_tasks[i] <= sent_tasks[busiest]) {
+          candidate = i;
+          candidate_packets = partition_packets[i];
+        }
+      }
+      if (candidate != PFWL_L7_EMITTER_NO_MIGRATION) {
+        start_migration(candidate, busiest, idlest);
+      }
+    }
+  }
+  memset(partition_packets, 0, sizeof(uint32_t) * num_partitions);
+}
+
+void pfwl_L7_emitter::flush() {
+  if (migrating != PFWL_L7_EMITTER_NO_MIGRATION) {
+    migrate(1);
+  }
+  ticks now = getticks();
+  for (uint16_t i = 0; i < num_L7_workers; i++) {
+    if (partially_filled_sizes[i]) {
+      send_batch(i, now, 0);
+    }
+  }
+  deadline = PFWL_BATCHING_NO_DEADLINE;
+  // They must receive the end of stream.
+  pthread_mutex_lock(&scaling->mutex);
+  scaling->terminating = 1;
+  pthread_cond_broadcast(&scaling->cond);
+  pthread_mutex_unlock(&scaling->mutex);
+}
+
+void pfwl_L7_emitter::eosnotify(ssize_t) {
+  flush();
+}
+
 void *pfwl_L7_emitter::svc(void *task) {
   mc_pfwl_task_t *real_task = (mc_pfwl_task_t *) task;
-  mc_pfwl_task_t *out;
-  uint pfs;
 
-  for (uint i = 0; i < PFWL_MULTICORE_DEFAULT_GRAIN_SIZE; i++) {
+  if (unlikely(migrating != PFWL_L7_EMITTER_NO_MIGRATION)) {
+    migrate(0);
+  } else if (unlikely(reassigning)) {
+    reassign();
+  }
+  ticks now = getticks();
+  for (uint i = 0; i < real_task->size; i++) {
 #if PFWL_MULTICORE_PREFETCH
     __builtin_prefetch(
         &(real_task->input_output_task_t.L3_L4_output_task_t[i + 4]), 0, 0);
 #endif
-    uint16_t destination_worker =
-        real_task->input_output_task_t.L3_L4_output_task_t[i]
-            .destination_worker;
-    worker_debug_print("[worker.cpp]: L7 emitter: Inserted"
-                       " a task into the queue of worker: "
-                       "%d\n",
-                       destination_worker);
-    pfs = partially_filled_sizes[destination_worker];
-#if PFWL_MULTICORE_PREFETCH
-    __builtin_prefetch(&(partially_filled[destination_worker]
-                             .input_output_task_t.L3_L4_output_task_t[pfs]),
-                       1, 0);
-#endif
-
-    if (pfs + 1 == PFWL_MULTICORE_DEFAULT_GRAIN_SIZE) {
-      assert(waiting_tasks_size != 0);
-      out = waiting_tasks[--waiting_tasks_size];
-      memcpy(out->input_output_task_t.L3_L4_output_task_t,
-             partially_filled[destination_worker]
-                 .input_output_task_t.L3_L4_output_task_t,
-             sizeof(L3_L4_output_task_struct) *
-                 (PFWL_MULTICORE_DEFAULT_GRAIN_SIZE - 1));
-      out->input_output_task_t
-          .L3_L4_output_task_t[PFWL_MULTICORE_DEFAULT_GRAIN_SIZE - 1] =
-          real_task->input_output_task_t.L3_L4_output_task_t[i];
-      lb->set_victim(destination_worker);
-      while (ff_send_out((void *) out, -1, SPINTICKS) == false)
-        ;
-      partially_filled_sizes[destination_worker] = 0;
-    } else {
-      partially_filled[destination_worker]
-          .input_output_task_t.L3_L4_output_task_t[pfs] =
-          real_task->input_output_task_t.L3_L4_output_task_t[i];
-      ++partially_filled_sizes[destination_worker];
+    const L3_L4_output_task_struct &packet =
+        real_task->input_output_task_t.L3_L4_output_task_t[i];
+    ++partition_packets[packet.partition];
+    if (unlikely(packet.partition == migrating)) {
+      if (held_size < PFWL_MULTICORE_MIGRATION_BUFFER_SIZE) {
+        held[held_size++] = packet;
+        continue;
+      }
+      migrate(1);
     }
+    dispatch(packet, now);
+  }
+  if (unlikely(now >= deadline)) {
+    expire(now);
+  }
+  if (waiting_tasks_size < waiting_tasks_capacity) {
+    waiting_tasks[waiting_tasks_size] = real_task;
+    ++waiting_tasks_size;
+  } else {
+    pfwl_free_task(real_task);
+  }
+  if (PFWL_MULTICORE_REBALANCE_INTERVAL &&
+      ++tasks_since_check == PFWL_MULTICORE_REBALANCE_INTERVAL) {
+    rebalance();
   }
-  waiting_tasks[waiting_tasks_size] = real_task;
-  ++waiting_tasks_size;
   return (void *) ff::FF_GO_ON;
 }
 
 pfwl_L7_worker::pfwl_L7_worker(pfwl_state_t *state, uint16_t worker_id,
-                               uint16_t proc_id)
-    : state(state), worker_id(worker_id), proc_id(proc_id) {
-  if (posix_memalign((void **) &this->temp, PFWL_CACHE_LINE_SIZE,
-                     (sizeof(L3_L4_output_task_struct) *
-                      PFWL_MULTICORE_DEFAULT_GRAIN_SIZE) +
-                         PFWL_CACHE_LINE_SIZE)) {
-    throw std::runtime_error("posix_memalign failed.");
-  }
+                               pfwl_L7_worker_load_t *load,
+                               pfwl_L7_scaling_t *scaling, uint16_t proc_id)
+    : state(state), worker_id(worker_id), proc_id(proc_id), load(load),
+      scaling(scaling), processed_tasks(0), busy_ticks(0) {
+  ;
 }
 
 pfwl_L7_worker::~pfwl_L7_worker() {
-  free(temp);
+  ;
 }
 
 int pfwl_L7_worker::svc_init() {
@@ -402,77 +1030,53 @@ int pfwl_L7_worker::svc_init() {
 }
 
 void *pfwl_L7_worker::svc(void *task) {
+  if (unlikely(task == PFWL_L7_WORKER_SLEEP)) {
+    pthread_mutex_lock(&scaling->mutex);
+    while (!load->active && !scaling->terminating) {
+      pthread_cond_wait(&scaling->cond, &scaling->mutex);
+    }
+    pthread_mutex_unlock(&scaling->mutex);
+    return (void *) ff::FF_GO_ON;
+  }
   mc_pfwl_task_t *real_task = (mc_pfwl_task_t *) task;
-  pfwl_pkt_info_t infos;
-  pfwl_flow_info_t *flow_infos = NULL;
-
-#if MC_PFWL_TICKS_WAIT == 1
   ticks svcstart = getticks();
-#endif
-  memcpy(temp, real_task->input_output_task_t.L3_L4_output_task_t,
-         PFWL_MULTICORE_DEFAULT_GRAIN_SIZE * sizeof(L3_L4_output_task_struct));
   worker_debug_print("[worker.cpp]: L7 worker %d received task\n", worker_id);
 
-  for (uint i = 0; i < PFWL_MULTICORE_DEFAULT_GRAIN_SIZE; i++) {
-    real_task->input_output_task_t.L7_output_task_t[i].user_pointer =
-        temp[i].user_pointer;
-    pfwl_flow_t *ipv4_flow = NULL;
-    pfwl_flow_t *ipv6_flow = NULL;
-
-    int8_t l3_status = temp[i].status;
-    if (unlikely(l3_status < 0 || l3_status == PFWL_STATUS_IP_FRAGMENT)) {
-      real_task->input_output_task_t.L7_output_task_t[i].result.status =
-          l3_status;
-      continue;
-    }
-    infos = temp[i].pkt_infos;
+  for (uint i = 0; i < real_task->size; i++) {
+    const L3_L4_output_task_struct *in =
+        &(real_task->input_output_task_t.L3_L4_output_task_t[i]);
+    L7_output_task_struct *out = &(real_task->L7_output_task_t[i]);
 #if PFWL_MULTICORE_PREFETCH
     __builtin_prefetch(
-        temp[i + 1].pkt_infos.pkt + temp[i + 1].pkt_infos.l7offset, 0, 0);
+        real_task->input_output_task_t.L3_L4_output_task_t[i + 1].l4_pkt, 0,
+        0);
 #endif
-
-    if (infos.ip_version == PFWL_PROTO_L3_IPV4) {
-      ipv4_flow = mc_pfwl_flow_table_find_or_create_flow(
-          state, this->worker_id, temp[i].hash_result, &(infos));
-      if (ipv4_flow)
-        flow_infos = &(ipv4_flow->infos);
-    } else {
-      ipv6_flow = mc_pfwl_flow_table_find_or_create_flow(
-          state, this->worker_id, temp[i].hash_result, &(infos));
-      if (ipv6_flow)
-        flow_infos = &(ipv6_flow->infos);
-    }
-
-    real_task->input_output_task_t.L7_output_task_t[i].result.status =
-        PFWL_STATUS_OK;
-    if (unlikely(flow_infos == NULL)) {
-      real_task->input_output_task_t.L7_output_task_t[i].result.status =
-          PFWL_ERROR_MAX_FLOWS;
-      if (unlikely(l3_status == PFWL_STATUS_IP_DATA_REBUILT)) {
-        free((unsigned char *) infos.pkt);
-      }
-      break;
-    } else {
-      real_task->input_output_task_t.L7_output_task_t[i].result =
-          pfwl_dissect_L7(state, flow_infos, &(infos));
-      if (real_task->input_output_task_t.L7_output_task_t[i].result.status ==
-          PFWL_STATUS_TCP_CONNECTION_TERMINATED) {
-        if (ipv4_flow != NULL) {
-          mc_pfwl_flow_table_delete_flow(
-              (pfwl_flow_table_t *) state->flow_table,
-              state->flow_cleaner_callback, this->worker_id, ipv4_flow);
-        } else {
-          mc_pfwl_flow_table_delete_flow((pfwl_flow_table_t *) state->db6,
-                                         state->flow_cleaner_callback,
-                                         this->worker_id, ipv6_flow);
-        }
-      }
-
-      if (unlikely(l3_status == PFWL_STATUS_IP_DATA_REBUILT)) {
-        free((unsigned char *) infos.pkt);
-      }
+    out->user_pointer = in->user_pointer;
+    pfwl_dissection_info_reset(state, &(out->result));
+    out->result.l3 = in->l3;
+    out->result.l4 = in->l4;
+    if (unlikely(in->status < 0 || in->status == PFWL_STATUS_IP_FRAGMENT)) {
+      out->status = (pfwl_status_t) in->status;
+      continue;
     }
+    /**
+     * Only this worker accesses the partition. Any rebuilt datagram is
+     * stored in the flow, as in the sequential version.
+     **/
+    out->status = mc_pfwl_dissect_from_L4(state, in->l4_pkt, in->l4_length,
+                                          in->current_time, in->partition,
+                                          in->hash_result, &(out->result));
   }
+  __atomic_store_n(&load->packets, load->packets + real_task->size,
+                   __ATOMIC_RELAXED);
+  busy_ticks += getticks() - svcstart;
+  __atomic_store_n(&load->busy_ticks, busy_ticks, __ATOMIC_RELAXED);
+  /**
+   * Releases the flows of this task to the worker which will own their
+   * partition after a migration.
+   **/
+  __atomic_store_n(&load->processed_tasks, ++processed_tasks,
+                   __ATOMIC_RELEASE);
   return real_task;
 }
 
@@ -492,14 +1096,10 @@ int pfwl_L7_collector::svc_init() {
 }
 
 void *pfwl_L7_collector::svc(void *task) {
-  mc_pfwl_processing_result_t r;
   mc_pfwl_task_t *real_task = (mc_pfwl_task_t *) task;
 
-  for (uint i = 0; i < PFWL_MULTICORE_DEFAULT_GRAIN_SIZE; i++) {
-    r.result = real_task->input_output_task_t.L7_output_task_t[i].result;
-    r.user_pointer =
-        real_task->input_output_task_t.L7_output_task_t[i].user_pointer;
-    (*(*cb))(&r, *user_data);
+  for (uint i = 0; i < real_task->size; i++) {
+    (*(*cb))(&(real_task->L7_output_task_t[i]), *user_data);
   }
 #if PFWL_MULTICORE_USE_TASKS_POOL
   if (tasks_pool->available()) {
@@ -526,13 +1126,17 @@ pfwl_L7_collector::~pfwl_L7_collector() {
 pfwl_collapsed_emitter::pfwl_collapsed_emitter(
     mc_pfwl_packet_reading_callback **cb, void **user_data,
     uint8_t *terminating, ff::SWSR_Ptr_Buffer *tasks_pool, pfwl_state_t *state,
-    uint16_t num_L7_workers, uint32_t v4_table_size, uint32_t v6_table_size,
-    pfwl_L7_scheduler *lb, uint16_t proc_id)
-    : pfwl_L7_emitter(lb, num_L7_workers, proc_id), proc_id(proc_id) {
-  L3_L4_emitter = new dpi::pfwl_L3_L4_emitter(state, cb, user_data, terminating,
-                                              proc_id, tasks_pool);
-  L3_L4_worker = new dpi::pfwl_L3_L4_worker(state, 0, num_L7_workers, proc_id,
-                                            v4_table_size, v6_table_size);
+    uint16_t num_L7_workers, uint16_t num_partitions,
+    pfwl_L7_worker_load_t *loads, pfwl_L7_scaling_t *scaling,
+    pfwl_batching_t *batching, pfwl_L7_scheduler *lb, uint16_t proc_id)
+    : pfwl_L7_emitter(state, lb, num_L7_workers, num_partitions, loads,
+                      scaling, &(batching[MC_PFWL_BATCHING_STAGE_L7]),
+                      proc_id),
+      proc_id(proc_id) {
+  L3_L4_emitter = new dpi::pfwl_L3_L4_emitter(
+      state, cb, user_data, terminating, proc_id, tasks_pool,
+      &(batching[MC_PFWL_BATCHING_STAGE_L3_L4]));
+  L3_L4_worker = new dpi::pfwl_L3_L4_worker(state, 0, proc_id);
 }
 
 pfwl_collapsed_emitter::~pfwl_collapsed_emitter() {
@@ -545,6 +1149,7 @@ void pfwl_collapsed_emitter::notifyRethreading(size_t oldNumWorkers,
                                                size_t newNumWorkers) {
   L3_L4_emitter->notifyRethreading(oldNumWorkers, newNumWorkers);
   L3_L4_worker->notifyRethreading(oldNumWorkers, newNumWorkers);
+  set_workers(newNumWorkers);
 }
 #endif
 
@@ -561,6 +1166,9 @@ int pfwl_collapsed_emitter::svc_init() {
 void *pfwl_collapsed_emitter::svc(void *task) {
   void *r = L3_L4_emitter->svc(task);
   if (unlikely(r == (void *) ff::FF_EOS || r == NULL)) {
+    flush();
+    return r;
+  } else if (r == (void *) ff::FF_GO_ON) {
     return r;
   } else {
     r = L3_L4_worker->svc(r);
@@ -44,6 +44,7 @@ void getProtocols(const char* pcapName, std::vector<uint>& protocols, pfwl_state
 
   Pcap pcap(pcapName);
   pfwl_dissection_info_t r;
+  memset(&r, 0, sizeof(r));
   std::pair<const u_char*, unsigned long> pkt;
 
   while((pkt = pcap.getNextPacket()).first != NULL){
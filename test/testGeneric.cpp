@@ -2,6 +2,8 @@
  *  Generic tests.
  **/
 #include "common.h"
+#include <peafowl/guess_ordering.h>
+#include <fstream>
 #include <time.h>
 
 TEST(GenericTest, MaxFlows) {
@@ -18,6 +20,438 @@ TEST(GenericTest, MaxFlows) {
   pfwl_terminate(state);
 }
 
+TEST(GenericTest, MaxFlowsBucketed) {
+  pfwl_state_t* state = pfwl_init();
+  std::vector<uint> protocols;
+  pfwl_set_expected_flows(state, 1, 1);
+  pfwl_set_flow_table_engine(state, PFWL_FLOW_TABLE_ENGINE_BUCKETED);
+  uint errors = 0;
+  getProtocols("./pcaps/whatsapp.pcap", protocols, state, [&](pfwl_status_t status, pfwl_dissection_info_t r){
+    if(status == PFWL_ERROR_MAX_FLOWS){
+      ++errors;
+    }
+  });
+  EXPECT_GT(errors, 0);
+  pfwl_terminate(state);
+}
+
+TEST(GenericTest, FlowTableEngines) {
+  std::vector<uint> protocolsChained, protocolsBucketed;
+  uint64_t idsChained = 0, idsBucketed = 0;
+  pfwl_state_t* state = pfwl_init();
+  getProtocols("./pcaps/skype-irc.cap", protocolsChained, state, [&](pfwl_status_t status, pfwl_dissection_info_t r){
+    idsChained += r.flow_info.id;
+  });
+  pfwl_terminate(state);
+
+  state = pfwl_init();
+  EXPECT_EQ(pfwl_set_flow_table_engine(state, PFWL_FLOW_TABLE_ENGINE_BUCKETED), 0);
+  getProtocols("./pcaps/skype-irc.cap", protocolsBucketed, state, [&](pfwl_status_t status, pfwl_dissection_info_t r){
+    idsBucketed += r.flow_info.id;
+  });
+  pfwl_terminate(state);
+
+  EXPECT_EQ(protocolsChained, protocolsBucketed);
+  EXPECT_EQ(idsChained, idsBucketed);
+}
+
+TEST(GenericTest, FlowTableHashes) {
+  std::vector<uint> protocolsDefault;
+  uint64_t idsDefault = 0;
+  getProtocols("./pcaps/6in4tunnel.pcap", protocolsDefault, NULL, [&](pfwl_status_t status, pfwl_dissection_info_t r){
+    idsDefault += r.flow_info.id;
+  });
+
+  pfwl_flow_table_hash_t hashes[] = {PFWL_FLOW_TABLE_HASH_SIMPLE, PFWL_FLOW_TABLE_HASH_FNV,
+                                     PFWL_FLOW_TABLE_HASH_MURMUR3, PFWL_FLOW_TABLE_HASH_BKDR,
+                                     PFWL_FLOW_TABLE_HASH_CRC32C, PFWL_FLOW_TABLE_HASH_XXHASH};
+  for(pfwl_flow_table_hash_t hash : hashes){
+    std::vector<uint> protocols;
+    uint64_t ids = 0;
+    pfwl_state_t* state = pfwl_init();
+    EXPECT_EQ(pfwl_set_flow_table_hash(state, hash), 0);
+    getProtocols("./pcaps/6in4tunnel.pcap", protocols, state, [&](pfwl_status_t status, pfwl_dissection_info_t r){
+      ids += r.flow_info.id;
+    });
+    // Flows are already stored, the hash can no longer change.
+    EXPECT_EQ(pfwl_set_flow_table_hash(state, PFWL_FLOW_TABLE_HASH_CRC32C), 1);
+    pfwl_terminate(state);
+
+    EXPECT_EQ(protocols, protocolsDefault);
+    EXPECT_EQ(ids, idsDefault);
+  }
+}
+
+TEST(GenericTest, MemoryAllocators) {
+  std::vector<uint> protocolsMalloc, protocolsSlab;
+  pfwl_memory_stats_t statsMalloc, statsSlab;
+  pfwl_state_t* state = pfwl_init();
+  EXPECT_EQ(pfwl_set_memory_allocator(state, PFWL_MEMORY_ALLOCATOR_MALLOC), 0);
+  getProtocols("./pcaps/tcp_resegment/http_out_of_order_1.pcap", protocolsMalloc, state);
+  EXPECT_EQ(pfwl_get_memory_stats(state, &statsMalloc), 0);
+  // Flows are still stored.
+  EXPECT_EQ(pfwl_set_memory_allocator(state, PFWL_MEMORY_ALLOCATOR_SLAB), 1);
+  pfwl_terminate(state);
+
+  state = pfwl_init();
+  EXPECT_EQ(pfwl_set_memory_allocator(state, PFWL_MEMORY_ALLOCATOR_SLAB), 0);
+  getProtocols("./pcaps/tcp_resegment/http_out_of_order_1.pcap", protocolsSlab, state);
+  EXPECT_EQ(pfwl_get_memory_stats(state, &statsSlab), 0);
+  pfwl_terminate(state);
+
+  EXPECT_EQ(protocolsMalloc, protocolsSlab);
+  EXPECT_GT(statsMalloc.used[PFWL_MEMORY_FLOWS], 0);
+  EXPECT_GT(statsMalloc.high_water[PFWL_MEMORY_FRAGMENTS], 0);
+  EXPECT_EQ(statsMalloc.reserved, 0);
+  EXPECT_EQ(statsMalloc.used[PFWL_MEMORY_FLOWS], statsSlab.used[PFWL_MEMORY_FLOWS]);
+  EXPECT_EQ(statsMalloc.high_water[PFWL_MEMORY_FRAGMENTS], statsSlab.high_water[PFWL_MEMORY_FRAGMENTS]);
+  EXPECT_GT(statsSlab.reserved, 0);
+}
+
+TEST(GenericTest, MemoryAllocatorNotMixed) {
+  pfwl_state_t* state = pfwl_init();
+  ASSERT_EQ(pfwl_set_memory_allocator(state, PFWL_MEMORY_ALLOCATOR_SLAB), 0);
+  // First fragment of a UDP datagram: no flows, but a stored fragment.
+  unsigned char fragment[] = {0x45, 0x00, 0x00, 0x24, 0x12, 0x34, 0x20, 0x00,
+                              0x40, 0x11, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01,
+                              0x0a, 0x00, 0x00, 0x02, 0x04, 0xd2, 0x00, 0x35,
+                              0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                              0x00, 0x00, 0x00, 0x00};
+  pfwl_dissection_info_t r;
+  memset(&r, 0, sizeof(r));
+  EXPECT_EQ(pfwl_dissect_from_L3(state, fragment, sizeof(fragment), 1, &r), PFWL_STATUS_IP_FRAGMENT);
+  pfwl_memory_stats_t before, after;
+  EXPECT_EQ(pfwl_get_memory_stats(state, &before), 0);
+  EXPECT_GT(before.used[PFWL_MEMORY_FRAGMENTS], 0);
+  EXPECT_EQ(pfwl_set_memory_allocator(state, PFWL_MEMORY_ALLOCATOR_MALLOC), 1);
+
+  // The flows are still allocated from the slabs.
+  std::vector<uint> protocols;
+  getProtocols("./pcaps/http.cap", protocols, state);
+  EXPECT_EQ(pfwl_get_memory_stats(state, &after), 0);
+  EXPECT_GT(after.used[PFWL_MEMORY_FLOWS], 0);
+  EXPECT_GT(after.reserved, before.reserved);
+  pfwl_terminate(state);
+}
+
+TEST(GenericTest, TcpReorderingMemoryLimits) {
+  std::vector<uint> protocols, protocolsLimited;
+  pfwl_tcp_reordering_stats_t stats, statsLimited;
+  pfwl_state_t* state = pfwl_init();
+  getProtocols("./pcaps/tcp_resegment/http_out_of_order_1.pcap", protocols, state);
+  EXPECT_EQ(pfwl_tcp_reordering_get_stats(state, &stats), 0);
+  pfwl_terminate(state);
+
+  state = pfwl_init();
+  EXPECT_EQ(pfwl_tcp_reordering_set_per_flow_memory_limit(state, 0), 0);
+  getProtocols("./pcaps/tcp_resegment/http_out_of_order_1.pcap", protocolsLimited, state);
+  EXPECT_EQ(pfwl_tcp_reordering_get_stats(state, &statsLimited), 0);
+  pfwl_terminate(state);
+
+  // Out of order segments are stored and then delivered (the data
+  // delivered with the last packet is kept until the next one).
+  EXPECT_GT(stats.high_water, 0);
+  EXPECT_LE(stats.used, stats.high_water);
+  EXPECT_EQ(stats.dropped_segments, 0);
+  // Nothing can be stored, the flows resynchronize on the next segments.
+  EXPECT_EQ(statsLimited.high_water, 0);
+  EXPECT_GT(statsLimited.dropped_segments, 0);
+  EXPECT_GT(statsLimited.dropped_bytes, 0);
+
+  state = pfwl_init();
+  EXPECT_EQ(pfwl_tcp_reordering_set_total_memory_limit(state, stats.high_water), 0);
+  EXPECT_EQ(pfwl_tcp_reordering_set_per_partition_memory_limit(state, stats.high_water), 0);
+  getProtocols("./pcaps/tcp_resegment/http_out_of_order_1.pcap", protocolsLimited, state);
+  EXPECT_EQ(pfwl_tcp_reordering_get_stats(state, &statsLimited), 0);
+  pfwl_terminate(state);
+  EXPECT_EQ(protocols, protocolsLimited);
+  EXPECT_EQ(statsLimited.high_water, stats.high_water);
+  EXPECT_EQ(statsLimited.dropped_segments, 0);
+}
+
+static size_t terminatedFlows = 0;
+
+static void countTerminated(pfwl_flow_info_t*){
+  ++terminatedFlows;
+}
+
+// Returns the number of flows expired before the end of the capture.
+static size_t getExpiredFlows(pfwl_state_t* state, uint32_t timestampStep){
+  Pcap pcap("./pcaps/ntp.pcap");
+  pfwl_dissection_info_t r;
+  memset(&r, 0, sizeof(r));
+  std::pair<const u_char*, unsigned long> pkt;
+  uint32_t timestamp = 1;
+  terminatedFlows = 0;
+  pfwl_set_flow_termination_callback(state, &countTerminated);
+  while((pkt = pcap.getNextPacket()).first != NULL){
+    pfwl_dissect_from_L2(state, pkt.first, pkt.second, timestamp, pcap._datalink_type, &r);
+    timestamp += timestampStep;
+  }
+  size_t expired = terminatedFlows;
+  pfwl_terminate(state);
+  return expired;
+}
+
+TEST(GenericTest, FlowTimeouts) {
+  // One packet every 10 seconds, default timeouts.
+  pfwl_state_t* state = pfwl_init();
+  size_t expiredDefault = getExpiredFlows(state, 10);
+
+  state = pfwl_init();
+  EXPECT_EQ(pfwl_set_flow_timeout(state, PFWL_FLOW_TIMEOUT_UDP, 1), 0);
+  size_t expiredShort = getExpiredFlows(state, 10);
+  EXPECT_GT(expiredShort, expiredDefault);
+
+  // Timeouts are in seconds also when timestamps are in milliseconds.
+  state = pfwl_init();
+  EXPECT_EQ(pfwl_set_timestamp_unit(state, PFWL_TIMESTAMP_UNIT_MILLISECONDS), 0);
+  EXPECT_EQ(getExpiredFlows(state, 10000), expiredDefault);
+
+  state = pfwl_init();
+  EXPECT_EQ(pfwl_set_flow_timeout(state, PFWL_FLOW_TIMEOUT_NUM, 1), 1);
+  // Only UDP flows in the capture.
+  EXPECT_EQ(pfwl_set_flow_timeout(state, PFWL_FLOW_TIMEOUT_TCP, 1), 0);
+  EXPECT_EQ(pfwl_set_flow_timeout(state, PFWL_FLOW_TIMEOUT_OTHER, 1), 0);
+  EXPECT_EQ(getExpiredFlows(state, 10), expiredDefault);
+}
+
+TEST(GenericTest, DissectBatch) {
+  std::vector<uint> protocols, protocolsBatch(PFWL_PROTO_L7_NUM);
+  std::vector<pfwl_status_t> statuses, statusesBatch;
+  getProtocols("./pcaps/dropbox.pcap", protocols, NULL, [&](pfwl_status_t status, pfwl_dissection_info_t r){
+    statuses.push_back(status);
+  });
+
+  Pcap pcap("./pcaps/dropbox.pcap");
+  std::pair<const u_char*, unsigned long> pkt;
+  std::vector<std::string> pkts;
+  while((pkt = pcap.getNextPacket()).first != NULL){
+    pkts.push_back(std::string((const char*) pkt.first, pkt.second));
+  }
+  pfwl_state_t* state = pfwl_init();
+  // Not a multiple of the chunk size.
+  const size_t burst = 50;
+  for(size_t first = 0; first < pkts.size(); first += burst){
+    size_t n = std::min(burst, pkts.size() - first);
+    std::vector<const unsigned char*> data(n);
+    std::vector<size_t> lengths(n);
+    std::vector<uint32_t> timestamps(n, time(NULL));
+    std::vector<pfwl_dissection_info_t> infos(n);
+    std::vector<pfwl_status_t> s(n);
+    for(size_t i = 0; i < n; i++){
+      data[i] = (const unsigned char*) pkts[first + i].c_str();
+      lengths[i] = pkts[first + i].size();
+    }
+    pfwl_dissect_batch(state, data.data(), lengths.data(), timestamps.data(), n,
+                       pcap._datalink_type, infos.data(), s.data());
+    for(size_t i = 0; i < n; i++){
+      statusesBatch.push_back(s[i]);
+      if(infos[i].l4.protocol == IPPROTO_TCP || infos[i].l4.protocol == IPPROTO_UDP){
+        for(size_t j = 0; j < infos[i].l7.protocols_num; j++){
+          if(infos[i].l7.protocols[j] < PFWL_PROTO_L7_NUM){
+            ++protocolsBatch[infos[i].l7.protocols[j]];
+          }
+        }
+      }
+    }
+  }
+  pfwl_terminate(state);
+  EXPECT_EQ(statuses, statusesBatch);
+  EXPECT_EQ(protocols, protocolsBatch);
+}
+
+static void dissectReused(const char* filename, pfwl_state_t* state, pfwl_dissection_info_t& reused){
+  Pcap pcap(filename);
+  std::pair<const u_char*, unsigned long> pkt;
+  pfwl_state_t* stateFresh = pfwl_init();
+  for(size_t i = 0; i < PFWL_FIELDS_L7_NUM; i++){
+    if(state->fields_to_extract[i]){
+      pfwl_field_add_L7(stateFresh, (pfwl_field_id_t) i);
+    }
+  }
+  while((pkt = pcap.getNextPacket()).first != NULL){
+    pfwl_dissection_info_t fresh;
+    memset(&fresh, 0, sizeof(fresh));
+    pfwl_status_t s = pfwl_dissect_from_L2(state, pkt.first, pkt.second, time(NULL), pcap._datalink_type, &reused);
+    pfwl_status_t sFresh = pfwl_dissect_from_L2(stateFresh, pkt.first, pkt.second, time(NULL), pcap._datalink_type, &fresh);
+    EXPECT_EQ(s, sFresh);
+    EXPECT_EQ(reused.l7.protocol, fresh.l7.protocol);
+    EXPECT_EQ(reused.l7.tags_num, fresh.l7.tags_num);
+    EXPECT_EQ(reused.flow_info.num_packets[0], fresh.flow_info.num_packets[0]);
+    for(size_t i = 0; i < PFWL_FIELDS_L7_NUM; i++){
+      pfwl_string_t str, strFresh;
+      EXPECT_EQ(reused.l7.protocol_fields[i].present, fresh.l7.protocol_fields[i].present);
+      if(pfwl_get_L7_field_type((pfwl_field_id_t) i) == PFWL_FIELD_TYPE_STRING &&
+         !pfwl_field_string_get(fresh.l7.protocol_fields, (pfwl_field_id_t) i, &strFresh)){
+        EXPECT_EQ(pfwl_field_string_get(reused.l7.protocol_fields, (pfwl_field_id_t) i, &str), 0);
+        EXPECT_EQ(std::string((const char*) str.value, str.length),
+                  std::string((const char*) strFresh.value, strFresh.length));
+      }
+    }
+  }
+  pfwl_terminate(stateFresh);
+}
+
+TEST(GenericTest, DissectionInfoReuse) {
+  pfwl_dissection_info_t reused;
+  memset(&reused, 0, sizeof(reused));
+  pfwl_state_t* state = pfwl_init();
+  pfwl_field_add_L7(state, PFWL_FIELDS_L7_HTTP_URL);
+  pfwl_field_add_L7(state, PFWL_FIELDS_L7_HTTP_BODY);
+  dissectReused("./pcaps/http.cap", state, reused);
+  pfwl_terminate(state);
+
+  // The fields set by the previous state must be reset as well.
+  state = pfwl_init();
+  pfwl_field_add_L7(state, PFWL_FIELDS_L7_DNS_NAME_SRV);
+  dissectReused("./pcaps/http.cap", state, reused);
+  pfwl_terminate(state);
+}
+
+TEST(GenericTest, DissectionInfoNotZeroed) {
+  Pcap pcap("./pcaps/http.cap");
+  std::pair<const u_char*, unsigned long> pkt = pcap.getNextPacket();
+  ASSERT_TRUE(pkt.first != NULL);
+  std::string p((const char*) pkt.first, pkt.second);
+  pfwl_state_t* state = pfwl_init();
+  // Garbage which may look like a dissection info filled by this state.
+  for(uint64_t id = 0; id < 4096; id++){
+    pfwl_dissection_info_t r;
+    memset(&r, 0xAB, sizeof(r));
+    r.l7.reset_id = id;
+    std::string copy = p;
+    pfwl_dissect_from_L2(state, (const unsigned char*) copy.c_str(), copy.size(), time(NULL), pcap._datalink_type, &r);
+    ASSERT_EQ(r.l7.tags_num, 0);
+    for(size_t i = 0; i < PFWL_FIELDS_L7_NUM; i++){
+      ASSERT_EQ(r.l7.protocol_fields[i].present, 0);
+    }
+  }
+  pfwl_terminate(state);
+}
+
+TEST(GenericTest, FlowInfoReference) {
+  Pcap pcap("./pcaps/whatsapp.pcap");
+  std::pair<const u_char*, unsigned long> pkt;
+  pfwl_state_t* state = pfwl_init();
+  pfwl_state_t* stateRef = pfwl_init();
+  EXPECT_EQ(pfwl_set_flow_info_mode(stateRef, PFWL_FLOW_INFO_MODE_REFERENCE), 0);
+  // Unknown modes are rejected, keeping the previous one.
+  EXPECT_EQ(pfwl_set_flow_info_mode(stateRef, (pfwl_flow_info_mode_t) 2), 1);
+  pfwl_dissection_info_t r, rRef;
+  memset(&r, 0, sizeof(r));
+  memset(&rRef, 0, sizeof(rRef));
+  size_t flows = 0;
+  while((pkt = pcap.getNextPacket()).first != NULL){
+    // Each state gets its own copy, since some inspectors modify the packet.
+    std::string p((const char*) pkt.first, pkt.second), pRef = p;
+    pfwl_status_t s = pfwl_dissect_from_L2(state, (const unsigned char*) p.c_str(), p.size(), time(NULL), pcap._datalink_type, &r);
+    pfwl_status_t sRef = pfwl_dissect_from_L2(stateRef, (const unsigned char*) pRef.c_str(), pRef.size(), time(NULL), pcap._datalink_type, &rRef);
+    EXPECT_EQ(s, sRef);
+    EXPECT_EQ(r.l7.protocol, rRef.l7.protocol);
+    EXPECT_TRUE(rRef.flow_info.udata == NULL);
+    if(r.flow_info.udata){
+      ASSERT_TRUE(rRef.flow_info_ref != NULL);
+      EXPECT_EQ(r.flow_info.id, rRef.flow_info_ref->id);
+      for(size_t i = 0; i < PFWL_STAT_NUM; i++){
+        EXPECT_EQ(r.flow_info.statistics[i][0], rRef.flow_info_ref->statistics[i][0]);
+        EXPECT_EQ(r.flow_info.statistics[i][1], rRef.flow_info_ref->statistics[i][1]);
+      }
+      ++flows;
+    }
+  }
+  EXPECT_GT(flows, 0);
+  pfwl_terminate(state);
+  pfwl_terminate(stateRef);
+}
+
+TEST(GenericTest, DissectBatchFlowInfoReference) {
+  Pcap pcap("./pcaps/http.cap");
+  std::pair<const u_char*, unsigned long> pkt;
+  std::vector<std::string> pkts;
+  while((pkt = pcap.getNextPacket()).first != NULL){
+    pkts.push_back(std::string((const char*) pkt.first, pkt.second));
+  }
+  peafowl::Peafowl state, stateBatch;
+  stateBatch.setFlowInfoMode(PFWL_FLOW_INFO_MODE_REFERENCE);
+  std::vector<uint32_t> timestamps(pkts.size(), time(NULL));
+  std::vector<std::string> copies = pkts;
+  std::vector<peafowl::DissectionInfo> infos = stateBatch.dissectBatch(copies, timestamps, pcap._datalink_type);
+  ASSERT_EQ(infos.size(), pkts.size());
+  size_t flows = 0;
+  for(size_t i = 0; i < pkts.size(); i++){
+    peafowl::DissectionInfo r = state.dissectFromL2(pkts[i], timestamps[i], pcap._datalink_type);
+    EXPECT_EQ(r.getStatus().getMessage(), infos[i].getStatus().getMessage());
+    if(!r.getStatus().isError() && (r.getL4().getProtocol().getId() == IPPROTO_TCP ||
+                                     r.getL4().getProtocol().getId() == IPPROTO_UDP)){
+      EXPECT_EQ(r.getFlowInfo().getId(), infos[i].getFlowInfo().getId());
+      EXPECT_EQ(r.getFlowInfo().getNumPackets(PFWL_DIRECTION_OUTBOUND),
+                infos[i].getFlowInfo().getNumPackets(PFWL_DIRECTION_OUTBOUND));
+      EXPECT_EQ(r.getFlowInfo().getNumPackets(PFWL_DIRECTION_INBOUND),
+                infos[i].getFlowInfo().getNumPackets(PFWL_DIRECTION_INBOUND));
+      ++flows;
+    }
+  }
+  EXPECT_GT(flows, 0);
+}
+
+TEST(GenericTest, GuessOrdering) {
+  std::vector<uint> protocols, protocolsAdaptive, protocolsStatic;
+  getProtocols("./pcaps/skype-irc.cap", protocols);
+
+  pfwl_state_t* state = pfwl_init();
+  EXPECT_EQ(pfwl_set_guess_ordering(state, PFWL_GUESS_ORDERING_ADAPTIVE), 0);
+  getProtocols("./pcaps/skype-irc.cap", protocolsAdaptive, state);
+  EXPECT_EQ(pfwl_guess_profile_export(state, "./guess_profile.txt"), 0);
+  pfwl_terminate(state);
+
+  state = pfwl_init();
+  EXPECT_EQ(pfwl_guess_profile_import(state, "./nonexisting_profile.txt"), 1);
+  EXPECT_EQ(pfwl_guess_profile_import(state, "./guess_profile.txt"), 0);
+  EXPECT_EQ(pfwl_set_guess_ordering(state, PFWL_GUESS_ORDERING_STATIC), 0);
+  getProtocols("./pcaps/skype-irc.cap", protocolsStatic, state);
+  pfwl_terminate(state);
+  remove("./guess_profile.txt");
+
+  EXPECT_EQ(protocols, protocolsAdaptive);
+  EXPECT_EQ(protocols, protocolsStatic);
+}
+
+TEST(GenericTest, GuessProfileSaturation) {
+  FILE* f = fopen("./guess_profile.txt", "w");
+  ASSERT_TRUE(f != NULL);
+  fprintf(f, "peafowl-guess-profile %d %d\n", PFWL_GUESS_PORT_BUCKETS, PFWL_GUESS_BYTE_CLASSES);
+  fprintf(f, "tcp 16 1 HTTP 4294967295\n");
+  fprintf(f, "tcp 16 1 HTTP 4294967295\n");
+  fclose(f);
+  pfwl_state_t* state = pfwl_init();
+  EXPECT_EQ(pfwl_guess_profile_import(state, "./guess_profile.txt"), 0);
+  EXPECT_EQ(pfwl_guess_profile_export(state, "./guess_profile.txt"), 0);
+  pfwl_terminate(state);
+
+  // The counter saturates instead of wrapping around.
+  std::ifstream in("./guess_profile.txt");
+  std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  remove("./guess_profile.txt");
+  EXPECT_NE(content.find("tcp 16 1 HTTP 4294967295\n"), std::string::npos) << content;
+}
+
+TEST(GenericTest, EnableAfterDisable) {
+  std::vector<uint> protocols, protocolsSubset;
+  getProtocols("./pcaps/ntp.pcap", protocols);
+
+  pfwl_state_t* state = pfwl_init();
+  pfwl_protocol_l7_disable_all(state);
+  pfwl_protocol_l7_enable(state, PFWL_PROTO_L7_NTP);
+  pfwl_protocol_l7_enable(state, PFWL_PROTO_L7_RTP);
+  getProtocols("./pcaps/ntp.pcap", protocolsSubset, state);
+  pfwl_terminate(state);
+
+  EXPECT_GT(protocols[PFWL_PROTO_L7_NTP], 0);
+  EXPECT_EQ(protocolsSubset[PFWL_PROTO_L7_NTP], protocols[PFWL_PROTO_L7_NTP]);
+  EXPECT_EQ(protocolsSubset[PFWL_PROTO_L7_DNS], 0);
+}
+
 TEST(GenericTest, MaxTrials) {
   pfwl_state_t* state = pfwl_init();
   std::vector<uint> protocols;
@@ -31,6 +465,15 @@ TEST(GenericTest, MaxTrials) {
 TEST(GenericTest, NullState) {
   EXPECT_EQ(pfwl_set_expected_flows(NULL, 0, 0), 1);
   EXPECT_EQ(pfwl_set_max_trials(NULL, 0), 1);
+  EXPECT_EQ(pfwl_set_flow_table_engine(NULL, PFWL_FLOW_TABLE_ENGINE_BUCKETED), 1);
+  EXPECT_EQ(pfwl_set_flow_table_hash(NULL, PFWL_FLOW_TABLE_HASH_CRC32C), 1);
+  EXPECT_EQ(pfwl_set_memory_allocator(NULL, PFWL_MEMORY_ALLOCATOR_SLAB), 1);
+  EXPECT_EQ(pfwl_get_memory_stats(NULL, NULL), 1);
+  EXPECT_EQ(pfwl_set_flow_timeout(NULL, PFWL_FLOW_TIMEOUT_TCP, 0), 1);
+  EXPECT_EQ(pfwl_set_flow_info_mode(NULL, PFWL_FLOW_INFO_MODE_REFERENCE), 1);
+  EXPECT_EQ(pfwl_set_guess_ordering(NULL, PFWL_GUESS_ORDERING_ADAPTIVE), 1);
+  EXPECT_EQ(pfwl_guess_profile_export(NULL, "./guess_profile.txt"), 1);
+  EXPECT_EQ(pfwl_guess_profile_import(NULL, "./guess_profile.txt"), 1);
   EXPECT_EQ(pfwl_defragmentation_enable_ipv4(NULL, 0), 1);
   EXPECT_EQ(pfwl_defragmentation_enable_ipv6(NULL, 0), 1);
   EXPECT_EQ(pfwl_defragmentation_set_per_host_memory_limit_ipv4(NULL, 0), 1);
@@ -43,6 +486,12 @@ TEST(GenericTest, NullState) {
   EXPECT_EQ(pfwl_defragmentation_disable_ipv6(NULL), 1);
   EXPECT_EQ(pfwl_tcp_reordering_enable(NULL), 1);
   EXPECT_EQ(pfwl_tcp_reordering_disable(NULL), 1);
+  EXPECT_EQ(pfwl_tcp_reordering_enable_pickup(NULL), 1);
+  EXPECT_EQ(pfwl_tcp_reordering_disable_pickup(NULL), 1);
+  EXPECT_EQ(pfwl_tcp_reordering_set_per_flow_memory_limit(NULL, 0), 1);
+  EXPECT_EQ(pfwl_tcp_reordering_set_per_partition_memory_limit(NULL, 0), 1);
+  EXPECT_EQ(pfwl_tcp_reordering_set_total_memory_limit(NULL, 0), 1);
+  EXPECT_EQ(pfwl_tcp_reordering_get_stats(NULL, NULL), 1);
   EXPECT_EQ(pfwl_protocol_l7_enable(NULL, PFWL_PROTO_L7_BGP), 1);
   EXPECT_EQ(pfwl_protocol_l7_disable(NULL, PFWL_PROTO_L7_BGP), 1);
   EXPECT_EQ(pfwl_protocol_l7_enable_all(NULL), 1);
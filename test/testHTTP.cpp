@@ -2,7 +2,10 @@
  *  Test for HTTP protocol.
  **/
 #include "common.h"
+#include <peafowl/flow_table.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <stddef.h>
 
 TEST(HTTPTest, Generic) {
     std::vector<uint> protocols;
@@ -138,6 +141,44 @@ TEST(HTTPTest, ContentType2) {
     }
 }
 
+TEST(HTTPTest, ResegmentedSpans) {
+  std::vector<uint> protocols;
+  pfwl_state_t* state = pfwl_init();
+  // JSON-RPC would be dissected on the HTTP payload, and needs it contiguous.
+  pfwl_protocol_l7_disable(state, PFWL_PROTO_L7_JSON_RPC);
+  pfwl_field_add_L7(state, PFWL_FIELDS_L7_HTTP_BODY);
+  size_t rebuilt = 0, contiguous = 0;
+  bool bodyFound = false;
+  getProtocols("./pcaps/tcp_resegment/http_ip_fragmented_out_of_order.pcap", protocols, state, [&](pfwl_status_t status, pfwl_dissection_info_t r){
+    if(r.l4.resegmented_pkt_len){
+      ++rebuilt;
+      std::string payload;
+      for(size_t i = 0; i < r.l4.payload_spans_num; i++){
+        payload.append((const char*) r.l4.payload_spans[i].data, r.l4.payload_spans[i].length);
+      }
+      EXPECT_GT(r.l4.payload_spans_num, 1);
+      EXPECT_EQ(payload.size(), r.l4.resegmented_pkt_len);
+      if(r.l4.resegmented_pkt){
+        ++contiguous;
+        EXPECT_EQ(payload, std::string((const char*) r.l4.resegmented_pkt, r.l4.resegmented_pkt_len));
+      }
+      pfwl_string_t field;
+      if(!pfwl_field_string_get(r.l7.protocol_fields, PFWL_FIELDS_L7_HTTP_BODY, &field)){
+        // The body is split between the packet and the stored data.
+        bodyFound = true;
+        EXPECT_FALSE(strncmp((const char*) field.value, "<!DOCTYPE HTML PUBLIC", 21));
+        EXPECT_EQ(std::string((const char*) field.value, field.length),
+                  payload.substr(payload.size() - field.length));
+      }
+    }
+  });
+  pfwl_terminate(state);
+  EXPECT_TRUE(bodyFound);
+  EXPECT_GT(rebuilt, 0);
+  // The flow is already identified as HTTP, the payload is not copied.
+  EXPECT_EQ(contiguous, 0);
+}
+
 TEST(HTTPTest, Tags) {
   pfwl_state_t* state = pfwl_init();
   pfwl_field_string_tags_add_L7(state, PFWL_FIELDS_L7_HTTP_URL, "load.html", PFWL_FIELD_MATCHING_SUFFIX, "TAG_SUFFIX");
@@ -216,3 +257,64 @@ TEST(HTTPTest, TagsFromFile) {
   pfwl_terminate(state);
 }
 
+
+static std::string httpSegment(uint16_t clientPort, bool fromClient, bool syn, uint32_t seq,
+                               uint32_t ack, const std::string& payload = ""){
+  std::string pkt(sizeof(struct iphdr) + sizeof(struct tcphdr), 0);
+  struct iphdr* ip = (struct iphdr*) &pkt[0];
+  ip->version = 4;
+  ip->ihl = 5;
+  ip->ttl = 64;
+  ip->tot_len = htons(pkt.size() + payload.size());
+  ip->protocol = IPPROTO_TCP;
+  ip->saddr = htonl(fromClient ? 0x0A000001 : 0x0A000002);
+  ip->daddr = htonl(fromClient ? 0x0A000002 : 0x0A000001);
+  struct tcphdr* tcp = (struct tcphdr*) &pkt[sizeof(struct iphdr)];
+  tcp->source = htons(fromClient ? clientPort : 80);
+  tcp->dest = htons(fromClient ? 80 : clientPort);
+  tcp->seq = htonl(seq);
+  tcp->ack_seq = htonl(ack);
+  tcp->doff = 5;
+  tcp->syn = syn;
+  tcp->ack = !syn || !fromClient;
+  tcp->psh = payload.size() ? 1 : 0;
+  tcp->window = htons(65535);
+  return pkt + payload;
+}
+
+// Opens a connection to port 80 and sends 'payload', returning the flow.
+static pfwl_flow_t* httpConnection(pfwl_state_t* state, uint16_t clientPort, const std::string& payload,
+                                   pfwl_dissection_info_t& r){
+  std::string segments[] = {httpSegment(clientPort, true, true, 1000, 0),
+                            httpSegment(clientPort, false, true, 5000, 1001),
+                            httpSegment(clientPort, true, false, 1001, 5001),
+                            httpSegment(clientPort, true, false, 1001, 5001, payload)};
+  for(size_t i = 0; i < (payload.empty() ? 3 : 4); i++){
+    pfwl_dissect_from_L3(state, (const unsigned char*) segments[i].c_str(), segments[i].size(), 1, &r);
+  }
+  return (pfwl_flow_t*) ((char*) r.flow_info_ref - offsetof(pfwl_flow_t, info));
+}
+
+TEST(HTTPTest, InspectorStateRecycled) {
+  pfwl_state_t* state = pfwl_init();
+  pfwl_protocol_l7_disable_all(state);
+  pfwl_protocol_l7_enable(state, PFWL_PROTO_L7_HTTP);
+  pfwl_dissection_info_t r;
+
+  pfwl_flow_t* flow = httpConnection(state, 40000, "", r);
+  void* block = pfwl_inspector_state_get(&flow->info_private, PFWL_INSPECTOR_STATE_HTTP);
+  ASSERT_TRUE(block != NULL);
+
+  // Data which is not HTTP releases the state.
+  std::string garbage("\x00\x01\x02\x03", 4);
+  std::string s = httpSegment(40000, true, false, 1001, 5001, garbage);
+  pfwl_dissect_from_L3(state, (const unsigned char*) s.c_str(), s.size(), 1, &r);
+  EXPECT_NE(r.l7.protocol, PFWL_PROTO_L7_HTTP);
+  EXPECT_TRUE(flow->info_private.inspectors_state[PFWL_INSPECTOR_STATE_HTTP] == NULL);
+
+  // The next flow takes it back from the free list.
+  flow = httpConnection(state, 40001, "GET /index.html HTTP/1.1\r\n\r\n", r);
+  EXPECT_EQ(r.l7.protocol, PFWL_PROTO_L7_HTTP);
+  EXPECT_EQ(flow->info_private.inspectors_state[PFWL_INSPECTOR_STATE_HTTP], block);
+  pfwl_terminate(state);
+}
@@ -2,6 +2,9 @@
  *  Test for IP fragmentation.
  **/
 #include "common.h"
+#include <peafowl/ipv4_reassembly.h>
+#include <peafowl/ipv6_reassembly.h>
+#include <peafowl/reassembly.h>
 
 static void test4in4(bool defrag){
   pfwl_state_t* state = pfwl_init();
@@ -113,6 +116,73 @@ TEST(IPFragmentation, sixInSixInner) {
   test6in6(false, "./pcaps/ip_fragmentation/6in6_inner.pcap", 4);
 }
 
+TEST(IPFragmentation, memoryLimits) {
+  std::vector<uint> protocols;
+  pfwl_memory_stats_t stats;
+  pfwl_state_t* state = pfwl_init();
+  getProtocols("./pcaps/ip_fragmentation/correct_1.pcap", protocols, state);
+  EXPECT_EQ(pfwl_get_memory_stats(state, &stats), 0);
+  pfwl_terminate(state);
+  EXPECT_EQ(protocols[PFWL_PROTO_L7_SIP], (uint) 1);
+  // All the datagrams have been rebuilt and given to the caller.
+  EXPECT_GT(stats.high_water[PFWL_MEMORY_FRAGMENTS], 0);
+  EXPECT_EQ(stats.used[PFWL_MEMORY_FRAGMENTS], 0);
+
+  // The fragments of the source do not fit in the per host limit.
+  protocols.clear();
+  state = pfwl_init();
+  EXPECT_EQ(pfwl_defragmentation_set_per_host_memory_limit_ipv4(state, 64), 0);
+  getProtocols("./pcaps/ip_fragmentation/correct_1.pcap", protocols, state);
+  pfwl_terminate(state);
+  EXPECT_EQ(protocols[PFWL_PROTO_L7_SIP], (uint) 0);
+}
+
+// Dissects the IP headers of a capture, steering each packet to a shard
+// as a multithreaded caller would do. Returns the rebuilt datagrams.
+static uint rebuildWithShards(const char* filename, uint16_t shards){
+  pfwl_state_t* state = pfwl_init();
+  EXPECT_EQ(pfwl_reordering_ipv4_fragmentation_set_shards((pfwl_ipv4_fragmentation_state_t*) state->ipv4_frag_state, 0), 1);
+  EXPECT_EQ(pfwl_reordering_ipv4_fragmentation_set_shards((pfwl_ipv4_fragmentation_state_t*) state->ipv4_frag_state, shards), 0);
+  EXPECT_EQ(pfwl_reordering_ipv6_fragmentation_set_shards((pfwl_ipv6_fragmentation_state_t*) state->ipv6_frag_state, shards), 0);
+  Pcap pcap(filename);
+  std::pair<const u_char*, unsigned long> pkt;
+  pfwl_dissection_info_t r;
+  uint rebuilt = 0;
+  while((pkt = pcap.getNextPacket()).first != NULL){
+    memset(&r, 0, sizeof(r));
+    if(pfwl_dissect_L2(pkt.first, pcap._datalink_type, &r) < PFWL_STATUS_OK){
+      continue;
+    }
+    const unsigned char* l3 = pkt.first + r.l2.length;
+    size_t length = pkt.second - r.l2.length;
+    uint16_t shard = pfwl_reassembly_ip_shard(l3, length, shards);
+    EXPECT_LT(shard, shards);
+    pfwl_status_t status = mc_pfwl_parse_L3_header(state, l3, length, time(NULL), shard, &r);
+    if(status == PFWL_STATUS_IP_DATA_REBUILT){
+      ++rebuilt;
+    }
+    if(r.l3.refrag_pkt){
+      free((unsigned char*) r.l3.refrag_pkt);
+    }
+  }
+  pfwl_memory_stats_t stats;
+  EXPECT_EQ(pfwl_get_memory_stats(state, &stats), 0);
+  EXPECT_EQ(stats.used[PFWL_MEMORY_FRAGMENTS], 0);
+  pfwl_terminate(state);
+  return rebuilt;
+}
+
+TEST(IPFragmentation, shards) {
+  const char* pcaps[] = {"./pcaps/ip_fragmentation/correct_1.pcap",
+                         "./pcaps/ip_fragmentation/4in4_outer.pcap",
+                         "./pcaps/ip_fragmentation/6in6_both.pcap"};
+  for(const char* filename : pcaps){
+    uint rebuilt = rebuildWithShards(filename, 1);
+    EXPECT_GT(rebuilt, (uint) 0);
+    EXPECT_EQ(rebuildWithShards(filename, 4), rebuilt);
+  }
+}
+
 TEST(IPFragmentation, overlapping) {
   std::vector<uint> protocols;
   getProtocols("./pcaps/ip_fragmentation/overlapping.pcap", protocols);
@@ -0,0 +1,550 @@
+/**
+ *  Tests for the multicore version.
+ **/
+#include "common.h"
+#include <peafowl/config.h>
+#include <peafowl/peafowl_mc.h>
+#include <algorithm>
+#include <dirent.h>
+#include <sys/time.h>
+
+typedef struct{
+  std::vector<std::string> packets; // Starting from the L3 header
+  size_t next;
+  std::vector<uint> protocols;
+  size_t processed;
+}McTestData;
+
+static void loadPcaps(const std::string& dirName, std::vector<std::string>& packets){
+  DIR* dir = opendir(dirName.c_str());
+  ASSERT_TRUE(dir != NULL);
+  std::vector<std::string> names;
+  struct dirent* entry;
+  while((entry = readdir(dir)) != NULL){
+    if(entry->d_name[0] != '.'){
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  for(auto& name : names){
+    std::string path = dirName + "/" + name;
+    DIR* subdir = opendir(path.c_str());
+    if(subdir){
+      closedir(subdir);
+      loadPcaps(path, packets);
+      continue;
+    }
+    if(path.size() < 5 || path.compare(path.size() - 5, 5, ".pcap")){
+      continue;
+    }
+    Pcap pcap(path.c_str());
+    std::pair<const u_char*, unsigned long> pkt;
+    pfwl_dissection_info_t r;
+    while((pkt = pcap.getNextPacket()).first != NULL){
+      memset(&r, 0, sizeof(r));
+      if(pfwl_dissect_L2(pkt.first, pcap._datalink_type, &r) >= PFWL_STATUS_OK &&
+         r.l2.length < pkt.second){
+        packets.push_back(std::string((const char*) pkt.first + r.l2.length,
+                                      pkt.second - r.l2.length));
+      }
+    }
+  }
+}
+
+static void countProtocols(pfwl_dissection_info_t* r, std::vector<uint>& protocols){
+  if(r->l4.protocol == IPPROTO_TCP || r->l4.protocol == IPPROTO_UDP){
+    for(size_t i = 0; i < r->l7.protocols_num; i++){
+      if(r->l7.protocols[i] < PFWL_PROTO_L7_NUM){
+        ++protocols[r->l7.protocols[i]];
+      }
+    }
+  }
+}
+
+static mc_pfwl_packet_reading_result_t readingCb(void* callback_data){
+  McTestData* data = (McTestData*) callback_data;
+  mc_pfwl_packet_reading_result_t res;
+  memset(&res, 0, sizeof(res));
+  if(data->next < data->packets.size()){
+    const std::string& pkt = data->packets[data->next++];
+    res.pkt = (const unsigned char*) pkt.data();
+    res.length = pkt.size();
+    res.current_time = 1;
+  }
+  return res;
+}
+
+static void processingCb(mc_pfwl_processing_result_t* processing_result, void* callback_data){
+  McTestData* data = (McTestData*) callback_data;
+  // Read by the reading callback, on the emitter thread.
+  __atomic_add_fetch(&data->processed, 1, __ATOMIC_RELEASE);
+  countProtocols(&(processing_result->result), data->protocols);
+}
+
+static double elapsedSeconds(struct timeval start){
+  struct timeval stop;
+  gettimeofday(&stop, NULL);
+  return (stop.tv_sec - start.tv_sec) + (stop.tv_usec - start.tv_usec) / 1e6;
+}
+
+// Dissects the packets on a single thread, returning the elapsed seconds.
+static double sequentialProtocols(const std::vector<std::string>& packets, std::vector<uint>& expected,
+                                  pfwl_field_id_t field = PFWL_FIELDS_L7_NUM){
+  expected.assign(PFWL_PROTO_L7_NUM, 0);
+  pfwl_state_t* state = pfwl_init();
+  if(field != PFWL_FIELDS_L7_NUM){
+    pfwl_field_add_L7(state, field);
+  }
+  pfwl_dissection_info_t r;
+  memset(&r, 0, sizeof(r));
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  for(auto& pkt : packets){
+    pfwl_dissect_from_L3(state, (const unsigned char*) pkt.data(), pkt.size(), 1, &r);
+    countProtocols(&r, expected);
+  }
+  double elapsed = elapsedSeconds(start);
+  pfwl_terminate(state);
+  return elapsed;
+}
+
+// If max_grain is not 0, packets wait for full batches.
+static void testCorpus(analysis_results form, uint32_t max_grain = 0){
+  McTestData data;
+  loadPcaps("./pcaps", data.packets);
+  ASSERT_GT(data.packets.size(), (size_t) 0);
+
+  // Sequential version
+  std::vector<uint> expected;
+  double sequential = sequentialProtocols(data.packets, expected);
+
+  // Multicore version
+  mc_pfwl_parallelism_details_t par;
+  memset(&par, 0, sizeof(par));
+  par.parallelism_form = form;
+  if(form == MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM){
+    par.available_processors = 6;
+    par.double_farm_num_L3_workers = 2;
+    par.double_farm_num_L7_workers = 2;
+  }else{
+    par.available_processors = 4;
+  }
+  mc_pfwl_state_t* mc_state = mc_pfwl_init(par);
+  data.next = 0;
+  data.processed = 0;
+  data.protocols.resize(PFWL_PROTO_L7_NUM);
+  mc_pfwl_set_core_callbacks(mc_state, readingCb, processingCb, &data);
+  if(max_grain){
+    EXPECT_EQ(mc_pfwl_set_batching(mc_state, 0, 1000), 0);
+    EXPECT_EQ(mc_pfwl_set_batching(mc_state, PFWL_MULTICORE_MAX_GRAIN_SIZE + 1, 1000), 0);
+    EXPECT_EQ(mc_pfwl_set_batching(mc_state, max_grain, 0), 0);
+    ASSERT_EQ(mc_pfwl_set_batching(mc_state, max_grain, 10000000), 1);
+  }
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  mc_pfwl_run(mc_state);
+  mc_pfwl_wait_end(mc_state);
+  double multicore = elapsedSeconds(start);
+
+  mc_pfwl_worker_load_t loads[2];
+  uint16_t workers = mc_pfwl_get_workers_load(mc_state, loads, 2);
+  EXPECT_EQ(workers, 2);
+  uint64_t dissected = 0;
+  for(uint16_t i = 0; i < workers; i++){
+    dissected += loads[i].packets;
+  }
+  // The flows are still stored, on the nodes of their workers.
+  pfwl_memory_stats_t nodes_stats[4];
+  uint16_t nodes = mc_pfwl_get_nodes_memory_stats(mc_state, nodes_stats, 4);
+  EXPECT_GE(nodes, 1);
+  size_t flows_memory = 0;
+  for(uint16_t i = 0; i < nodes; i++){
+    flows_memory += nodes_stats[i].used[PFWL_MEMORY_FLOWS];
+  }
+  EXPECT_GT(flows_memory, (size_t) 0);
+  for(uint16_t i = 0; i < workers; i++){
+    EXPECT_LT(loads[i].node, (int16_t) nodes);
+  }
+  for(uint stage = 0; stage < MC_PFWL_BATCHING_STAGES_NUM; stage++){
+    mc_pfwl_batching_stats_t stats;
+    ASSERT_EQ(mc_pfwl_get_batching_stats(mc_state, (mc_pfwl_batching_stage_t) stage, &stats), 1);
+    uint64_t batches = 0, latencies = 0;
+    for(size_t i = 0; i < MC_PFWL_BATCHING_HISTOGRAM_BUCKETS; i++){
+      batches += stats.sizes[i];
+      latencies += stats.latencies[i];
+    }
+    EXPECT_GT(stats.batches, (uint64_t) 0);
+    EXPECT_LE(stats.batches, (uint64_t) data.packets.size());
+    EXPECT_EQ(batches, stats.batches);
+    EXPECT_EQ(latencies, stats.batches);
+    if(max_grain){
+      // The grain grew, and the latency bound was never reached.
+      EXPECT_LT(stats.sizes[0], stats.batches);
+      EXPECT_EQ(stats.timeouts, (uint64_t) 0);
+    }
+  }
+  mc_pfwl_batching_stats_t stats;
+  EXPECT_EQ(mc_pfwl_get_batching_stats(mc_state, MC_PFWL_BATCHING_STAGES_NUM, &stats), 0);
+  mc_pfwl_terminate(mc_state);
+
+  EXPECT_EQ(data.processed, data.packets.size());
+  EXPECT_EQ(dissected, (uint64_t) data.packets.size());
+  for(size_t i = 0; i < PFWL_PROTO_L7_NUM; i++){
+    EXPECT_EQ(data.protocols[i], expected[i]) << pfwl_get_L7_protocol_name((pfwl_protocol_l7_t) i);
+  }
+  printf("%zu packets. Sequential: %.0f pps. Multicore: %.0f pps.\n",
+         data.packets.size(), data.packets.size() / sequential,
+         data.packets.size() / multicore);
+}
+
+TEST(MulticoreTest, OneFarm) {
+  testCorpus(MC_PFWL_PARALLELISM_FORM_ONE_FARM);
+}
+
+TEST(MulticoreTest, DoubleFarm) {
+  testCorpus(MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM);
+}
+
+TEST(MulticoreTest, Batching) {
+  testCorpus(MC_PFWL_PARALLELISM_FORM_ONE_FARM, PFWL_MULTICORE_MAX_GRAIN_SIZE);
+  testCorpus(MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM, PFWL_MULTICORE_MAX_GRAIN_SIZE);
+}
+
+// Some flows have many more packets than the others, and their partitions
+// are moved between the workers.
+TEST(MulticoreTest, Migration) {
+  McTestData data;
+  loadPcaps("./pcaps", data.packets);
+  std::vector<std::string> elephant;
+  loadPcaps("./pcaps/tcp_resegment", elephant);
+  ASSERT_GT(elephant.size(), (size_t) 0);
+  for(size_t i = 0; i < 20; i++){
+    data.packets.insert(data.packets.end(), elephant.begin(), elephant.end());
+  }
+  std::vector<uint> expected;
+  sequentialProtocols(data.packets, expected);
+
+  mc_pfwl_parallelism_details_t par;
+  memset(&par, 0, sizeof(par));
+  par.parallelism_form = MC_PFWL_PARALLELISM_FORM_ONE_FARM;
+  par.available_processors = 4;
+  mc_pfwl_state_t* mc_state = mc_pfwl_init(par);
+  data.next = 0;
+  data.processed = 0;
+  data.protocols.resize(PFWL_PROTO_L7_NUM);
+  mc_pfwl_set_core_callbacks(mc_state, readingCb, processingCb, &data);
+  // One packet per task, and a partition is moved at every check.
+  ASSERT_EQ(mc_pfwl_set_batching(mc_state, 1, 1000), 1);
+  ASSERT_EQ(mc_pfwl_set_rebalance_threshold(mc_state, 0), 1);
+  mc_pfwl_run(mc_state);
+  EXPECT_EQ(mc_pfwl_set_rebalance_threshold(mc_state, 0), 0);
+  mc_pfwl_wait_end(mc_state);
+
+  mc_pfwl_worker_load_t loads[2];
+  uint16_t workers = mc_pfwl_get_workers_load(mc_state, loads, 2);
+  EXPECT_EQ(workers, 2);
+  uint32_t migrations = 0, partitions = 0;
+  for(uint16_t i = 0; i < workers; i++){
+    migrations += loads[i].migrations;
+    partitions += loads[i].partitions;
+  }
+  mc_pfwl_terminate(mc_state);
+
+  EXPECT_GT(migrations, (uint32_t) 0);
+  EXPECT_EQ(partitions, (uint32_t) 2 * PFWL_MULTICORE_PARTITIONS_PER_WORKER);
+  EXPECT_EQ(data.processed, data.packets.size());
+  for(size_t i = 0; i < PFWL_PROTO_L7_NUM; i++){
+    EXPECT_EQ(data.protocols[i], expected[i]) << pfwl_get_L7_protocol_name((pfwl_protocol_l7_t) i);
+  }
+  printf("%zu packets, %u migrations.\n", data.packets.size(), migrations);
+}
+
+#define IDLE_EVERY 50
+#define IDLE_MIN_SECONDS 0.01
+#define IDLE_MAX_SECONDS 10
+#define IDLE_LATENCY_US 1000
+
+typedef struct : McTestData{
+  size_t idle_at;
+  struct timeval idle_since;
+  // Idle periods which ended with packets still waiting in partial batches.
+  size_t stalls;
+}IdleTestData;
+
+// Source which periodically has no packet for a while, without ending. It
+// stays idle until the packets already read are processed, waiting for
+// them only until the first stall.
+static mc_pfwl_packet_reading_result_t idleReadingCb(void* callback_data){
+  IdleTestData* data = (IdleTestData*) callback_data;
+  if(data->next % IDLE_EVERY == IDLE_EVERY - 1 && data->idle_at != data->next + 1){
+    if(data->idle_at != data->next){
+      data->idle_at = data->next;
+      gettimeofday(&data->idle_since, NULL);
+    }
+    double idle = elapsedSeconds(data->idle_since);
+    bool waiting = __atomic_load_n(&data->processed, __ATOMIC_ACQUIRE) < data->next;
+    if(idle < IDLE_MIN_SECONDS || (waiting && !data->stalls && idle < IDLE_MAX_SECONDS)){
+      usleep(100);
+      mc_pfwl_packet_reading_result_t res;
+      memset(&res, 0, sizeof(res));
+      res.pkt = MC_PFWL_NO_PACKET;
+      return res;
+    }
+    if(waiting){
+      ++data->stalls;
+    }
+    data->idle_at = data->next + 1;
+  }
+  return readingCb(callback_data);
+}
+
+// The partial batches are sent while the source is idle, not when the next
+// packet arrives.
+static void testIdle(analysis_results form){
+  IdleTestData data;
+  loadPcaps("./pcaps", data.packets);
+  ASSERT_GT(data.packets.size(), (size_t) IDLE_EVERY);
+  data.packets.resize(std::min(data.packets.size(), (size_t) 16 * IDLE_EVERY));
+
+  std::vector<uint> expected;
+  sequentialProtocols(data.packets, expected);
+
+  mc_pfwl_parallelism_details_t par;
+  memset(&par, 0, sizeof(par));
+  par.parallelism_form = form;
+  if(form == MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM){
+    par.available_processors = 6;
+    par.double_farm_num_L3_workers = 2;
+    par.double_farm_num_L7_workers = 2;
+  }else{
+    par.available_processors = 4;
+  }
+  mc_pfwl_state_t* mc_state = mc_pfwl_init(par);
+  data.next = 0;
+  data.processed = 0;
+  data.idle_at = SIZE_MAX;
+  data.stalls = 0;
+  data.protocols.resize(PFWL_PROTO_L7_NUM);
+  mc_pfwl_set_core_callbacks(mc_state, idleReadingCb, processingCb, &data);
+  ASSERT_EQ(mc_pfwl_set_batching(mc_state, PFWL_MULTICORE_MAX_GRAIN_SIZE, IDLE_LATENCY_US), 1);
+  mc_pfwl_run(mc_state);
+  mc_pfwl_wait_end(mc_state);
+
+  EXPECT_EQ(data.stalls, (size_t) 0) << "Form " << form;
+  for(uint stage = 0; stage < MC_PFWL_BATCHING_STAGES_NUM; stage++){
+    mc_pfwl_batching_stats_t stats;
+    ASSERT_EQ(mc_pfwl_get_batching_stats(mc_state, (mc_pfwl_batching_stage_t) stage, &stats), 1);
+    uint64_t latencies = 0, expired = 0;
+    for(size_t i = 0; i < MC_PFWL_BATCHING_HISTOGRAM_BUCKETS; i++){
+      latencies += stats.latencies[i];
+      // Waited at least the latency.
+      if((1ul << (i + 1)) > IDLE_LATENCY_US){
+        expired += stats.latencies[i];
+      }
+    }
+    EXPECT_GT(stats.timeouts, (uint64_t) 0) << "Form " << form << ", stage " << stage;
+    EXPECT_EQ(latencies, stats.batches) << "Form " << form << ", stage " << stage;
+    EXPECT_GT(expired, (uint64_t) 0) << "Form " << form << ", stage " << stage;
+  }
+  mc_pfwl_terminate(mc_state);
+
+  EXPECT_EQ(data.processed, data.packets.size());
+  for(size_t i = 0; i < PFWL_PROTO_L7_NUM; i++){
+    EXPECT_EQ(data.protocols[i], expected[i]) << pfwl_get_L7_protocol_name((pfwl_protocol_l7_t) i);
+  }
+}
+
+TEST(MulticoreTest, BatchingIdle) {
+  testIdle(MC_PFWL_PARALLELISM_FORM_ONE_FARM);
+  testIdle(MC_PFWL_PARALLELISM_FORM_DOUBLE_FARM);
+}
+
+#define NUM_SHARDS 2
+
+typedef struct{
+  // Written only by the thread of each shard.
+  std::vector<uint> protocols[NUM_SHARDS];
+  size_t processed[NUM_SHARDS];
+}ShardedTestData;
+
+static void shardedCb(uint16_t shard, pfwl_status_t, pfwl_dissection_info_t* r,
+                      void*, void* callback_data){
+  ShardedTestData* data = (ShardedTestData*) callback_data;
+  ++data->processed[shard];
+  countProtocols(r, data->protocols[shard]);
+}
+
+TEST(MulticoreTest, Sharded) {
+  std::vector<std::string> packets;
+  loadPcaps("./pcaps", packets);
+  ASSERT_GT(packets.size(), (size_t) 0);
+
+  std::vector<uint> expected;
+  sequentialProtocols(packets, expected);
+
+  ShardedTestData data;
+  for(size_t i = 0; i < NUM_SHARDS; i++){
+    data.protocols[i].resize(PFWL_PROTO_L7_NUM);
+    data.processed[i] = 0;
+  }
+  pfwl_sharded_state_t* sharded = pfwl_sharded_init(NUM_SHARDS, 1, PFWL_PROTO_L2_RAW, NULL);
+  ASSERT_TRUE(sharded != NULL);
+  EXPECT_TRUE(pfwl_sharded_get_state(sharded, 0) != NULL);
+  EXPECT_TRUE(pfwl_sharded_get_state(sharded, NUM_SHARDS) == NULL);
+  pfwl_sharded_set_callback(sharded, shardedCb, &data);
+  ASSERT_EQ(pfwl_sharded_run(sharded), 1);
+  struct timeval start;
+  gettimeofday(&start, NULL);
+  for(auto& pkt : packets){
+    while(!pfwl_sharded_dissect(sharded, 0, (const unsigned char*) pkt.data(), pkt.size(), 1, NULL)){
+      ;
+    }
+  }
+  pfwl_sharded_terminate(sharded);
+  double elapsed = elapsedSeconds(start);
+
+  std::vector<uint> protocols(PFWL_PROTO_L7_NUM);
+  size_t processed = 0;
+  for(size_t i = 0; i < NUM_SHARDS; i++){
+    processed += data.processed[i];
+    for(size_t j = 0; j < PFWL_PROTO_L7_NUM; j++){
+      protocols[j] += data.protocols[i][j];
+    }
+  }
+  EXPECT_EQ(processed, packets.size());
+  for(size_t i = 0; i < PFWL_PROTO_L7_NUM; i++){
+    EXPECT_EQ(protocols[i], expected[i]) << pfwl_get_L7_protocol_name((pfwl_protocol_l7_t) i);
+  }
+  printf("%zu packets. Sharded: %.0f pps.\n", packets.size(), packets.size() / elapsed);
+}
+
+typedef struct{
+  std::vector<mc_pfwl_scaling_decision_t> decisions;
+  uint16_t min_active;
+}ScalingTestData;
+
+static void scalingCb(mc_pfwl_scaling_stats_t* stats, void* callback_data){
+  ScalingTestData* data = (ScalingTestData*) callback_data;
+  data->decisions.push_back(stats->decision);
+  data->min_active = std::min(data->min_active, stats->active_workers);
+}
+
+// Slow source, which lets the workers keep up with the emitter.
+static mc_pfwl_packet_reading_result_t pacedReadingCb(void* callback_data){
+  McTestData* data = (McTestData*) callback_data;
+  if(data->next % 64 == 0){
+    usleep(1000);
+  }
+  return readingCb(callback_data);
+}
+
+TEST(MulticoreTest, Elastic) {
+  McTestData data;
+  std::vector<std::string> corpus;
+  loadPcaps("./pcaps", corpus);
+  ASSERT_GT(corpus.size(), (size_t) 0);
+  // Long enough for several scaling periods.
+  for(size_t i = 0; i < 5; i++){
+    data.packets.insert(data.packets.end(), corpus.begin(), corpus.end());
+  }
+
+  std::vector<uint> expected;
+  sequentialProtocols(data.packets, expected);
+
+  mc_pfwl_parallelism_details_t par;
+  memset(&par, 0, sizeof(par));
+  par.parallelism_form = MC_PFWL_PARALLELISM_FORM_ONE_FARM;
+  par.available_processors = 5;
+  mc_pfwl_state_t* mc_state = mc_pfwl_init(par);
+  data.next = 0;
+  data.processed = 0;
+  data.protocols.resize(PFWL_PROTO_L7_NUM);
+  mc_pfwl_set_core_callbacks(mc_state, pacedReadingCb, processingCb, &data);
+
+  ScalingTestData scaling_data;
+  scaling_data.min_active = UINT16_MAX;
+  mc_pfwl_scaling_parameters_t params;
+  memset(&params, 0, sizeof(params));
+  params.min_workers = 4;
+  EXPECT_EQ(mc_pfwl_set_scaling(mc_state, params), 0);
+  params.min_workers = 1;
+  params.low_utilization = 0.5;
+  params.high_utilization = 0.5;
+  EXPECT_EQ(mc_pfwl_set_scaling(mc_state, params), 0);
+  // Always below the low threshold: the workers are deactivated.
+  params.period_ms = 1;
+  params.low_utilization = 1.0;
+  params.high_utilization = 2.0;
+  params.high_backlog = 1e9;
+  params.callback = scalingCb;
+  params.callback_data = &scaling_data;
+  ASSERT_EQ(mc_pfwl_set_scaling(mc_state, params), 1);
+
+  mc_pfwl_run(mc_state);
+  mc_pfwl_wait_end(mc_state);
+  mc_pfwl_worker_load_t loads[3];
+  uint16_t workers = mc_pfwl_get_workers_load(mc_state, loads, 3);
+  EXPECT_EQ(workers, 3);
+  uint64_t dissected = 0;
+  for(uint16_t i = 0; i < workers; i++){
+    dissected += loads[i].packets;
+  }
+  mc_pfwl_terminate(mc_state);
+
+  EXPECT_NE(std::find(scaling_data.decisions.begin(), scaling_data.decisions.end(),
+                      MC_PFWL_SCALING_DOWN), scaling_data.decisions.end());
+  EXPECT_GE(scaling_data.min_active, 1);
+  EXPECT_EQ(data.processed, data.packets.size());
+  EXPECT_EQ(dissected, (uint64_t) data.packets.size());
+  for(size_t i = 0; i < PFWL_PROTO_L7_NUM; i++){
+    EXPECT_EQ(data.protocols[i], expected[i]) << pfwl_get_L7_protocol_name((pfwl_protocol_l7_t) i);
+  }
+}
+
+// The rules of an extracted field are replaced while the workers use them,
+// but a field can't be enabled while they are running.
+TEST(MulticoreTest, PublishTags) {
+  McTestData data;
+  loadPcaps("./pcaps", data.packets);
+  ASSERT_GT(data.packets.size(), (size_t) 0);
+  pfwl_field_id_t field = PFWL_FIELDS_L7_HTTP_URL, other = PFWL_FIELDS_L7_HTTP_BODY;
+  std::vector<uint> expected;
+  sequentialProtocols(data.packets, expected, field);
+
+  pfwl_field_tags_t* tags[2];
+  tags[0] = pfwl_field_tags_compile_L7(field, "./tags/http_url.json");
+  tags[1] = pfwl_field_tags_compile_L7(field, NULL);
+  pfwl_field_tags_t* other_tags = pfwl_field_tags_compile_L7(other, NULL);
+  ASSERT_TRUE(tags[0] && tags[1] && other_tags);
+
+  mc_pfwl_parallelism_details_t par;
+  memset(&par, 0, sizeof(par));
+  par.parallelism_form = MC_PFWL_PARALLELISM_FORM_ONE_FARM;
+  par.available_processors = 4;
+  mc_pfwl_state_t* mc_state = mc_pfwl_init(par);
+  data.next = 0;
+  data.processed = 0;
+  data.protocols.resize(PFWL_PROTO_L7_NUM);
+  mc_pfwl_set_core_callbacks(mc_state, pacedReadingCb, processingCb, &data);
+  ASSERT_EQ(mc_pfwl_field_tags_publish_L7(mc_state, field, tags[0]), 1);
+  mc_pfwl_run(mc_state);
+  size_t published = 0;
+  while(__atomic_load_n(&data.processed, __ATOMIC_ACQUIRE) < data.packets.size()){
+    EXPECT_EQ(mc_pfwl_field_tags_publish_L7(mc_state, other, other_tags), 0);
+    EXPECT_EQ(mc_pfwl_field_tags_publish_L7(mc_state, field, tags[published % 2]), 1);
+    ++published;
+    usleep(100);
+  }
+  mc_pfwl_wait_end(mc_state);
+  mc_pfwl_terminate(mc_state);
+  pfwl_field_tags_release_L7(tags[0]);
+  pfwl_field_tags_release_L7(tags[1]);
+  pfwl_field_tags_release_L7(other_tags);
+
+  EXPECT_GT(published, (size_t) 0);
+  EXPECT_EQ(data.processed, data.packets.size());
+  for(size_t i = 0; i < PFWL_PROTO_L7_NUM; i++){
+    EXPECT_EQ(data.protocols[i], expected[i]) << pfwl_get_L7_protocol_name((pfwl_protocol_l7_t) i);
+  }
+}
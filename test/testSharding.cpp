@@ -0,0 +1,141 @@
+/**
+ *  Tests for the assignment of packets to shards.
+ **/
+#include "common.h"
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <set>
+
+#define NUM_SHARDS 4
+
+static std::string ipv4Packet(uint32_t src, uint32_t dst, uint16_t sport,
+                              uint16_t dport, uint16_t fragOff = 0,
+                              uint8_t protocol = IPPROTO_UDP){
+  std::string pkt(sizeof(struct iphdr) + sizeof(struct udphdr), 0);
+  struct iphdr* ip = (struct iphdr*) &pkt[0];
+  ip->version = 4;
+  ip->ihl = 5;
+  ip->tot_len = htons(pkt.size());
+  ip->frag_off = htons(fragOff);
+  ip->protocol = protocol;
+  ip->saddr = htonl(src);
+  ip->daddr = htonl(dst);
+  struct udphdr* udp = (struct udphdr*) &pkt[sizeof(struct iphdr)];
+  udp->source = htons(sport);
+  udp->dest = htons(dport);
+  return pkt;
+}
+
+static uint16_t shardOf(const std::string& pkt){
+  return pfwl_shard_of((const unsigned char*) pkt.data(), pkt.size(), PFWL_PROTO_L2_RAW, NUM_SHARDS);
+}
+
+TEST(ShardingTest, Symmetric) {
+  std::set<uint16_t> shards;
+  for(uint16_t port = 1000; port < 1064; port++){
+    uint16_t shard = shardOf(ipv4Packet(0x0A000001, 0x0A000002, port, 80, 0, IPPROTO_TCP));
+    EXPECT_LT(shard, NUM_SHARDS);
+    EXPECT_EQ(shard, shardOf(ipv4Packet(0x0A000002, 0x0A000001, 80, port, 0, IPPROTO_TCP)));
+    shards.insert(shard);
+  }
+  // The ports are part of the hash of TCP segments.
+  EXPECT_GT(shards.size(), (size_t) 1);
+
+  std::string pkt6(sizeof(struct ip6_hdr) + sizeof(struct udphdr), 0);
+  struct ip6_hdr* ip6 = (struct ip6_hdr*) &pkt6[0];
+  ip6->ip6_vfc = 6 << 4;
+  ip6->ip6_plen = htons(sizeof(struct udphdr));
+  ip6->ip6_nxt = IPPROTO_UDP;
+  ip6->ip6_src.s6_addr[15] = 1;
+  ip6->ip6_dst.s6_addr[15] = 2;
+  struct udphdr* udp = (struct udphdr*) &pkt6[sizeof(struct ip6_hdr)];
+  udp->source = htons(1000);
+  udp->dest = htons(53);
+  uint16_t shard = shardOf(pkt6);
+  std::swap(ip6->ip6_src, ip6->ip6_dst);
+  std::swap(udp->source, udp->dest);
+  EXPECT_EQ(shard, shardOf(pkt6));
+}
+
+TEST(ShardingTest, Fragments) {
+  for(uint16_t port = 1000; port < 1064; port++){
+    // First fragment (with the ports) and a following one.
+    uint16_t shard = shardOf(ipv4Packet(0x0A000001, 0x0A000002, port, 53, 0x2000));
+    EXPECT_EQ(shard, shardOf(ipv4Packet(0x0A000001, 0x0A000002, 0, 0, 0x0010)));
+    // Unfragmented datagrams of the same flow, in both directions.
+    EXPECT_EQ(shard, shardOf(ipv4Packet(0x0A000001, 0x0A000002, port, 53)));
+    EXPECT_EQ(shard, shardOf(ipv4Packet(0x0A000002, 0x0A000001, 53, port)));
+  }
+}
+
+TEST(ShardingTest, Tunnels) {
+  std::set<uint16_t> shards;
+  for(uint32_t host = 1; host < 64; host++){
+    std::string inner = ipv4Packet(0xC0A80000 + host, 0xC0A800FF, 1000, 53);
+    std::string pkt = ipv4Packet(0x0A000001, 0x0A000002, 0, 0).substr(0, sizeof(struct iphdr)) + inner;
+    struct iphdr* outer = (struct iphdr*) &pkt[0];
+    outer->protocol = IPPROTO_IPIP;
+    outer->tot_len = htons(pkt.size());
+    // The shard only depends on the inner header.
+    EXPECT_EQ(shardOf(pkt), shardOf(inner));
+    shards.insert(shardOf(pkt));
+  }
+  EXPECT_GT(shards.size(), (size_t) 1);
+}
+
+TEST(ShardingTest, Truncated) {
+  // A hop-by-hop header longer than the packet, followed by an IPv4 tunnel.
+  std::string pkt(sizeof(struct ip6_hdr) + 22, 0);
+  struct ip6_hdr* ip6 = (struct ip6_hdr*) &pkt[0];
+  ip6->ip6_vfc = 6 << 4;
+  ip6->ip6_plen = htons(22);
+  ip6->ip6_nxt = IPPROTO_HOPOPTS;
+  pkt[sizeof(struct ip6_hdr)] = IPPROTO_IPIP;
+  pkt[sizeof(struct ip6_hdr) + 1] = (char) 255;
+  EXPECT_LT(shardOf(pkt), NUM_SHARDS);
+}
+
+TEST(ShardingTest, NotIP) {
+  std::string pkt(10, 0);
+  EXPECT_EQ(shardOf(pkt), 0);
+  EXPECT_EQ(pfwl_shard_of((const unsigned char*) pkt.data(), pkt.size(), PFWL_PROTO_L2_RAW, 1), 0);
+}
+
+// Dissecting each packet with the state of its shard gives the same
+// protocols of a single state.
+TEST(ShardingTest, Corpus) {
+  const char* pcaps[] = {"./pcaps/http.cap", "./pcaps/dhcpv6_1.pcap",
+                         "./pcaps/6in4tunnel.pcap", "./pcaps/ssl.pcapng",
+                         "./pcaps/ip_fragmentation/correct_1.pcap",
+                         "./pcaps/ip_fragmentation/6in6_both.pcap"};
+  for(const char* filename : pcaps){
+    std::vector<uint> expected, protocols(PFWL_PROTO_L7_NUM);
+    getProtocols(filename, expected);
+
+    pfwl_state_t* states[NUM_SHARDS];
+    for(size_t i = 0; i < NUM_SHARDS; i++){
+      states[i] = pfwl_init();
+    }
+    Pcap pcap(filename);
+    std::pair<const u_char*, unsigned long> pkt;
+    pfwl_dissection_info_t r;
+    memset(&r, 0, sizeof(r));
+    while((pkt = pcap.getNextPacket()).first != NULL){
+      uint16_t shard = pfwl_shard_of(pkt.first, pkt.second, pcap._datalink_type, NUM_SHARDS);
+      ASSERT_LT(shard, NUM_SHARDS);
+      pfwl_dissect_from_L2(states[shard], pkt.first, pkt.second, time(NULL), pcap._datalink_type, &r);
+      if(r.l4.protocol == IPPROTO_TCP || r.l4.protocol == IPPROTO_UDP){
+        for(size_t i = 0; i < r.l7.protocols_num; i++){
+          if(r.l7.protocols[i] < PFWL_PROTO_L7_NUM){
+            ++protocols[r.l7.protocols[i]];
+          }
+        }
+      }
+    }
+    for(size_t i = 0; i < NUM_SHARDS; i++){
+      pfwl_terminate(states[i]);
+    }
+    EXPECT_EQ(protocols, expected) << filename;
+  }
+}
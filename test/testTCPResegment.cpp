@@ -2,6 +2,8 @@
  *  Test for TCP resegmentation.
  **/
 #include "common.h"
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
 
 TEST(TCPResegmentation, Generic) {
     const char* filenames[] = {"./pcaps/tcp_resegment/http_ip_fragmented_out_of_order.pcap",
@@ -14,6 +16,8 @@ TEST(TCPResegmentation, Generic) {
                                "./pcaps/tcp_resegment/http_seq_num_wrapping.pcap",};
     uint expected_http_packets[] = {8, 8, 8, 3, 9, 5, 6, 8};
     uint expected_http_packets_without_reordering[] = {8, 8, 8, 8, 9, 6, 7, 8};
+    // Connections without handshake are inspected from their first segment
+    uint expected_http_packets_with_pickup[] = {8, 8, 8, 8, 9, 5, 6, 8};
     size_t numtests = sizeof(expected_http_packets) / sizeof(expected_http_packets[0]);
     for(size_t i = 0; i < numtests; i++){
       std::vector<uint> protocols;
@@ -34,4 +38,171 @@ TEST(TCPResegmentation, Generic) {
 
       pfwl_terminate(state);
     }
+
+    for(size_t i = 0; i < numtests; i++){
+      std::vector<uint> protocols;
+      pfwl_state* state = pfwl_init();
+      pfwl_tcp_reordering_enable_pickup(state);
+      getProtocols(filenames[i], protocols, state);
+      EXPECT_EQ(protocols[PFWL_PROTO_L7_HTTP], expected_http_packets_with_pickup[i]);
+
+      pfwl_terminate(state);
+    }
+}
+
+static const uint32_t CLIENT = 0x0A000001, SERVER = 0x0A000002;
+static const uint32_t CLIENT_ISN = 1000, SERVER_ISN = 5000;
+static const std::string REQUEST[] = {"GET /index.html HTTP/1.1\r\n",
+                                      "Host: www.example.com\r\n",
+                                      "User-Agent: peafowl\r\n\r\n",
+                                      "GET /next.html HTTP/1.1\r\n"};
+
+static std::string tcpSegment(bool fromClient, uint32_t seq, uint32_t ack,
+                              const std::string& payload = ""){
+  std::string pkt(sizeof(struct iphdr) + sizeof(struct tcphdr), 0);
+  struct iphdr* ip = (struct iphdr*) &pkt[0];
+  ip->version = 4;
+  ip->ihl = 5;
+  ip->ttl = 64;
+  ip->tot_len = htons(pkt.size() + payload.size());
+  ip->protocol = IPPROTO_TCP;
+  ip->saddr = htonl(fromClient ? CLIENT : SERVER);
+  ip->daddr = htonl(fromClient ? SERVER : CLIENT);
+  struct tcphdr* tcp = (struct tcphdr*) &pkt[sizeof(struct iphdr)];
+  tcp->source = htons(fromClient ? 40000 : 80);
+  tcp->dest = htons(fromClient ? 80 : 40000);
+  tcp->seq = htonl(seq);
+  tcp->ack_seq = htonl(ack);
+  tcp->doff = 5;
+  tcp->ack = 1;
+  tcp->psh = payload.size() ? 1 : 0;
+  tcp->window = htons(65535);
+  return pkt + payload;
+}
+
+// Sequence number of the i-th piece of the request.
+static uint32_t requestSeq(size_t i){
+  uint32_t seq = CLIENT_ISN;
+  for(size_t j = 0; j < i; j++){
+    seq += REQUEST[j].size();
+  }
+  return seq;
+}
+
+static pfwl_status_t dissectSegment(pfwl_state_t* state, const std::string& segment, pfwl_dissection_info_t& r){
+  return pfwl_dissect_from_L3(state, (const unsigned char*) segment.c_str(), segment.size(), 1, &r);
+}
+
+static std::string resegmentedPayload(const pfwl_dissection_info_t& r){
+  std::string payload;
+  for(size_t i = 0; i < r.l4.payload_spans_num; i++){
+    payload.append((const char*) r.l4.payload_spans[i].data, r.l4.payload_spans[i].length);
+  }
+  return payload;
+}
+
+static pfwl_state_t* pickupState(){
+  pfwl_state_t* state = pfwl_init();
+  pfwl_tcp_reordering_enable_pickup(state);
+  pfwl_field_add_L7(state, PFWL_FIELDS_L7_HTTP_URL);
+  pfwl_field_add_L7(state, PFWL_FIELDS_L7_HTTP_HEADERS);
+  return state;
+}
+
+// A segment received after the pickup fills the gap before a buffered one.
+TEST(TCPResegmentation, PickupGapFilled) {
+  pfwl_state_t* state = pickupState();
+  pfwl_dissection_info_t r;
+  memset(&r, 0, sizeof(r));
+  pfwl_string_t field;
+
+  std::string first = tcpSegment(true, requestSeq(0), SERVER_ISN, REQUEST[0]);
+  EXPECT_EQ(dissectSegment(state, first, r), PFWL_STATUS_OK);
+  EXPECT_EQ(r.l4.resegmented_pkt_len, 0);
+  EXPECT_EQ(r.l7.protocol, PFWL_PROTO_L7_HTTP);
+  ASSERT_EQ(pfwl_field_string_get(r.l7.protocol_fields, PFWL_FIELDS_L7_HTTP_URL, &field), 0);
+  EXPECT_EQ(std::string((const char*) field.value, field.length), "/index.html");
+
+  std::string third = tcpSegment(true, requestSeq(2), SERVER_ISN, REQUEST[2]);
+  EXPECT_EQ(dissectSegment(state, third, r), PFWL_STATUS_TCP_OUT_OF_ORDER);
+
+  std::string second = tcpSegment(true, requestSeq(1), SERVER_ISN, REQUEST[1]);
+  EXPECT_EQ(dissectSegment(state, second, r), PFWL_STATUS_OK);
+  EXPECT_EQ(r.l4.resegmented_pkt_len, REQUEST[1].size() + REQUEST[2].size());
+  EXPECT_EQ(resegmentedPayload(r), REQUEST[1] + REQUEST[2]);
+  EXPECT_EQ(r.l7.protocol, PFWL_PROTO_L7_HTTP);
+  ASSERT_EQ(pfwl_http_get_header(&r, "Host", &field), 0);
+  EXPECT_EQ(std::string((const char*) field.value, field.length), "www.example.com");
+  ASSERT_EQ(pfwl_http_get_header(&r, "User-Agent", &field), 0);
+  EXPECT_EQ(std::string((const char*) field.value, field.length), "peafowl");
+
+  // The following data is in order.
+  std::string fourth = tcpSegment(true, requestSeq(3), SERVER_ISN, REQUEST[3]);
+  EXPECT_EQ(dissectSegment(state, fourth, r), PFWL_STATUS_OK);
+  EXPECT_EQ(r.l4.resegmented_pkt_len, 0);
+  EXPECT_EQ(r.flow_info.statistics[PFWL_STAT_L4_TCP_COUNT_RETRANSMISSIONS][r.l4.direction], 0);
+  pfwl_terminate(state);
+}
+
+// A segment sent before the one the connection was picked up on arrives
+// late. It is inspected as it is, until the peer confirms the pickup.
+TEST(TCPResegmentation, PickupPrecedingSegment) {
+  pfwl_state_t* state = pickupState();
+  pfwl_dissection_info_t r;
+  memset(&r, 0, sizeof(r));
+  pfwl_string_t field;
+
+  std::string second = tcpSegment(true, requestSeq(1), SERVER_ISN, REQUEST[1]);
+  EXPECT_EQ(dissectSegment(state, second, r), PFWL_STATUS_OK);
+
+  std::string first = tcpSegment(true, requestSeq(0), SERVER_ISN, REQUEST[0]);
+  EXPECT_EQ(dissectSegment(state, first, r), PFWL_STATUS_OK);
+  EXPECT_EQ(r.l4.payload_length, REQUEST[0].size());
+  EXPECT_EQ(r.l4.resegmented_pkt_len, 0);
+  EXPECT_EQ(r.l7.protocol, PFWL_PROTO_L7_HTTP);
+  ASSERT_EQ(pfwl_field_string_get(r.l7.protocol_fields, PFWL_FIELDS_L7_HTTP_URL, &field), 0);
+  EXPECT_EQ(std::string((const char*) field.value, field.length), "/index.html");
+
+  // The expected sequence number was not moved back.
+  std::string third = tcpSegment(true, requestSeq(2), SERVER_ISN, REQUEST[2]);
+  EXPECT_EQ(dissectSegment(state, third, r), PFWL_STATUS_OK);
+  EXPECT_EQ(r.flow_info.statistics[PFWL_STAT_L4_TCP_COUNT_RETRANSMISSIONS][r.l4.direction], 0);
+
+  // Once the server acknowledges the pickup point, the first segment is
+  // a retransmission.
+  std::string ack = tcpSegment(false, SERVER_ISN, requestSeq(3));
+  EXPECT_EQ(dissectSegment(state, ack, r), PFWL_STATUS_OK);
+  EXPECT_EQ(dissectSegment(state, first, r), PFWL_STATUS_TCP_OUT_OF_ORDER);
+  EXPECT_EQ(r.flow_info.statistics[PFWL_STAT_L4_TCP_COUNT_RETRANSMISSIONS][r.l4.direction], 1);
+  pfwl_terminate(state);
+}
+
+// The server acknowledges data which was never seen, the client direction
+// is resynchronized on its next segment.
+TEST(TCPResegmentation, PickupResynchronization) {
+  pfwl_state_t* state = pickupState();
+  pfwl_dissection_info_t r;
+  memset(&r, 0, sizeof(r));
+
+  std::string first = tcpSegment(true, requestSeq(0), SERVER_ISN, REQUEST[0]);
+  EXPECT_EQ(dissectSegment(state, first, r), PFWL_STATUS_OK);
+  // Buffered, waiting for the second piece.
+  std::string third = tcpSegment(true, requestSeq(2), SERVER_ISN, REQUEST[2]);
+  EXPECT_EQ(dissectSegment(state, third, r), PFWL_STATUS_TCP_OUT_OF_ORDER);
+
+  std::string ack = tcpSegment(false, SERVER_ISN, requestSeq(3));
+  EXPECT_EQ(dissectSegment(state, ack, r), PFWL_STATUS_OK);
+
+  std::string fourth = tcpSegment(true, requestSeq(3), SERVER_ISN, REQUEST[3]);
+  EXPECT_EQ(dissectSegment(state, fourth, r), PFWL_STATUS_OK);
+  EXPECT_EQ(r.l4.payload_length, REQUEST[3].size());
+  // The buffered data was dropped rather than delivered with this segment.
+  EXPECT_EQ(r.l4.resegmented_pkt_len, 0);
+
+  // And the direction is in order again.
+  std::string next = tcpSegment(true, requestSeq(4), SERVER_ISN, REQUEST[0]);
+  EXPECT_EQ(dissectSegment(state, next, r), PFWL_STATUS_OK);
+  EXPECT_EQ(r.l4.resegmented_pkt_len, 0);
+  EXPECT_EQ(r.flow_info.statistics[PFWL_STAT_L4_TCP_COUNT_RETRANSMISSIONS][r.l4.direction], 0);
+  pfwl_terminate(state);
 }
@@ -0,0 +1,355 @@
+/**
+ *  Test for fields tags matching.
+ **/
+#include "common.h"
+#include <peafowl/tags.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+
+static const char* stringTag(pfwl_state_t* state, pfwl_field_id_t field, const std::string& s){
+  pfwl_string_t value;
+  value.value = (const unsigned char*) s.c_str();
+  value.length = s.size();
+  pfwl_field_tags_flush(state, 1);
+  return pfwl_field_string_tag_get(state->tags_matchers[field], &value);
+}
+
+static const char* mmapTag(pfwl_state_t* state, pfwl_field_id_t field, const std::string& k, const std::string& v){
+  pfwl_string_t key, value;
+  key.value = (const unsigned char*) k.c_str();
+  key.length = k.size();
+  value.value = (const unsigned char*) v.c_str();
+  value.length = v.size();
+  pfwl_field_tags_flush(state, 1);
+  return pfwl_field_mmap_tag_get(state->tags_matchers[field], &key, &value);
+}
+
+static std::string tagOrEmpty(const char* tag){
+  return tag ? tag : "";
+}
+
+TEST(TagsTest, String) {
+  pfwl_state_t* state = pfwl_init();
+  pfwl_field_id_t field = PFWL_FIELDS_L7_HTTP_URL;
+  pfwl_field_string_tags_add_L7(state, field, "www.", PFWL_FIELD_MATCHING_PREFIX, "WWW");
+  pfwl_field_string_tags_add_L7(state, field, "www.Google.", PFWL_FIELD_MATCHING_PREFIX, "WWW_GOOGLE");
+  pfwl_field_string_tags_add_L7(state, field, "google.com", PFWL_FIELD_MATCHING_SUFFIX, "GOOGLE");
+  pfwl_field_string_tags_add_L7(state, field, "mail.google.com", PFWL_FIELD_MATCHING_SUFFIX, "GMAIL");
+  pfwl_field_string_tags_add_L7(state, field, "mail.google.com", PFWL_FIELD_MATCHING_EXACT, "GMAIL_EXACT");
+  pfwl_field_string_tags_add_L7(state, field, "www.google.com", PFWL_FIELD_MATCHING_EXACT, "NEVER");
+
+  // Longest prefix, case insensitive
+  EXPECT_STREQ(stringTag(state, field, "WWW.GOOGLE.IT"), "WWW_GOOGLE");
+  EXPECT_STREQ(stringTag(state, field, "www.amazon.com"), "WWW");
+  // Prefixes have the priority over exact matches
+  EXPECT_STREQ(stringTag(state, field, "www.google.com"), "WWW_GOOGLE");
+  // Exact matches have the priority over suffixes
+  EXPECT_STREQ(stringTag(state, field, "Mail.Google.Com"), "GMAIL_EXACT");
+  // Longest suffix
+  EXPECT_STREQ(stringTag(state, field, "x.mail.google.com"), "GMAIL");
+  EXPECT_STREQ(stringTag(state, field, "maps.google.com"), "GOOGLE");
+  EXPECT_STREQ(stringTag(state, field, "google.com"), "GOOGLE");
+  EXPECT_EQ(stringTag(state, field, "oogle.com"), (const char*) NULL);
+  EXPECT_EQ(stringTag(state, field, ""), (const char*) NULL);
+
+  // Rules added later override previous ones
+  pfwl_field_string_tags_add_L7(state, field, "google.com", PFWL_FIELD_MATCHING_SUFFIX, "GOOGLE2");
+  EXPECT_STREQ(stringTag(state, field, "maps.google.com"), "GOOGLE2");
+
+  pfwl_field_tags_unload_L7(state, field);
+  EXPECT_EQ(state->tags_matchers_num, (size_t) 0);
+  pfwl_terminate(state);
+}
+
+TEST(TagsTest, Domain) {
+  pfwl_state_t* state = pfwl_init();
+  pfwl_field_id_t field = PFWL_FIELDS_L7_SSL_SNI;
+  pfwl_field_string_tags_add_L7(state, field, "example.com", PFWL_FIELD_MATCHING_DOMAIN, "EXAMPLE");
+  pfwl_field_string_tags_add_L7(state, field, "*.mail.Example.com", PFWL_FIELD_MATCHING_DOMAIN, "MAIL");
+  pfwl_field_string_tags_add_L7(state, field, "ple.com", PFWL_FIELD_MATCHING_SUFFIX, "PLE");
+  pfwl_field_string_tags_add_L7(state, field, "org.", PFWL_FIELD_MATCHING_DOMAIN, "ORG");
+
+  EXPECT_STREQ(stringTag(state, field, "example.com"), "EXAMPLE");
+  EXPECT_STREQ(stringTag(state, field, "www.EXAMPLE.com"), "EXAMPLE");
+  EXPECT_STREQ(stringTag(state, field, "mail.example.com"), "MAIL");
+  EXPECT_STREQ(stringTag(state, field, "a.b.mail.example.com"), "MAIL");
+  EXPECT_STREQ(stringTag(state, field, "xmail.example.com"), "EXAMPLE");
+  // Not on a label boundary, the suffix rule matches instead.
+  EXPECT_STREQ(stringTag(state, field, "badexample.com"), "PLE");
+  EXPECT_STREQ(stringTag(state, field, "peafowl.org"), "ORG");
+  EXPECT_EQ(stringTag(state, field, "peafowlorg"), (const char*) NULL);
+  EXPECT_EQ(stringTag(state, field, "example.co"), (const char*) NULL);
+  // The port and the trailing dot are ignored.
+  EXPECT_STREQ(stringTag(state, field, "www.example.com:8080"), "EXAMPLE");
+  EXPECT_STREQ(stringTag(state, field, "mail.example.com."), "MAIL");
+  EXPECT_STREQ(stringTag(state, field, "example.com.:443"), "EXAMPLE");
+  EXPECT_STREQ(stringTag(state, field, "peafowl.org."), "ORG");
+  EXPECT_EQ(stringTag(state, field, "badexample.com:8080"), (const char*) NULL);
+  EXPECT_EQ(stringTag(state, field, "example.com.."), (const char*) NULL);
+
+  field = PFWL_FIELDS_L7_HTTP_HEADERS;
+  pfwl_field_mmap_tags_add_L7(state, field, "Host", "example.com", PFWL_FIELD_MATCHING_DOMAIN, "HOST");
+  EXPECT_STREQ(mmapTag(state, field, "host", "www.example.com:8080"), "HOST");
+  pfwl_terminate(state);
+}
+
+TEST(TagsTest, Mmap) {
+  pfwl_state_t* state = pfwl_init();
+  pfwl_field_id_t field = PFWL_FIELDS_L7_HTTP_HEADERS;
+  EXPECT_EQ(pfwl_field_tags_load_L7(state, field, "./tags/http_headers.json"), 0);
+  pfwl_field_mmap_tags_add_L7(state, field, "Host", "example.org", PFWL_FIELD_MATCHING_SUFFIX, "TAG_EXAMPLE");
+
+  EXPECT_STREQ(mmapTag(state, field, "User-Agent", "Mozilla/5.0"), "TAG_MOZILLA");
+  EXPECT_STREQ(mmapTag(state, field, "host", "www.ethereal.com"), "TAG_ETHEREAL");
+  EXPECT_STREQ(mmapTag(state, field, "HOST", "www.example.org"), "TAG_EXAMPLE");
+  EXPECT_EQ(mmapTag(state, field, "hos", "www.ethereal.com"), (const char*) NULL);
+  EXPECT_EQ(mmapTag(state, field, "referer", "www.ethereal.com"), (const char*) NULL);
+  EXPECT_EQ(mmapTag(state, field, "user-agent", "curl"), (const char*) NULL);
+
+  // Reloading replaces the rules
+  EXPECT_EQ(pfwl_field_tags_load_L7(state, field, "./tags/http_headers.json"), 0);
+  EXPECT_EQ(mmapTag(state, field, "HOST", "www.example.org"), (const char*) NULL);
+  EXPECT_EQ(state->tags_matchers_num, (size_t) 1);
+  EXPECT_EQ(pfwl_field_tags_load_L7(state, field, "./tags/not_existing.json"), 1);
+  EXPECT_EQ(state->tags_matchers_num, (size_t) 0);
+  pfwl_terminate(state);
+}
+
+TEST(TagsTest, ManyRules) {
+  pfwl_state_t* state = pfwl_init();
+  pfwl_field_id_t field = PFWL_FIELDS_L7_DNS_NAME_SRV;
+  std::map<std::string, std::string> prefixes, exact, suffixes, domains;
+  const char* alphabet = "abcdefghijAB.";
+  srand(7);
+  for(size_t i = 0; i < 3000; i++){
+    std::string s;
+    size_t length = rand() % 5;
+    for(size_t j = 0; j < length; j++){
+      s += alphabet[rand() % 13];
+    }
+    std::string lower(s);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    std::string tag = std::to_string(i);
+    pfwl_field_matching_t type = (pfwl_field_matching_t) (rand() % 4);
+    pfwl_field_string_tags_add_L7(state, field, s.c_str(), type, tag.c_str());
+    if(type == PFWL_FIELD_MATCHING_PREFIX){
+      prefixes[lower] = tag;
+    }else if(type == PFWL_FIELD_MATCHING_EXACT){
+      exact[lower] = tag;
+    }else if(type == PFWL_FIELD_MATCHING_SUFFIX){
+      suffixes[lower] = tag;
+    }else{
+      if(!lower.empty() && lower[0] == '.'){
+        lower.erase(0, 1);
+      }
+      if(!lower.empty() && lower[lower.size() - 1] == '.'){
+        lower.erase(lower.size() - 1);
+      }
+      if(!lower.empty()){
+        domains[lower] = tag;
+      }
+    }
+  }
+
+  for(size_t i = 0; i < 3000; i++){
+    std::string s;
+    size_t length = rand() % 6;
+    for(size_t j = 0; j < length; j++){
+      s += alphabet[rand() % 13];
+    }
+    std::string lower(s);
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    std::string expected;
+    for(size_t l = lower.size() + 1; l-- > 0 && expected.empty(); ){
+      auto it = prefixes.find(lower.substr(0, l));
+      if(it != prefixes.end()){
+        expected = it->second;
+      }
+    }
+    if(expected.empty() && exact.count(lower)){
+      expected = exact[lower];
+    }
+    for(size_t l = lower.size() + 1; l-- > 0 && expected.empty(); ){
+      auto it = domains.find(lower.substr(lower.size() - l));
+      if(it != domains.end() && (l == lower.size() || lower[lower.size() - l - 1] == '.')){
+        expected = it->second;
+      }
+      it = suffixes.find(lower.substr(lower.size() - l));
+      if(expected.empty() && it != suffixes.end()){
+        expected = it->second;
+      }
+    }
+    EXPECT_EQ(tagOrEmpty(stringTag(state, field, s)), expected) << s;
+  }
+  pfwl_terminate(state);
+}
+
+TEST(TagsTest, Publish) {
+  pfwl_state_t* first = pfwl_init();
+  pfwl_state_t* second = pfwl_init();
+  pfwl_field_id_t field = PFWL_FIELDS_L7_HTTP_URL;
+  EXPECT_EQ(pfwl_field_tags_compile_L7(field, "./tags/not_existing.json"), (pfwl_field_tags_t*) NULL);
+  EXPECT_EQ(pfwl_field_tags_compile_L7(PFWL_FIELDS_L7_HTTP_VERSION_MAJOR, NULL), (pfwl_field_tags_t*) NULL);
+
+  pfwl_field_tags_t* tags = pfwl_field_tags_compile_L7(field, "./tags/http_url.json");
+  ASSERT_NE(tags, (pfwl_field_tags_t*) NULL);
+  EXPECT_EQ(pfwl_field_tags_publish_L7(first, PFWL_FIELDS_L7_HTTP_BODY, tags), 1);
+  EXPECT_EQ(pfwl_field_tags_publish_L7(first, field, tags), 0);
+  EXPECT_EQ(pfwl_field_tags_publish_L7(second, field, tags), 0);
+  pfwl_field_tags_release_L7(tags);
+
+  const char* tag = stringTag(first, field, "/Page/Load.HTML");
+  EXPECT_STREQ(tag, "TAG_SUFFIX");
+  EXPECT_STREQ(stringTag(second, field, "/load.html"), "TAG_SUFFIX");
+
+  // Replacing the rules of a state does not affect the other one, nor the
+  // tags already returned.
+  pfwl_field_string_tags_add_L7(first, field, "/page", PFWL_FIELD_MATCHING_PREFIX, "TAG_PAGE");
+  EXPECT_STREQ(stringTag(first, field, "/page/load.html"), "TAG_PAGE");
+  EXPECT_STREQ(stringTag(first, field, "/load.html"), "TAG_SUFFIX");
+  EXPECT_STREQ(stringTag(second, field, "/page/load.html"), "TAG_SUFFIX");
+  pfwl_field_tags_unload_L7(second, field);
+  EXPECT_EQ(second->tags_matchers_num, (size_t) 0);
+  EXPECT_STREQ(tag, "TAG_SUFFIX");
+
+  pfwl_terminate(first);
+  pfwl_terminate(second);
+}
+
+TEST(TagsTest, PublishWhileMatching) {
+  pfwl_state_t* state = pfwl_init();
+  pfwl_field_id_t field = PFWL_FIELDS_L7_HTTP_URL;
+  pfwl_field_tags_t* tags[2];
+  tags[0] = pfwl_field_tags_compile_L7(field, "./tags/http_url.json");
+  tags[1] = pfwl_field_tags_compile_L7(field, NULL);
+  ASSERT_NE(tags[0], (pfwl_field_tags_t*) NULL);
+  ASSERT_NE(tags[1], (pfwl_field_tags_t*) NULL);
+  EXPECT_EQ(pfwl_field_tags_publish_L7(state, field, tags[0]), 0);
+
+  const std::string url = "/load.html";
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> readers;
+  for(size_t r = 0; r < 4; r++){
+    readers.push_back(std::thread([&](){
+      pfwl_dissection_info_t info;
+      memset(&info, 0, sizeof(info));
+      info.l7.protocol_fields[field].present = 1;
+      info.l7.protocol_fields[field].basic.string.value = (const unsigned char*) url.c_str();
+      info.l7.protocol_fields[field].basic.string.length = url.size();
+      while(!stop){
+        info.l7.tags_num = 0;
+        pfwl_field_tags_match(state, &info);
+        if(info.l7.tags_num){
+          EXPECT_STREQ(info.l7.tags[0], "TAG_SUFFIX");
+        }
+      }
+    }));
+  }
+  for(size_t i = 0; i < 2000; i++){
+    pfwl_field_tags_t* next = tags[i % 2];
+    if(i % 100 == 99){
+      // Rebuilt from scratch, so that old databases really get freed.
+      pfwl_field_tags_release_L7(tags[i % 2]);
+      next = tags[i % 2] = pfwl_field_tags_compile_L7(field, i % 2 ? NULL : "./tags/http_url.json");
+    }
+    EXPECT_EQ(pfwl_field_tags_publish_L7(state, field, next), 0);
+  }
+  stop = true;
+  for(auto& t : readers){
+    t.join();
+  }
+  pfwl_field_tags_release_L7(tags[0]);
+  pfwl_field_tags_release_L7(tags[1]);
+  pfwl_terminate(state);
+}
+
+TEST(TagsTest, Mapped) {
+  pfwl_state_t* state = pfwl_init();
+  pfwl_field_id_t field = PFWL_FIELDS_L7_HTTP_HEADERS;
+  pfwl_field_tags_t* tags = pfwl_field_tags_compile_L7(field, "./tags/http_headers.json");
+  ASSERT_NE(tags, (pfwl_field_tags_t*) NULL);
+  EXPECT_EQ(pfwl_field_tags_save_L7(tags, "./tags/http_headers.db"), 0);
+  EXPECT_EQ(pfwl_field_tags_save_L7(tags, "./not_existing/http_headers.db"), 1);
+  pfwl_field_tags_release_L7(tags);
+
+  // Fields of a different type are rejected.
+  EXPECT_EQ(pfwl_field_tags_map_L7(PFWL_FIELDS_L7_HTTP_URL, "./tags/http_headers.db"), (pfwl_field_tags_t*) NULL);
+  EXPECT_EQ(pfwl_field_tags_load_L7_mmap(state, field, "./tags/not_existing.db"), 1);
+  EXPECT_EQ(pfwl_field_tags_load_L7_mmap(state, field, "./tags/http_headers.db"), 0);
+  EXPECT_STREQ(mmapTag(state, field, "User-Agent", "Mozilla/5.0"), "TAG_MOZILLA");
+  EXPECT_STREQ(mmapTag(state, field, "host", "www.ethereal.com"), "TAG_ETHEREAL");
+  EXPECT_EQ(mmapTag(state, field, "hos", "www.ethereal.com"), (const char*) NULL);
+
+  // Rules can be added on top of the mapped ones.
+  pfwl_field_mmap_tags_add_L7(state, field, "Host", "example.org", PFWL_FIELD_MATCHING_SUFFIX, "TAG_EXAMPLE");
+  EXPECT_STREQ(mmapTag(state, field, "HOST", "www.example.org"), "TAG_EXAMPLE");
+  EXPECT_STREQ(mmapTag(state, field, "host", "www.ethereal.com"), "TAG_ETHEREAL");
+  EXPECT_STREQ(mmapTag(state, field, "User-Agent", "Mozilla/5.0"), "TAG_MOZILLA");
+  pfwl_terminate(state);
+  remove("./tags/http_headers.db");
+}
+
+TEST(TagsTest, MappedManyRules) {
+  pfwl_field_id_t field = PFWL_FIELDS_L7_DNS_NAME_SRV;
+  const char* alphabet = "abcdefghijAB.";
+  const char* types[] = {"PREFIX", "EXACT", "SUFFIX", "DOMAIN"};
+  srand(11);
+  std::ofstream json("./tags/many_rules.json");
+  json << "{\"rules\": [";
+  for(size_t i = 0; i < 3000; i++){
+    std::string s;
+    size_t length = rand() % 5;
+    for(size_t j = 0; j < length; j++){
+      s += alphabet[rand() % 13];
+    }
+    json << (i ? "," : "") << "{\"value\": \"" << s << "\", \"matchingType\": \""
+         << types[rand() % 4] << "\", \"tag\": \"" << i << "\"}";
+  }
+  json << "]}";
+  json.close();
+
+  pfwl_field_tags_t* tags = pfwl_field_tags_compile_L7(field, "./tags/many_rules.json");
+  ASSERT_NE(tags, (pfwl_field_tags_t*) NULL);
+  EXPECT_EQ(pfwl_field_tags_save_L7(tags, "./tags/many_rules.db"), 0);
+  pfwl_field_tags_t* mapped = pfwl_field_tags_map_L7(field, "./tags/many_rules.db");
+  ASSERT_NE(mapped, (pfwl_field_tags_t*) NULL);
+  pfwl_state_t* compiledState = pfwl_init();
+  pfwl_state_t* mappedState = pfwl_init();
+  EXPECT_EQ(pfwl_field_tags_publish_L7(compiledState, field, tags), 0);
+  EXPECT_EQ(pfwl_field_tags_publish_L7(mappedState, field, mapped), 0);
+  pfwl_field_tags_release_L7(tags);
+  pfwl_field_tags_release_L7(mapped);
+  for(size_t i = 0; i < 3000; i++){
+    std::string s;
+    size_t length = rand() % 6;
+    for(size_t j = 0; j < length; j++){
+      s += alphabet[rand() % 13];
+    }
+    EXPECT_EQ(tagOrEmpty(stringTag(mappedState, field, s)),
+              tagOrEmpty(stringTag(compiledState, field, s))) << s;
+  }
+
+  // Truncated or corrupted files are rejected.
+  std::ifstream in("./tags/many_rules.db", std::ios::binary);
+  std::string db((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  in.close();
+  std::string corrupted(db);
+  std::fill(corrupted.begin() + corrupted.size() / 2, corrupted.end(), (char) 0xFF);
+  const std::string broken[] = {db.substr(0, db.size() / 2), db.substr(0, 20), corrupted};
+  for(const std::string& b : broken){
+    std::ofstream out("./tags/many_rules.db", std::ios::binary);
+    out << b;
+    out.close();
+    EXPECT_EQ(pfwl_field_tags_map_L7(field, "./tags/many_rules.db"), (pfwl_field_tags_t*) NULL);
+  }
+  pfwl_terminate(compiledState);
+  pfwl_terminate(mappedState);
+  remove("./tags/many_rules.json");
+  remove("./tags/many_rules.db");
+}
@@ -0,0 +1,64 @@
+/*
+ * tags_compiler.c
+ *
+ * Compiles the tags rules of a field (in the JSON format accepted by
+ * pfwl_field_tags_load_L7) into a database file which can be mapped
+ * with pfwl_field_tags_load_L7_mmap.
+ *
+ * =========================================================================
+ * Copyright (c) 2016-2019 Daniele De Sensi (d.desensi.software@gmail.com)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is furnished to do
+ * so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * =========================================================================
+ */
+
+#include <peafowl/peafowl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char** argv){
+  if(argc != 5){
+    fprintf(stderr, "Usage: %s protocol field rules.json output.db\n", argv[0]);
+    fprintf(stderr, "E.g.: %s HTTP URL http_url.json http_url.db\n", argv[0]);
+    return -1;
+  }
+  pfwl_protocol_l7_t protocol = pfwl_get_L7_protocol_id(argv[1]);
+  if(protocol == PFWL_PROTO_L7_NUM){
+    fprintf(stderr, "Unknown protocol: %s\n", argv[1]);
+    return -1;
+  }
+  pfwl_field_id_t field = pfwl_get_L7_field_id(protocol, argv[2]);
+  if(field == PFWL_FIELDS_L7_NUM){
+    fprintf(stderr, "Unknown field: %s\n", argv[2]);
+    return -1;
+  }
+  pfwl_field_tags_t* tags = pfwl_field_tags_compile_L7(field, argv[3]);
+  if(!tags){
+    fprintf(stderr, "Impossible to compile %s: the file cannot be parsed "
+                    "or the field is neither a string nor a multi map.\n", argv[3]);
+    return -1;
+  }
+  int r = 0;
+  if(pfwl_field_tags_save_L7(tags, argv[4])){
+    fprintf(stderr, "Impossible to write %s\n", argv[4]);
+    r = -1;
+  }
+  pfwl_field_tags_release_L7(tags);
+  return r;
+}